@@ -0,0 +1,830 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bytecode.h"
+#include "diff.h"
+#include "work_stack.h"
+#include "vec_math.h"
+#include "debug/debug.h"
+
+static const size_t kBaseBcCapacity = 64;
+
+static const size_t kBcMultiplier = 2;
+
+static const BcReg_t kBcZeroReg = 0;
+static const BcReg_t kBcNoReg   = UINT32_MAX;
+
+// 4 doubles per operation; GCC splits the vector into SSE2 halves when AVX
+// is not enabled. aligned(8) allows unaligned loads from plain arrays.
+#if defined(__GNUC__)
+typedef NumType_t BcVec_t __attribute__((vector_size(32), aligned(8)));
+#else
+typedef NumType_t BcVec_t;
+#endif
+
+static const size_t kBcLanes = sizeof(BcVec_t) / sizeof(NumType_t);
+
+struct BcSeenEntry
+{
+    const TreeNode *node;
+    BcReg_t         reg;
+};
+
+struct BcSeen
+{
+    BcSeenEntry *entries;
+
+    size_t capacity;
+    size_t size;
+};
+
+static BcReg_t BcAddReg(BcProgram *prog,
+                        NumType_t  val);
+
+static BcReg_t BcEmit(BcProgram *prog,
+                      uint32_t   op,
+                      BcReg_t    lhs,
+                      BcReg_t    rhs);
+
+static BcReg_t SeenFind(const BcSeen   *seen,
+                        const TreeNode *node);
+
+static TreeErrs_t SeenAdd(BcSeen         *seen,
+                          const TreeNode *node,
+                          BcReg_t         reg);
+
+static BcReg_t CompileLeaf(BcProgram      *prog,
+                           BcReg_t       **var_regs,
+                           size_t         *var_regs_size,
+                           const TreeNode *node);
+
+static TreeErrs_t BatchReserve(BcProgram *prog);
+
+static void BatchSweep(BcProgram              *prog,
+                       const Variables        *vars,
+                       const NumType_t *const *var_values,
+                       size_t                  base,
+                       size_t                  width);
+
+//==============================================================================
+
+TreeErrs_t BcCtor(BcProgram *prog)
+{
+    CHECK(prog);
+
+    memset(prog, 0, sizeof(BcProgram));
+
+    prog->code = (BcInstr *)   calloc(kBaseBcCapacity, sizeof(BcInstr));
+    prog->regs = (NumType_t *) calloc(kBaseBcCapacity, sizeof(NumType_t));
+
+    if (prog->code == nullptr || prog->regs == nullptr)
+    {
+        BcDtor(prog);
+
+        return kFailedAllocation;
+    }
+
+    prog->code_capacity = kBaseBcCapacity;
+    prog->reg_capacity  = kBaseBcCapacity;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t BcDtor(BcProgram *prog)
+{
+    CHECK(prog);
+
+    free(prog->code);
+    free(prog->regs);
+    free(prog->batch_regs);
+
+    memset(prog, 0, sizeof(BcProgram));
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static BcReg_t BcAddReg(BcProgram *prog,
+                        NumType_t  val)
+{
+    if (prog->reg_count >= prog->reg_capacity)
+    {
+        size_t new_capacity = prog->reg_capacity * kBcMultiplier;
+
+        if (new_capacity >= kBcNoReg)
+        {
+            return kBcNoReg;
+        }
+
+        NumType_t *new_regs = (NumType_t *) realloc(prog->regs, new_capacity * sizeof(NumType_t));
+
+        if (new_regs == nullptr)
+        {
+            return kBcNoReg;
+        }
+
+        prog->regs         = new_regs;
+        prog->reg_capacity = new_capacity;
+    }
+
+    prog->regs[prog->reg_count] = val;
+
+    return (BcReg_t) prog->reg_count++;
+}
+
+//==============================================================================
+
+static BcReg_t BcEmit(BcProgram *prog,
+                      uint32_t   op,
+                      BcReg_t    lhs,
+                      BcReg_t    rhs)
+{
+    if (prog->code_size >= prog->code_capacity)
+    {
+        size_t new_capacity = prog->code_capacity * kBcMultiplier;
+
+        BcInstr *new_code = (BcInstr *) realloc(prog->code, new_capacity * sizeof(BcInstr));
+
+        if (new_code == nullptr)
+        {
+            return kBcNoReg;
+        }
+
+        prog->code          = new_code;
+        prog->code_capacity = new_capacity;
+    }
+
+    BcReg_t dst = BcAddReg(prog, 0);
+
+    if (dst == kBcNoReg)
+    {
+        return kBcNoReg;
+    }
+
+    prog->code[prog->code_size++] = {op, dst, lhs, rhs};
+
+    return dst;
+}
+
+//==============================================================================
+
+static size_t SeenHash(const TreeNode *node,
+                       size_t          capacity)
+{
+    return (size_t) (((uintptr_t) node >> 4) * 0x9e3779b97f4a7c15ull) & (capacity - 1);
+}
+
+//==============================================================================
+
+static BcReg_t SeenFind(const BcSeen   *seen,
+                        const TreeNode *node)
+{
+    if (seen->capacity == 0)
+    {
+        return kBcNoReg;
+    }
+
+    for (size_t i = SeenHash(node, seen->capacity); seen->entries[i].node != nullptr; i = (i + 1) & (seen->capacity - 1))
+    {
+        if (seen->entries[i].node == node)
+        {
+            return seen->entries[i].reg;
+        }
+    }
+
+    return kBcNoReg;
+}
+
+//==============================================================================
+
+static TreeErrs_t SeenAdd(BcSeen         *seen,
+                          const TreeNode *node,
+                          BcReg_t         reg)
+{
+    if ((seen->size + 1) * kBcMultiplier > seen->capacity)
+    {
+        size_t new_capacity = (seen->capacity == 0) ? kBaseBcCapacity : seen->capacity * kBcMultiplier;
+
+        BcSeenEntry *new_entries = (BcSeenEntry *) calloc(new_capacity, sizeof(BcSeenEntry));
+
+        if (new_entries == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        for (size_t i = 0; i < seen->capacity; i++)
+        {
+            if (seen->entries[i].node == nullptr)
+            {
+                continue;
+            }
+
+            size_t j = SeenHash(seen->entries[i].node, new_capacity);
+
+            while (new_entries[j].node != nullptr)
+            {
+                j = (j + 1) & (new_capacity - 1);
+            }
+
+            new_entries[j] = seen->entries[i];
+        }
+
+        free(seen->entries);
+
+        seen->entries  = new_entries;
+        seen->capacity = new_capacity;
+    }
+
+    size_t i = SeenHash(node, seen->capacity);
+
+    while (seen->entries[i].node != nullptr)
+    {
+        i = (i + 1) & (seen->capacity - 1);
+    }
+
+    seen->entries[i] = {node, reg};
+    seen->size++;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static BcReg_t CompileLeaf(BcProgram      *prog,
+                           BcReg_t       **var_regs,
+                           size_t         *var_regs_size,
+                           const TreeNode *node)
+{
+    if (node->type == kConstNumber)
+    {
+        return BcAddReg(prog, node->data.const_val);
+    }
+
+    if (node->type != kVariable)
+    {
+        return kBcNoReg;
+    }
+
+    size_t var_pos = node->data.variable_pos;
+
+    if (var_pos >= *var_regs_size)
+    {
+        size_t new_size = var_pos + 1;
+
+        BcReg_t *new_regs = (BcReg_t *) realloc(*var_regs, new_size * sizeof(BcReg_t));
+
+        if (new_regs == nullptr)
+        {
+            return kBcNoReg;
+        }
+
+        memset(new_regs + *var_regs_size, 0, (new_size - *var_regs_size) * sizeof(BcReg_t));
+
+        *var_regs      = new_regs;
+        *var_regs_size = new_size;
+    }
+
+    if ((*var_regs)[var_pos] == kBcZeroReg)
+    {
+        (*var_regs)[var_pos] = BcEmit(prog, kBcLoadVar, (BcReg_t) var_pos, kBcZeroReg);
+    }
+
+    return (*var_regs)[var_pos];
+}
+
+//==============================================================================
+
+TreeErrs_t BcCompile(BcProgram      *prog,
+                     const TreeNode *node)
+{
+    static const int kBcEnter = 0;
+    static const int kBcApply = 1;
+
+    CHECK(prog);
+    CHECK(node);
+
+    prog->code_size = 0;
+    prog->reg_count = 0;
+
+    BcAddReg(prog, 0); // kBcZeroReg
+
+    BcSeen seen = {};
+
+    BcReg_t *var_regs      = nullptr;
+    size_t   var_regs_size = 0;
+
+    WorkStack frames = {};
+    WorkStack regs   = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&regs);
+
+    WorkPushNode(&frames, node, kBcEnter);
+
+    TreeErrs_t status = kTreeSuccess;
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        BcReg_t reg = kBcNoReg;
+
+        if (frame.state == kBcApply)
+        {
+            BcReg_t rhs = (BcReg_t) WorkPop(&regs).val.idx;
+            BcReg_t lhs = (BcReg_t) WorkPop(&regs).val.idx;
+
+            reg = BcEmit(prog, curr->data.op_code, lhs, rhs);
+        }
+        else if (curr == nullptr)
+        {
+            reg = kBcZeroReg;
+        }
+        else if ((reg = SeenFind(&seen, curr)) != kBcNoReg)
+        {
+            // shared subtree, already compiled
+        }
+        else if (curr->type == kOperator)
+        {
+            if (WorkPushNode(&frames, curr,        kBcApply) != kTreeSuccess ||
+                WorkPushNode(&frames, curr->right, kBcEnter) != kTreeSuccess ||
+                WorkPushNode(&frames, curr->left,  kBcEnter) != kTreeSuccess)
+            {
+                status = kFailedAllocation;
+            }
+
+            continue;
+        }
+        else
+        {
+            reg = CompileLeaf(prog, &var_regs, &var_regs_size, curr);
+        }
+
+        if (reg == kBcNoReg)
+        {
+            status = kFailedAllocation;
+
+            break;
+        }
+
+        WorkItem item = {};
+        item.val.idx  = reg;
+
+        if ((curr != nullptr && reg != kBcZeroReg && SeenAdd(&seen, curr, reg) != kTreeSuccess) ||
+            WorkPush(&regs, item) != kTreeSuccess)
+        {
+            status = kFailedAllocation;
+        }
+    }
+
+    if (status == kTreeSuccess)
+    {
+        prog->result = (BcReg_t) WorkPop(&regs).val.idx;
+    }
+    else
+    {
+        prog->code_size = 0;
+        prog->result    = kBcZeroReg;
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&regs);
+
+    free(seen.entries);
+    free(var_regs);
+
+    return status;
+}
+
+//==============================================================================
+
+NumType_t BcEval(BcProgram       *prog,
+                 const Variables *vars)
+{
+    CHECK(prog);
+
+    NumType_t     *regs = prog->regs;
+    const BcInstr *code = prog->code;
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        const BcInstr ins = code[i];
+
+        switch ((BcOp_t) ins.op)
+        {
+            case kBcLoadVar:
+            {
+                regs[ins.dst] = vars->var_array[ins.lhs].value;
+
+                break;
+            }
+
+            case kBcAdd:
+            {
+                regs[ins.dst] = regs[ins.lhs] + regs[ins.rhs];
+
+                break;
+            }
+
+            case kBcSub:
+            {
+                regs[ins.dst] = regs[ins.lhs] - regs[ins.rhs];
+
+                break;
+            }
+
+            case kBcMult:
+            {
+                regs[ins.dst] = regs[ins.lhs] * regs[ins.rhs];
+
+                break;
+            }
+
+            case kBcDiv:
+            {
+                regs[ins.dst] = !IsNumEqual(regs[ins.rhs], 0) ? regs[ins.lhs] / regs[ins.rhs] : NAN;
+
+                break;
+            }
+
+            case kBcSqrt:
+            {
+                regs[ins.dst] = sqrt(regs[ins.rhs]);
+
+                break;
+            }
+
+            case kBcSin:
+            {
+                regs[ins.dst] = sin(regs[ins.rhs]);
+
+                break;
+            }
+
+            case kBcCos:
+            {
+                regs[ins.dst] = cos(regs[ins.rhs]);
+
+                break;
+            }
+
+            case kBcTg:
+            {
+                regs[ins.dst] = tan(regs[ins.rhs]);
+
+                break;
+            }
+
+            case kBcLn:
+            {
+                regs[ins.dst] = log(regs[ins.rhs]);
+
+                break;
+            }
+
+            case kBcExp:
+            {
+                regs[ins.dst] = pow(regs[ins.lhs], regs[ins.rhs]);
+
+                break;
+            }
+
+            default:
+            {
+                regs[ins.dst] = NAN;
+
+                break;
+            }
+        }
+    }
+
+    return regs[prog->result];
+}
+
+//==============================================================================
+
+TreeErrs_t BcEvalBatch(BcProgram              *prog,
+                       const Variables        *vars,
+                       const NumType_t *const *var_values,
+                       size_t                  point_count,
+                       NumType_t              *out)
+{
+    CHECK(prog);
+    CHECK(vars);
+    CHECK(out);
+
+    if (BatchReserve(prog) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    // registers that no instruction writes (zero and constants) keep their
+    // value in every lane for the whole call
+
+    for (size_t reg = 0; reg < prog->reg_count; reg++)
+    {
+        NumType_t *lanes = prog->batch_regs + reg * kBcBatchBlock;
+
+        for (size_t k = 0; k < kBcBatchBlock; k++)
+        {
+            lanes[k] = prog->regs[reg];
+        }
+    }
+
+    const NumType_t *result = prog->batch_regs + prog->result * kBcBatchBlock;
+
+    for (size_t base = 0; base < point_count; base += kBcBatchBlock)
+    {
+        size_t width = point_count - base;
+
+        if (width > kBcBatchBlock)
+        {
+            width = kBcBatchBlock;
+        }
+
+        BatchSweep(prog, vars, var_values, base, width);
+
+        memcpy(out + base, result, width * sizeof(NumType_t));
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static TreeErrs_t BatchReserve(BcProgram *prog)
+{
+    size_t capacity = prog->reg_count * kBcBatchBlock;
+
+    if (capacity <= prog->batch_capacity)
+    {
+        return kTreeSuccess;
+    }
+
+    NumType_t *new_regs = (NumType_t *) realloc(prog->batch_regs, capacity * sizeof(NumType_t));
+
+    if (new_regs == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    prog->batch_regs     = new_regs;
+    prog->batch_capacity = capacity;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static inline void LoadVec(BcVec_t         *vec,
+                           const NumType_t *src)
+{
+    memcpy(vec, src, sizeof(BcVec_t));
+}
+
+//==============================================================================
+
+static inline void StoreVec(NumType_t     *dst,
+                            const BcVec_t *vec)
+{
+    memcpy(dst, vec, sizeof(BcVec_t));
+}
+
+//==============================================================================
+
+// All lanes of the block are computed even if fewer than kBcBatchBlock
+// points are left: stale lanes are never copied out.
+
+static void BatchSweep(BcProgram              *prog,
+                       const Variables        *vars,
+                       const NumType_t *const *var_values,
+                       size_t                  base,
+                       size_t                  width)
+{
+    #define VEC_LOOP(expr)                                          \
+        for (size_t k = 0; k < kBcBatchBlock; k += kBcLanes)        \
+        {                                                           \
+            BcVec_t l = {};                                         \
+            BcVec_t r = {};                                         \
+                                                                    \
+            LoadVec(&l, lhs + k);                                   \
+            LoadVec(&r, rhs + k);                                   \
+                                                                    \
+            BcVec_t res = expr;                                     \
+                                                                    \
+            StoreVec(dst + k, &res);                                \
+        }
+
+    #define SCALAR_LOOP(expr)                                       \
+        for (size_t k = 0; k < kBcBatchBlock; k++)                  \
+        {                                                           \
+            dst[k] = expr;                                          \
+        }
+
+    NumType_t *regs = prog->batch_regs;
+
+    BcVec_t zeros = {};
+    BcVec_t nans  = {};
+
+    LoadVec(&zeros, regs + kBcZeroReg * kBcBatchBlock);
+
+    NumType_t nan_lanes[kBcLanes] = {};
+
+    for (size_t k = 0; k < kBcLanes; k++)
+    {
+        nan_lanes[k] = NAN;
+    }
+
+    LoadVec(&nans, nan_lanes);
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        const BcInstr ins = prog->code[i];
+
+        NumType_t       *dst = regs + ins.dst * kBcBatchBlock;
+        const NumType_t *lhs = regs + ins.lhs * kBcBatchBlock;
+        const NumType_t *rhs = regs + ins.rhs * kBcBatchBlock;
+
+        switch ((BcOp_t) ins.op)
+        {
+            case kBcLoadVar:
+            {
+                if (var_values != nullptr && var_values[ins.lhs] != nullptr)
+                {
+                    memcpy(dst, var_values[ins.lhs] + base, width * sizeof(NumType_t));
+                }
+                else
+                {
+                    NumType_t val = vars->var_array[ins.lhs].value;
+
+                    SCALAR_LOOP(val);
+                }
+
+                break;
+            }
+
+            case kBcAdd:
+            {
+                VEC_LOOP(l + r);
+
+                break;
+            }
+
+            case kBcSub:
+            {
+                VEC_LOOP(l - r);
+
+                break;
+            }
+
+            case kBcMult:
+            {
+                VEC_LOOP(l * r);
+
+                break;
+            }
+
+            case kBcDiv:
+            {
+                VEC_LOOP((r != zeros) ? l / r : nans);
+
+                break;
+            }
+
+            case kBcSqrt:
+            {
+#if defined(__SSE2__)
+                for (size_t k = 0; k < kBcBatchBlock; k += 2)
+                {
+                    _mm_storeu_pd(dst + k, _mm_sqrt_pd(_mm_loadu_pd(rhs + k)));
+                }
+#else
+                SCALAR_LOOP(sqrt(rhs[k]));
+#endif
+                break;
+            }
+
+            case kBcSin:
+            {
+                if (prog->approx_math)
+                {
+                    VecSin(dst, rhs, kBcBatchBlock);
+                }
+                else
+                {
+                    SCALAR_LOOP(sin(rhs[k]));
+                }
+
+                break;
+            }
+
+            case kBcCos:
+            {
+                if (prog->approx_math)
+                {
+                    VecCos(dst, rhs, kBcBatchBlock);
+                }
+                else
+                {
+                    SCALAR_LOOP(cos(rhs[k]));
+                }
+
+                break;
+            }
+
+            case kBcTg:
+            {
+                if (prog->approx_math)
+                {
+                    VecTg(dst, rhs, kBcBatchBlock);
+                }
+                else
+                {
+                    SCALAR_LOOP(tan(rhs[k]));
+                }
+
+                break;
+            }
+
+            case kBcLn:
+            {
+                if (prog->approx_math)
+                {
+                    VecLn(dst, rhs, kBcBatchBlock);
+                }
+                else
+                {
+                    SCALAR_LOOP(log(rhs[k]));
+                }
+
+                break;
+            }
+
+            case kBcExp:
+            {
+                if (prog->approx_math)
+                {
+                    VecPow(dst, lhs, rhs, kBcBatchBlock);
+                }
+                else
+                {
+                    SCALAR_LOOP(pow(lhs[k], rhs[k]));
+                }
+
+                break;
+            }
+
+            default:
+            {
+                SCALAR_LOOP(NAN);
+
+                break;
+            }
+        }
+    }
+
+    #undef VEC_LOOP
+    #undef SCALAR_LOOP
+}
+
+//==============================================================================
+
+void BcDump(const BcProgram *prog,
+            FILE            *output_file)
+{
+    CHECK(prog);
+    CHECK(output_file);
+
+    fprintf(output_file, "bytecode: %zu instructions, %zu registers, result r%u\n",
+                         prog->code_size,
+                         prog->reg_count,
+                         prog->result);
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        const BcInstr *ins = &prog->code[i];
+
+        if (ins->op == kBcLoadVar)
+        {
+            fprintf(output_file, "%6zu: r%u = var[%u]\n", i, ins->dst, ins->lhs);
+        }
+        else if (IsUnaryOp((OpCode_t) ins->op))
+        {
+            fprintf(output_file, "%6zu: r%u = %s r%u\n", i, ins->dst, OperationArray[ins->op].op_str, ins->rhs);
+        }
+        else
+        {
+            fprintf(output_file, "%6zu: r%u = r%u %s r%u\n", i, ins->dst, ins->lhs, OperationArray[ins->op].op_str, ins->rhs);
+        }
+    }
+}
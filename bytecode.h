@@ -0,0 +1,91 @@
+#ifndef BYTECODE_HEADER
+#define BYTECODE_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trees.h"
+#include "parse.h"
+
+//! Expression lowered to straight-line code over a register file.
+//! Constants are put into their registers once by BcCompile(), every variable
+//! is loaded once per BcEval() and every operator node becomes one instruction.
+//! Register 0 always holds 0 and stands for a missing operand, as in Eval().
+//! A node reached through several parents (DAG mode) is compiled once.
+
+typedef enum
+{
+    kBcAdd  = kAdd,
+    kBcSub  = kSub,
+    kBcMult = kMult,
+    kBcDiv  = kDiv,
+    kBcSqrt = kSqrt,
+    kBcSin  = kSin,
+    kBcCos  = kCos,
+    kBcTg   = kTg,
+    kBcLn   = kLn,
+    kBcExp  = kExp,
+
+    kBcLoadVar, // regs[dst] = vars[lhs]
+} BcOp_t;
+
+typedef uint32_t BcReg_t;
+
+static const size_t kBcBatchBlock = 64;
+
+struct BcInstr
+{
+    uint32_t op;
+
+    BcReg_t dst;
+    BcReg_t lhs;
+    BcReg_t rhs;
+};
+
+struct BcProgram
+{
+    BcInstr *code;
+
+    size_t code_size;
+    size_t code_capacity;
+
+    NumType_t *regs;
+
+    size_t reg_count;
+    size_t reg_capacity;
+
+    BcReg_t result;
+
+    NumType_t *batch_regs; // scratch for BcEvalBatch, kBcBatchBlock values per register
+    size_t     batch_capacity;
+
+    bool approx_math; // BcEvalBatch uses vec_math kernels, see vec_math.h for their error
+};
+
+TreeErrs_t BcCtor(BcProgram *prog);
+
+TreeErrs_t BcDtor(BcProgram *prog);
+
+//! Replaces the contents of prog with the code for node.
+TreeErrs_t BcCompile(BcProgram      *prog,
+                     const TreeNode *node);
+
+//! Gives the same bits as Eval() on the compiled tree.
+NumType_t BcEval(BcProgram       *prog,
+                 const Variables *vars);
+
+//! Evaluates the program at point_count points, kBcBatchBlock points per sweep
+//! over the code. var_values[i] holds the values of variable i at every point,
+//! a nullptr entry (or var_values == nullptr) keeps vars->var_array[i].value.
+//! + - * / and sqrt run on vectors where the compiler supports them.
+//! Results are bit-identical to BcEval() unless prog->approx_math is set.
+TreeErrs_t BcEvalBatch(BcProgram              *prog,
+                       const Variables        *vars,
+                       const NumType_t *const *var_values,
+                       size_t                  point_count,
+                       NumType_t              *out);
+
+void BcDump(const BcProgram *prog,
+            FILE            *output_file);
+
+#endif
@@ -0,0 +1,1098 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "canon.h"
+#include "diff.h"
+#include "dag.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+static const size_t kBaseCanonCapacity = 64;
+static const size_t kCanonMultiplier   = 2;
+
+static const int kCanonEnter   = 0;
+static const int kCanonSum     = 1;
+static const int kCanonProduct = 2;
+static const int kCanonOp      = 3;
+static const int kCanonCopy    = 4;
+
+struct CanonFactor
+{
+    TreeNode *base;
+    size_t    hash;
+    NumType_t exp;
+    bool      in_den; // set by BuildTerm()
+};
+
+// Operand of a sum or a product: coef times count factors. The factors of
+// the items on the stack follow each other at the end of CanonCtx::factors.
+struct CanonItem
+{
+    NumType_t coef;
+    size_t    first;
+    size_t    count;
+};
+
+struct CanonLeaf
+{
+    const TreeNode *node;
+    NumType_t       mult; // sign in a sum, power in a product
+};
+
+struct CanonTerm
+{
+    NumType_t coef;
+    size_t    first;
+    size_t    count;
+    size_t    key;
+};
+
+struct CanonCtx
+{
+    CanonItem *items;
+    size_t     item_count;
+    size_t     item_capacity;
+
+    CanonFactor *factors;
+    size_t       factor_count;
+    size_t       factor_capacity;
+
+    CanonLeaf *leaves;
+    size_t     leaf_count;
+    size_t     leaf_capacity;
+
+    CanonTerm *terms;
+    size_t     term_capacity;
+};
+
+static TreeErrs_t EnterNode(CanonCtx       *ctx,
+                            WorkStack      *frames,
+                            const TreeNode *node);
+
+static TreeErrs_t CollectLeaves(CanonCtx       *ctx,
+                                const TreeNode *root,
+                                bool            is_sum);
+
+static TreeErrs_t CombineOp(CanonCtx       *ctx,
+                            const TreeNode *node);
+
+static TreeErrs_t CombineProduct(CanonCtx *ctx,
+                                 size_t    begin);
+
+static TreeErrs_t CombineSum(CanonCtx *ctx,
+                             size_t    begin);
+
+static size_t MergeFactors(CanonFactor *factors,
+                           size_t       count);
+
+static TreeNode *BuildTerm(CanonFactor *factors,
+                           size_t       count,
+                           NumType_t    coef,
+                           size_t      *hash);
+
+static bool HasNumTwin(const CanonFactor *factors,
+                       size_t             count,
+                       size_t             idx);
+
+static TreeNode *PopNode(CanonCtx *ctx,
+                         size_t   *hash);
+
+static TreeErrs_t PushItem(CanonCtx  *ctx,
+                           NumType_t  coef,
+                           size_t     count);
+
+static TreeErrs_t PushNodeItem(CanonCtx *ctx,
+                               TreeNode *node,
+                               size_t    hash);
+
+static TreeErrs_t PushFactor(CanonCtx  *ctx,
+                             TreeNode  *base,
+                             size_t     hash,
+                             NumType_t  exp);
+
+static TreeErrs_t PushLeaf(CanonCtx       *ctx,
+                           const TreeNode *node,
+                           NumType_t       mult);
+
+static TreeErrs_t PushCopy(CanonCtx       *ctx,
+                           const TreeNode *node);
+
+static void *Reserve(void   *data,
+                     size_t *capacity,
+                     size_t  size,
+                     size_t  elem_size);
+
+static TreeNode *CanonOp(OpCode_t  op_code,
+                         TreeNode *left,
+                         size_t    left_hash,
+                         TreeNode *right,
+                         size_t    right_hash,
+                         size_t   *hash);
+
+static TreeNode *CanonNum(NumType_t  val,
+                          size_t    *hash);
+
+static int ClusterKind(const TreeNode *node);
+
+static bool IsIntPow(const TreeNode *node,
+                     int             mult);
+
+static size_t FactorsKey(const CanonFactor *factors,
+                         size_t             count);
+
+static bool FactorsEqual(const CanonFactor *lhs,
+                         const CanonFactor *rhs,
+                         size_t             count);
+
+static int CompareFactors(const void *lhs,
+                          const void *rhs);
+
+static int CompareTerms(const void *lhs,
+                        const void *rhs);
+
+static void DropBase(TreeNode *node);
+
+//==============================================================================
+
+TreeNode *CanonNode(const TreeNode *node)
+{
+    CHECK(node);
+
+    CanonCtx ctx = {};
+
+    WorkStack frames = {};
+    WorkStackCtor(&frames);
+
+    TreeErrs_t status = WorkPushNode(&frames, node, kCanonEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        switch (frame.state)
+        {
+            case kCanonEnter:
+            {
+                status = EnterNode(&ctx, &frames, frame.val.const_node);
+
+                break;
+            }
+
+            case kCanonSum:
+            {
+                status = CombineSum(&ctx, frame.val.idx);
+
+                break;
+            }
+
+            case kCanonProduct:
+            {
+                status = CombineProduct(&ctx, frame.val.idx);
+
+                break;
+            }
+
+            case kCanonOp:
+            {
+                status = CombineOp(&ctx, frame.val.const_node);
+
+                break;
+            }
+
+            case kCanonCopy:
+            {
+                status = PushCopy(&ctx, frame.val.const_node);
+
+                break;
+            }
+
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    TreeNode *root = nullptr;
+
+    if (status == kTreeSuccess && ctx.item_count == 1)
+    {
+        size_t hash = 0;
+
+        root = PopNode(&ctx, &hash);
+    }
+
+    // only left after a failure
+
+    for (size_t i = 0; i < ctx.factor_count; i++)
+    {
+        DropBase(ctx.factors[i].base);
+    }
+
+    free(ctx.items);
+    free(ctx.factors);
+    free(ctx.leaves);
+    free(ctx.terms);
+
+    WorkStackDtor(&frames);
+
+    return root;
+}
+
+//==============================================================================
+
+TreeErrs_t CanonTree(Tree *tree)
+{
+    CHECK(tree);
+
+    if (tree->root == nullptr)
+    {
+        return kTreeSuccess;
+    }
+
+    TreeNode *root = CanonNode(tree->root);
+
+    if (root == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    root->parent = tree->root->parent;
+
+    DropBase(tree->root);
+
+    tree->root = root;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Numbers and variables become items at once. The leaves of a sum or a
+// product are entered after it with a frame that combines their items,
+// other operators get the items of their operands built back into nodes.
+// The exponent of a base that may be negative is copied as it is: rounded
+// differently, an integer exponent like y/y turns a real power into NaN.
+
+static TreeErrs_t EnterNode(CanonCtx       *ctx,
+                            WorkStack      *frames,
+                            const TreeNode *node)
+{
+    if (node->type == kConstNumber)
+    {
+        return PushItem(ctx, node->data.const_val, 0);
+    }
+
+    if (node->type != kOperator)
+    {
+        TreeNode *copy = CopyNode(node, nullptr);
+
+        if (copy == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        return PushNodeItem(ctx, copy, NodeHash(copy, 0, 0));
+    }
+
+    TreeErrs_t status = kTreeSuccess;
+
+    int kind = ClusterKind(node);
+
+    if (kind == kCanonOp)
+    {
+        int right_state = (node->data.op_code == kExp && node->right->type != kConstNumber &&
+                           !IsAboveZero(node->left)) ? kCanonCopy : kCanonEnter;
+
+        if ((status = WorkPushNode(frames, node, kCanonOp)) != kTreeSuccess ||
+            (node->right != nullptr && (status = WorkPushNode(frames, node->right, right_state)) != kTreeSuccess) ||
+            (node->left  != nullptr && (status = WorkPushNode(frames, node->left,  kCanonEnter)) != kTreeSuccess))
+        {
+            return status;
+        }
+
+        return kTreeSuccess;
+    }
+
+    size_t begin = ctx->leaf_count;
+
+    if ((status = CollectLeaves(ctx, node, kind == kCanonSum)) != kTreeSuccess)
+    {
+        return status;
+    }
+
+    WorkItem combine = {};
+
+    combine.val.idx = begin;
+    combine.state   = kind;
+
+    if ((status = WorkPush(frames, combine)) != kTreeSuccess)
+    {
+        return status;
+    }
+
+    // the first leaf is entered first, so the items keep the order of leaves
+
+    for (size_t i = ctx->leaf_count; i > begin; i--)
+    {
+        if ((status = WorkPushNode(frames, ctx->leaves[i - 1].node, kCanonEnter)) != kTreeSuccess)
+        {
+            return status;
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Operands of the chain of + and - (or of *, / and integer powers) starting at
+// root, with the sign (or power) they get in the whole chain.
+
+static TreeErrs_t CollectLeaves(CanonCtx       *ctx,
+                                const TreeNode *root,
+                                bool            is_sum)
+{
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    TreeErrs_t status = WorkPushNode(&stk, root, 1);
+
+    while (stk.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem item = WorkPop(&stk);
+
+        const TreeNode *curr = item.val.const_node;
+
+        int mult = item.state;
+
+        OpCode_t op_code = (curr->type == kOperator) ? curr->data.op_code : kNotAnOperation;
+
+        bool is_chain = is_sum ? (op_code == kAdd  || op_code == kSub) :
+                                 (op_code == kMult || op_code == kDiv);
+
+        if (is_chain)
+        {
+            int right_mult = (op_code == kSub || op_code == kDiv) ? -mult : mult;
+
+            if ((status = WorkPushNode(&stk, curr->right, right_mult)) != kTreeSuccess ||
+                (status = WorkPushNode(&stk, curr->left,  mult))       != kTreeSuccess)
+            {
+                break;
+            }
+        }
+        else if (!is_sum && IsIntPow(curr, mult))
+        {
+            status = WorkPushNode(&stk, curr->left, mult * (int) curr->right->data.const_val);
+        }
+        else
+        {
+            status = PushLeaf(ctx, curr, mult);
+        }
+    }
+
+    WorkStackDtor(&stk);
+
+    return status;
+}
+
+//==============================================================================
+
+static TreeErrs_t CombineOp(CanonCtx       *ctx,
+                            const TreeNode *node)
+{
+    size_t right_hash = 0;
+    size_t left_hash  = 0;
+
+    TreeNode *right = (node->right != nullptr) ? PopNode(ctx, &right_hash) : nullptr;
+    TreeNode *left  = (node->left  != nullptr) ? PopNode(ctx, &left_hash)  : nullptr;
+
+    size_t    hash  = 0;
+    TreeNode *built = CanonOp(node->data.op_code, left, left_hash, right, right_hash, &hash);
+
+    if (built == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    return PushNodeItem(ctx, built, hash);
+}
+
+//------------------------------------------------------------------------------
+// Coefficients of the items are multiplied, factors of all of them are sorted
+// by hash and equal ones merged. A zero coefficient takes the factors away.
+
+static TreeErrs_t CombineProduct(CanonCtx *ctx,
+                                 size_t    begin)
+{
+    size_t     count = ctx->leaf_count - begin;
+    CanonItem *items = ctx->items + ctx->item_count - count;
+    size_t     first = items[0].first;
+
+    NumType_t coef = 1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        NumType_t exp = ctx->leaves[begin + i].mult;
+
+        coef *= IsNumEqual(exp, 1) ? items[i].coef : pow(items[i].coef, exp);
+
+        for (size_t j = items[i].first; j < items[i].first + items[i].count; j++)
+        {
+            ctx->factors[j].exp *= exp;
+        }
+    }
+
+    CanonFactor *factors = ctx->factors + first;
+
+    qsort(factors, ctx->factor_count - first, sizeof(CanonFactor), CompareFactors);
+
+    size_t kept = MergeFactors(factors, ctx->factor_count - first);
+
+    if (IsNumEqual(coef, 0))
+    {
+        for (size_t i = 0; i < kept; i++)
+        {
+            DropBase(factors[i].base);
+        }
+
+        coef = 0; // not -0
+        kept = 0;
+    }
+
+    ctx->factor_count = first + kept;
+    ctx->item_count  -= count;
+    ctx->leaf_count   = begin;
+
+    return PushItem(ctx, coef, kept);
+}
+
+//------------------------------------------------------------------------------
+// Terms with equal factors are merged, numbers go to one constant. A sum left
+// with one term and no constant is passed up as that term, so the product
+// around it still sees its factors.
+
+static TreeErrs_t CombineSum(CanonCtx *ctx,
+                             size_t    begin)
+{
+    size_t count = ctx->leaf_count - begin;
+
+    CanonTerm *terms = (CanonTerm *) Reserve(ctx->terms, &ctx->term_capacity, count, sizeof(CanonTerm));
+
+    if (terms == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    ctx->terms = terms;
+
+    CanonItem *items = ctx->items + ctx->item_count - count;
+    size_t     first = items[0].first;
+
+    NumType_t constant   = 0;
+    size_t    term_count = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        NumType_t coef = ctx->leaves[begin + i].mult * items[i].coef;
+
+        if (items[i].count == 0)
+        {
+            constant += coef;
+
+            continue;
+        }
+
+        terms[term_count++] = {coef, items[i].first, items[i].count,
+                               FactorsKey(ctx->factors + items[i].first, items[i].count)};
+    }
+
+    qsort(terms, term_count, sizeof(CanonTerm), CompareTerms);
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < term_count; i++)
+    {
+        CanonTerm *curr = &terms[i];
+
+        bool merged = false;
+
+        for (size_t j = kept; j > 0 && terms[j - 1].key == curr->key; j--)
+        {
+            CanonTerm *prev = &terms[j - 1];
+
+            if (prev->count == curr->count &&
+                FactorsEqual(ctx->factors + prev->first, ctx->factors + curr->first, curr->count))
+            {
+                prev->coef += curr->coef;
+                merged      = true;
+
+                break;
+            }
+        }
+
+        if (merged)
+        {
+            for (size_t j = curr->first; j < curr->first + curr->count; j++)
+            {
+                DropBase(ctx->factors[j].base);
+            }
+
+            continue;
+        }
+
+        terms[kept++] = *curr;
+    }
+
+    size_t nonzero = 0;
+
+    for (size_t i = 0; i < kept; i++)
+    {
+        if (!IsNumEqual(terms[i].coef, 0))
+        {
+            terms[nonzero++] = terms[i];
+
+            continue;
+        }
+
+        for (size_t j = terms[i].first; j < terms[i].first + terms[i].count; j++)
+        {
+            DropBase(ctx->factors[j].base);
+        }
+    }
+
+    ctx->item_count -= count;
+    ctx->leaf_count  = begin;
+
+    if (nonzero == 0)
+    {
+        ctx->factor_count = first;
+
+        return PushItem(ctx, constant, 0);
+    }
+
+    if (nonzero == 1 && IsNumEqual(constant, 0))
+    {
+        memmove(ctx->factors + first, ctx->factors + terms[0].first, terms[0].count * sizeof(CanonFactor));
+
+        ctx->factor_count = first + terms[0].count;
+
+        return PushItem(ctx, terms[0].coef, terms[0].count);
+    }
+
+    // t1 + t2 - t3 ... + constant, a negative coefficient turns + into -
+
+    size_t    hash = 0;
+    TreeNode *sum  = BuildTerm(ctx->factors + terms[0].first, terms[0].count, terms[0].coef, &hash);
+
+    for (size_t i = 1; i < nonzero && sum != nullptr; i++)
+    {
+        bool is_neg = (terms[i].coef < 0);
+
+        size_t    term_hash = 0;
+        TreeNode *term      = BuildTerm(ctx->factors + terms[i].first, terms[i].count,
+                                        is_neg ? -terms[i].coef : terms[i].coef, &term_hash);
+
+        sum = CanonOp(is_neg ? kSub : kAdd, sum, hash, term, term_hash, &hash);
+    }
+
+    if (sum != nullptr && !IsNumEqual(constant, 0))
+    {
+        size_t    num_hash = 0;
+        TreeNode *num      = CanonNum((constant < 0) ? -constant : constant, &num_hash);
+
+        sum = CanonOp((constant < 0) ? kSub : kAdd, sum, hash, num, num_hash, &hash);
+    }
+
+    ctx->factor_count = first;
+
+    if (sum == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    return PushNodeItem(ctx, sum, hash);
+}
+
+//------------------------------------------------------------------------------
+// Factors sorted by hash, equal ones are next to each other. Returns how many
+// are left after merging them and dropping the zero powers. A power is only
+// merged with one of the other sign if its base is proven nonzero: x^3 / x
+// is not defined at 0, so it stays as it is.
+
+static size_t MergeFactors(CanonFactor *factors,
+                           size_t       count)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        CanonFactor *curr = &factors[i];
+
+        bool merged = false;
+
+        for (size_t j = kept; j > 0 && factors[j - 1].hash == curr->hash; j--)
+        {
+            bool same_sign = ((factors[j - 1].exp > 0) == (curr->exp > 0));
+
+            if (TreeEqual(factors[j - 1].base, curr->base) &&
+                (same_sign || IsAwayFromZero(curr->base)))
+            {
+                factors[j - 1].exp += curr->exp;
+                merged              = true;
+
+                DropBase(curr->base);
+
+                break;
+            }
+        }
+
+        if (!merged)
+        {
+            factors[kept++] = *curr;
+        }
+    }
+
+    size_t nonzero = 0;
+
+    for (size_t i = 0; i < kept; i++)
+    {
+        if (IsNumEqual(factors[i].exp, 0))
+        {
+            DropBase(factors[i].base);
+        }
+        else
+        {
+            factors[nonzero++] = factors[i];
+        }
+    }
+
+    return nonzero;
+}
+
+//------------------------------------------------------------------------------
+// coef * f1^e1 * f2^e2 ... / (g1^d1 * ...), the factors are used up. Only
+// bases proven nonzero go to the denominator, pow(0, -1) is inf while the
+// division by 0 is nan, so the others keep their negative power. A base left
+// in the numerator as well goes there too: at 0 both forms are nan, and y/y
+// is exactly 1 where y * y^-1 may round below it.
+
+static TreeNode *BuildTerm(CanonFactor *factors,
+                           size_t       count,
+                           NumType_t    coef,
+                           size_t      *hash)
+{
+    bool has_num = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        factors[i].in_den = (factors[i].exp < 0 &&
+                             (HasNumTwin(factors, count, i) || IsAwayFromZero(factors[i].base)));
+
+        has_num |= !factors[i].in_den;
+    }
+
+    TreeNode *num      = nullptr;
+    TreeNode *den      = nullptr;
+    size_t    num_hash = 0;
+    size_t    den_hash = 0;
+
+    if (!IsNumEqual(coef, 1) || !has_num)
+    {
+        num = CanonNum(coef, &num_hash);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        bool is_num = !factors[i].in_den;
+
+        size_t    exp_hash = 0;
+        TreeNode *exp      = CanonNum(is_num ? factors[i].exp : -factors[i].exp, &exp_hash);
+
+        size_t    power_hash = 0;
+        TreeNode *power      = CanonOp(kExp, factors[i].base, factors[i].hash, exp, exp_hash, &power_hash);
+
+        TreeNode **part      = is_num ? &num      : &den;
+        size_t    *part_hash = is_num ? &num_hash : &den_hash;
+
+        if (*part == nullptr)
+        {
+            *part      = power;
+            *part_hash = power_hash;
+        }
+        else
+        {
+            *part = CanonOp(kMult, *part, *part_hash, power, power_hash, part_hash);
+        }
+    }
+
+    if (den != nullptr)
+    {
+        num = CanonOp(kDiv, num, num_hash, den, den_hash, &num_hash);
+    }
+
+    *hash = num_hash;
+
+    return num;
+}
+
+//------------------------------------------------------------------------------
+// Another factor with the base of factors[idx] and a positive power, the
+// ones MergeFactors() left apart. Equal bases are next to each other.
+
+static bool HasNumTwin(const CanonFactor *factors,
+                       size_t             count,
+                       size_t             idx)
+{
+    for (size_t i = idx; i > 0 && factors[i - 1].hash == factors[idx].hash; i--)
+    {
+        if (factors[i - 1].exp > 0 && TreeEqual(factors[i - 1].base, factors[idx].base))
+        {
+            return true;
+        }
+    }
+
+    for (size_t i = idx + 1; i < count && factors[i].hash == factors[idx].hash; i++)
+    {
+        if (factors[i].exp > 0 && TreeEqual(factors[i].base, factors[idx].base))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//==============================================================================
+
+static TreeNode *PopNode(CanonCtx *ctx,
+                         size_t   *hash)
+{
+    CanonItem item = ctx->items[--ctx->item_count];
+
+    ctx->factor_count = item.first;
+
+    return BuildTerm(ctx->factors + item.first, item.count, item.coef, hash);
+}
+
+//==============================================================================
+
+static TreeErrs_t PushItem(CanonCtx  *ctx,
+                           NumType_t  coef,
+                           size_t     count)
+{
+    CanonItem *items = (CanonItem *) Reserve(ctx->items, &ctx->item_capacity,
+                                             ctx->item_count + 1, sizeof(CanonItem));
+
+    if (items == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    ctx->items = items;
+
+    ctx->items[ctx->item_count++] = {coef, ctx->factor_count - count, count};
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Item of a built node: a number goes to the coefficient, anything else is
+// one factor.
+
+static TreeErrs_t PushNodeItem(CanonCtx *ctx,
+                               TreeNode *node,
+                               size_t    hash)
+{
+    if (node->type == kConstNumber)
+    {
+        NumType_t val = node->data.const_val;
+
+        DropBase(node);
+
+        return PushItem(ctx, val, 0);
+    }
+
+    TreeErrs_t status = PushFactor(ctx, node, hash, 1);
+
+    if (status != kTreeSuccess)
+    {
+        DropBase(node);
+
+        return status;
+    }
+
+    return PushItem(ctx, 1, 1);
+}
+
+//==============================================================================
+
+static TreeErrs_t PushFactor(CanonCtx  *ctx,
+                             TreeNode  *base,
+                             size_t     hash,
+                             NumType_t  exp)
+{
+    CanonFactor *factors = (CanonFactor *) Reserve(ctx->factors, &ctx->factor_capacity,
+                                                   ctx->factor_count + 1, sizeof(CanonFactor));
+
+    if (factors == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    ctx->factors = factors;
+
+    ctx->factors[ctx->factor_count++] = {base, hash, exp, false};
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static TreeErrs_t PushLeaf(CanonCtx       *ctx,
+                           const TreeNode *node,
+                           NumType_t       mult)
+{
+    CanonLeaf *leaves = (CanonLeaf *) Reserve(ctx->leaves, &ctx->leaf_capacity,
+                                              ctx->leaf_count + 1, sizeof(CanonLeaf));
+
+    if (leaves == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    ctx->leaves = leaves;
+
+    ctx->leaves[ctx->leaf_count++] = {node, mult};
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Item of a copy of the whole subtree at node, for exponents kept as they are.
+
+static TreeErrs_t PushCopy(CanonCtx       *ctx,
+                           const TreeNode *node)
+{
+    TreeNode *copy = CopyNode(node, nullptr);
+
+    if (copy == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    return PushNodeItem(ctx, copy, TreeHash(copy));
+}
+
+//------------------------------------------------------------------------------
+// data grown to hold size elements or nullptr, then data is still valid.
+
+static void *Reserve(void   *data,
+                     size_t *capacity,
+                     size_t  size,
+                     size_t  elem_size)
+{
+    if (size <= *capacity && data != nullptr)
+    {
+        return data;
+    }
+
+    size_t new_capacity = (*capacity == 0) ? kBaseCanonCapacity : *capacity;
+
+    while (size > new_capacity)
+    {
+        new_capacity *= kCanonMultiplier;
+    }
+
+    void *new_data = realloc(data, new_capacity * elem_size);
+
+    if (new_data != nullptr)
+    {
+        *capacity = new_capacity;
+    }
+
+    return new_data;
+}
+
+//------------------------------------------------------------------------------
+// OpCtor() with the structural hash of the result, operands are taken even
+// when nullptr is returned.
+
+static TreeNode *CanonOp(OpCode_t  op_code,
+                         TreeNode *left,
+                         size_t    left_hash,
+                         TreeNode *right,
+                         size_t    right_hash,
+                         size_t   *hash)
+{
+    if (right == nullptr || (left == nullptr && !IsUnaryOp(op_code)))
+    {
+        DropBase(left);
+        DropBase(right);
+
+        return nullptr;
+    }
+
+    TreeNode *node = OpCtor(op_code, left, right);
+
+    if (node == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (node == left)
+    {
+        *hash = left_hash;
+    }
+    else if (node == right)
+    {
+        *hash = right_hash;
+    }
+    else if (node->left == left && node->right == right)
+    {
+        *hash = NodeHash(node, left_hash, right_hash);
+    }
+    else
+    {
+        *hash = TreeHash(node);
+    }
+
+    return node;
+}
+
+//==============================================================================
+
+static TreeNode *CanonNum(NumType_t  val,
+                          size_t    *hash)
+{
+    TreeNode *node = NodeCtor(nullptr, nullptr, nullptr, kConstNumber, IsNumEqual(val, 0) ? 0 : val);
+
+    if (node != nullptr)
+    {
+        *hash = NodeHash(node, 0, 0);
+    }
+
+    return node;
+}
+
+//==============================================================================
+
+static int ClusterKind(const TreeNode *node)
+{
+    switch (node->data.op_code)
+    {
+        case kAdd:
+        case kSub:
+        {
+            return kCanonSum;
+        }
+
+        case kMult:
+        case kDiv:
+        {
+            return kCanonProduct;
+        }
+
+        case kExp:
+        {
+            return IsIntPow(node, 1) ? kCanonProduct : kCanonOp;
+        }
+
+        case kSqrt:
+        case kSin:
+        case kCos:
+        case kTg:
+        case kLn:
+        case kNotAnOperation:
+        default:
+        {
+            return kCanonOp;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// node is base^n with an integer n that stays within kMaxCanonExp when the
+// power mult around node is applied.
+
+static bool IsIntPow(const TreeNode *node,
+                     int             mult)
+{
+    if (node->type != kOperator || node->data.op_code != kExp ||
+        node->right == nullptr || node->right->type != kConstNumber)
+    {
+        return false;
+    }
+
+    NumType_t exp = node->right->data.const_val;
+
+    return IsNumEqual(exp, trunc(exp)) && fabs(exp * mult) <= kMaxCanonExp;
+}
+
+//==============================================================================
+
+static size_t FactorsKey(const CanonFactor *factors,
+                         size_t             count)
+{
+    uint64_t key = count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        key = key * 31 + factors[i].hash;
+        key = key * 31 + (uint64_t) (int64_t) factors[i].exp;
+    }
+
+    key ^= key >> 32;
+
+    return (size_t) key;
+}
+
+//==============================================================================
+
+static bool FactorsEqual(const CanonFactor *lhs,
+                         const CanonFactor *rhs,
+                         size_t             count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (lhs[i].hash != rhs[i].hash || !IsNumEqual(lhs[i].exp, rhs[i].exp) ||
+            !TreeEqual(lhs[i].base, rhs[i].base))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//==============================================================================
+
+static int CompareFactors(const void *lhs,
+                          const void *rhs)
+{
+    size_t lhs_hash = ((const CanonFactor *) lhs)->hash;
+    size_t rhs_hash = ((const CanonFactor *) rhs)->hash;
+
+    return (lhs_hash > rhs_hash) - (lhs_hash < rhs_hash);
+}
+
+//==============================================================================
+
+static int CompareTerms(const void *lhs,
+                        const void *rhs)
+{
+    size_t lhs_key = ((const CanonTerm *) lhs)->key;
+    size_t rhs_key = ((const CanonTerm *) rhs)->key;
+
+    return (lhs_key > rhs_key) - (lhs_key < rhs_key);
+}
+
+//------------------------------------------------------------------------------
+// Nodes of a DagTable are shared and never destroyed one by one.
+
+static void DropBase(TreeNode *node)
+{
+    if (node != nullptr && DagCurrent() == nullptr)
+    {
+        TreeDtor(node);
+    }
+}
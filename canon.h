@@ -0,0 +1,31 @@
+#ifndef CANON_HEADER
+#define CANON_HEADER
+
+#include "trees.h"
+
+//! Canonical form of sums and products. Chains of + and - and chains of *, /
+//! and integer powers are flattened into lists of operands, numbers are
+//! folded into one coefficient per product and one constant per sum, equal
+//! factors are merged into powers (x * x^2 / x -> x^2) and equal terms into
+//! one term (2*x*y + y*x*3 -> 5*x*y). Operands are then ordered by structural
+//! hash and built back as left-deep binary chains, the coefficient first and
+//! the constant last, factors with negative powers go to one denominator if
+//! IsAwayFromZero() proves their base nonzero and stay powers otherwise.
+//!
+//! Expressions equal up to these laws get the same canonical tree, so they
+//! can be compared by TreeHash() and TreeEqual() alone. Factors are only
+//! cancelled (x/x -> 1, x^3/x -> x^2) where IsAwayFromZero() proves them
+//! nonzero, so the canonical tree is defined wherever the original one is.
+//! The exponent of a base that IsAboveZero() does not prove positive is
+//! copied unchanged, (-2)^(y/y) must keep its exact exponent 1.
+
+//! Largest integer power that is expanded into factors, x^1000 stays a power.
+static const int kMaxCanonExp = 256;
+
+//! Canonical copy of node, node itself is not changed.
+TreeNode *CanonNode(const TreeNode *node);
+
+//! Replaces the root of tree with its canonical copy.
+TreeErrs_t CanonTree(Tree *tree);
+
+#endif
@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "codegen.h"
+#include "bytecode.h"
+#include "diff.h"
+#include "dag.h"
+#include "debug/debug.h"
+
+static const size_t kMaxCgName = 256;
+
+static const size_t kCgMultiplier = 2;
+
+static const uint32_t kCgNone = UINT32_MAX;
+
+// Every register of the compiled program after value numbering: canon is the
+// register holding the same value that is actually printed.
+struct CgReg
+{
+    uint32_t canon;
+    uint32_t var;   // variable position for loaded variables, kCgNone otherwise
+    bool     is_op; // result of an operator, printed as local t<canon>
+};
+
+struct CgKey
+{
+    uint64_t first;
+    uint64_t second;
+    uint32_t reg;
+};
+
+static TreeErrs_t NumberValues(const BcProgram *prog,
+                               CgReg           *regs);
+
+static uint32_t InternKey(CgKey    *table,
+                          size_t    capacity,
+                          uint64_t  first,
+                          uint64_t  second,
+                          uint32_t  reg);
+
+static void PrintOperand(const BcProgram *prog,
+                         const CgReg     *regs,
+                         uint32_t         reg,
+                         bool             batch,
+                         FILE            *output_file);
+
+static void PrintBody(const BcProgram *prog,
+                      const CgReg     *regs,
+                      bool             batch,
+                      const char      *indent,
+                      FILE            *output_file);
+
+//==============================================================================
+
+TreeErrs_t CodegenPrologue(FILE *output_file)
+{
+    CHECK(output_file);
+
+    fprintf(output_file, "/* Generated by Diff, do not edit. */\n"
+                         "\n"
+                         "#include <math.h>\n"
+                         "#include <stddef.h>\n"
+                         "\n"
+                         "static inline double diff_div(double num, double den)\n"
+                         "{\n"
+                         "    return (den != 0) ? num / den : NAN;\n"
+                         "}\n"
+                         "\n");
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t CodegenFunction(const TreeNode *node,
+                           const char     *name,
+                           FILE           *output_file)
+{
+    CHECK(node);
+    CHECK(name);
+    CHECK(output_file);
+
+    BcProgram prog = {};
+
+    TreeErrs_t status = BcCtor(&prog);
+
+    if (status == kTreeSuccess)
+    {
+        status = BcCompile(&prog, node);
+    }
+
+    CgReg *regs = nullptr;
+
+    if (status == kTreeSuccess)
+    {
+        regs = (CgReg *) calloc(prog.reg_count, sizeof(CgReg));
+
+        status = (regs == nullptr) ? kFailedAllocation : NumberValues(&prog, regs);
+    }
+
+    if (status != kTreeSuccess)
+    {
+        free(regs);
+        BcDtor(&prog);
+
+        return status;
+    }
+
+    fprintf(output_file, "double %s(const double *vars)\n"
+                         "{\n", name);
+
+    PrintBody(&prog, regs, false, "    ", output_file);
+
+    fprintf(output_file, "    return ");
+    PrintOperand(&prog, regs, prog.result, false, output_file);
+    fprintf(output_file, ";\n"
+                         "}\n"
+                         "\n");
+
+    fprintf(output_file, "void %s_batch(const double *const *vars, double *out, size_t count)\n"
+                         "{\n"
+                         "    for (size_t i = 0; i < count; i++)\n"
+                         "    {\n", name);
+
+    PrintBody(&prog, regs, true, "        ", output_file);
+
+    fprintf(output_file, "        out[i] = ");
+    PrintOperand(&prog, regs, prog.result, true, output_file);
+    fprintf(output_file, ";\n"
+                         "    }\n"
+                         "}\n"
+                         "\n");
+
+    free(regs);
+    BcDtor(&prog);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t CodegenMaclaurin(const Tree *func,
+                            size_t      order,
+                            const char *name,
+                            const char *c_file_name)
+{
+    CHECK(func);
+    CHECK(name);
+    CHECK(c_file_name);
+
+    FILE *output_file = fopen(c_file_name, "w");
+
+    if (output_file == nullptr)
+    {
+        return kFailedToOpenFile;
+    }
+
+    // derivatives share subtrees in a DagTable, the code is generated per
+    // distinct subexpression anyway
+
+    DagTable  dag      = {};
+    DagTable *prev_dag = DagCurrent();
+
+    if (DagCtor(&dag) != kDagSuccess)
+    {
+        fclose(output_file);
+
+        return kFailedAllocation;
+    }
+
+    DagSelect(&dag);
+
+    CodegenPrologue(output_file);
+
+    TreeErrs_t status = kTreeSuccess;
+
+    TreeNode *diff = DagImport(&dag, func->root);
+
+    char func_name[kMaxCgName] = {};
+
+    for (size_t k = 0; k <= order && status == kTreeSuccess; k++)
+    {
+        if (k > 0)
+        {
+            diff = DiffTree(diff, 0, nullptr);
+        }
+
+        if (diff == nullptr)
+        {
+            status = kFailedAllocation;
+
+            break;
+        }
+
+        snprintf(func_name, kMaxCgName, "%s_d%zu", name, k);
+
+        status = CodegenFunction(diff, func_name, output_file);
+    }
+
+    DagSelect(prev_dag);
+    DagDtor(&dag);
+
+    if (status == kTreeSuccess)
+    {
+        fprintf(output_file, "double (*const %s_derivs[])(const double *) =\n{\n", name);
+
+        for (size_t k = 0; k <= order; k++)
+        {
+            fprintf(output_file, "    %s_d%zu,\n", name, k);
+        }
+
+        fprintf(output_file, "};\n\n");
+
+        fprintf(output_file, "void (*const %s_derivs_batch[])(const double *const *, double *, size_t) =\n{\n", name);
+
+        for (size_t k = 0; k <= order; k++)
+        {
+            fprintf(output_file, "    %s_d%zu_batch,\n", name, k);
+        }
+
+        fprintf(output_file, "};\n\n");
+
+        fprintf(output_file, "void %s_maclaurin(const double *vars, double *coeffs)\n{\n", name);
+
+        double factorial = 1;
+
+        for (size_t k = 0; k <= order; k++)
+        {
+            if (k > 0)
+            {
+                factorial *= (double) k;
+            }
+
+            fprintf(output_file, "    coeffs[%zu] = %s_d%zu(vars) / %.17g;\n", k, name, k, factorial);
+        }
+
+        fprintf(output_file, "}\n");
+    }
+
+    fclose(output_file);
+
+    return status;
+}
+
+//==============================================================================
+
+// Local value numbering over the bytecode: equal constants and instructions
+// with equal (op, operands) share one register.
+
+static TreeErrs_t NumberValues(const BcProgram *prog,
+                               CgReg           *regs)
+{
+    size_t capacity = 1;
+
+    while (capacity < prog->reg_count * kCgMultiplier)
+    {
+        capacity *= kCgMultiplier;
+    }
+
+    CgKey *table = (CgKey *) calloc(capacity, sizeof(CgKey));
+
+    if (table == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    for (size_t reg = 0; reg < prog->reg_count; reg++)
+    {
+        regs[reg].canon = (uint32_t) reg;
+        regs[reg].var   = kCgNone;
+        regs[reg].is_op = false;
+    }
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        regs[prog->code[i].dst].is_op = true;
+    }
+
+    // registers no instruction writes hold constants
+
+    for (size_t reg = 0; reg < prog->reg_count; reg++)
+    {
+        if (regs[reg].is_op)
+        {
+            continue;
+        }
+
+        uint64_t bits = 0;
+
+        memcpy(&bits, &prog->regs[reg], sizeof(bits));
+
+        regs[reg].canon = InternKey(table, capacity, 0, bits, (uint32_t) reg);
+    }
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        const BcInstr *ins = &prog->code[i];
+
+        uint32_t lhs = regs[ins->lhs].canon;
+        uint32_t rhs = regs[ins->rhs].canon;
+
+        if (ins->op == kBcLoadVar)
+        {
+            lhs = ins->lhs;
+            rhs = 0;
+
+            regs[ins->dst].var   = ins->lhs;
+            regs[ins->dst].is_op = false;
+        }
+        else if (IsUnaryOp((OpCode_t) ins->op))
+        {
+            lhs = 0;
+        }
+        else if ((ins->op == kBcAdd || ins->op == kBcMult) && lhs > rhs)
+        {
+            uint32_t tmp = lhs;
+
+            lhs = rhs;
+            rhs = tmp;
+        }
+
+        uint64_t first = ((uint64_t) (ins->op + 1) << 32) | lhs;
+
+        regs[ins->dst].canon = InternKey(table, capacity, first, rhs, ins->dst);
+    }
+
+    free(table);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static uint32_t InternKey(CgKey    *table,
+                          size_t    capacity,
+                          uint64_t  first,
+                          uint64_t  second,
+                          uint32_t  reg)
+{
+    uint64_t hash = (first * 0x9e3779b97f4a7c15ull) ^ (second * 0xff51afd7ed558ccdull);
+
+    size_t pos = (size_t) (hash ^ (hash >> 29)) & (capacity - 1);
+
+    // reg + 1 so that zeroed slots are free
+
+    while (table[pos].reg != 0)
+    {
+        if (table[pos].first == first && table[pos].second == second)
+        {
+            return table[pos].reg - 1;
+        }
+
+        pos = (pos + 1) & (capacity - 1);
+    }
+
+    table[pos] = {first, second, reg + 1};
+
+    return reg;
+}
+
+//==============================================================================
+
+static void PrintOperand(const BcProgram *prog,
+                         const CgReg     *regs,
+                         uint32_t         reg,
+                         bool             batch,
+                         FILE            *output_file)
+{
+    const CgReg *info = &regs[regs[reg].canon];
+
+    if (info->is_op)
+    {
+        fprintf(output_file, "t%u", regs[reg].canon);
+
+        return;
+    }
+
+    if (info->var != kCgNone)
+    {
+        fprintf(output_file, batch ? "vars[%u][i]" : "vars[%u]", info->var);
+
+        return;
+    }
+
+    NumType_t val = prog->regs[regs[reg].canon];
+
+    if (isnan(val))
+    {
+        fprintf(output_file, "NAN");
+    }
+    else if (isinf(val))
+    {
+        fprintf(output_file, (val > 0) ? "INFINITY" : "(-INFINITY)");
+    }
+    else
+    {
+        char literal[32] = {};
+
+        snprintf(literal, sizeof(literal), "%.17g", val);
+
+        // keep it a double literal: 1 / 2 must not become integer division
+        bool is_integer = (strpbrk(literal, ".e") == nullptr);
+
+        fprintf(output_file, (val < 0) ? "(%s%s)" : "%s%s", literal, is_integer ? ".0" : "");
+    }
+}
+
+//==============================================================================
+
+static void PrintBody(const BcProgram *prog,
+                      const CgReg     *regs,
+                      bool             batch,
+                      const char      *indent,
+                      FILE            *output_file)
+{
+    #define OPERAND(reg) PrintOperand(prog, regs, reg, batch, output_file)
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        const BcInstr *ins = &prog->code[i];
+
+        if (!regs[ins->dst].is_op || regs[ins->dst].canon != ins->dst)
+        {
+            continue;
+        }
+
+        fprintf(output_file, "%sconst double t%u = ", indent, ins->dst);
+
+        switch ((BcOp_t) ins->op)
+        {
+            case kBcAdd:
+            case kBcSub:
+            case kBcMult:
+            {
+                OPERAND(ins->lhs);
+                fprintf(output_file, " %s ", OperationArray[ins->op].op_str);
+                OPERAND(ins->rhs);
+
+                break;
+            }
+
+            case kBcDiv:
+            {
+                fprintf(output_file, "diff_div(");
+                OPERAND(ins->lhs);
+                fprintf(output_file, ", ");
+                OPERAND(ins->rhs);
+                fprintf(output_file, ")");
+
+                break;
+            }
+
+            case kBcExp:
+            {
+                fprintf(output_file, "pow(");
+                OPERAND(ins->lhs);
+                fprintf(output_file, ", ");
+                OPERAND(ins->rhs);
+                fprintf(output_file, ")");
+
+                break;
+            }
+
+            case kBcSqrt:
+            case kBcSin:
+            case kBcCos:
+            case kBcTg:
+            case kBcLn:
+            {
+                static const char *const kLibmNames[] = {"sqrt", "sin", "cos", "tan", "log"};
+
+                fprintf(output_file, "%s(", kLibmNames[ins->op - kBcSqrt]);
+                OPERAND(ins->rhs);
+                fprintf(output_file, ")");
+
+                break;
+            }
+
+            case kBcLoadVar:
+            default:
+            {
+                fprintf(output_file, "NAN");
+
+                break;
+            }
+        }
+
+        fprintf(output_file, ";\n");
+    }
+
+    #undef OPERAND
+}
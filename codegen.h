@@ -0,0 +1,34 @@
+#ifndef CODEGEN_HEADER
+#define CODEGEN_HEADER
+
+#include <stdio.h>
+
+#include "trees.h"
+#include "parse.h"
+
+//! C source backend. An expression becomes
+//!
+//!   double <name>(const double *vars);
+//!   void   <name>_batch(const double *const *vars, double *out, size_t count);
+//!
+//! vars[i] (vars[i][point] in the batch version) is the variable at position i
+//! of Variables. Every distinct subexpression is computed once into a local.
+//! Generated code follows Eval(): division by zero gives NAN.
+
+//! Includes and helpers every generated translation unit starts with.
+TreeErrs_t CodegenPrologue(FILE *output_file);
+
+TreeErrs_t CodegenFunction(const TreeNode *node,
+                           const char     *name,
+                           FILE           *output_file);
+
+//! Writes a whole translation unit with <name>_d0 ... <name>_d<order>,
+//! tables <name>_derivs[] and <name>_derivs_batch[] of them and
+//! void <name>_maclaurin(const double *vars, double *coeffs)
+//! that fills coeffs[k] = f^(k)(vars) / k!, k = 0 ... order.
+TreeErrs_t CodegenMaclaurin(const Tree *func,
+                            size_t      order,
+                            const char *name,
+                            const char *c_file_name);
+
+#endif
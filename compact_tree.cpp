@@ -0,0 +1,738 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "compact_tree.h"
+#include "diff.h"
+#include "tree_dump.h"
+#include "debug/debug.h"
+
+static const size_t kBaseCompactCapacity = 64;
+
+static const int kCompactMultiplier = 2;
+
+static TreeErrs_t CompactReserve(CompactTree *ct,
+                                 size_t       capacity);
+
+static CompactIdx_t CompactAddNode(CompactTree      *ct,
+                                   ExpressionType_t  type,
+                                   OpCode_t          op_code,
+                                   CompactIdx_t      left,
+                                   CompactIdx_t      right);
+
+static CompactIdx_t AddSubtree(CompactTree    *ct,
+                               const TreeNode *node);
+
+static bool IsCompactNum(const CompactTree *ct,
+                         CompactIdx_t       idx,
+                         NumType_t          val);
+
+static CompactIdx_t FoldNode(CompactTree  *ct,
+                             OpCode_t      op_code,
+                             CompactIdx_t  left,
+                             CompactIdx_t  right);
+
+//==============================================================================
+
+TreeErrs_t CompactCtor(CompactTree *ct)
+{
+    CHECK(ct);
+
+    memset(ct, 0, sizeof(CompactTree));
+
+    ct->root = kNoChild;
+
+    return CompactReserve(ct, kBaseCompactCapacity);
+}
+
+//==============================================================================
+
+TreeErrs_t CompactDtor(CompactTree *ct)
+{
+    CHECK(ct);
+
+    free(ct->kinds);
+    free(ct->left);
+    free(ct->right);
+    free(ct->vals);
+
+    memset(ct, 0, sizeof(CompactTree));
+
+    ct->root = kNoChild;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static TreeErrs_t CompactReserve(CompactTree *ct,
+                                 size_t       capacity)
+{
+    uint8_t      *kinds = (uint8_t *)      realloc(ct->kinds, capacity * sizeof(uint8_t));
+    CompactIdx_t *left  = (CompactIdx_t *) realloc(ct->left,  capacity * sizeof(CompactIdx_t));
+    CompactIdx_t *right = (CompactIdx_t *) realloc(ct->right, capacity * sizeof(CompactIdx_t));
+
+    if (kinds != nullptr) ct->kinds = kinds;
+    if (left  != nullptr) ct->left  = left;
+    if (right != nullptr) ct->right = right;
+
+    if (kinds == nullptr || left == nullptr || right == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    ct->capacity = capacity;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static CompactIdx_t CompactAddNode(CompactTree      *ct,
+                                   ExpressionType_t  type,
+                                   OpCode_t          op_code,
+                                   CompactIdx_t      left,
+                                   CompactIdx_t      right)
+{
+    if (ct->size >= ct->capacity)
+    {
+        if (CompactReserve(ct, ct->capacity * kCompactMultiplier) != kTreeSuccess)
+        {
+            return kNoChild;
+        }
+    }
+
+    CompactIdx_t idx = (CompactIdx_t) ct->size++;
+
+    ct->kinds[idx] = (uint8_t) ((type << 4) | (op_code & 0x0f));
+    ct->left[idx]  = left;
+    ct->right[idx] = right;
+
+    return idx;
+}
+
+//==============================================================================
+
+CompactIdx_t CompactAddOp(CompactTree  *ct,
+                          OpCode_t      op_code,
+                          CompactIdx_t  left,
+                          CompactIdx_t  right)
+{
+    CHECK(ct);
+
+    return CompactAddNode(ct, kOperator, op_code, left, right);
+}
+
+//==============================================================================
+
+CompactIdx_t CompactAddNum(CompactTree *ct,
+                           NumType_t    val)
+{
+    CHECK(ct);
+
+    CompactIdx_t halves[2] = {};
+
+    memcpy(halves, &val, sizeof(NumType_t));
+
+    return CompactAddNode(ct, kConstNumber, kNotAnOperation, halves[0], halves[1]);
+}
+
+//==============================================================================
+
+CompactIdx_t CompactAddVar(CompactTree *ct,
+                           size_t       var_pos)
+{
+    CHECK(ct);
+
+    return CompactAddNode(ct, kVariable, kNotAnOperation, (CompactIdx_t) var_pos, kNoChild);
+}
+
+//==============================================================================
+
+NumType_t CompactNum(const CompactTree *ct,
+                     CompactIdx_t       idx)
+{
+    CompactIdx_t halves[2] = {ct->left[idx], ct->right[idx]};
+
+    NumType_t val = 0;
+
+    memcpy(&val, halves, sizeof(NumType_t));
+
+    return val;
+}
+
+//==============================================================================
+
+TreeErrs_t CompactFromTree(CompactTree    *ct,
+                           const TreeNode *node)
+{
+    CHECK(ct);
+    CHECK(node);
+
+    ct->root = AddSubtree(ct, node);
+
+    return (ct->root == kNoChild) ? kFailedAllocation : kTreeSuccess;
+}
+
+//==============================================================================
+
+static CompactIdx_t AddSubtree(CompactTree    *ct,
+                               const TreeNode *node)
+{
+    if (node == nullptr)
+    {
+        return kNoChild;
+    }
+
+    if (node->type == kConstNumber)
+    {
+        return CompactAddNum(ct, node->data.const_val);
+    }
+
+    if (node->type == kVariable)
+    {
+        return CompactAddVar(ct, node->data.variable_pos);
+    }
+
+    CompactIdx_t left  = AddSubtree(ct, node->left);
+    CompactIdx_t right = AddSubtree(ct, node->right);
+
+    return CompactAddOp(ct, node->data.op_code, left, right);
+}
+
+//==============================================================================
+
+TreeNode *CompactToTree(const CompactTree *ct,
+                        CompactIdx_t       idx)
+{
+    CHECK(ct);
+
+    if (idx == kNoChild)
+    {
+        return nullptr;
+    }
+
+    switch (CompactType(ct->kinds[idx]))
+    {
+        case kConstNumber:
+        {
+            return NodeCtor(nullptr, nullptr, nullptr, kConstNumber, CompactNum(ct, idx));
+        }
+
+        case kVariable:
+        {
+            return NodeCtor(nullptr, nullptr, nullptr, kVariable, ct->left[idx]);
+        }
+
+        case kOperator:
+        {
+            TreeNode *left  = CompactToTree(ct, ct->left[idx]);
+            TreeNode *right = CompactToTree(ct, ct->right[idx]);
+
+            TreeNode *node = NodeCtor(nullptr, left, right, kOperator, CompactOp(ct->kinds[idx]));
+
+            if (left  != nullptr) left->parent  = node;
+            if (right != nullptr) right->parent = node;
+
+            return node;
+        }
+
+        case kRepVar:
+        default:
+        {
+            return nullptr;
+        }
+    }
+}
+
+//==============================================================================
+
+NumType_t CompactEval(CompactTree *ct,
+                      Variables   *vars)
+{
+    CHECK(ct);
+
+    if (ct->root == kNoChild)
+    {
+        return 0;
+    }
+
+    NumType_t *vals = (NumType_t *) realloc(ct->vals, ct->capacity * sizeof(NumType_t));
+
+    if (vals == nullptr)
+    {
+        return NAN;
+    }
+
+    ct->vals = vals;
+
+    for (size_t i = 0; i <= ct->root; i++)
+    {
+        uint8_t kind = ct->kinds[i];
+
+        switch (CompactType(kind))
+        {
+            case kConstNumber:
+            {
+                vals[i] = CompactNum(ct, (CompactIdx_t) i);
+
+                break;
+            }
+
+            case kVariable:
+            {
+                vals[i] = vars->var_array[ct->left[i]].value;
+
+                break;
+            }
+
+            case kOperator:
+            {
+                NumType_t left  = (ct->left[i]  == kNoChild) ? 0 : vals[ct->left[i]];
+                NumType_t right = (ct->right[i] == kNoChild) ? 0 : vals[ct->right[i]];
+
+                vals[i] = ApplyOp(CompactOp(kind), left, right);
+
+                break;
+            }
+
+            case kRepVar:
+            default:
+            {
+                vals[i] = NAN;
+
+                break;
+            }
+        }
+    }
+
+    return vals[ct->root];
+}
+
+//==============================================================================
+
+TreeErrs_t CompactDiff(CompactTree       *dst,
+                       const CompactTree *src,
+                       size_t             var_pos)
+{
+    CHECK(dst);
+    CHECK(src);
+    CHECK(dst != src);
+
+    #define NUM(val)        CompactAddNum(dst, val)
+    #define OP(op, lhs, rhs) CompactAddOp(dst, op, lhs, rhs)
+    #define ADD(lhs, rhs)   OP(kAdd,  lhs, rhs)
+    #define SUB(lhs, rhs)   OP(kSub,  lhs, rhs)
+    #define MULT(lhs, rhs)  OP(kMult, lhs, rhs)
+    #define DIV(lhs, rhs)   OP(kDiv,  lhs, rhs)
+    #define POW(lhs, rhs)   OP(kExp,  lhs, rhs)
+    #define SQRT(rhs)       OP(kSqrt, kNoChild, rhs)
+    #define SIN(rhs)        OP(kSin,  kNoChild, rhs)
+    #define COS(rhs)        OP(kCos,  kNoChild, rhs)
+    #define LN(rhs)         OP(kLn,   kNoChild, rhs)
+
+    dst->size = 0;
+
+    if (CompactReserve(dst, src->size * 4 + kBaseCompactCapacity) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    memcpy(dst->kinds, src->kinds, src->size * sizeof(uint8_t));
+    memcpy(dst->left,  src->left,  src->size * sizeof(CompactIdx_t));
+    memcpy(dst->right, src->right, src->size * sizeof(CompactIdx_t));
+
+    dst->size = src->size;
+
+    CompactIdx_t *diffs = (CompactIdx_t *) calloc(src->size, sizeof(CompactIdx_t));
+
+    if (diffs == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    for (size_t i = 0; i < src->size; i++)
+    {
+        uint8_t kind = src->kinds[i];
+
+        if (CompactType(kind) == kConstNumber)
+        {
+            diffs[i] = NUM(0);
+
+            continue;
+        }
+
+        if (CompactType(kind) == kVariable)
+        {
+            diffs[i] = NUM((src->left[i] == var_pos) ? 1 : 0);
+
+            continue;
+        }
+
+        CompactIdx_t node  = (CompactIdx_t) i;
+        CompactIdx_t left  = src->left[i];
+        CompactIdx_t right = src->right[i];
+
+        CompactIdx_t d_left  = (left  == kNoChild) ? kNoChild : diffs[left];
+        CompactIdx_t d_right = (right == kNoChild) ? kNoChild : diffs[right];
+
+        switch (CompactOp(kind))
+        {
+            case kAdd:
+            {
+                diffs[i] = ADD(d_left, d_right);
+
+                break;
+            }
+
+            case kSub:
+            {
+                diffs[i] = SUB(d_left, d_right);
+
+                break;
+            }
+
+            case kMult:
+            {
+                diffs[i] = ADD(MULT(d_left, right),
+                               MULT(left, d_right));
+
+                break;
+            }
+
+            case kDiv:
+            {
+                diffs[i] = DIV(SUB(MULT(d_left, right),
+                                   MULT(left, d_right)),
+                               POW(right, NUM(2)));
+
+                break;
+            }
+
+            case kSqrt:
+            {
+                diffs[i] = MULT(DIV(NUM(1),
+                                    MULT(NUM(2), node)),
+                                d_right);
+
+                break;
+            }
+
+            case kSin:
+            {
+                diffs[i] = MULT(COS(right), d_right);
+
+                break;
+            }
+
+            case kCos:
+            {
+                diffs[i] = MULT(MULT(NUM(-1), SIN(right)), d_right);
+
+                break;
+            }
+
+            case kTg:
+            {
+                diffs[i] = MULT(DIV(NUM(1),
+                                    POW(COS(right), NUM(2))),
+                                d_right);
+
+                break;
+            }
+
+            case kLn:
+            {
+                diffs[i] = MULT(DIV(NUM(1), right), d_right);
+
+                break;
+            }
+
+            case kExp:
+            {
+                if (CompactType(src->kinds[right]) == kConstNumber)
+                {
+                    NumType_t power = CompactNum(src, right);
+
+                    diffs[i] = MULT(MULT(NUM(power),
+                                         POW(left, NUM(power - 1))),
+                                    d_left);
+                }
+                else
+                {
+                    diffs[i] = MULT(node,
+                                    ADD(MULT(DIV(right, left), d_left),
+                                        MULT(d_right, LN(left))));
+                }
+
+                break;
+            }
+
+            case kNotAnOperation:
+            default:
+            {
+                printf("CompactDiff() don't know such derivative OPCODE : %d\n", CompactOp(kind));
+
+                diffs[i] = NUM(NAN);
+
+                break;
+            }
+        }
+    }
+
+    dst->root = (src->root == kNoChild) ? kNoChild : diffs[src->root];
+
+    free(diffs);
+
+    #undef NUM
+    #undef OP
+    #undef ADD
+    #undef SUB
+    #undef MULT
+    #undef DIV
+    #undef POW
+    #undef SQRT
+    #undef SIN
+    #undef COS
+    #undef LN
+
+    return (dst->size >= UINT32_MAX) ? kFailedAllocation : kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t CompactOptimize(CompactTree       *dst,
+                           const CompactTree *src)
+{
+    CHECK(dst);
+    CHECK(src);
+    CHECK(dst != src);
+
+    dst->size = 0;
+    dst->root = kNoChild;
+
+    if (src->root == kNoChild)
+    {
+        return kTreeSuccess;
+    }
+
+    CompactIdx_t *new_idx = (CompactIdx_t *) malloc((src->root + 1) * sizeof(CompactIdx_t));
+
+    if (new_idx == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    for (size_t i = 0; i <= src->root; i++)
+    {
+        new_idx[i] = kNoChild;
+    }
+
+    new_idx[src->root] = 0;
+
+    for (size_t i = src->root + 1; i-- > 0; )
+    {
+        if (new_idx[i] == kNoChild || CompactType(src->kinds[i]) != kOperator)
+        {
+            continue;
+        }
+
+        if (src->left[i]  != kNoChild) new_idx[src->left[i]]  = 0;
+        if (src->right[i] != kNoChild) new_idx[src->right[i]] = 0;
+    }
+
+    for (size_t i = 0; i <= src->root; i++)
+    {
+        if (new_idx[i] == kNoChild)
+        {
+            continue;
+        }
+
+        uint8_t kind = src->kinds[i];
+
+        if (CompactType(kind) != kOperator)
+        {
+            new_idx[i] = CompactAddNode(dst, CompactType(kind), CompactOp(kind), src->left[i], src->right[i]);
+
+            continue;
+        }
+
+        CompactIdx_t left  = (src->left[i]  == kNoChild) ? kNoChild : new_idx[src->left[i]];
+        CompactIdx_t right = (src->right[i] == kNoChild) ? kNoChild : new_idx[src->right[i]];
+
+        new_idx[i] = FoldNode(dst, CompactOp(kind), left, right);
+    }
+
+    dst->root = new_idx[src->root];
+
+    free(new_idx);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static bool IsCompactNum(const CompactTree *ct,
+                         CompactIdx_t       idx,
+                         NumType_t          val)
+{
+    return idx != kNoChild &&
+           CompactType(ct->kinds[idx]) == kConstNumber &&
+           IsNumEqual(CompactNum(ct, idx), val);
+}
+
+//------------------------------------------------------------------------------
+// Rules of OptimizeConstants() and OptimizeNeutralExpr(). Children are already
+// folded, so one bottom-up pass reaches the same fixpoint.
+
+static CompactIdx_t FoldNode(CompactTree  *ct,
+                             OpCode_t      op_code,
+                             CompactIdx_t  left,
+                             CompactIdx_t  right)
+{
+    if (left  != kNoChild && CompactType(ct->kinds[left])  == kConstNumber &&
+        right != kNoChild && CompactType(ct->kinds[right]) == kConstNumber)
+    {
+        return CompactAddNum(ct, ApplyOp(op_code, CompactNum(ct, left), CompactNum(ct, right)));
+    }
+
+    switch (op_code)
+    {
+        case kAdd:
+        {
+            if (IsCompactNum(ct, right, 0)) return left;
+            if (IsCompactNum(ct, left,  0)) return right;
+
+            break;
+        }
+
+        case kSub:
+        {
+            if (IsCompactNum(ct, right, 0)) return left;
+
+            break;
+        }
+
+        case kMult:
+        {
+            if (IsCompactNum(ct, left, 0) || IsCompactNum(ct, right, 0)) return CompactAddNum(ct, 0);
+
+            if (IsCompactNum(ct, left,  1)) return right;
+            if (IsCompactNum(ct, right, 1)) return left;
+
+            break;
+        }
+
+        case kDiv:
+        {
+            if (IsCompactNum(ct, left,  0)) return CompactAddNum(ct, 0);
+            if (IsCompactNum(ct, right, 1)) return left;
+
+            break;
+        }
+
+        case kExp:
+        {
+            if (IsCompactNum(ct, right, 0) || IsCompactNum(ct, left, 1)) return CompactAddNum(ct, 1);
+
+            if (IsCompactNum(ct, right, 1)) return left;
+
+            break;
+        }
+
+        case kSqrt:
+        case kSin:
+        case kCos:
+        case kTg:
+        case kLn:
+        case kNotAnOperation:
+        default:
+        {
+            break;
+        }
+    }
+
+    return CompactAddOp(ct, op_code, left, right);
+}
+
+//==============================================================================
+
+void CompactInFixPrint(const CompactTree *ct,
+                       Variables         *vars,
+                       CompactIdx_t       idx,
+                       FILE              *output_file)
+{
+    CHECK(ct);
+    CHECK(output_file);
+
+    if (idx == kNoChild)
+    {
+        return;
+    }
+
+    uint8_t kind = ct->kinds[idx];
+
+    if (CompactType(kind) == kConstNumber)
+    {
+        fprintf(output_file, "%lg ", CompactNum(ct, idx));
+
+        return;
+    }
+
+    if (CompactType(kind) == kVariable)
+    {
+        fprintf(output_file, "%s ", vars->var_array[ct->left[idx]].id);
+
+        return;
+    }
+
+    fprintf(output_file, "( ");
+
+    CompactInFixPrint(ct, vars, ct->left[idx], output_file);
+
+    fprintf(output_file, "%s ", OperationArray[CompactOp(kind)].op_str);
+
+    CompactInFixPrint(ct, vars, ct->right[idx], output_file);
+
+    fprintf(output_file, ") ");
+}
+
+//==============================================================================
+
+TreeErrs_t CompactLatexPrint(const CompactTree *ct,
+                             Variables         *vars,
+                             FILE              *latex_file)
+{
+    CHECK(ct);
+    CHECK(latex_file);
+
+    NodeArena print_arena = {};
+
+    NodeArena *prev_arena = NodeArenaSelect(&print_arena);
+
+    TreeNode *root = CompactToTree(ct, ct->root);
+
+    NodeArenaSelect(prev_arena);
+
+    if (root == nullptr && ct->root != kNoChild)
+    {
+        NodeArenaDtor(&print_arena);
+
+        return kFailedAllocation;
+    }
+
+    TreeErrs_t status = LatexPrintNode(nullptr, vars, root, latex_file);
+
+    NodeArenaDtor(&print_arena);
+
+    return status;
+}
+
+//==============================================================================
+
+size_t CompactBytes(const CompactTree *ct)
+{
+    CHECK(ct);
+
+    return ct->size * (sizeof(uint8_t) + 2 * sizeof(CompactIdx_t));
+}
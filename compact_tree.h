@@ -0,0 +1,94 @@
+#ifndef COMPACT_TREE_HEADER
+#define COMPACT_TREE_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trees.h"
+#include "parse.h"
+
+//! Tree stored as arrays in post-order: every child has a smaller index than
+//! its parent, so one forward sweep visits operands before operators.
+//! A node takes 9 bytes: packed type/opcode byte and two 32-bit child indices.
+//! Leaves keep their payload in the child slots (the two halves of a constant,
+//! or the variable position in left). Unary operators use right only.
+//! Subtrees may be referenced by several parents.
+
+typedef uint32_t CompactIdx_t;
+
+static const CompactIdx_t kNoChild = UINT32_MAX;
+
+struct CompactTree
+{
+    uint8_t      *kinds;
+    CompactIdx_t *left;
+    CompactIdx_t *right;
+
+    size_t size;
+    size_t capacity;
+
+    CompactIdx_t root;
+
+    NumType_t *vals; // scratch for CompactEval
+};
+
+inline ExpressionType_t CompactType(uint8_t kind)
+{
+    return (ExpressionType_t) (kind >> 4);
+}
+
+inline OpCode_t CompactOp(uint8_t kind)
+{
+    return (OpCode_t) (kind & 0x0f);
+}
+
+TreeErrs_t CompactCtor(CompactTree *ct);
+
+TreeErrs_t CompactDtor(CompactTree *ct);
+
+CompactIdx_t CompactAddOp(CompactTree  *ct,
+                          OpCode_t      op_code,
+                          CompactIdx_t  left,
+                          CompactIdx_t  right);
+
+CompactIdx_t CompactAddNum(CompactTree *ct,
+                           NumType_t    val);
+
+CompactIdx_t CompactAddVar(CompactTree *ct,
+                           size_t       var_pos);
+
+NumType_t CompactNum(const CompactTree *ct,
+                     CompactIdx_t       idx);
+
+TreeErrs_t CompactFromTree(CompactTree    *ct,
+                           const TreeNode *node);
+
+TreeNode *CompactToTree(const CompactTree *ct,
+                        CompactIdx_t       idx);
+
+NumType_t CompactEval(CompactTree *ct,
+                      Variables   *vars);
+
+//! Writes src followed by its derivative by the variable var_pos into dst.
+//! Derivative nodes refer to the copied nodes of src instead of copying them
+//! again.
+TreeErrs_t CompactDiff(CompactTree       *dst,
+                       const CompactTree *src,
+                       size_t             var_pos);
+
+//! Folds constants, drops neutral elements and unreachable nodes.
+TreeErrs_t CompactOptimize(CompactTree       *dst,
+                           const CompactTree *src);
+
+void CompactInFixPrint(const CompactTree *ct,
+                       Variables         *vars,
+                       CompactIdx_t       idx,
+                       FILE              *output_file);
+
+TreeErrs_t CompactLatexPrint(const CompactTree *ct,
+                             Variables         *vars,
+                             FILE              *latex_file);
+
+size_t CompactBytes(const CompactTree *ct);
+
+#endif
@@ -0,0 +1,702 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "dag.h"
+#include "diff.h"
+#include "debug/debug.h"
+
+static const size_t kBaseDagCapacity = 1024;
+
+static thread_local DagTable *curr_dag = nullptr;
+
+static size_t HashKey(ExpressionType_t  type,
+                      NodeData          data,
+                      const TreeNode   *left,
+                      const TreeNode   *right);
+
+static size_t HashPtr(const void *ptr);
+
+static bool IsConst(const TreeNode *node,
+                    NumType_t       val);
+
+static NumType_t DagEvalNode(DagTable       *dag,
+                             Variables      *vars,
+                             const TreeNode *node);
+
+static bool KeyEqual(const TreeNode   *node,
+                     ExpressionType_t  type,
+                     NodeData          data,
+                     const TreeNode   *left,
+                     const TreeNode   *right);
+
+static DagErrs_t DagRehash(DagTable *dag);
+
+static TreeNode *DagSeek(DagTable       *dag,
+                         const TreeNode *node);
+
+static TreeNode *DagFold(DagTable *dag,
+                         OpCode_t  op_code,
+                         TreeNode *left,
+                         TreeNode *right);
+
+static TreeNode *DagNum(DagTable *dag,
+                        NumType_t val);
+
+static DagMemoEntry *MemoSeek(DagMemo        *memo,
+                              const TreeNode *key);
+
+static DagMemoEntry *MemoInsert(DagMemo        *memo,
+                                const TreeNode *key);
+
+static void MemoClear(DagMemo *memo);
+
+static void DiffMemoSwitch(DagTable *dag,
+                           size_t    var_pos);
+
+static void MemoDtor(DagMemo *memo);
+
+//==============================================================================
+
+DagErrs_t DagCtor(DagTable *dag)
+{
+    CHECK(dag);
+
+    memset(dag, 0, sizeof(DagTable));
+
+    dag->buckets = (TreeNode **) calloc(kBaseDagCapacity, sizeof(TreeNode *));
+
+    if (dag->buckets == nullptr)
+    {
+        return kDagFailedAlloc;
+    }
+
+    dag->capacity = kBaseDagCapacity;
+
+    NodeArenaCtor(&dag->arena);
+
+    return kDagSuccess;
+}
+
+//==============================================================================
+
+DagErrs_t DagDtor(DagTable *dag)
+{
+    CHECK(dag);
+
+    if (curr_dag == dag)
+    {
+        curr_dag = nullptr;
+    }
+
+    free(dag->buckets);
+
+    MemoDtor(&dag->diff_memo);
+    MemoDtor(&dag->eval_memo);
+    MemoDtor(&dag->size_memo);
+
+    NodeArenaDtor(&dag->arena);
+
+    memset(dag, 0, sizeof(DagTable));
+
+    return kDagSuccess;
+}
+
+//==============================================================================
+
+DagTable *DagSelect(DagTable *dag)
+{
+    DagTable *prev_dag = curr_dag;
+
+    curr_dag = dag;
+
+    return prev_dag;
+}
+
+//==============================================================================
+
+DagTable *DagCurrent()
+{
+    return curr_dag;
+}
+
+//==============================================================================
+
+TreeNode *DagNodeCtor(DagTable         *dag,
+                      ExpressionType_t  type,
+                      NodeData          data,
+                      TreeNode         *left,
+                      TreeNode         *right)
+{
+    CHECK(dag);
+
+    if (type == kOperator)
+    {
+        TreeNode *folded = DagFold(dag, data.op_code, left, right);
+
+        if (folded != nullptr)
+        {
+            return folded;
+        }
+    }
+
+    size_t mask = dag->capacity - 1;
+    size_t pos  = HashKey(type, data, left, right) & mask;
+
+    while (dag->buckets[pos] != nullptr)
+    {
+        if (KeyEqual(dag->buckets[pos], type, data, left, right))
+        {
+            dag->hits++;
+
+            return dag->buckets[pos];
+        }
+
+        pos = (pos + 1) & mask;
+    }
+
+    dag->misses++;
+
+    NodeArena *prev_arena = NodeArenaSelect(&dag->arena);
+
+    TreeNode *node = NodeAlloc();
+
+    NodeArenaSelect(prev_arena);
+
+    if (node == nullptr)
+    {
+        return nullptr;
+    }
+
+    node->type  = type;
+    node->data  = data;
+    node->left  = left;
+    node->right = right;
+
+    node->deps = ((left  != nullptr) ? left->deps  : 0) |
+                 ((right != nullptr) ? right->deps : 0) |
+                 ((type == kVariable) ? VarDepsBit(data.variable_pos) : 0);
+
+    // folded by DagFold() on construction
+    node->dirty = false;
+
+    dag->buckets[pos] = node;
+    dag->size++;
+
+    if (dag->size * 2 > dag->capacity)
+    {
+        if (DagRehash(dag) != kDagSuccess)
+        {
+            return nullptr;
+        }
+    }
+
+    return node;
+}
+
+//==============================================================================
+
+TreeNode *DagImport(DagTable       *dag,
+                    const TreeNode *node)
+{
+    CHECK(dag);
+
+    if (node == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (DagOwns(dag, node))
+    {
+        return DagSeek(dag, node);
+    }
+
+    TreeNode *left  = DagImport(dag, node->left);
+    TreeNode *right = DagImport(dag, node->right);
+
+    return DagNodeCtor(dag, node->type, node->data, left, right);
+}
+
+//==============================================================================
+
+bool DagOwns(const DagTable *dag,
+             const TreeNode *node)
+{
+    return NodeOwner(node) == &dag->arena;
+}
+
+//==============================================================================
+
+TreeNode *DagFindDiff(DagTable       *dag,
+                      const TreeNode *node,
+                      size_t          var_pos)
+{
+    DiffMemoSwitch(dag, var_pos);
+
+    DagMemoEntry *entry = MemoSeek(&dag->diff_memo, node);
+
+    if (entry == nullptr)
+    {
+        dag->diff_misses++;
+
+        return nullptr;
+    }
+
+    dag->diff_hits++;
+
+    return entry->node;
+}
+
+//==============================================================================
+
+DagErrs_t DagAddDiff(DagTable       *dag,
+                     const TreeNode *node,
+                     size_t          var_pos,
+                     TreeNode       *diff)
+{
+    DiffMemoSwitch(dag, var_pos);
+
+    DagMemoEntry *entry = MemoInsert(&dag->diff_memo, node);
+
+    if (entry == nullptr)
+    {
+        return kDagFailedAlloc;
+    }
+
+    entry->node = diff;
+
+    return kDagSuccess;
+}
+
+//==============================================================================
+
+static NumType_t DagEvalNode(DagTable       *dag,
+                             Variables      *vars,
+                             const TreeNode *node)
+{
+    if (node == nullptr || node->type != kOperator)
+    {
+        return Eval(vars, node);
+    }
+
+    DagMemoEntry *entry = MemoSeek(&dag->eval_memo, node);
+
+    if (entry != nullptr)
+    {
+        return entry->val;
+    }
+
+    NumType_t left  = DagEvalNode(dag, vars, node->left);
+    NumType_t right = DagEvalNode(dag, vars, node->right);
+
+    NumType_t val = ApplyOp(node->data.op_code, left, right);
+
+    entry = MemoInsert(&dag->eval_memo, node);
+
+    if (entry != nullptr)
+    {
+        entry->val = val;
+    }
+
+    return val;
+}
+
+//==============================================================================
+
+NumType_t DagEval(DagTable       *dag,
+                  Variables      *vars,
+                  const TreeNode *node)
+{
+    CHECK(dag);
+
+    MemoClear(&dag->eval_memo);
+
+    return DagEvalNode(dag, vars, node);
+}
+
+//==============================================================================
+
+size_t DagTreeSize(DagTable       *dag,
+                   const TreeNode *node)
+{
+    CHECK(dag);
+
+    if (node == nullptr)
+    {
+        return 0;
+    }
+
+    if (node->left == nullptr && node->right == nullptr)
+    {
+        return 1;
+    }
+
+    DagMemoEntry *entry = MemoSeek(&dag->size_memo, node);
+
+    if (entry != nullptr)
+    {
+        return entry->count;
+    }
+
+    size_t left_size  = DagTreeSize(dag, node->left);
+    size_t right_size = DagTreeSize(dag, node->right);
+
+    size_t size = SIZE_MAX;
+
+    if (left_size < SIZE_MAX / 2 && right_size < SIZE_MAX / 2)
+    {
+        size = left_size + right_size + 1;
+    }
+
+    entry = MemoInsert(&dag->size_memo, node);
+
+    if (entry != nullptr)
+    {
+        entry->count = size;
+    }
+
+    return size;
+}
+
+//==============================================================================
+
+void DagDump(const DagTable *dag,
+             FILE           *output_file)
+{
+    CHECK(dag);
+    CHECK(output_file);
+
+    fprintf(output_file, "dag[%p]:\n"
+                         "\tunique nodes : %zu\n"
+                         "\ttable hits   : %zu\n"
+                         "\ttable misses : %zu\n"
+                         "\tderivatives  : %zu\n"
+                         "\tdiff hits    : %zu\n"
+                         "\tdiff misses  : %zu\n",
+                         dag,
+                         dag->size,
+                         dag->hits,
+                         dag->misses,
+                         dag->diff_memo.size,
+                         dag->diff_hits,
+                         dag->diff_misses);
+
+    NodeArenaDump(&dag->arena, "dag nodes", output_file);
+}
+
+//==============================================================================
+
+static TreeNode *DagNum(DagTable *dag,
+                        NumType_t val)
+{
+    NodeData data = {};
+
+    data.const_val = val;
+
+    return DagNodeCtor(dag, kConstNumber, data, nullptr, nullptr);
+}
+
+//==============================================================================
+
+static bool IsConst(const TreeNode *node,
+                    NumType_t       val)
+{
+    return node != nullptr && node->type == kConstNumber && IsNumEqual(node->data.const_val, val);
+}
+
+//------------------------------------------------------------------------------
+// Same rewrites OptimizeNeutralExpr() and OptimizeConstants() do, applied
+// before the node exists since shared nodes can't be rewritten in place.
+
+static TreeNode *DagFold(DagTable *dag,
+                         OpCode_t  op_code,
+                         TreeNode *left,
+                         TreeNode *right)
+{
+    if (left  != nullptr && left->type  == kConstNumber &&
+        right != nullptr && right->type == kConstNumber)
+    {
+        return DagNum(dag, ApplyOp(op_code, left->data.const_val, right->data.const_val));
+    }
+
+    switch (op_code)
+    {
+        case kAdd:
+        {
+            if (IsConst(right, 0)) return left;
+            if (IsConst(left,  0)) return right;
+
+            break;
+        }
+
+        case kSub:
+        {
+            if (IsConst(right, 0)) return left;
+
+            break;
+        }
+
+        case kMult:
+        {
+            if (IsConst(left, 0) || IsConst(right, 0)) return DagNum(dag, 0);
+
+            if (IsConst(left,  1)) return right;
+            if (IsConst(right, 1)) return left;
+
+            break;
+        }
+
+        case kDiv:
+        {
+            if (IsConst(left,  0)) return DagNum(dag, 0);
+            if (IsConst(right, 1)) return left;
+
+            break;
+        }
+
+        case kExp:
+        {
+            if (IsConst(right, 0) || IsConst(left, 1)) return DagNum(dag, 1);
+
+            if (IsConst(right, 1)) return left;
+
+            break;
+        }
+
+        case kSqrt:
+        case kSin:
+        case kCos:
+        case kTg:
+        case kLn:
+        case kNotAnOperation:
+        default:
+        {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+//==============================================================================
+
+static size_t HashPtr(const void *ptr)
+{
+    uint64_t val = (uint64_t) (uintptr_t) ptr;
+
+    val ^= val >> 33;
+    val *= 0xff51afd7ed558ccdULL;
+    val ^= val >> 33;
+
+    return (size_t) val;
+}
+
+//==============================================================================
+
+static size_t HashKey(ExpressionType_t  type,
+                      NodeData          data,
+                      const TreeNode   *left,
+                      const TreeNode   *right)
+{
+    uint64_t data_bits = 0;
+
+    memcpy(&data_bits, &data, sizeof(data_bits));
+
+    size_t hash = HashPtr((const void *) (uintptr_t) (data_bits + (uint64_t) type));
+
+    hash = hash * 31 + HashPtr(left);
+    hash = hash * 31 + HashPtr(right);
+
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+// The table's own pointer to a node it owns, every one of them is in buckets.
+
+static TreeNode *DagSeek(DagTable       *dag,
+                         const TreeNode *node)
+{
+    size_t mask = dag->capacity - 1;
+    size_t pos  = HashKey(node->type, node->data, node->left, node->right) & mask;
+
+    while (dag->buckets[pos] != node)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return dag->buckets[pos];
+}
+
+//==============================================================================
+
+static bool KeyEqual(const TreeNode   *node,
+                     ExpressionType_t  type,
+                     NodeData          data,
+                     const TreeNode   *left,
+                     const TreeNode   *right)
+{
+    return node->type  == type &&
+           node->left  == left &&
+           node->right == right &&
+           memcmp(&node->data, &data, sizeof(NodeData)) == 0;
+}
+
+//==============================================================================
+
+static DagErrs_t DagRehash(DagTable *dag)
+{
+    size_t new_capacity = dag->capacity * 2;
+
+    TreeNode **new_buckets = (TreeNode **) calloc(new_capacity, sizeof(TreeNode *));
+
+    if (new_buckets == nullptr)
+    {
+        return kDagFailedAlloc;
+    }
+
+    size_t mask = new_capacity - 1;
+
+    for (size_t i = 0; i < dag->capacity; i++)
+    {
+        TreeNode *node = dag->buckets[i];
+
+        if (node == nullptr)
+        {
+            continue;
+        }
+
+        size_t pos = HashKey(node->type, node->data, node->left, node->right) & mask;
+
+        while (new_buckets[pos] != nullptr)
+        {
+            pos = (pos + 1) & mask;
+        }
+
+        new_buckets[pos] = node;
+    }
+
+    free(dag->buckets);
+
+    dag->buckets  = new_buckets;
+    dag->capacity = new_capacity;
+
+    return kDagSuccess;
+}
+
+//==============================================================================
+
+static DagMemoEntry *MemoSeek(DagMemo        *memo,
+                              const TreeNode *key)
+{
+    if (memo->capacity == 0)
+    {
+        return nullptr;
+    }
+
+    size_t mask = memo->capacity - 1;
+    size_t pos  = HashPtr(key) & mask;
+
+    while (memo->entries[pos].key != nullptr)
+    {
+        if (memo->entries[pos].key == key)
+        {
+            return &memo->entries[pos];
+        }
+
+        pos = (pos + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+//==============================================================================
+
+static DagMemoEntry *MemoInsert(DagMemo        *memo,
+                                const TreeNode *key)
+{
+    if ((memo->size + 1) * 2 > memo->capacity)
+    {
+        size_t new_capacity = (memo->capacity == 0) ? kBaseDagCapacity : memo->capacity * 2;
+
+        DagMemoEntry *new_entries = (DagMemoEntry *) calloc(new_capacity, sizeof(DagMemoEntry));
+
+        if (new_entries == nullptr)
+        {
+            return nullptr;
+        }
+
+        for (size_t i = 0; i < memo->capacity; i++)
+        {
+            if (memo->entries[i].key == nullptr)
+            {
+                continue;
+            }
+
+            size_t pos = HashPtr(memo->entries[i].key) & (new_capacity - 1);
+
+            while (new_entries[pos].key != nullptr)
+            {
+                pos = (pos + 1) & (new_capacity - 1);
+            }
+
+            new_entries[pos] = memo->entries[i];
+        }
+
+        free(memo->entries);
+
+        memo->entries  = new_entries;
+        memo->capacity = new_capacity;
+    }
+
+    size_t mask = memo->capacity - 1;
+    size_t pos  = HashPtr(key) & mask;
+
+    while (memo->entries[pos].key != nullptr && memo->entries[pos].key != key)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    if (memo->entries[pos].key == nullptr)
+    {
+        memo->entries[pos].key = key;
+        memo->size++;
+    }
+
+    return &memo->entries[pos];
+}
+
+//==============================================================================
+
+static void MemoClear(DagMemo *memo)
+{
+    if (memo->entries != nullptr)
+    {
+        memset(memo->entries, 0, memo->capacity * sizeof(DagMemoEntry));
+    }
+
+    memo->size = 0;
+}
+
+//==============================================================================
+
+static void DiffMemoSwitch(DagTable *dag,
+                           size_t    var_pos)
+{
+    if (dag->diff_var != var_pos)
+    {
+        MemoClear(&dag->diff_memo);
+
+        dag->diff_var = var_pos;
+    }
+}
+
+//==============================================================================
+
+static void MemoDtor(DagMemo *memo)
+{
+    free(memo->entries);
+
+    memo->entries  = nullptr;
+    memo->capacity = 0;
+    memo->size     = 0;
+}
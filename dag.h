@@ -0,0 +1,106 @@
+#ifndef DAG_HEADER
+#define DAG_HEADER
+
+#include "trees.h"
+#include "parse.h"
+
+//! Hash-consed node storage. While a DagTable is selected, NodeCtor() returns
+//! the single shared node for every (type, data, left, right) key, CopyNode()
+//! shares instead of copying and DiffTree() memoizes derivatives per node.
+//! Shared nodes have no meaningful parent and must never be passed to
+//! TreeDtor() or OptimizeTree(): all of them are released by DagDtor().
+
+typedef enum
+{
+    kDagSuccess,
+    kDagFailedAlloc,
+} DagErrs_t;
+
+struct DagMemoEntry
+{
+    const TreeNode *key;
+
+    union
+    {
+        TreeNode  *node;
+        NumType_t  val;
+        size_t     count;
+    };
+};
+
+struct DagMemo
+{
+    DagMemoEntry *entries;
+
+    size_t capacity;
+    size_t size;
+};
+
+struct DagTable
+{
+    TreeNode **buckets;
+
+    size_t capacity;
+    size_t size;
+
+    NodeArena arena;
+
+    DagMemo diff_memo; // derivatives by the variable at diff_var
+    size_t  diff_var;
+    DagMemo eval_memo;
+    DagMemo size_memo;
+
+    size_t hits;
+    size_t misses;
+
+    size_t diff_hits;
+    size_t diff_misses;
+};
+
+DagErrs_t DagCtor(DagTable *dag);
+
+DagErrs_t DagDtor(DagTable *dag);
+
+//! Makes dag current for the calling thread, returns the previous one.
+//! nullptr switches back to ordinary trees.
+DagTable *DagSelect(DagTable *dag);
+
+DagTable *DagCurrent();
+
+TreeNode *DagNodeCtor(DagTable         *dag,
+                      ExpressionType_t  type,
+                      NodeData          data,
+                      TreeNode         *left,
+                      TreeNode         *right);
+
+//! Returns the shared node equal to the tree, interning it when needed.
+TreeNode *DagImport(DagTable       *dag,
+                    const TreeNode *node);
+
+bool DagOwns(const DagTable *dag,
+             const TreeNode *node);
+
+//! Derivatives by one variable are memoized at a time, asking for another
+//! var_pos forgets the previous ones.
+TreeNode *DagFindDiff(DagTable       *dag,
+                      const TreeNode *node,
+                      size_t          var_pos);
+
+DagErrs_t DagAddDiff(DagTable       *dag,
+                     const TreeNode *node,
+                     size_t          var_pos,
+                     TreeNode       *diff);
+
+//! Eval() that visits every shared node once.
+NumType_t DagEval(DagTable       *dag,
+                  Variables      *vars,
+                  const TreeNode *node);
+
+//! Node count of the tree the shared node expands to, saturated at SIZE_MAX.
+size_t DagTreeSize(DagTable       *dag,
+                   const TreeNode *node);
+
+void DagDump(const DagTable *dag,
+             FILE           *output_file);
+
+#endif
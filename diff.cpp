@@ -7,6 +7,26 @@
 #include "debug/debug.h"
 #include "parse.h"
 #include "tree_dump.h"
+#include "dag.h"
+#include "work_stack.h"
+#include "bytecode.h"
+#include "diff_memo.h"
+#include "rules.h"
+#include "canon.h"
+#include "egraph.h"
+#include "poly.h"
+
+static const size_t kMaxRulePasses = 8;
+
+// Chains of * with fewer factors of the variable keep the binary rule, the
+// product split in halves is only smaller from four on.
+static const size_t kMinSplitFactors = 4;
+
+struct Bounds
+{
+    NumType_t lo;
+    NumType_t hi;
+};
 
 static bool IsValZero( const TreeNode *node);
 static bool IsValOne(  const TreeNode *node);
@@ -15,6 +35,72 @@ static bool IsVariable(const TreeNode *node);
 
 static TreeErrs_t ReconnectTree(TreeNode **dest, TreeNode *src);
 
+static TreeNode *DiffRule(const TreeNode *node,
+                          size_t          var_pos,
+                          TreeNode       *d_left,
+                          TreeNode       *d_right);
+
+static void DropNode(TreeNode *node);
+
+static TreeNode *SimplifyOp(OpCode_t  op_code,
+                            TreeNode *left,
+                            TreeNode *right);
+
+static TreeNode *MultByCopy(TreeNode       *diff,
+                            const TreeNode *factor,
+                            bool            diff_first);
+
+static TreeErrs_t CollectFactors(const TreeNode *node,
+                                 WorkStack      *factors);
+
+static bool IsLongProduct(const TreeNode *node,
+                          size_t          var_pos);
+
+static TreeNode *DiffProduct(const TreeNode *node,
+                             size_t          var_pos,
+                             WorkStack      *results);
+
+static TreeNode *DiffFactors(const WorkStack *factors,
+                             const WorkStack *d_factors,
+                             size_t           begin,
+                             size_t           end);
+
+static TreeNode *CopyFactors(const WorkStack *factors,
+                             size_t           begin,
+                             size_t           end);
+
+static Bounds BoundsOf(const TreeNode *node);
+
+static Bounds BoundsRule(OpCode_t op_code,
+                         Bounds   left,
+                         Bounds   right);
+
+static Bounds BoundsMult(Bounds left,
+                         Bounds right);
+
+static Bounds BoundsIntPow(Bounds    base,
+                           NumType_t exp);
+
+static Bounds BoundsRecip(Bounds bounds);
+
+static TreeErrs_t SimplifyDirty(TreeNode *root,
+                                RuleSet  *rules,
+                                bool     *changed);
+
+static bool SimplifyNode(TreeNode **node,
+                         RuleSet   *rules);
+
+static void SetClean(TreeNode *node);
+
+static bool IsDirtyOp(const TreeNode *node);
+
+static Dual DualRule(const TreeNode *node,
+                     Dual            left,
+                     Dual            right);
+
+static NumType_t DualTerm(NumType_t der,
+                          NumType_t factor);
+
 OpCode_t SeekOperator(const char *op_str)
 {
     CHECK(op_str);
@@ -69,197 +155,1215 @@ DiffErrs_t SetUpData(TreeNode   *node,
         return kDiffSuccess;
     }
 
-    if (SetNumber(node, str) != kNotANumber)
-    {
-        node->type = kConstNumber;
+    if (SetNumber(node, str) != kNotANumber)
+    {
+        node->type = kConstNumber;
+
+        return kDiffSuccess;
+    }
+
+    printf(">> SetUpData() unknown op_code. str = %s\n", str);
+
+    return kSyntaxError;
+}
+
+//==============================================================================
+
+NumType_t Eval(Variables      *vars,
+               const TreeNode *node)
+{
+    static const int kEvalEnter = 0;
+    static const int kEvalApply = 1;
+
+    WorkStack frames = {};
+    WorkStack values = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&values);
+
+    WorkPushNode(&frames, node, kEvalEnter);
+
+    while (frames.size > 0)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        if (frame.state == kEvalApply)
+        {
+            NumType_t right = WorkPop(&values).val.num;
+            NumType_t left  = WorkPop(&values).val.num;
+
+            WorkPushNum(&values, ApplyOp(curr->data.op_code, left, right));
+
+            continue;
+        }
+
+        if (curr == nullptr)
+        {
+            WorkPushNum(&values, 0);
+        }
+        else if (curr->type == kConstNumber)
+        {
+            WorkPushNum(&values, curr->data.const_val);
+        }
+        else if (curr->type == kVariable)
+        {
+            WorkPushNum(&values, vars->var_array[curr->data.variable_pos].value);
+        }
+        else if (WorkPushNode(&frames, curr,        kEvalApply) != kTreeSuccess ||
+                 WorkPushNode(&frames, curr->right, kEvalEnter) != kTreeSuccess ||
+                 WorkPushNode(&frames, curr->left,  kEvalEnter) != kTreeSuccess)
+        {
+            WorkStackDtor(&frames);
+            WorkStackDtor(&values);
+
+            return NAN;
+        }
+    }
+
+    NumType_t val = (values.size > 0) ? WorkPop(&values).val.num : NAN;
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&values);
+
+    return val;
+}
+
+//==============================================================================
+
+Dual EvalDual(Variables      *vars,
+              const TreeNode *node,
+              size_t          var_pos)
+{
+    static const int kDualEnter = 0;
+    static const int kDualApply = 1;
+
+    WorkStack frames = {};
+    WorkStack values = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&values);
+
+    WorkPushNode(&frames, node, kDualEnter);
+
+    // values holds val and der of every finished operand, der on top
+
+    while (frames.size > 0)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        if (frame.state == kDualApply)
+        {
+            Dual right = {};
+            Dual left  = {};
+
+            right.der = WorkPop(&values).val.num;
+            right.val = WorkPop(&values).val.num;
+            left.der  = WorkPop(&values).val.num;
+            left.val  = WorkPop(&values).val.num;
+
+            Dual res = DualRule(curr, left, right);
+
+            WorkPushNum(&values, res.val);
+            WorkPushNum(&values, res.der);
+
+            continue;
+        }
+
+        if (curr == nullptr)
+        {
+            WorkPushNum(&values, 0);
+            WorkPushNum(&values, 0);
+        }
+        else if (curr->type == kConstNumber)
+        {
+            WorkPushNum(&values, curr->data.const_val);
+            WorkPushNum(&values, 0);
+        }
+        else if (curr->type == kVariable)
+        {
+            WorkPushNum(&values, vars->var_array[curr->data.variable_pos].value);
+            WorkPushNum(&values, (curr->data.variable_pos == var_pos) ? 1 : 0);
+        }
+        else if (WorkPushNode(&frames, curr,        kDualApply) != kTreeSuccess ||
+                 WorkPushNode(&frames, curr->right, kDualEnter) != kTreeSuccess ||
+                 WorkPushNode(&frames, curr->left,  kDualEnter) != kTreeSuccess)
+        {
+            WorkStackDtor(&frames);
+            WorkStackDtor(&values);
+
+            return {NAN, NAN};
+        }
+    }
+
+    Dual res = {NAN, NAN};
+
+    if (values.size == 2)
+    {
+        res.der = WorkPop(&values).val.num;
+        res.val = WorkPop(&values).val.num;
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&values);
+
+    return res;
+}
+
+//------------------------------------------------------------------------------
+// Same formulas as DiffRule(), so EvalDual() agrees with Eval() of DiffTree().
+// A zero derivative of an operand drops its whole term like MULT_CTOR() folds
+// e * 0, so nan or inf in the other factors of the term does not leak in.
+
+static Dual DualRule(const TreeNode *node,
+                     Dual            left,
+                     Dual            right)
+{
+    OpCode_t op_code = node->data.op_code;
+
+    Dual res = {ApplyOp(op_code, left.val, right.val), NAN};
+
+    switch (op_code)
+    {
+        case kAdd:
+        {
+            res.der = left.der + right.der;
+
+            break;
+        }
+
+        case kSub:
+        {
+            res.der = left.der - right.der;
+
+            break;
+        }
+
+        case kMult:
+        {
+            res.der = DualTerm(left.der, right.val) + DualTerm(right.der, left.val);
+
+            break;
+        }
+
+        case kDiv:
+        {
+            NumType_t num = DualTerm(left.der, right.val) - DualTerm(right.der, left.val);
+
+            res.der = IsNumEqual(num, 0) ? 0 : ApplyOp(kDiv, num, pow(right.val, 2));
+
+            break;
+        }
+
+        case kSqrt:
+        {
+            res.der = DualTerm(right.der, ApplyOp(kDiv, 1, 2 * res.val));
+
+            break;
+        }
+
+        case kCos:
+        {
+            res.der = DualTerm(right.der, -1 * sin(right.val));
+
+            break;
+        }
+
+        case kSin:
+        {
+            res.der = DualTerm(right.der, cos(right.val));
+
+            break;
+        }
+
+        case kTg:
+        {
+            res.der = DualTerm(right.der, ApplyOp(kDiv, 1, pow(cos(right.val), 2)));
+
+            break;
+        }
+
+        case kLn:
+        {
+            res.der = DualTerm(right.der, ApplyOp(kDiv, 1, right.val));
+
+            break;
+        }
+
+        case kExp:
+        {
+            if (IsNumber(node->right) && !IsValZero(node->right))
+            {
+                res.der = DualTerm(left.der, right.val * pow(left.val, right.val - 1));
+
+                break;
+            }
+
+            res.der = DualTerm(DualTerm(left.der,  ApplyOp(kDiv, right.val, left.val)) +
+                               DualTerm(right.der, log(left.val)), res.val);
+
+            break;
+        }
+
+        case kNotAnOperation:
+        default:
+        {
+            break;
+        }
+    }
+
+    return res;
+}
+
+//------------------------------------------------------------------------------
+
+static NumType_t DualTerm(NumType_t der,
+                          NumType_t factor)
+{
+    return IsNumEqual(der, 0) ? 0 : der * factor;
+}
+
+//==============================================================================
+
+TreeErrs_t EvalBatch(const Variables        *vars,
+                     const TreeNode         *node,
+                     const NumType_t *const *var_values,
+                     size_t                  point_count,
+                     NumType_t              *out)
+{
+    CHECK(vars);
+    CHECK(node);
+    CHECK(out);
+
+    BcProgram prog = {};
+
+    TreeErrs_t status = BcCtor(&prog);
+
+    if (status == kTreeSuccess)
+    {
+        status = BcCompile(&prog, node);
+    }
+
+    if (status == kTreeSuccess)
+    {
+        status = BcEvalBatch(&prog, vars, var_values, point_count, out);
+    }
+
+    BcDtor(&prog);
+
+    return status;
+}
+
+//==============================================================================
+
+NumType_t ApplyOp(OpCode_t  op_code,
+                  NumType_t left,
+                  NumType_t right)
+{
+    switch (op_code)
+    {
+        case kAdd:
+        {
+            return left + right;
+        }
+
+        case kSub:
+        {
+            return left - right;
+        }
+
+        case kMult:
+        {
+            return left * right;
+        }
+
+        case kDiv:
+        {
+            if (right != 0)
+            {
+                return left / right;
+            }
+            else
+            {
+                return NAN;
+            }
+        }
+
+        case kSqrt:
+        {
+            return sqrt(right);
+        }
+
+        case kSin:
+        {
+            return sin(right);
+        }
+
+        case kCos:
+        {
+            return cos(right);
+        }
+
+        case kTg:
+        {
+            return tan(right);
+        }
+
+        case kExp:
+        {
+            return pow(left, right);
+        }
+
+        case kLn:
+        {
+            return log(right);
+        }
+
+        case kNotAnOperation:
+        default:
+        {
+            printf("ApplyOp() got unknown op_code.");
+
+            break;
+        }
+    }
+
+    return NAN;
+}
+
+//==============================================================================
+
+#define NUM_CTOR(num)          NodeCtor(nullptr, nullptr, nullptr, kConstNumber, num)
+#define VAR_CTOR(val)          NodeCtor(nullptr, nullptr, nullptr, kVariable, val)
+
+#define ADD_CTOR(left, right)  OpCtor(kAdd,  left, right)
+#define SUB_CTOR(left, right)  OpCtor(kSub,  left, right)
+#define DIV_CTOR(left, right)  OpCtor(kDiv,  left, right)
+#define MULT_CTOR(left, right) OpCtor(kMult, left, right)
+#define SQRT_CTOR(right)       OpCtor(kSqrt, nullptr, right)
+#define SIN_CTOR(right)        OpCtor(kSin,  nullptr, right)
+#define COS_CTOR(right)        OpCtor(kCos,  nullptr, right)
+#define TG_CTOR(right)         OpCtor(kTg,   nullptr, right)
+#define LN_CTOR(right)         OpCtor(kLn,   nullptr, right)
+#define POW_CTOR(left, right)  OpCtor(kExp,  left, right)
+
+#define C(node) CopyNode(node, nullptr)
+
+TreeNode *OpCtor(OpCode_t  op_code,
+                 TreeNode *left,
+                 TreeNode *right)
+{
+    TreeNode *node = SimplifyOp(op_code, left, right);
+
+    if (node != nullptr)
+    {
+        return node;
+    }
+
+    return NodeCtor(nullptr, left, right, kOperator, op_code);
+}
+
+//------------------------------------------------------------------------------
+// Result of a rule that applies to op_code on these operands or nullptr, then
+// nothing is changed. On success the operands belong to the result, the ones
+// it does not use are destroyed. Unary ops are left as they are, so sin(2)
+// is still printed as sin(2).
+
+static TreeNode *SimplifyOp(OpCode_t  op_code,
+                            TreeNode *left,
+                            TreeNode *right)
+{
+    if (left == nullptr || right == nullptr)
+    {
+        return nullptr;
+    }
+
+    TreeNode *kept = nullptr;
+
+    if (IsNumber(left) && IsNumber(right))
+    {
+        NumType_t val = ApplyOp(op_code, left->data.const_val, right->data.const_val);
+
+        // 1/0 stays in the tree to be seen
+        if (isnan(val))
+        {
+            return nullptr;
+        }
+
+        kept = NUM_CTOR(val);
+    }
+    else
+    {
+        switch (op_code)
+        {
+            case kAdd:
+            {
+                kept = IsValZero(left)  ? right :
+                       IsValZero(right) ? left  : nullptr;
+
+                break;
+            }
+
+            case kSub:
+            {
+                kept = IsValZero(right) ? left : nullptr;
+
+                break;
+            }
+
+            case kMult:
+            {
+                kept = IsValZero(left)  ? left  :
+                       IsValZero(right) ? right :
+                       IsValOne(left)   ? right :
+                       IsValOne(right)  ? left  : nullptr;
+
+                break;
+            }
+
+            case kDiv:
+            {
+                kept = IsValZero(left) ? left :
+                       IsValOne(right) ? left : nullptr;
+
+                break;
+            }
+
+            case kExp:
+            {
+                kept = IsValZero(right) ? NUM_CTOR(1) :
+                       IsValOne(left)   ? left        :
+                       IsValOne(right)  ? left        : nullptr;
+
+                break;
+            }
+
+            // unary ops stay as they are, see above
+            case kSqrt:
+            case kSin:
+            case kCos:
+            case kTg:
+            case kLn:
+            case kNotAnOperation:
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    if (kept == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (kept != left)
+    {
+        DropNode(left);
+    }
+
+    if (kept != right)
+    {
+        DropNode(right);
+    }
+
+    return kept;
+}
+
+//------------------------------------------------------------------------------
+// diff * factor (or factor * diff) without copying factor when diff is zero.
+
+static TreeNode *MultByCopy(TreeNode       *diff,
+                            const TreeNode *factor,
+                            bool            diff_first)
+{
+    if (diff != nullptr && IsValZero(diff))
+    {
+        return diff;
+    }
+
+    return diff_first ? MULT_CTOR(diff, C(factor)) : MULT_CTOR(C(factor), diff);
+}
+
+//------------------------------------------------------------------------------
+// Operands of the chain of * that starts at node, left to right.
+
+static TreeErrs_t CollectFactors(const TreeNode *node,
+                                 WorkStack      *factors)
+{
+    WorkStack pending = {};
+
+    WorkStackCtor(&pending);
+
+    TreeErrs_t status = WorkPushNode(&pending, node, 0);
+
+    while (status == kTreeSuccess && pending.size > 0)
+    {
+        const TreeNode *curr = WorkPop(&pending).val.const_node;
+
+        if (curr->type == kOperator && curr->data.op_code == kMult)
+        {
+            if ((status = WorkPushNode(&pending, curr->right, 0)) == kTreeSuccess)
+            {
+                status = WorkPushNode(&pending, curr->left, 0);
+            }
+        }
+        else
+        {
+            status = WorkPushNode(factors, curr, 0);
+        }
+    }
+
+    WorkStackDtor(&pending);
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+// True if the chain of * at node has at least kMinSplitFactors factors of the
+// variable.
+
+static bool IsLongProduct(const TreeNode *node,
+                          size_t          var_pos)
+{
+    if (node->type != kOperator || node->data.op_code != kMult)
+    {
+        return false;
+    }
+
+    WorkStack factors = {};
+
+    WorkStackCtor(&factors);
+
+    size_t count = 0;
+
+    if (CollectFactors(node, &factors) == kTreeSuccess)
+    {
+        for (size_t i = 0; i < factors.size && count < kMinSplitFactors; i++)
+        {
+            count += (factors.data[i].val.const_node->deps & VarDepsBit(var_pos)) != 0;
+        }
+    }
+
+    WorkStackDtor(&factors);
+
+    return count >= kMinSplitFactors;
+}
+
+//------------------------------------------------------------------------------
+// Derivative of the chain of * at node by DiffFactors(). The derivatives of
+// the factors of the variable are on top of results, the leftmost one on top.
+
+static TreeNode *DiffProduct(const TreeNode *node,
+                             size_t          var_pos,
+                             WorkStack      *results)
+{
+    WorkStack factors   = {};
+    WorkStack d_factors = {};
+
+    WorkStackCtor(&factors);
+    WorkStackCtor(&d_factors);
+
+    TreeErrs_t status = CollectFactors(node, &factors);
+
+    for (size_t i = 0; i < factors.size && status == kTreeSuccess; i++)
+    {
+        const TreeNode *factor = factors.data[i].val.const_node;
+
+        TreeNode *d_factor = ((factor->deps & VarDepsBit(var_pos)) != 0) ? WorkPop(results).val.node : nullptr;
+
+        status = WorkPushNode(&d_factors, d_factor, 0);
+    }
+
+    TreeNode *diff = (status == kTreeSuccess) ? DiffFactors(&factors, &d_factors, 0, factors.size) : nullptr;
+
+    WorkStackDtor(&factors);
+    WorkStackDtor(&d_factors);
+
+    return diff;
+}
+
+//------------------------------------------------------------------------------
+// (L * R)' = L' * R + L * R' with L and R the halves of the factors from
+// begin to end. Every level copies each factor at most once, so the result
+// has O(n log n) nodes where the binary rule on a chain copies O(n^2), and
+// unlike f' / f terms it holds where factors are zero. Uses up the
+// derivatives, nullptr ones are zero.
+
+static TreeNode *DiffFactors(const WorkStack *factors,
+                             const WorkStack *d_factors,
+                             size_t           begin,
+                             size_t           end)
+{
+    if (end - begin == 1)
+    {
+        TreeNode *d_factor = d_factors->data[begin].val.node;
+
+        return (d_factor != nullptr) ? d_factor : NUM_CTOR(0);
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+
+    TreeNode *d_left  = DiffFactors(factors, d_factors, begin, mid);
+    TreeNode *d_right = DiffFactors(factors, d_factors, mid,   end);
+
+    if (!IsValZero(d_left))
+    {
+        d_left = MULT_CTOR(d_left, CopyFactors(factors, mid, end));
+    }
+
+    if (!IsValZero(d_right))
+    {
+        d_right = MULT_CTOR(CopyFactors(factors, begin, mid), d_right);
+    }
+
+    return ADD_CTOR(d_left, d_right);
+}
+
+//------------------------------------------------------------------------------
+
+static TreeNode *CopyFactors(const WorkStack *factors,
+                             size_t           begin,
+                             size_t           end)
+{
+    TreeNode *prod = C(factors->data[begin].val.const_node);
+
+    for (size_t i = begin + 1; i < end; i++)
+    {
+        prod = MULT_CTOR(prod, C(factors->data[i].val.const_node));
+    }
+
+    return prod;
+}
+
+//==============================================================================
+
+bool IsAwayFromZero(const TreeNode *node)
+{
+    Bounds bounds = BoundsOf(node);
+
+    return bounds.lo > 0 || bounds.hi < 0;
+}
+
+//==============================================================================
+
+bool IsAboveZero(const TreeNode *node)
+{
+    return BoundsOf(node).lo > 0;
+}
+
+//------------------------------------------------------------------------------
+// Interval of values node can take for any values of the variables, a
+// variable may be anything. Unknown bounds are (-inf, inf).
+
+static Bounds BoundsOf(const TreeNode *node)
+{
+    static const int kBoundsEnter = 0;
+    static const int kBoundsApply = 1;
+
+    WorkStack frames = {};
+    WorkStack bounds = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&bounds);
+
+    TreeErrs_t status = WorkPushNode(&frames, node, kBoundsEnter);
+
+    while (status == kTreeSuccess && frames.size > 0)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        Bounds res = {-INFINITY, INFINITY};
+
+        if (frame.state == kBoundsApply)
+        {
+            Bounds right = {};
+            Bounds left  = {};
+
+            right.hi = WorkPop(&bounds).val.num;
+            right.lo = WorkPop(&bounds).val.num;
+
+            if (curr->left != nullptr)
+            {
+                left.hi = WorkPop(&bounds).val.num;
+                left.lo = WorkPop(&bounds).val.num;
+            }
+
+            res = BoundsRule(curr->data.op_code, left, right);
+        }
+        else if (curr->type == kConstNumber)
+        {
+            res.lo = res.hi = curr->data.const_val;
+        }
+        else if (curr->type == kOperator)
+        {
+            if ((status = WorkPushNode(&frames, curr, kBoundsApply)) == kTreeSuccess &&
+                (status = WorkPushNode(&frames, curr->right, kBoundsEnter)) == kTreeSuccess &&
+                curr->left != nullptr)
+            {
+                status = WorkPushNode(&frames, curr->left, kBoundsEnter);
+            }
+
+            continue;
+        }
+
+        if (isnan(res.lo) || isnan(res.hi))
+        {
+            res = {-INFINITY, INFINITY};
+        }
+
+        if ((status = WorkPushNum(&bounds, res.lo)) == kTreeSuccess)
+        {
+            status = WorkPushNum(&bounds, res.hi);
+        }
+    }
+
+    Bounds res = {-INFINITY, INFINITY};
+
+    if (status == kTreeSuccess && bounds.size == 2)
+    {
+        res.hi = WorkPop(&bounds).val.num;
+        res.lo = WorkPop(&bounds).val.num;
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&bounds);
+
+    return res;
+}
+
+//------------------------------------------------------------------------------
+// Same cases as ApplyOp(), unary ops use right. Operands known exactly are
+// folded by ApplyOp() itself.
+
+static Bounds BoundsRule(OpCode_t op_code,
+                         Bounds   left,
+                         Bounds   right)
+{
+    static const Bounds kUnknown = {-INFINITY, INFINITY};
+
+    if ((IsUnaryOp(op_code) || IsNumEqual(left.lo, left.hi)) && IsNumEqual(right.lo, right.hi))
+    {
+        NumType_t val = ApplyOp(op_code, left.lo, right.lo);
+
+        return {val, val};
+    }
+
+    switch (op_code)
+    {
+        case kAdd:
+        {
+            return {left.lo + right.lo, left.hi + right.hi};
+        }
+
+        case kSub:
+        {
+            return {left.lo - right.hi, left.hi - right.lo};
+        }
+
+        case kMult:
+        {
+            return BoundsMult(left, right);
+        }
+
+        case kDiv:
+        {
+            return BoundsMult(left, BoundsRecip(right));
+        }
+
+        case kSqrt:
+        {
+            if (right.hi >= 0)
+            {
+                return {sqrt(fmax(right.lo, 0)), sqrt(right.hi)};
+            }
+
+            return kUnknown;
+        }
+
+        case kSin:
+        case kCos:
+        {
+            return {-1, 1};
+        }
+
+        case kLn:
+        {
+            if (right.lo > 0)
+            {
+                return {log(right.lo), log(right.hi)};
+            }
+
+            return kUnknown;
+        }
+
+        case kExp:
+        {
+            if (IsNumEqual(right.lo, right.hi) && IsNumEqual(right.lo, floor(right.lo)))
+            {
+                return BoundsIntPow(left, right.lo);
+            }
+
+            if (left.lo > 0)
+            {
+                // monotone in each operand, a^b > 0 even where its bound is 0
+
+                NumType_t corners[] = {pow(left.lo, right.lo), pow(left.lo, right.hi),
+                                       pow(left.hi, right.lo), pow(left.hi, right.hi)};
+
+                Bounds res = {corners[0], corners[0]};
+
+                for (size_t i = 1; i < sizeof(corners) / sizeof(corners[0]); i++)
+                {
+                    res.lo = fmin(res.lo, corners[i]);
+                    res.hi = fmax(res.hi, corners[i]);
+                }
+
+                res.lo = fmax(res.lo, nextafter((NumType_t) 0, (NumType_t) 1));
+
+                return res;
+            }
+
+            return kUnknown;
+        }
+
+        case kTg:
+        case kNotAnOperation:
+        default:
+        {
+            return kUnknown;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// 0 * inf is 0 here: the infinite bound is never reached.
+
+static Bounds BoundsMult(Bounds left,
+                         Bounds right)
+{
+    NumType_t corners[] = {left.lo * right.lo, left.lo * right.hi,
+                           left.hi * right.lo, left.hi * right.hi};
+
+    Bounds res = {INFINITY, -INFINITY};
+
+    for (size_t i = 0; i < sizeof(corners) / sizeof(corners[0]); i++)
+    {
+        NumType_t corner = isnan(corners[i]) ? 0 : corners[i];
+
+        res.lo = fmin(res.lo, corner);
+        res.hi = fmax(res.hi, corner);
+    }
+
+    return res;
+}
+
+//------------------------------------------------------------------------------
+
+static Bounds BoundsIntPow(Bounds    base,
+                           NumType_t exp)
+{
+    if (IsNumEqual(exp, 0))
+    {
+        return {1, 1};
+    }
+
+    NumType_t abs_exp = fabs(exp);
+    NumType_t pow_lo  = pow(base.lo, abs_exp);
+    NumType_t pow_hi  = pow(base.hi, abs_exp);
+
+    Bounds res = {};
+
+    if (!IsNumEqual(fmod(abs_exp, 2), 0) || base.lo >= 0)
+    {
+        res = {pow_lo, pow_hi};
+    }
+    else if (base.hi <= 0)
+    {
+        res = {pow_hi, pow_lo};
+    }
+    else
+    {
+        res = {0, fmax(pow_lo, pow_hi)};
+    }
+
+    if (exp > 0)
+    {
+        return res;
+    }
+
+    return BoundsRecip(res);
+}
+
+//------------------------------------------------------------------------------
+// 1 / bounds keeps its sign strictly, 1 / inf is still not 0.
+
+static Bounds BoundsRecip(Bounds bounds)
+{
+    NumType_t tiny = nextafter((NumType_t) 0, (NumType_t) 1);
+
+    if (bounds.lo > 0)
+    {
+        return {fmax(1 / bounds.hi, tiny), 1 / bounds.lo};
+    }
+
+    if (bounds.hi < 0)
+    {
+        return {1 / bounds.hi, fmin(1 / bounds.lo, -tiny)};
+    }
+
+    return {-INFINITY, INFINITY};
+}
+
+//==============================================================================
+
+//------------------------------------------------------------------------------
+// Derivatives of the operands are built by DiffTree() before the operator
+// itself and passed in as d_left and d_right.
+
+TreeNode *DiffTree(const TreeNode *node,
+                   size_t          var_pos,
+                   TreeNode       *parent_node)
+{
+    static const int kDiffEnter     = 0;
+    static const int kDiffCombine   = 1;
+    static const int kDiffEnterTree = 2; // below a rational subtree left as a tree
+    static const int kDiffProduct   = 3; // chain of * split in halves
+
+    CHECK(node);
+
+    DagTable *dag  = DagCurrent();
+    DiffMemo *memo = (dag == nullptr) ? DiffMemoCurrent() : nullptr;
+
+    // a DagTable already shares equal subtrees, its own memo is enough
+
+    if (memo != nullptr && DiffMemoBegin(memo, node) != kTreeSuccess)
+    {
+        memo = nullptr;
+    }
+
+    // PolyDiffNode() is asked on every operator on the way down, without
+    // shapes (out of memory) the dense path is just not taken
+
+    RatShapes shapes = {};
+
+    RatShapesCtor(&shapes, node);
+
+    WorkStack frames  = {};
+    WorkStack results = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&results);
+
+    WorkPushNode(&frames, node, kDiffEnter);
+
+    while (frames.size > 0)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        TreeNode *diff   = nullptr;
+        bool      is_rat = false;
+
+        if (frame.state == kDiffEnter || frame.state == kDiffEnterTree)
+        {
+            if (dag != nullptr && (diff = DagFindDiff(dag, curr, var_pos)) != nullptr)
+            {
+                if (WorkPushNode(&results, diff, 0) != kTreeSuccess)
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            if ((curr->deps & VarDepsBit(var_pos)) == 0)
+            {
+                // no target variable below, nothing to differentiate
+                diff = NUM_CTOR(0);
+            }
+            else if (memo != nullptr && (diff = DiffMemoFind(memo, curr)) != nullptr)
+            {
+                if (WorkPushNode(&results, C(diff), 0) != kTreeSuccess)
+                {
+                    break;
+                }
+
+                continue;
+            }
+            else if (curr->type != kOperator)
+            {
+                diff = DiffRule(curr, var_pos, nullptr, nullptr);
+            }
+            else if (frame.state == kDiffEnterTree || (diff = PolyDiffNode(curr, var_pos, &shapes, &is_rat)) == nullptr)
+            {
+                // no dense form, operands go first
+
+                int enter = is_rat ? kDiffEnterTree : frame.state;
 
-        return kDiffSuccess;
-    }
+                bool chain_top = (curr == node || curr->parent == nullptr ||
+                                  curr->parent->type != kOperator || curr->parent->data.op_code != kMult);
 
-    printf(">> SetUpData() unknown op_code. str = %s\n", str);
+                if (dag == nullptr && chain_top && IsLongProduct(curr, var_pos))
+                {
+                    // copies of the other factors in every term of the binary
+                    // rule make a chain of n factors O(n^2), only factors of
+                    // the variable go first here, see DiffProduct(). With a
+                    // DagTable the binary rule shares the prefix products of
+                    // the chain and stays O(n)
 
-    return kSyntaxError;
-}
+                    WorkStack factors = {};
 
-//==============================================================================
+                    WorkStackCtor(&factors);
 
-NumType_t Eval(Variables      *vars,
-               const TreeNode *node)
-{
-    if (node == nullptr)
-    {
-        return 0;
-    }
+                    bool pushed = (CollectFactors(curr, &factors)                  == kTreeSuccess &&
+                                   WorkPushNode(&frames, curr, kDiffProduct) == kTreeSuccess);
 
-    if (node->type == kConstNumber)
-    {
-        return node->data.const_val;
-    }
+                    for (size_t i = 0; pushed && i < factors.size; i++)
+                    {
+                        const TreeNode *factor = factors.data[i].val.const_node;
 
-    if (node->type == kVariable)
-    {
-        return vars->var_array[node->data.variable_pos].value;
-    }
+                        pushed = (factor->deps & VarDepsBit(var_pos)) == 0 ||
+                                 WorkPushNode(&frames, factor, enter) == kTreeSuccess;
+                    }
 
-    NumType_t left  = Eval(vars, node->left);
-    NumType_t right = Eval(vars, node->right);
+                    WorkStackDtor(&factors);
 
-    switch (node->data.op_code)
-    {
-        case kAdd:
-        {
-            return left + right;
-        }
+                    if (!pushed)
+                    {
+                        break;
+                    }
 
-        case kSub:
-        {
-            return left - right;
-        }
+                    continue;
+                }
 
-        case kMult:
-        {
-            return left * right;
-        }
+                if (WorkPushNode(&frames, curr, kDiffCombine) != kTreeSuccess ||
+                    (curr->right != nullptr && WorkPushNode(&frames, curr->right, enter) != kTreeSuccess) ||
+                    (curr->left  != nullptr && WorkPushNode(&frames, curr->left,  enter) != kTreeSuccess))
+                {
+                    break;
+                }
 
-        case kDiv:
-        {
-            if (right != 0)
-            {
-                return left / right;
+                continue;
             }
-            else
-            {
-                return NAN;
-            }
-        }
-
-        case kSqrt:
-        {
-            return sqrt(right);
         }
-
-        case kSin:
+        else if (frame.state == kDiffProduct)
         {
-            return sin(right);
+            diff = DiffProduct(curr, var_pos, &results);
         }
-
-        case kCos:
+        else
         {
-            return cos(right);
-        }
+            TreeNode *d_right = (curr->right != nullptr) ? WorkPop(&results).val.node : nullptr;
+            TreeNode *d_left  = (curr->left  != nullptr) ? WorkPop(&results).val.node : nullptr;
 
-        case kTg:
-        {
-            return tan(right);
+            diff = DiffRule(curr, var_pos, d_left, d_right);
         }
 
-        case kExp:
+        if (dag != nullptr)
         {
-            return pow(left, right);
+            DagAddDiff(dag, curr, var_pos, diff);
         }
-
-        case kLn:
+        else if (memo != nullptr)
         {
-            return log(right);
+            DiffMemoAdd(memo, curr, diff);
         }
 
-        default:
+        if (WorkPushNode(&results, diff, 0) != kTreeSuccess)
         {
-            printf("Eval() got unknown op_code.");
-
             break;
         }
     }
 
-    return NAN;
-}
+    TreeNode *diff = (frames.size == 0 && results.size == 1) ? WorkPop(&results).val.node : nullptr;
 
-//==============================================================================
+    WorkStackDtor(&frames);
+    WorkStackDtor(&results);
 
-TreeNode *DiffTree(const TreeNode *node,
-                   TreeNode       *parent_node)
-{
-    #define NUM_CTOR(num)          NodeCtor(nullptr, nullptr, nullptr, kConstNumber, num)
-    #define VAR_CTOR(val)          NodeCtor(nullptr, nullptr, nullptr, kVariable, val)
+    RatShapesDtor(&shapes);
 
-    #define ADD_CTOR(left, right)  NodeCtor(nullptr, left, right, kOperator, kAdd)
-    #define SUB_CTOR(left, right)  NodeCtor(nullptr, left, right, kOperator, kSub)
-    #define DIV_CTOR(left, right)  NodeCtor(nullptr, left, right, kOperator, kDiv)
-    #define MULT_CTOR(left, right) NodeCtor(nullptr, left, right, kOperator, kMult)
-    #define SQRT_CTOR(right)       NodeCtor(nullptr, nullptr, right, kOperator, kSqrt)
-    #define SIN_CTOR(right)        NodeCtor(nullptr, nullptr, right, kOperator, kSin)
-    #define COS_CTOR(right)        NodeCtor(nullptr, nullptr, right, kOperator, kCos)
-    #define TG_CTOR(right)         NodeCtor(nullptr, nullptr, right, kOperator, kTg)
-    #define LN_CTOR(right)         NodeCtor(nullptr, nullptr, right, kOperator, kLn)
-    #define POW_CTOR(left, right)  NodeCtor(nullptr, left, right, kOperator, kExp)
+    if (memo != nullptr)
+    {
+        DiffMemoEnd(memo);
+    }
+
+    if (diff != nullptr && dag == nullptr)
+    {
+        diff->parent = parent_node;
+    }
 
-    #define D(node) DiffTree(node, nullptr)
-    #define C(node) CopyNode(node, nullptr)
+    return diff;
+}
 
-    CHECK(node);
+//==============================================================================
 
+static TreeNode *DiffRule(const TreeNode *node,
+                          size_t          var_pos,
+                          TreeNode       *d_left,
+                          TreeNode       *d_right)
+{
     if (node->type == kConstNumber)
     {
-        return NodeCtor(parent_node, nullptr, nullptr, kConstNumber, 0);
+        return NUM_CTOR(0);
     }
 
     if (node->type == kVariable)
     {
-        return NodeCtor(parent_node, nullptr, nullptr, kConstNumber, 1);
+        return NUM_CTOR((node->data.variable_pos == var_pos) ? 1 : 0);
     }
 
     switch (node->data.op_code)
     {
         case kAdd:
         {
-            return ADD_CTOR(D(node->left),
-                            D(node->right));
-
-            break;
+            return ADD_CTOR(d_left,
+                            d_right);
         }
 
         case kSub:
         {
-            return SUB_CTOR(D(node->left),
-                            D(node->right));
-
-            break;
+            return SUB_CTOR(d_left,
+                            d_right);
         }
 
         case kMult:
         {
-                return ADD_CTOR(MULT_CTOR(D(node->left),
-                                          C(node->right)),
-                                MULT_CTOR(C(node->left),
-                                          D(node->right)));
-
-            break;
+            return ADD_CTOR(MultByCopy(d_left,  node->right, true),
+                            MultByCopy(d_right, node->left,  false));
         }
 
         case kDiv:
         {
-            return DIV_CTOR(SUB_CTOR(MULT_CTOR(D(node->left),
-                                               C(node->right)),
-                                     MULT_CTOR(C(node->left),
-                                               D(node->right))),
+            return DIV_CTOR(SUB_CTOR(MultByCopy(d_left,  node->right, true),
+                                     MultByCopy(d_right, node->left,  false)),
                             POW_CTOR(C(node->right),
                                      NUM_CTOR(2)));
+        }
 
-            break;
-
+        case kSqrt:
+        {
+            return MULT_CTOR(DIV_CTOR(NUM_CTOR(1),
+                                      MULT_CTOR(NUM_CTOR(2),
+                                                C(node))),
+                             d_right);
         }
 
         case kCos:
         {
             return MULT_CTOR(MULT_CTOR(NUM_CTOR(-1),
                                        SIN_CTOR(C(node->right))),
-                             D(node->right));
+                             d_right);
         }
 
         case kSin:
         {
             return MULT_CTOR(COS_CTOR(C(node->right)),
-                             D(node->right));
+                             d_right);
         }
 
         case kTg:
@@ -267,44 +1371,48 @@ TreeNode *DiffTree(const TreeNode *node,
             return MULT_CTOR(DIV_CTOR(NUM_CTOR(1),
                                       POW_CTOR(COS_CTOR(C(node->right)),
                                                NUM_CTOR(2))),
-                             D(node->right));
+                             d_right);
         }
 
         case kLn:
         {
             return MULT_CTOR(DIV_CTOR(NUM_CTOR(1),
                                       C(node->right)),
-                             D(node->right));
+                             d_right);
         }
 
         case kExp:
         {
-            if (!IsValZero(node->right))
+            if (IsNumber(node->right) && !IsValZero(node->right))
             {
-                if (IsNumber(node->right))
+                NumType_t power = node->right->data.const_val;
+
+                DropNode(d_right);
+
+                if (IsVariable(node->left) && node->left->data.variable_pos == var_pos)
                 {
-                    if (IsVariable(node->left))
-                    {
-                        return MULT_CTOR(NUM_CTOR(node->right->data.const_val),
-                                         POW_CTOR(VAR_CTOR(0),
-                                                  NUM_CTOR(node->right->data.const_val - 1)));
-                    }
-                    else
-                    {
-                        return MULT_CTOR(POW_CTOR(C(node->left),
-                                         NUM_CTOR(node->right->data.const_val - 1)), D(node->left));
-                    }
+                    DropNode(d_left);
+
+                    return MULT_CTOR(NUM_CTOR(power),
+                                     POW_CTOR(C(node->left),
+                                              NUM_CTOR(power - 1)));
                 }
+
+                return MULT_CTOR(MULT_CTOR(NUM_CTOR(power),
+                                           POW_CTOR(C(node->left),
+                                                    NUM_CTOR(power - 1))),
+                                 d_left);
             }
 
             return MULT_CTOR(C(node),
                              ADD_CTOR(MULT_CTOR(DIV_CTOR(C(node->right),
                                                          C(node->left)),
-                                                D(node->left)),
-                                      MULT_CTOR(D(node->right),
+                                                d_left),
+                                      MULT_CTOR(d_right,
                                                 LN_CTOR(C(node->left)))));
         }
 
+        case kNotAnOperation:
         default:
         {
             printf("Diff() don't know such derivative OPCODE : %d, TYPE: %d\n", node->data.op_code, node->type);
@@ -313,11 +1421,24 @@ TreeNode *DiffTree(const TreeNode *node,
         }
     }
 
+    DropNode(d_left);
+    DropNode(d_right);
+
     return nullptr;
 }
 
 //==============================================================================
 
+static void DropNode(TreeNode *node)
+{
+    if (DagCurrent() == nullptr)
+    {
+        TreeDtor(node);
+    }
+}
+
+//==============================================================================
+
 TreeErrs_t OptimizeConstants(Variables *vars,
                              Tree      *tree,
                              TreeNode **node)
@@ -335,9 +1456,7 @@ TreeErrs_t OptimizeConstants(Variables *vars,
 
             NumType_t val = Eval(vars, *node);
 
-            TreeDtor(*node);
-
-            *node = NUM_CTOR(val);
+            ReconnectTree(node, NUM_CTOR(val));
 
             return kTreeOptimized;
         }
@@ -370,157 +1489,257 @@ TreeErrs_t OptimizeNeutralExpr(Tree      *tree,
 {
     if ((*node)->type == kConstNumber || (*node)->type == kVariable)
     {
-        return kTreeSuccess;;
+        return kTreeNotOptimized;
     }
 
-    switch ((*node)->data.op_code)
+    // same rules as the constructors, see SimplifyOp()
+
+    TreeNode *simple = SimplifyOp((*node)->data.op_code, (*node)->left, (*node)->right);
+
+    if (simple != nullptr)
     {
-        case kAdd:
-        {
-            if (IsValZero((*node)->right))
-            {
-                ReconnectTree(node, C((*node)->left));
+        // the operands are used or already destroyed by SimplifyOp()
+        (*node)->left  = nullptr;
+        (*node)->right = nullptr;
 
-                return kTreeOptimized;
-            }
-            if (IsValZero((*node)->left))
-            {
-                ReconnectTree(node, C((*node)->right));
+        ReconnectTree(node, simple);
 
-                return kTreeOptimized;
-            }
+        return kTreeOptimized;
+    }
 
-            break;
+    if ((*node)->left != nullptr)
+    {
+        if (OptimizeNeutralExpr(tree, &(*node)->left) == kTreeOptimized)
+        {
+            return kTreeOptimized;
         }
+    }
 
-        case kSub:
+    if ((*node)->right != nullptr)
+    {
+        if (OptimizeNeutralExpr(tree, &(*node)->right) == kTreeOptimized)
         {
-            if (IsValZero((*node)->right))
-            {
-                ReconnectTree(node, C((*node)->left));
+            return kTreeOptimized;
+        }
+    }
 
-                return kTreeOptimized;
-            }
+    return kTreeNotOptimized;
+}
+
+//==============================================================================
+
+TreeErrs_t OptimizeTree(Tree *tree)
+{
+    TreeErrs_t status = SimplifyTree(tree);
+
+    if (status == kTreeSuccess)
+    {
+        status = PolyTree(tree);
+    }
+
+    if (status == kTreeSuccess)
+    {
+        status = CanonTree(tree);
+    }
+
+    if (status == kTreeSuccess && EGraphCurrent() != nullptr)
+    {
+        status = EGraphSimplify(EGraphCurrent(), tree);
+    }
+
+    GRAPH_DUMP_TREE(tree);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeErrs_t SimplifyTree(Tree *tree)
+{
+    CHECK(tree);
+
+    if (tree->root == nullptr)
+    {
+        return kTreeSuccess;
+    }
+
+    RuleSet *rules = RuleSetCurrent();
+
+    TreeErrs_t status  = kTreeSuccess;
+    bool       changed = false;
 
+    // a rule may turn the root into new operators, they are swept again
+
+    for (size_t pass = 0; status == kTreeSuccess; pass++)
+    {
+        if ((status = SimplifyDirty(tree->root, rules, &changed)) != kTreeSuccess)
+        {
             break;
         }
 
-        case kMult:
+        SetClean(tree->root);
+
+        changed |= SimplifyNode(&tree->root, (pass < kMaxRulePasses) ? rules : nullptr);
+
+        if (!IsDirtyOp(tree->root))
         {
-            if (IsValZero((*node)->left) || IsValZero((*node)->right))
-            {
-                ReconnectTree(node, NUM_CTOR(0));
+            break;
+        }
+    }
 
-                return kTreeOptimized;
-            }
+    SetClean(tree->root);
 
-            if (IsValOne((*node)->left))
-            {
-                ReconnectTree(node, C((*node)->right));
+    if (changed)
+    {
+        tree->status = kNotChanged;
+    }
 
-                return kTreeOptimized;
-            }
+    return status;
+}
 
-            if (IsValOne((*node)->right))
-            {
-                ReconnectTree(node, C((*node)->left));
+//------------------------------------------------------------------------------
+// A node is rewritten when its parent is left, the children of the parent's
+// children are final by then. Clean subtrees are not entered. When a rule
+// replaces a child with new operators, the child is swept and the parent
+// left again, rules are tried there at most kMaxRulePasses times.
 
-                return kTreeOptimized;
-            }
+static TreeErrs_t SimplifyDirty(TreeNode *root,
+                                RuleSet  *rules,
+                                bool     *changed)
+{
+    static const int kSimplifyEnter    = 0;
+    static const int kSimplifyChildren = 1; // + number of passes done
 
-            break;
-        }
+    WorkStack frames = {};
+    WorkStackCtor(&frames);
 
-        case kDiv:
+    TreeErrs_t status = WorkPushNode(&frames, root, kSimplifyEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        TreeNode *curr = frame.val.node;
+
+        if (frame.state == kSimplifyEnter)
         {
-            if (IsValZero((*node)->left))
+            if (!curr->dirty || curr->type != kOperator)
             {
-                ReconnectTree(node, NUM_CTOR(0));
-
-                return kTreeOptimized;
+                continue;
             }
 
-            if (IsValOne((*node)->right))
+            if ((status = WorkPushNode(&frames, curr, kSimplifyChildren)) != kTreeSuccess ||
+                (curr->right != nullptr && (status = WorkPushNode(&frames, curr->right, kSimplifyEnter)) != kTreeSuccess) ||
+                (curr->left  != nullptr && (status = WorkPushNode(&frames, curr->left,  kSimplifyEnter)) != kTreeSuccess))
             {
-                ReconnectTree(node, C((*node)->left));
-
-                return kTreeOptimized;
+                break;
             }
 
-            break;
+            continue;
         }
 
-        case kExp:
+        size_t   pass       = (size_t) (frame.state - kSimplifyChildren);
+        RuleSet *node_rules = (pass < kMaxRulePasses) ? rules : nullptr;
+
+        TreeNode **children[] = {&curr->left, &curr->right};
+
+        bool rewritten = false;
+
+        for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); i++)
         {
-            if (IsValZero((*node)->right))
-            {
-                ReconnectTree(node, NUM_CTOR(1));
+            SetClean(*children[i]);
 
-                return kTreeOptimized;
-            }
+            *changed |= SimplifyNode(children[i], node_rules);
 
-            if (IsValOne((*node)->left))
+            if (IsDirtyOp(*children[i]))
             {
-                ReconnectTree(node, NUM_CTOR(1));
-
-                return kTreeOptimized;
+                rewritten = true;
             }
-
-            if (IsValOne((*node)->right))
+            else
             {
-                ReconnectTree(node, C((*node)->left));
-
-                return kTreeOptimized;
+                SetClean(*children[i]);
             }
+        }
 
-            break;
+        if (!rewritten)
+        {
+            continue;
         }
-    }
 
-    if ((*node)->left != nullptr)
-    {
-        if (OptimizeNeutralExpr(tree, &(*node)->left) == kTreeOptimized)
+        if ((status = WorkPushNode(&frames, curr, frame.state + 1)) != kTreeSuccess)
         {
-            return kTreeOptimized;
+            break;
         }
-    }
 
-    if ((*node)->right != nullptr)
-    {
-        if (OptimizeNeutralExpr(tree, &(*node)->right) == kTreeOptimized)
+        for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); i++)
         {
-            return kTreeOptimized;
+            if (IsDirtyOp(*children[i]) &&
+                (status = WorkPushNode(&frames, *children[i], kSimplifyEnter)) != kTreeSuccess)
+            {
+                break;
+            }
         }
     }
 
-    return kTreeNotOptimized;
+    WorkStackDtor(&frames);
+
+    return status;
 }
 
-//==============================================================================
+//------------------------------------------------------------------------------
+// Rules of OptimizeNeutralExpr() and OptimizeConstants() on *node alone, then
+// the rules of the RuleSet. Its operands are already simplified and the result
+// of the first ones is one of them or a number, so one check per node is
+// enough. A rule builds new operators, they are left dirty.
 
-TreeErrs_t OptimizeTree(Variables *vars,
-                        Tree *tree)
+static bool SimplifyNode(TreeNode **node,
+                         RuleSet   *rules)
 {
-    while (true)
+    if (*node == nullptr || (*node)->type != kOperator)
     {
+        return false;
+    }
 
-        TreeErrs_t status_1 = OptimizeNeutralExpr(tree, &tree->root);
-        //GRAPH_DUMP_TREE(tree);
+    TreeNode *left  = (*node)->left;
+    TreeNode *right = (*node)->right;
 
-        TreeErrs_t status_2 = OptimizeConstants(vars, tree, &tree->root);
-        //GRAPH_DUMP_TREE(tree);
+    TreeNode *simple = SimplifyOp((*node)->data.op_code, left, right);
 
-        if (status_1 == kTreeNotOptimized && status_2 == kTreeNotOptimized)
-        {
-            break;
-        }
+    if (simple != nullptr)
+    {
+        (*node)->left  = nullptr;
+        (*node)->right = nullptr;
+    }
+    else if (left != nullptr && right != nullptr && IsNumber(left) && IsNumber(right))
+    {
+        // 1/0 is kept by the constructors, but OptimizeConstants() folds it
+        simple = NUM_CTOR(ApplyOp((*node)->data.op_code, left->data.const_val, right->data.const_val));
+    }
+    else if ((simple = RuleRewrite(rules, *node)) == nullptr)
+    {
+        return false;
+    }
 
-        tree->status = kNotChanged;
+    ReconnectTree(node, simple);
+
+    return true;
+}
+
+//==============================================================================
+
+static void SetClean(TreeNode *node)
+{
+    if (node != nullptr)
+    {
+        node->dirty = false;
     }
+}
 
-    GRAPH_DUMP_TREE(tree);
+//==============================================================================
 
-    return kTreeSuccess;
+static bool IsDirtyOp(const TreeNode *node)
+{
+    return node != nullptr && node->dirty && node->type == kOperator;
 }
 
 //==============================================================================
@@ -566,10 +1785,14 @@ static bool IsNumber(const TreeNode *node)
 
 static TreeErrs_t ReconnectTree(TreeNode **dest, TreeNode *src)
 {
+    src->parent = (*dest)->parent;
+
     TreeDtor(*dest);
 
     *dest = src;
 
+    MarkDirty(src->parent);
+
     return kTreeSuccess;
 }
 
@@ -46,7 +46,57 @@ DiffErrs_t SetUpData(TreeNode *node,
 NumType_t Eval(Variables      *vars,
                const TreeNode *node);
 
+//! Value of a node together with its derivative.
+struct Dual
+{
+    NumType_t val;
+    NumType_t der;
+};
+
+//! f and f' at the current values of vars in one walk of the tree, with the
+//! rules of DiffTree() applied to numbers instead of nodes. The derivative is
+//! taken by the variable at var_pos, other variables are constants. A term
+//! with a zero operand derivative is 0 even where its other factors are nan,
+//! the way DiffTree() folds it away. Nothing is allocated unless the tree is
+//! deeper than the WorkStack inline buffer.
+Dual EvalDual(Variables      *vars,
+              const TreeNode *node,
+              size_t          var_pos);
+
+//! Eval() at point_count points at once, see BcEvalBatch() for var_values.
+TreeErrs_t EvalBatch(const Variables        *vars,
+                     const TreeNode         *node,
+                     const NumType_t *const *var_values,
+                     size_t                  point_count,
+                     NumType_t              *out);
+
+//! Value of operator node with operands already evaluated, unary ops use right.
+NumType_t ApplyOp(OpCode_t  op_code,
+                  NumType_t left,
+                  NumType_t right);
+
+//! Operator node on left and right with neutral elements dropped and binary
+//! ops on two numbers folded (0*e -> 0, e*1 -> e, 2+3 -> 5). Takes ownership
+//! of the operands, the ones left out of the result are destroyed.
+TreeNode *OpCtor(OpCode_t  op_code,
+                 TreeNode *left,
+                 TreeNode *right);
+
+//! True if node is never zero, whatever the values of its variables. Proven
+//! by interval bounds of the subtrees, false when they do not tell.
+bool IsAwayFromZero(const TreeNode *node);
+
+//! True if node is above zero for any values of its variables, the same way.
+bool IsAboveZero(const TreeNode *node);
+
+//! Derivative by the variable at var_pos, other variables are constants.
+//! Rational functions of var_pos alone are differentiated in dense form, see
+//! poly.h. Outside of a DagTable long chains of * are split in halves,
+//! (L * R)' = L' * R + L * R', so n factors give O(n log n) nodes instead of
+//! copying every other factor into each of n terms. In a DagTable the binary
+//! rule already shares the prefix products of the chain.
 TreeNode *DiffTree(const TreeNode *node,
+                   size_t          var_pos,
                    TreeNode       *parent_node);
 
 TreeErrs_t OptimizeConstants(Variables *vars,
@@ -56,8 +106,16 @@ TreeErrs_t OptimizeConstants(Variables *vars,
 TreeErrs_t OptimizeNeutralExpr(Tree      *tree,
                                TreeNode **node);
 
-TreeErrs_t OptimizeTree(Variables *vars,
-                        Tree *tree);
+//! SimplifyTree(), PolyTree() and CanonTree() followed by a graph dump of the
+//! result. With an EGraph selected the cheapest equal tree is taken, see
+//! egraph.h.
+TreeErrs_t OptimizeTree(Tree *tree);
+
+//! Fixpoint of OptimizeNeutralExpr() and OptimizeConstants() in one
+//! post-order walk over the dirty nodes, each of them is checked once and
+//! left clean. The rules of RuleSetCurrent() are applied on top, see rules.h.
+//! Dumps nothing, so it may run on worker threads.
+TreeErrs_t SimplifyTree(Tree *tree);
 
 bool IsUnaryOp(const OpCode_t op_code);
 
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "diff_memo.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+static const size_t kBaseMemoCapacity = 256;
+static const size_t kMemoMultiplier   = 2;
+
+static thread_local DiffMemo *curr_memo = nullptr;
+
+static TreeErrs_t MemoReserve(DiffMemo *memo,
+                              size_t    size);
+
+static DiffMemoEntry *SeekNode(DiffMemoEntry  *table,
+                               size_t          capacity,
+                               const TreeNode *node);
+
+static DiffMemoEntry *SeekHash(DiffMemoEntry  *table,
+                               size_t          capacity,
+                               const TreeNode *node,
+                               size_t          hash);
+
+static size_t HashPtr(const void *ptr);
+
+//==============================================================================
+
+TreeErrs_t DiffMemoCtor(DiffMemo *memo)
+{
+    CHECK(memo);
+
+    memset(memo, 0, sizeof(DiffMemo));
+
+    return MemoReserve(memo, kBaseMemoCapacity / kMemoMultiplier);
+}
+
+//==============================================================================
+
+TreeErrs_t DiffMemoDtor(DiffMemo *memo)
+{
+    CHECK(memo);
+
+    if (curr_memo == memo)
+    {
+        curr_memo = nullptr;
+    }
+
+    free(memo->by_node);
+    free(memo->by_hash);
+
+    memset(memo, 0, sizeof(DiffMemo));
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+DiffMemo *DiffMemoSelect(DiffMemo *memo)
+{
+    DiffMemo *prev_memo = curr_memo;
+
+    curr_memo = memo;
+
+    return prev_memo;
+}
+
+//==============================================================================
+
+DiffMemo *DiffMemoCurrent()
+{
+    return curr_memo;
+}
+
+//==============================================================================
+
+TreeErrs_t DiffMemoBegin(DiffMemo       *memo,
+                         const TreeNode *root)
+{
+    static const int kHashEnter   = 0;
+    static const int kHashCombine = 1;
+
+    CHECK(memo);
+    CHECK(root);
+
+    memo->size = 0;
+
+    memset(memo->by_node, 0, memo->capacity * sizeof(DiffMemoEntry));
+    memset(memo->by_hash, 0, memo->capacity * sizeof(DiffMemoEntry));
+
+    // post-order, hashes holds the hashes of finished children
+
+    WorkStack frames = {};
+    WorkStack hashes = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&hashes);
+
+    TreeErrs_t status = WorkPushNode(&frames, root, kHashEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        WorkItem hash = {};
+
+        if (frame.state == kHashCombine)
+        {
+            size_t right_hash = (curr->right != nullptr) ? WorkPop(&hashes).val.idx : 0;
+            size_t left_hash  = (curr->left  != nullptr) ? WorkPop(&hashes).val.idx : 0;
+
+            hash.val.idx = NodeHash(curr, left_hash, right_hash);
+
+            if ((status = MemoReserve(memo, memo->size + 1)) != kTreeSuccess)
+            {
+                break;
+            }
+
+            DiffMemoEntry *entry = SeekNode(memo->by_node, memo->capacity, curr);
+
+            if (entry->node == nullptr)
+            {
+                entry->node = curr;
+                entry->hash = hash.val.idx;
+
+                memo->size++;
+            }
+        }
+        else if (curr->type == kOperator)
+        {
+            if ((status = WorkPushNode(&frames, curr, kHashCombine)) != kTreeSuccess ||
+                (curr->right != nullptr && (status = WorkPushNode(&frames, curr->right, kHashEnter)) != kTreeSuccess) ||
+                (curr->left  != nullptr && (status = WorkPushNode(&frames, curr->left,  kHashEnter)) != kTreeSuccess))
+            {
+                break;
+            }
+
+            continue;
+        }
+        else
+        {
+            hash.val.idx = NodeHash(curr, 0, 0);
+        }
+
+        status = WorkPush(&hashes, hash);
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&hashes);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeNode *DiffMemoFind(DiffMemo       *memo,
+                       const TreeNode *node)
+{
+    CHECK(memo);
+    CHECK(node);
+
+    DiffMemoEntry *by_node = SeekNode(memo->by_node, memo->capacity, node);
+
+    if (by_node->node == nullptr)
+    {
+        return nullptr;
+    }
+
+    DiffMemoEntry *by_hash = SeekHash(memo->by_hash, memo->capacity, node, by_node->hash);
+
+    if (by_hash->node == nullptr || by_hash->diff == nullptr)
+    {
+        memo->misses++;
+
+        return nullptr;
+    }
+
+    memo->hits++;
+
+    return by_hash->diff;
+}
+
+//==============================================================================
+
+TreeErrs_t DiffMemoAdd(DiffMemo       *memo,
+                       const TreeNode *node,
+                       const TreeNode *diff)
+{
+    CHECK(memo);
+    CHECK(node);
+
+    DiffMemoEntry *by_node = SeekNode(memo->by_node, memo->capacity, node);
+
+    // numbers and variables are cheaper to build again than to look up
+
+    if (by_node->node == nullptr || diff == nullptr || diff->type != kOperator)
+    {
+        return kTreeSuccess;
+    }
+
+    DiffMemoEntry *by_hash = SeekHash(memo->by_hash, memo->capacity, node, by_node->hash);
+
+    if (by_hash->node != nullptr)
+    {
+        return kTreeSuccess;
+    }
+
+    // own copy, the constructors may destroy diff as a part of a bigger tree
+
+    TreeNode *copy = CopyNode(diff, nullptr);
+
+    if (copy == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    by_hash->node = node;
+    by_hash->hash = by_node->hash;
+    by_hash->diff = copy;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t DiffMemoEnd(DiffMemo *memo)
+{
+    CHECK(memo);
+
+    for (size_t i = 0; i < memo->capacity; i++)
+    {
+        if (memo->by_hash[i].diff != nullptr)
+        {
+            TreeDtor(memo->by_hash[i].diff);
+
+            memo->by_hash[i].diff = nullptr;
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+void DiffMemoDump(const DiffMemo *memo,
+                  FILE           *output_file)
+{
+    CHECK(memo);
+    CHECK(output_file);
+
+    size_t lookups = memo->hits + memo->misses;
+
+    fprintf(output_file, "diff memo[%p]:\n"
+                         "\tlookups  : %zu\n"
+                         "\thits     : %zu (%.1f%%)\n"
+                         "\tmisses   : %zu\n",
+                         memo,
+                         lookups,
+                         memo->hits, (lookups == 0) ? 0.0 : 100.0 * (double) memo->hits / (double) lookups,
+                         memo->misses);
+}
+
+//==============================================================================
+
+// Both tables have the same capacity, by_hash never has more entries than
+// by_node. Only called while by_hash is empty.
+
+static TreeErrs_t MemoReserve(DiffMemo *memo,
+                              size_t    size)
+{
+    if (size * kMemoMultiplier <= memo->capacity)
+    {
+        return kTreeSuccess;
+    }
+
+    size_t new_capacity = (memo->capacity == 0) ? kBaseMemoCapacity : memo->capacity;
+
+    while (size * kMemoMultiplier > new_capacity)
+    {
+        new_capacity *= kMemoMultiplier;
+    }
+
+    DiffMemoEntry *by_node = (DiffMemoEntry *) calloc(new_capacity, sizeof(DiffMemoEntry));
+    DiffMemoEntry *by_hash = (DiffMemoEntry *) calloc(new_capacity, sizeof(DiffMemoEntry));
+
+    if (by_node == nullptr || by_hash == nullptr)
+    {
+        free(by_node);
+        free(by_hash);
+
+        return kFailedAllocation;
+    }
+
+    for (size_t i = 0; i < memo->capacity; i++)
+    {
+        if (memo->by_node[i].node != nullptr)
+        {
+            *SeekNode(by_node, new_capacity, memo->by_node[i].node) = memo->by_node[i];
+        }
+    }
+
+    free(memo->by_node);
+    free(memo->by_hash);
+
+    memo->by_node  = by_node;
+    memo->by_hash  = by_hash;
+    memo->capacity = new_capacity;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static DiffMemoEntry *SeekNode(DiffMemoEntry  *table,
+                               size_t          capacity,
+                               const TreeNode *node)
+{
+    size_t mask = capacity - 1;
+    size_t pos  = HashPtr(node) & mask;
+
+    while (table[pos].node != nullptr && table[pos].node != node)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return &table[pos];
+}
+
+//==============================================================================
+
+static DiffMemoEntry *SeekHash(DiffMemoEntry  *table,
+                               size_t          capacity,
+                               const TreeNode *node,
+                               size_t          hash)
+{
+    size_t mask = capacity - 1;
+    size_t pos  = hash & mask;
+
+    while (table[pos].node != nullptr &&
+           (table[pos].hash != hash || !TreeEqual(table[pos].node, node)))
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return &table[pos];
+}
+
+//==============================================================================
+
+static size_t HashPtr(const void *ptr)
+{
+    uint64_t val = (uint64_t) (uintptr_t) ptr;
+
+    val ^= val >> 33;
+    val *= 0xff51afd7ed558ccdULL;
+    val ^= val >> 33;
+
+    return (size_t) val;
+}
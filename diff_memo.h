@@ -0,0 +1,66 @@
+#ifndef DIFF_MEMO_HEADER
+#define DIFF_MEMO_HEADER
+
+#include <stdio.h>
+
+#include "trees.h"
+
+//! Derivative cache for ordinary (not DagTable) trees. While a DiffMemo is
+//! selected, DiffTree() hashes every subtree of its input first and
+//! differentiates each distinct structure once, equal subtrees met later get
+//! a copy of the first derivative. The memo keeps its own copies of the
+//! derivatives, they are built in the arena of the caller and destroyed by
+//! DiffMemoEnd() before DiffTree() returns, so the cache only lives through
+//! one call. The hit counters add up over all of them. The hashing costs
+//! about as much as it saves unless the input repeats large subtrees, so
+//! PrintMaclaurinSeries() selects one only with --memo.
+
+struct DiffMemoEntry
+{
+    const TreeNode *node;
+    size_t          hash;
+    TreeNode       *diff;
+};
+
+struct DiffMemo
+{
+    DiffMemoEntry *by_node; // operator node -> structural hash
+    DiffMemoEntry *by_hash; // first node of every structure -> its derivative
+
+    size_t capacity;
+    size_t size;
+
+    size_t hits;
+    size_t misses;
+};
+
+TreeErrs_t DiffMemoCtor(DiffMemo *memo);
+
+TreeErrs_t DiffMemoDtor(DiffMemo *memo);
+
+//! Makes memo current for the calling thread, returns the previous one.
+DiffMemo *DiffMemoSelect(DiffMemo *memo);
+
+DiffMemo *DiffMemoCurrent();
+
+//! Forgets the previous call and hashes every operator node of root.
+TreeErrs_t DiffMemoBegin(DiffMemo       *memo,
+                         const TreeNode *root);
+
+//! Derivative of an equal subtree seen earlier in this call or nullptr.
+TreeNode *DiffMemoFind(DiffMemo       *memo,
+                       const TreeNode *node);
+
+//! Keeps a copy of diff if node is an operator and the derivative is not a
+//! single number or variable.
+TreeErrs_t DiffMemoAdd(DiffMemo       *memo,
+                       const TreeNode *node,
+                       const TreeNode *diff);
+
+//! Destroys the cached derivatives of the current call.
+TreeErrs_t DiffMemoEnd(DiffMemo *memo);
+
+void DiffMemoDump(const DiffMemo *memo,
+                  FILE           *output_file);
+
+#endif
@@ -0,0 +1,1363 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "egraph.h"
+#include "diff.h"
+#include "dag.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+static const size_t kBaseEGraphCapacity = 256;
+static const size_t kEGraphMultiplier   = 2;
+
+static const int kEEnter   = 0;
+static const int kECombine = 1;
+
+//! Applied together with the rules of RuleSetCurrent(). They only make sense
+//! when nothing is removed, a greedy rewriter would loop on the first two.
+static const char * const kAlgebraRules[] =
+{
+    "a + b -> b + a",
+    "a * b -> b * a",
+    "(a + b) + c -> a + (b + c)",
+    "a + (b + c) -> (a + b) + c",
+    "(a * b) * c -> a * (b * c)",
+    "a * (b * c) -> (a * b) * c",
+    "(a + b) - c -> a + (b - c)",
+
+    "a * b + a * c -> a * (b + c)",
+    "a * b - a * c -> a * (b - c)",
+    "(a * b) / a -> b : nonzero(a)",
+    "(a * b) / (a * c) -> b / c : nonzero(a)",
+
+    "a / c + b / c -> (a + b) / c",
+    "a / c - b / c -> (a - b) / c",
+    "a / b + c / d -> (a * d + b * c) / (b * d)",
+    "(a / b) * c -> (a * c) / b",
+    "(a / b) / c -> a / (b * c)",
+
+    "a^2 -> a * a",
+};
+
+static const size_t kAlgebraRuleCount = sizeof(kAlgebraRules) / sizeof(kAlgebraRules[0]);
+
+static thread_local EGraph *curr_egraph = nullptr;
+
+struct EGoal
+{
+    const TreeNode *pattern;
+    size_t          eclass;
+};
+
+static TreeErrs_t AddTree(EGraph         *eg,
+                          const TreeNode *root,
+                          size_t         *eclass,
+                          double         *cost);
+
+static size_t AddNode(EGraph           *eg,
+                      ExpressionType_t  type,
+                      NodeData          data,
+                      size_t            left,
+                      size_t            right);
+
+static size_t FoldNode(EGraph *eg,
+                       size_t  node);
+
+static size_t Find(EGraph *eg,
+                   size_t  eclass);
+
+static bool Union(EGraph *eg,
+                  size_t  lhs,
+                  size_t  rhs);
+
+static TreeErrs_t Rebuild(EGraph *eg);
+
+static TreeErrs_t FreezeExponents(EGraph *eg);
+
+static TreeErrs_t CollectMatches(EGraph        *eg,
+                                 const RuleSet *set);
+
+static TreeErrs_t MatchGoals(EGraph      *eg,
+                             const Rule  *rule,
+                             const EGoal *goals,
+                             size_t       goal_count,
+                             size_t      *binds,
+                             size_t       eclass);
+
+static bool CheckGuards(EGraph       *eg,
+                        const Rule   *rule,
+                        const size_t *binds);
+
+static TreeErrs_t ApplyMatches(EGraph *eg);
+
+static size_t Instantiate(EGraph         *eg,
+                          const TreeNode *node,
+                          const size_t   *binds);
+
+static void Extract(EGraph *eg);
+
+static TreeNode *BuildBest(EGraph *eg,
+                           size_t  eclass);
+
+static size_t *SeekNode(EGraph           *eg,
+                        ExpressionType_t  type,
+                        NodeData          data,
+                        size_t            left,
+                        size_t            right);
+
+static TreeErrs_t TableReserve(EGraph *eg,
+                               size_t  size);
+
+static void *Reserve(void   *data,
+                     size_t *capacity,
+                     size_t  size,
+                     size_t  elem_size);
+
+static uint64_t DataKey(ExpressionType_t type,
+                        NodeData         data);
+
+static double NodeCost(ExpressionType_t type,
+                       NodeData         data);
+
+static double ElapsedMs(clock_t start);
+
+//==============================================================================
+
+TreeErrs_t EGraphCtor(EGraph *eg)
+{
+    CHECK(eg);
+
+    memset(eg, 0, sizeof(EGraph));
+
+    eg->node_limit    = kBaseENodeLimit;
+    eg->iter_limit    = kBaseEIterLimit;
+    eg->time_limit_ms = kBaseETimeLimitMs;
+
+    TreeErrs_t status = RuleSetCtor(&eg->algebra);
+
+    for (size_t i = 0; status == kTreeSuccess && i < kAlgebraRuleCount; i++)
+    {
+        status = RuleSetAdd(&eg->algebra, kAlgebraRules[i]);
+    }
+
+    if (status != kTreeSuccess)
+    {
+        EGraphDtor(eg);
+    }
+
+    return status;
+}
+
+//==============================================================================
+
+TreeErrs_t EGraphDtor(EGraph *eg)
+{
+    CHECK(eg);
+
+    if (curr_egraph == eg)
+    {
+        curr_egraph = nullptr;
+    }
+
+    free(eg->nodes);
+    free(eg->classes);
+    free(eg->table);
+    free(eg->matches);
+
+    RuleSetDtor(&eg->algebra);
+
+    memset(eg, 0, sizeof(EGraph));
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+EGraph *EGraphSelect(EGraph *eg)
+{
+    EGraph *prev_egraph = curr_egraph;
+
+    curr_egraph = eg;
+
+    return prev_egraph;
+}
+
+//==============================================================================
+
+EGraph *EGraphCurrent()
+{
+    return curr_egraph;
+}
+
+//==============================================================================
+
+TreeErrs_t EGraphSimplify(EGraph *eg,
+                          Tree   *tree)
+{
+    CHECK(eg);
+    CHECK(tree);
+
+    if (tree->root == nullptr || DagCurrent() != nullptr)
+    {
+        return kTreeSuccess;
+    }
+
+    clock_t start = clock();
+
+    eg->node_count  = 0;
+    eg->class_count = 0;
+    eg->match_count = 0;
+
+    for (size_t i = 0; i < eg->table_capacity; i++)
+    {
+        eg->table[i] = kENone;
+    }
+
+    size_t root        = kENone;
+    double cost_before = 0;
+
+    TreeErrs_t status = AddTree(eg, tree->root, &root, &cost_before);
+
+    RuleSet *rules = RuleSetCurrent();
+
+    bool saturated = false;
+
+    for (size_t iter = 0; status == kTreeSuccess && iter < eg->iter_limit; iter++)
+    {
+        if (eg->node_count >= eg->node_limit || ElapsedMs(start) > eg->time_limit_ms)
+        {
+            break;
+        }
+
+        eg->iterations++;
+
+        size_t node_count  = eg->node_count;
+        size_t class_count = eg->class_count;
+        size_t root_count  = 0;
+
+        for (size_t i = 0; i < class_count; i++)
+        {
+            root_count += (eg->classes[i].parent == i);
+        }
+
+        if ((status = FreezeExponents(eg))              != kTreeSuccess ||
+            (status = CollectMatches(eg, &eg->algebra)) != kTreeSuccess ||
+            (rules != nullptr && (status = CollectMatches(eg, rules)) != kTreeSuccess) ||
+            (status = ApplyMatches(eg)) != kTreeSuccess ||
+            (status = Rebuild(eg))      != kTreeSuccess)
+        {
+            break;
+        }
+
+        // no new node and no merge: every rule only found what is there
+
+        size_t new_root_count = 0;
+
+        for (size_t i = 0; i < class_count; i++)
+        {
+            new_root_count += (eg->classes[i].parent == i);
+        }
+
+        if (eg->node_count == node_count && new_root_count == root_count)
+        {
+            saturated = true;
+
+            break;
+        }
+    }
+
+    if (eg->node_count > eg->max_nodes)
+    {
+        eg->max_nodes = eg->node_count;
+    }
+
+    eg->runs++;
+    eg->saturated   += saturated;
+    eg->cost_before += cost_before;
+
+    double cost_after = cost_before;
+
+    if (status == kTreeSuccess)
+    {
+        Extract(eg);
+
+        root = Find(eg, root);
+
+        if (eg->classes[root].cost < cost_before)
+        {
+            TreeNode *best = BuildBest(eg, root);
+
+            if (best != nullptr)
+            {
+                best->parent = tree->root->parent;
+
+                TreeDtor(tree->root);
+
+                tree->root = best;
+                cost_after = eg->classes[root].cost;
+
+                eg->improved++;
+            }
+            else
+            {
+                status = kFailedAllocation;
+            }
+        }
+    }
+
+    eg->cost_after += cost_after;
+
+    return status;
+}
+
+//==============================================================================
+
+double EGraphTreeCost(const TreeNode *node)
+{
+    if (node == nullptr)
+    {
+        return 0;
+    }
+
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    WorkPushNode(&stk, node, 0);
+
+    double cost = 0;
+
+    while (stk.size > 0)
+    {
+        const TreeNode *curr = WorkPop(&stk).val.const_node;
+
+        cost += NodeCost(curr->type, curr->data);
+
+        if ((curr->left  != nullptr && WorkPushNode(&stk, curr->left,  0) != kTreeSuccess) ||
+            (curr->right != nullptr && WorkPushNode(&stk, curr->right, 0) != kTreeSuccess))
+        {
+            break;
+        }
+    }
+
+    WorkStackDtor(&stk);
+
+    return cost;
+}
+
+//==============================================================================
+
+void EGraphDump(const EGraph *eg,
+                FILE         *output_file)
+{
+    CHECK(eg);
+    CHECK(output_file);
+
+    fprintf(output_file, "egraph[%p]:\n"
+                         "\truns       : %zu\n"
+                         "\timproved   : %zu\n"
+                         "\tsaturated  : %zu\n"
+                         "\titerations : %zu\n"
+                         "\tmax nodes  : %zu\n"
+                         "\tcost       : %.0f -> %.0f\n",
+                         eg,
+                         eg->runs,
+                         eg->improved,
+                         eg->saturated,
+                         eg->iterations,
+                         eg->max_nodes,
+                         eg->cost_before, eg->cost_after);
+}
+
+//------------------------------------------------------------------------------
+// e-class of every node of root in post-order, cost is the cost of root.
+
+static TreeErrs_t AddTree(EGraph         *eg,
+                          const TreeNode *root,
+                          size_t         *eclass,
+                          double         *cost)
+{
+    WorkStack frames  = {};
+    WorkStack classes = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&classes);
+
+    TreeErrs_t status = WorkPushNode(&frames, root, kEEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        if (frame.state == kEEnter && (curr->left != nullptr || curr->right != nullptr))
+        {
+            if ((status = WorkPushNode(&frames, curr, kECombine)) != kTreeSuccess ||
+                (curr->right != nullptr && (status = WorkPushNode(&frames, curr->right, kEEnter)) != kTreeSuccess) ||
+                (curr->left  != nullptr && (status = WorkPushNode(&frames, curr->left,  kEEnter)) != kTreeSuccess))
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        size_t right = (curr->right != nullptr) ? WorkPop(&classes).val.idx : kENone;
+        size_t left  = (curr->left  != nullptr) ? WorkPop(&classes).val.idx : kENone;
+
+        WorkItem item = {};
+
+        item.val.idx = AddNode(eg, curr->type, curr->data, left, right);
+
+        if (item.val.idx == kENone)
+        {
+            status = kFailedAllocation;
+
+            break;
+        }
+
+        *cost += NodeCost(curr->type, curr->data);
+
+        status = WorkPush(&classes, item);
+    }
+
+    if (status == kTreeSuccess)
+    {
+        *eclass = WorkPop(&classes).val.idx;
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&classes);
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+// e-class of the node, a new one unless an equal node is already there.
+// Returns kENone if out of memory.
+
+static size_t AddNode(EGraph           *eg,
+                      ExpressionType_t  type,
+                      NodeData          data,
+                      size_t            left,
+                      size_t            right)
+{
+    left  = Find(eg, left);
+    right = Find(eg, right);
+
+    if (type == kConstNumber && IsNumEqual(data.const_val, 0))
+    {
+        data.const_val = 0; // not -0
+    }
+
+    ENode  *nodes   = (ENode *)  Reserve(eg->nodes,   &eg->node_capacity,  eg->node_count  + 1, sizeof(ENode));
+    EClass *classes = (EClass *) Reserve(eg->classes, &eg->class_capacity, eg->class_count + 1, sizeof(EClass));
+
+    if (nodes != nullptr)
+    {
+        eg->nodes = nodes;
+    }
+
+    if (classes != nullptr)
+    {
+        eg->classes = classes;
+    }
+
+    if (nodes == nullptr || classes == nullptr || TableReserve(eg, eg->node_count + 1) != kTreeSuccess)
+    {
+        return kENone;
+    }
+
+    size_t *slot = SeekNode(eg, type, data, left, right);
+
+    if (*slot != kENone)
+    {
+        return Find(eg, eg->nodes[*slot].eclass);
+    }
+
+    size_t node   = eg->node_count++;
+    size_t eclass = eg->class_count++;
+
+    *slot = node;
+
+    eg->nodes[node]     = {type, data, left, right, eclass, kENone, false};
+    eg->classes[eclass] = {eclass, node, node,
+                           type == kConstNumber, (type == kConstNumber) ? data.const_val : 0,
+                           HUGE_VAL, kENone, false};
+
+    if (FoldNode(eg, node) == kENone)
+    {
+        return kENone;
+    }
+
+    return Find(eg, eclass);
+}
+
+//------------------------------------------------------------------------------
+// A binary operator on two numbers is merged with its value unless that is
+// NaN, as OpCtor() does. Returns the e-class of node or kENone if out of memory.
+
+static size_t FoldNode(EGraph *eg,
+                       size_t  node)
+{
+    const ENode *curr   = &eg->nodes[node];
+    size_t       eclass = Find(eg, curr->eclass);
+
+    if (curr->type != kOperator || curr->left == kENone || curr->right == kENone ||
+        eg->classes[eclass].has_const)
+    {
+        return eclass;
+    }
+
+    const EClass *left  = &eg->classes[Find(eg, curr->left)];
+    const EClass *right = &eg->classes[Find(eg, curr->right)];
+
+    if (!left->has_const || !right->has_const)
+    {
+        return eclass;
+    }
+
+    NodeData val = {};
+
+    val.const_val = ApplyOp(curr->data.op_code, left->const_val, right->const_val);
+
+    if (isnan(val.const_val))
+    {
+        return eclass;
+    }
+
+    size_t num = AddNode(eg, kConstNumber, val, kENone, kENone);
+
+    if (num == kENone)
+    {
+        return kENone;
+    }
+
+    Union(eg, eclass, num);
+
+    return Find(eg, eclass);
+}
+
+//==============================================================================
+
+static size_t Find(EGraph *eg,
+                   size_t  eclass)
+{
+    if (eclass == kENone)
+    {
+        return kENone;
+    }
+
+    EClass *classes = eg->classes;
+
+    while (classes[eclass].parent != eclass)
+    {
+        classes[eclass].parent = classes[classes[eclass].parent].parent;
+
+        eclass = classes[eclass].parent;
+    }
+
+    return eclass;
+}
+
+//------------------------------------------------------------------------------
+// The smaller index stays the root, so the classes of the input keep theirs.
+
+static bool Union(EGraph *eg,
+                  size_t  lhs,
+                  size_t  rhs)
+{
+    lhs = Find(eg, lhs);
+    rhs = Find(eg, rhs);
+
+    if (lhs == rhs)
+    {
+        return false;
+    }
+
+    if (rhs < lhs)
+    {
+        size_t tmp = lhs;
+
+        lhs = rhs;
+        rhs = tmp;
+    }
+
+    EClass *root  = &eg->classes[lhs];
+    EClass *other = &eg->classes[rhs];
+
+    other->parent = lhs;
+
+    eg->nodes[root->last].next = other->first;
+    root->last                 = other->last;
+
+    if (!root->has_const && other->has_const)
+    {
+        root->has_const = true;
+        root->const_val = other->const_val;
+    }
+
+    root->frozen = root->frozen || other->frozen;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Merges restore congruence: nodes with the same operator on the same classes
+// are equal, so their classes are merged too, until nothing changes. Of two
+// equal nodes in one class the later is marked dead.
+
+static TreeErrs_t Rebuild(EGraph *eg)
+{
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (size_t i = 0; i < eg->table_capacity; i++)
+        {
+            eg->table[i] = kENone;
+        }
+
+        // nodes made by folding are added to the end and checked as well
+
+        for (size_t node = 0; node < eg->node_count; node++)
+        {
+            ENode *curr = &eg->nodes[node];
+
+            if (curr->dead)
+            {
+                continue;
+            }
+
+            curr->left  = Find(eg, curr->left);
+            curr->right = Find(eg, curr->right);
+
+            size_t *slot = SeekNode(eg, curr->type, curr->data, curr->left, curr->right);
+
+            if (*slot != kENone && *slot != node)
+            {
+                changed |= Union(eg, curr->eclass, eg->nodes[*slot].eclass);
+
+                curr->dead = true;
+
+                continue;
+            }
+
+            *slot = node;
+
+            size_t eclass    = Find(eg, curr->eclass);
+            bool   had_const = eg->classes[eclass].has_const;
+
+            if (FoldNode(eg, node) == kENone)
+            {
+                return kFailedAllocation;
+            }
+
+            changed |= (!had_const && eg->classes[Find(eg, eclass)].has_const);
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Marks the classes under the exponent of every power whose base is not a
+// positive number, rules leave them as they are. Redone every round, as
+// rules make new powers.
+
+static TreeErrs_t FreezeExponents(EGraph *eg)
+{
+    for (size_t i = 0; i < eg->class_count; i++)
+    {
+        eg->classes[i].frozen = false;
+    }
+
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    TreeErrs_t status = kTreeSuccess;
+
+    for (size_t node = 0; node < eg->node_count && status == kTreeSuccess; node++)
+    {
+        const ENode *curr = &eg->nodes[node];
+
+        if (curr->dead || curr->type != kOperator || curr->data.op_code != kExp)
+        {
+            continue;
+        }
+
+        const EClass *base = &eg->classes[Find(eg, curr->left)];
+
+        WorkItem item = {};
+
+        item.val.idx = Find(eg, curr->right);
+
+        if ((base->has_const && base->const_val > 0) || eg->classes[item.val.idx].frozen)
+        {
+            continue;
+        }
+
+        eg->classes[item.val.idx].frozen = true;
+
+        status = WorkPush(&stk, item);
+
+        while (stk.size > 0 && status == kTreeSuccess)
+        {
+            size_t eclass = WorkPop(&stk).val.idx;
+
+            for (size_t i = eg->classes[eclass].first; i != kENone && status == kTreeSuccess; i = eg->nodes[i].next)
+            {
+                size_t operands[2] = {eg->nodes[i].left, eg->nodes[i].right};
+
+                for (size_t j = 0; j < 2 && status == kTreeSuccess; j++)
+                {
+                    item.val.idx = Find(eg, operands[j]);
+
+                    if (item.val.idx != kENone && !eg->classes[item.val.idx].frozen)
+                    {
+                        eg->classes[item.val.idx].frozen = true;
+
+                        status = WorkPush(&stk, item);
+                    }
+                }
+            }
+        }
+    }
+
+    WorkStackDtor(&stk);
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+// Matches of every rule of set rooted at the nodes there are now, at most
+// node_limit of them are kept for one round.
+
+static TreeErrs_t CollectMatches(EGraph        *eg,
+                                 const RuleSet *set)
+{
+    size_t node_count = eg->node_count;
+
+    for (size_t node = 0; node < node_count; node++)
+    {
+        const ENode curr = eg->nodes[node];
+
+        if (curr.dead || curr.type != kOperator || eg->classes[Find(eg, curr.eclass)].frozen)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < set->rule_count; i++)
+        {
+            const Rule     *rule    = &set->rules[i];
+            const TreeNode *pattern = rule->pattern;
+
+            if (pattern->data.op_code != curr.data.op_code)
+            {
+                continue;
+            }
+
+            if (eg->match_count >= eg->node_limit)
+            {
+                return kTreeSuccess;
+            }
+
+            EGoal  goals[2]    = {};
+            size_t goal_count  = 0;
+            size_t binds[kMaxRuleVars] = {};
+
+            for (size_t var = 0; var < kMaxRuleVars; var++)
+            {
+                binds[var] = kENone;
+            }
+
+            if (pattern->left != nullptr)
+            {
+                goals[goal_count++] = {pattern->left, curr.left};
+            }
+
+            if (pattern->right != nullptr)
+            {
+                goals[goal_count++] = {pattern->right, curr.right};
+            }
+
+            TreeErrs_t status = MatchGoals(eg, rule, goals, goal_count, binds, Find(eg, curr.eclass));
+
+            if (status != kTreeSuccess)
+            {
+                return status;
+            }
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Every way to match the patterns of goals against their classes with the
+// variables bound so far, the last goal is matched first. Patterns have at
+// most kMaxRuleSize nodes, so the recursion is as deep as a pattern.
+
+static TreeErrs_t MatchGoals(EGraph      *eg,
+                             const Rule  *rule,
+                             const EGoal *goals,
+                             size_t       goal_count,
+                             size_t      *binds,
+                             size_t       eclass)
+{
+    if (eg->match_count >= eg->node_limit)
+    {
+        return kTreeSuccess;
+    }
+
+    if (goal_count == 0)
+    {
+        if (!CheckGuards(eg, rule, binds))
+        {
+            return kTreeSuccess;
+        }
+
+        EMatch *matches = (EMatch *) Reserve(eg->matches, &eg->match_capacity,
+                                             eg->match_count + 1, sizeof(EMatch));
+
+        if (matches == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        eg->matches = matches;
+
+        EMatch *match = &eg->matches[eg->match_count++];
+
+        match->rule   = rule;
+        match->eclass = eclass;
+
+        memcpy(match->binds, binds, sizeof(match->binds));
+
+        return kTreeSuccess;
+    }
+
+    const TreeNode *pattern = goals[goal_count - 1].pattern;
+    size_t          target  = Find(eg, goals[goal_count - 1].eclass);
+
+    if (pattern->type == kVariable)
+    {
+        size_t *bind = &binds[pattern->data.variable_pos];
+
+        if (*bind != kENone)
+        {
+            return (Find(eg, *bind) == target) ?
+                   MatchGoals(eg, rule, goals, goal_count - 1, binds, eclass) : kTreeSuccess;
+        }
+
+        *bind = target;
+
+        TreeErrs_t status = MatchGoals(eg, rule, goals, goal_count - 1, binds, eclass);
+
+        *bind = kENone;
+
+        return status;
+    }
+
+    if (pattern->type == kConstNumber)
+    {
+        const EClass *curr = &eg->classes[target];
+
+        return (curr->has_const && IsNumEqual(curr->const_val, pattern->data.const_val)) ?
+               MatchGoals(eg, rule, goals, goal_count - 1, binds, eclass) : kTreeSuccess;
+    }
+
+    EGoal next[kMaxRuleSize] = {};
+
+    memcpy(next, goals, (goal_count - 1) * sizeof(EGoal));
+
+    for (size_t node = eg->classes[target].first; node != kENone; node = eg->nodes[node].next)
+    {
+        const ENode *curr = &eg->nodes[node];
+
+        if (curr->dead || curr->type != kOperator || curr->data.op_code != pattern->data.op_code)
+        {
+            continue;
+        }
+
+        size_t next_count = goal_count - 1;
+
+        if (pattern->left != nullptr && next_count < kMaxRuleSize)
+        {
+            next[next_count++] = {pattern->left, curr->left};
+        }
+
+        if (pattern->right != nullptr && next_count < kMaxRuleSize)
+        {
+            next[next_count++] = {pattern->right, curr->right};
+        }
+
+        TreeErrs_t status = MatchGoals(eg, rule, next, next_count, binds, eclass);
+
+        if (status != kTreeSuccess)
+        {
+            return status;
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Guards of rules.h with a class standing for a number if it holds one. A
+// class has no bounds, so nonzero(a) and positive(a) only hold for numbers.
+
+static bool CheckGuards(EGraph       *eg,
+                        const Rule   *rule,
+                        const size_t *binds)
+{
+    for (size_t i = 0; i < rule->guard_count; i++)
+    {
+        const EClass *bind = &eg->classes[Find(eg, binds[rule->guards[i].var])];
+
+        bool is_int = bind->has_const && IsNumEqual(bind->const_val, floor(bind->const_val));
+
+        switch (rule->guards[i].kind)
+        {
+            case kGuardNum:
+            {
+                if (!bind->has_const) return false;
+
+                break;
+            }
+
+            case kGuardNotNum:
+            {
+                if (bind->has_const) return false;
+
+                break;
+            }
+
+            case kGuardInt:
+            {
+                if (!is_int) return false;
+
+                break;
+            }
+
+            case kGuardOdd:
+            {
+                if (!is_int || IsNumEqual(fmod(bind->const_val, 2), 0)) return false;
+
+                break;
+            }
+
+            case kGuardNonZero:
+            {
+                if (!bind->has_const || IsNumEqual(bind->const_val, 0)) return false;
+
+                break;
+            }
+
+            case kGuardPositive:
+            {
+                if (!bind->has_const || !(bind->const_val > 0)) return false;
+
+                break;
+            }
+
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//==============================================================================
+
+static TreeErrs_t ApplyMatches(EGraph *eg)
+{
+    for (size_t i = 0; i < eg->match_count && eg->node_count < eg->node_limit; i++)
+    {
+        const EMatch *match = &eg->matches[i];
+
+        size_t eclass = Instantiate(eg, match->rule->replacement, match->binds);
+
+        if (eclass == kENone)
+        {
+            return kFailedAllocation;
+        }
+
+        // a frozen class takes no rewritten nodes of another one
+
+        if (!eg->classes[Find(eg, eclass)].frozen)
+        {
+            Union(eg, match->eclass, eclass);
+        }
+    }
+
+    eg->match_count = 0;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// e-class of the replacement with the pattern variables bound to binds.
+
+static size_t Instantiate(EGraph         *eg,
+                          const TreeNode *node,
+                          const size_t   *binds)
+{
+    if (node->type == kVariable)
+    {
+        return binds[node->data.variable_pos];
+    }
+
+    size_t left  = (node->left  != nullptr) ? Instantiate(eg, node->left,  binds) : kENone;
+    size_t right = (node->right != nullptr) ? Instantiate(eg, node->right, binds) : kENone;
+
+    if ((node->left != nullptr && left == kENone) || (node->right != nullptr && right == kENone))
+    {
+        return kENone;
+    }
+
+    return AddNode(eg, node->type, node->data, left, right);
+}
+
+//------------------------------------------------------------------------------
+// Cheapest node of every class, relaxed until no cost goes down. The best
+// node of a class only has cheaper classes below it, so following the best
+// nodes from any class ends at leaves.
+
+static void Extract(EGraph *eg)
+{
+    for (size_t i = 0; i < eg->class_count; i++)
+    {
+        eg->classes[i].cost = HUGE_VAL;
+        eg->classes[i].best = kENone;
+    }
+
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (size_t node = 0; node < eg->node_count; node++)
+        {
+            const ENode *curr = &eg->nodes[node];
+
+            if (curr->dead)
+            {
+                continue;
+            }
+
+            double cost = NodeCost(curr->type, curr->data);
+
+            if (curr->left != kENone)
+            {
+                cost += eg->classes[Find(eg, curr->left)].cost;
+            }
+
+            if (curr->right != kENone)
+            {
+                cost += eg->classes[Find(eg, curr->right)].cost;
+            }
+
+            EClass *eclass = &eg->classes[Find(eg, curr->eclass)];
+
+            if (cost < eclass->cost)
+            {
+                eclass->cost = cost;
+                eclass->best = node;
+
+                changed = true;
+            }
+        }
+    }
+}
+
+//==============================================================================
+
+static TreeNode *BuildBest(EGraph *eg,
+                           size_t  eclass)
+{
+    WorkStack frames = {};
+    WorkStack built  = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&built);
+
+    WorkItem root = {};
+
+    root.val.idx = eclass;
+    root.state   = kEEnter;
+
+    TreeErrs_t status = WorkPush(&frames, root);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const ENode *best = &eg->nodes[eg->classes[Find(eg, frame.val.idx)].best];
+
+        if (frame.state == kEEnter && (best->left != kENone || best->right != kENone))
+        {
+            WorkItem combine = frame;
+            WorkItem left    = {};
+            WorkItem right   = {};
+
+            combine.state = kECombine;
+            left.val.idx  = best->left;
+            right.val.idx = best->right;
+
+            if ((status = WorkPush(&frames, combine)) != kTreeSuccess ||
+                (best->right != kENone && (status = WorkPush(&frames, right)) != kTreeSuccess) ||
+                (best->left  != kENone && (status = WorkPush(&frames, left))  != kTreeSuccess))
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        TreeNode *right = (best->right != kENone) ? WorkPop(&built).val.node : nullptr;
+        TreeNode *left  = (best->left  != kENone) ? WorkPop(&built).val.node : nullptr;
+
+        double data = (best->type == kOperator)  ? (double) best->data.op_code :
+                      (best->type == kConstNumber) ? best->data.const_val    :
+                                                     (double) best->data.variable_pos;
+
+        WorkItem item = {};
+
+        item.val.node = NodeCtor(nullptr, left, right, best->type, data);
+
+        if (item.val.node == nullptr)
+        {
+            TreeDtor(left);
+            TreeDtor(right);
+
+            status = kFailedAllocation;
+
+            break;
+        }
+
+        status = WorkPush(&built, item);
+    }
+
+    TreeNode *tree = nullptr;
+
+    if (status == kTreeSuccess)
+    {
+        tree = WorkPop(&built).val.node;
+    }
+
+    while (built.size > 0)
+    {
+        TreeDtor(WorkPop(&built).val.node);
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&built);
+
+    return tree;
+}
+
+//------------------------------------------------------------------------------
+// Slot of the node equal to the given one or the empty slot where it would go.
+// Nodes in the table may have classes merged after they were put there, they
+// are compared by the roots.
+
+static size_t *SeekNode(EGraph           *eg,
+                        ExpressionType_t  type,
+                        NodeData          data,
+                        size_t            left,
+                        size_t            right)
+{
+    uint64_t key  = DataKey(type, data);
+    uint64_t hash = key * 0x9e3779b97f4a7c15ULL + (uint64_t) type;
+
+    hash = (hash ^ (hash >> 29)) * 31 + (uint64_t) left;
+    hash = (hash ^ (hash >> 29)) * 31 + (uint64_t) right;
+    hash ^= hash >> 32;
+
+    size_t mask = eg->table_capacity - 1;
+    size_t pos  = (size_t) hash & mask;
+
+    while (eg->table[pos] != kENone)
+    {
+        const ENode *node = &eg->nodes[eg->table[pos]];
+
+        if (node->type == type && DataKey(node->type, node->data) == key &&
+            Find(eg, node->left) == left && Find(eg, node->right) == right)
+        {
+            break;
+        }
+
+        pos = (pos + 1) & mask;
+    }
+
+    return &eg->table[pos];
+}
+
+//------------------------------------------------------------------------------
+// Keeps the table at most half full. Nodes are put back by their current
+// classes, equal ones stay out until Rebuild() sees them.
+
+static TreeErrs_t TableReserve(EGraph *eg,
+                               size_t  size)
+{
+    if (size * kEGraphMultiplier <= eg->table_capacity)
+    {
+        return kTreeSuccess;
+    }
+
+    size_t new_capacity = (eg->table_capacity == 0) ? kBaseEGraphCapacity : eg->table_capacity;
+
+    while (size * kEGraphMultiplier > new_capacity)
+    {
+        new_capacity *= kEGraphMultiplier;
+    }
+
+    size_t *new_table = (size_t *) calloc(new_capacity, sizeof(size_t));
+
+    if (new_table == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    for (size_t i = 0; i < new_capacity; i++)
+    {
+        new_table[i] = kENone;
+    }
+
+    free(eg->table);
+
+    eg->table          = new_table;
+    eg->table_capacity = new_capacity;
+
+    for (size_t node = 0; node < eg->node_count; node++)
+    {
+        const ENode *curr = &eg->nodes[node];
+
+        if (curr->dead)
+        {
+            continue;
+        }
+
+        size_t *slot = SeekNode(eg, curr->type, curr->data, Find(eg, curr->left), Find(eg, curr->right));
+
+        if (*slot == kENone)
+        {
+            *slot = node;
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// data grown to hold size elements or nullptr, then data is still valid.
+
+static void *Reserve(void   *data,
+                     size_t *capacity,
+                     size_t  size,
+                     size_t  elem_size)
+{
+    if (size <= *capacity && data != nullptr)
+    {
+        return data;
+    }
+
+    size_t new_capacity = (*capacity == 0) ? kBaseEGraphCapacity : *capacity;
+
+    while (size > new_capacity)
+    {
+        new_capacity *= kEGraphMultiplier;
+    }
+
+    void *new_data = realloc(data, new_capacity * elem_size);
+
+    if (new_data != nullptr)
+    {
+        *capacity = new_capacity;
+    }
+
+    return new_data;
+}
+
+//==============================================================================
+
+static uint64_t DataKey(ExpressionType_t type,
+                        NodeData         data)
+{
+    uint64_t key = 0;
+
+    if (type == kOperator)
+    {
+        key = (uint64_t) data.op_code;
+    }
+    else if (type == kConstNumber)
+    {
+        memcpy(&key, &data.const_val, sizeof(key));
+    }
+    else
+    {
+        key = (uint64_t) data.variable_pos;
+    }
+
+    return key;
+}
+
+//------------------------------------------------------------------------------
+// One for the node itself and the rough price of evaluating it, a function
+// call costs as much as a few dozen additions.
+
+static double NodeCost(ExpressionType_t type,
+                       NodeData         data)
+{
+    if (type != kOperator)
+    {
+        return 1;
+    }
+
+    switch (data.op_code)
+    {
+        case kAdd:
+        case kSub:
+        {
+            return 2;
+        }
+
+        case kMult:
+        {
+            return 3;
+        }
+
+        case kDiv:
+        case kSqrt:
+        {
+            return 10;
+        }
+
+        case kSin:
+        case kCos:
+        case kTg:
+        case kLn:
+        case kExp:
+        case kNotAnOperation:
+        default:
+        {
+            return 40;
+        }
+    }
+}
+
+//==============================================================================
+
+static double ElapsedMs(clock_t start)
+{
+    return (double) (clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
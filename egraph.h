@@ -0,0 +1,124 @@
+#ifndef EGRAPH_HEADER
+#define EGRAPH_HEADER
+
+#include <stdio.h>
+
+#include "trees.h"
+#include "rules.h"
+
+//! Equality saturation for OptimizeTree(). While an EGraph is selected, the
+//! optimized tree is added to an e-graph where every e-class holds nodes
+//! known to be equal. The rules of RuleSetCurrent() and the algebra rules of
+//! the EGraph (commutativity, associativity, factoring, merging divisions)
+//! are applied to all of them without removing anything, so no rewrite can
+//! block another one. Binary operators on numbers are folded like OpCtor()
+//! does. Saturation stops at node_limit nodes, iter_limit rounds or
+//! time_limit_ms, then the cheapest tree of the root class is taken if it is
+//! cheaper than the input one, see EGraphTreeCost(). A factor is only
+//! cancelled from a fraction if it is a nonzero number, e-classes have no
+//! bounds to prove more. No rule rewrites the exponent of a base that is not
+//! a positive number: regrouped, an exponent that is exactly 1 in the input
+//! may round to 0.99999999999999989 and a negative base gives NaN.
+//!
+//! Extracted trees are for storing and evaluating. Their derivatives are
+//! often bigger than those of canonical trees (factored sums and merged
+//! fractions grow under the quotient rule), so a chain of derivatives keeps
+//! differentiating the canonical tree.
+
+static const size_t kENone = SIZE_MAX;
+
+static const size_t kBaseENodeLimit   = 20000;
+static const size_t kBaseEIterLimit   = 10;
+static const double kBaseETimeLimitMs = 50;
+
+struct ENode
+{
+    ExpressionType_t type;
+    NodeData         data;
+
+    size_t left;  // e-classes, kENone if there is no operand
+    size_t right;
+
+    size_t eclass;
+    size_t next;   // next node of the same e-class
+
+    bool dead;     // equal to another node of its e-class
+};
+
+struct EClass
+{
+    size_t parent; // union-find, the class itself for a root
+
+    size_t first;  // nodes of the class
+    size_t last;
+
+    bool      has_const;
+    NumType_t const_val;
+
+    double cost;   // of the cheapest tree, set by extraction
+    size_t best;
+
+    bool frozen;   // under the exponent of a base not known positive
+};
+
+struct EMatch
+{
+    const Rule *rule;
+    size_t      eclass;
+    size_t      binds[kMaxRuleVars];
+};
+
+struct EGraph
+{
+    ENode *nodes;
+    size_t node_count;
+    size_t node_capacity;
+
+    EClass *classes;
+    size_t  class_count;
+    size_t  class_capacity;
+
+    size_t *table; // hashcons, node indices
+    size_t  table_capacity;
+
+    EMatch *matches;
+    size_t  match_count;
+    size_t  match_capacity;
+
+    RuleSet algebra;
+
+    size_t node_limit;
+    size_t iter_limit;
+    double time_limit_ms;
+
+    size_t runs;
+    size_t iterations;
+    size_t saturated;
+    size_t max_nodes;
+    size_t improved;
+    double cost_before;
+    double cost_after;
+};
+
+TreeErrs_t EGraphCtor(EGraph *eg);
+
+TreeErrs_t EGraphDtor(EGraph *eg);
+
+//! Makes eg current for the calling thread, returns the previous one.
+EGraph *EGraphSelect(EGraph *eg);
+
+EGraph *EGraphCurrent();
+
+//! Saturates the e-graph of tree and replaces the root with the cheapest
+//! tree found. Trees of a DagTable are left as they are.
+TreeErrs_t EGraphSimplify(EGraph *eg,
+                          Tree   *tree);
+
+//! Size of the tree plus the rough cost of evaluating it once: + and - are
+//! the cheapest, then *, then / and sqrt, functions and ^ are the dearest.
+double EGraphTreeCost(const TreeNode *node);
+
+void EGraphDump(const EGraph *eg,
+                FILE         *output_file);
+
+#endif
@@ -0,0 +1,331 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gradient.h"
+#include "diff.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+static const size_t kBaseTapeCapacity = 64;
+static const size_t kTapeMultiplier   = 2;
+
+static TreeErrs_t TapePush(GradTape  *tape,
+                           GradEntry  entry,
+                           size_t    *idx);
+
+static void TapePartials(const TreeNode *node,
+                         GradEntry      *entry,
+                         NumType_t       left,
+                         NumType_t       right);
+
+//==============================================================================
+
+TreeErrs_t GradTapeCtor(GradTape *tape)
+{
+    CHECK(tape);
+
+    tape->entries  = (GradEntry *) calloc(kBaseTapeCapacity, sizeof(GradEntry));
+    tape->adjoints = (NumType_t *) calloc(kBaseTapeCapacity, sizeof(NumType_t));
+
+    if (tape->entries == nullptr || tape->adjoints == nullptr)
+    {
+        GradTapeDtor(tape);
+
+        return kFailedAllocation;
+    }
+
+    tape->size     = 0;
+    tape->capacity = kBaseTapeCapacity;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t GradTapeDtor(GradTape *tape)
+{
+    CHECK(tape);
+
+    free(tape->entries);
+    free(tape->adjoints);
+
+    tape->entries  = nullptr;
+    tape->adjoints = nullptr;
+    tape->size     = 0;
+    tape->capacity = 0;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t EvalGradient(GradTape       *tape,
+                        Variables      *vars,
+                        const TreeNode *node,
+                        NumType_t      *value,
+                        NumType_t      *grad)
+{
+    static const int kGradEnter  = 0;
+    static const int kGradRecord = 1;
+
+    CHECK(tape);
+    CHECK(vars);
+    CHECK(node);
+    CHECK(value);
+    CHECK(grad);
+
+    tape->size = 0;
+
+    WorkStack frames  = {};
+    WorkStack records = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&records);
+
+    TreeErrs_t status = WorkPushNode(&frames, node, kGradEnter);
+
+    // forward sweep, records holds the tape index of every finished operand
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        GradEntry entry = {kGradNone, kGradNone, kGradNone, 0, 0, 0};
+
+        if (frame.state == kGradRecord)
+        {
+            entry.right = (uint32_t) WorkPop(&records).val.idx;
+            entry.left  = (uint32_t) WorkPop(&records).val.idx;
+
+            NumType_t left  = (entry.left  != kGradNone) ? tape->entries[entry.left].val  : 0;
+            NumType_t right = (entry.right != kGradNone) ? tape->entries[entry.right].val : 0;
+
+            entry.val = ApplyOp(curr->data.op_code, left, right);
+
+            TapePartials(curr, &entry, left, right);
+        }
+        else if (curr == nullptr)
+        {
+            // missing operand of a unary op, kGradNone goes to records
+        }
+        else if (curr->type == kOperator)
+        {
+            if ((status = WorkPushNode(&frames, curr,        kGradRecord)) != kTreeSuccess ||
+                (status = WorkPushNode(&frames, curr->right, kGradEnter))  != kTreeSuccess ||
+                (status = WorkPushNode(&frames, curr->left,  kGradEnter))  != kTreeSuccess)
+            {
+                break;
+            }
+
+            continue;
+        }
+        else if (curr->type == kConstNumber)
+        {
+            entry.val = curr->data.const_val;
+        }
+        else
+        {
+            entry.var = (uint32_t) curr->data.variable_pos;
+            entry.val = vars->var_array[curr->data.variable_pos].value;
+        }
+
+        WorkItem item = {};
+        item.val.idx  = kGradNone;
+
+        if (curr == nullptr || (status = TapePush(tape, entry, &item.val.idx)) == kTreeSuccess)
+        {
+            status = WorkPush(&records, item);
+        }
+    }
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&records);
+
+    for (size_t i = 0; i < vars->var_count; i++)
+    {
+        grad[i] = (status == kTreeSuccess) ? 0 : NAN;
+    }
+
+    if (status != kTreeSuccess || tape->size == 0)
+    {
+        *value = NAN;
+
+        return status;
+    }
+
+    // backward sweep, operands are always recorded before their operator
+
+    memset(tape->adjoints, 0, tape->size * sizeof(NumType_t));
+
+    tape->adjoints[tape->size - 1] = 1;
+
+    for (size_t i = tape->size; i-- > 0; )
+    {
+        const GradEntry *entry = &tape->entries[i];
+
+        NumType_t adjoint = tape->adjoints[i];
+
+        if (entry->var != kGradNone)
+        {
+            grad[entry->var] += adjoint;
+        }
+
+        if (entry->left != kGradNone)
+        {
+            tape->adjoints[entry->left] += adjoint * entry->d_left;
+        }
+
+        if (entry->right != kGradNone)
+        {
+            tape->adjoints[entry->right] += adjoint * entry->d_right;
+        }
+    }
+
+    *value = tape->entries[tape->size - 1].val;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static TreeErrs_t TapePush(GradTape  *tape,
+                           GradEntry  entry,
+                           size_t    *idx)
+{
+    if (tape->size >= tape->capacity)
+    {
+        size_t new_capacity = tape->capacity * kTapeMultiplier;
+
+        GradEntry *new_entries  = (GradEntry *) realloc(tape->entries, new_capacity * sizeof(GradEntry));
+
+        if (new_entries == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        tape->entries = new_entries;
+
+        NumType_t *new_adjoints = (NumType_t *) realloc(tape->adjoints, new_capacity * sizeof(NumType_t));
+
+        if (new_adjoints == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        tape->adjoints = new_adjoints;
+        tape->capacity = new_capacity;
+    }
+
+    *idx = tape->size;
+
+    tape->entries[tape->size++] = entry;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// d(node)/d(left) and d(node)/d(right) by the rules of DiffRule(), unary ops
+// depend on right only.
+
+static void TapePartials(const TreeNode *node,
+                         GradEntry      *entry,
+                         NumType_t       left,
+                         NumType_t       right)
+{
+    switch (node->data.op_code)
+    {
+        case kAdd:
+        {
+            entry->d_left  = 1;
+            entry->d_right = 1;
+
+            break;
+        }
+
+        case kSub:
+        {
+            entry->d_left  =  1;
+            entry->d_right = -1;
+
+            break;
+        }
+
+        case kMult:
+        {
+            entry->d_left  = right;
+            entry->d_right = left;
+
+            break;
+        }
+
+        case kDiv:
+        {
+            entry->d_left  = ApplyOp(kDiv, right, pow(right, 2));
+            entry->d_right = ApplyOp(kDiv, -left, pow(right, 2));
+
+            break;
+        }
+
+        case kSqrt:
+        {
+            entry->d_right = ApplyOp(kDiv, 1, 2 * entry->val);
+
+            break;
+        }
+
+        case kCos:
+        {
+            entry->d_right = -1 * sin(right);
+
+            break;
+        }
+
+        case kSin:
+        {
+            entry->d_right = cos(right);
+
+            break;
+        }
+
+        case kTg:
+        {
+            entry->d_right = ApplyOp(kDiv, 1, pow(cos(right), 2));
+
+            break;
+        }
+
+        case kLn:
+        {
+            entry->d_right = ApplyOp(kDiv, 1, right);
+
+            break;
+        }
+
+        case kExp:
+        {
+            if (node->right->type == kConstNumber && !IsNumEqual(node->right->data.const_val, 0))
+            {
+                entry->d_left = right * pow(left, right - 1);
+
+                break;
+            }
+
+            entry->d_left  = entry->val * ApplyOp(kDiv, right, left);
+            entry->d_right = entry->val * log(left);
+
+            break;
+        }
+
+        case kNotAnOperation:
+        default:
+        {
+            entry->d_left  = NAN;
+            entry->d_right = NAN;
+
+            break;
+        }
+    }
+}
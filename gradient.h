@@ -0,0 +1,50 @@
+#ifndef GRADIENT_HEADER
+#define GRADIENT_HEADER
+
+#include <stdint.h>
+
+#include "trees.h"
+#include "parse.h"
+
+//! Reverse mode: one forward sweep records every node with the partial
+//! derivatives of its value by its operands, one backward sweep over the
+//! records accumulates the adjoints into the gradient by every variable.
+//! The tape keeps its memory between calls, so evaluating the same
+//! expression at many points allocates only once.
+
+static const uint32_t kGradNone = UINT32_MAX;
+
+struct GradEntry
+{
+    uint32_t left;  // operand records, kGradNone if there is none
+    uint32_t right;
+    uint32_t var;   // variable position for variables, kGradNone otherwise
+
+    NumType_t val;
+    NumType_t d_left;
+    NumType_t d_right;
+};
+
+struct GradTape
+{
+    GradEntry *entries;
+    size_t     size;
+    size_t     capacity;
+
+    NumType_t *adjoints; // capacity values
+};
+
+TreeErrs_t GradTapeCtor(GradTape *tape);
+
+TreeErrs_t GradTapeDtor(GradTape *tape);
+
+//! Value of node at the current vars and grad[i] = df / d(var_array[i]) for
+//! every i < vars->var_count. Partial derivatives follow DiffTree(), so
+//! division by zero gives NAN.
+TreeErrs_t EvalGradient(GradTape       *tape,
+                        Variables      *vars,
+                        const TreeNode *node,
+                        NumType_t      *value,
+                        NumType_t      *grad);
+
+#endif
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <new>
+#include <thread>
+#include <atomic>
+
+#include "jacobian.h"
+#include "diff.h"
+#include "canon.h"
+#include "dag.h"
+#include "rules.h"
+#include "diff_memo.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+struct JacobianJob
+{
+    Jacobian        *jac;
+    TreeNode *const *funcs;
+
+    const size_t *pairs; // indices of the entries that are not structural zeros
+    size_t        pair_count;
+
+    std::atomic<size_t> next_pair;
+    std::atomic<bool>   failed;
+};
+
+static void JacobianWorker(JacobianJob *job,
+                           size_t       worker);
+
+static TreeErrs_t MarkSharedVars(const TreeNode *node,
+                                 bool           *row);
+
+//==============================================================================
+
+TreeErrs_t JacobianCtor(Jacobian        *jac,
+                        Variables       *vars,
+                        TreeNode *const *funcs,
+                        size_t           func_count,
+                        size_t           thread_count)
+{
+    CHECK(jac);
+    CHECK(vars);
+    CHECK(funcs);
+
+    size_t entry_count = func_count * vars->var_count;
+
+    jac->func_count    = func_count;
+    jac->var_count     = vars->var_count;
+    jac->nonzero_count = 0;
+    jac->entries       = (TreeNode **) calloc(entry_count + 1, sizeof(TreeNode *));
+    jac->arenas        = nullptr;
+    jac->arena_count   = 0;
+
+    bool   *pattern = (bool *)   calloc(entry_count + 1, sizeof(bool));
+    size_t *pairs   = (size_t *) calloc(entry_count + 1, sizeof(size_t));
+
+    TreeErrs_t status = (jac->entries == nullptr || pattern == nullptr || pairs == nullptr) ?
+                        kFailedAllocation : JacobianPattern(vars, funcs, func_count, pattern);
+
+    size_t pair_count = 0;
+
+    for (size_t i = 0; status == kTreeSuccess && i < entry_count; i++)
+    {
+        if (pattern[i])
+        {
+            pairs[pair_count++] = i;
+        }
+    }
+
+    free(pattern);
+
+    if (status != kTreeSuccess)
+    {
+        free(pairs);
+        JacobianDtor(jac);
+
+        return status;
+    }
+
+    jac->nonzero_count = pair_count;
+
+    if (thread_count == 0)
+    {
+        thread_count = std::thread::hardware_concurrency();
+    }
+
+    if (thread_count > pair_count)
+    {
+        thread_count = pair_count;
+    }
+
+    if (thread_count == 0)
+    {
+        thread_count = 1;
+    }
+
+    jac->arenas      = (NodeArena *) calloc(thread_count, sizeof(NodeArena));
+    jac->arena_count = thread_count;
+
+    if (jac->arenas == nullptr)
+    {
+        free(pairs);
+        JacobianDtor(jac);
+
+        return kFailedAllocation;
+    }
+
+    JacobianJob job = {jac, funcs, pairs, pair_count, {0}, {false}};
+
+    // the calling thread is worker 0
+
+    std::thread *threads = new (std::nothrow) std::thread[thread_count - 1];
+
+    size_t started = 0;
+
+    if (threads != nullptr)
+    {
+        try
+        {
+            for ( ; started < thread_count - 1; started++)
+            {
+                threads[started] = std::thread(JacobianWorker, &job, started + 1);
+            }
+        }
+        catch (...)
+        {
+            // fewer threads are started, the rest of the pairs go to the others
+        }
+    }
+
+    JacobianWorker(&job, 0);
+
+    for (size_t i = 0; i < started; i++)
+    {
+        threads[i].join();
+    }
+
+    delete[] threads;
+
+    free(pairs);
+
+    if (job.failed)
+    {
+        JacobianDtor(jac);
+
+        return kFailedAllocation;
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t JacobianDtor(Jacobian *jac)
+{
+    CHECK(jac);
+
+    // every entry lives in one of the arenas
+
+    for (size_t i = 0; jac->arenas != nullptr && i < jac->arena_count; i++)
+    {
+        NodeArenaDtor(&jac->arenas[i]);
+    }
+
+    free(jac->entries);
+    free(jac->arenas);
+
+    jac->entries     = nullptr;
+    jac->arenas      = nullptr;
+    jac->arena_count = 0;
+    jac->func_count    = 0;
+    jac->var_count     = 0;
+    jac->nonzero_count = 0;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t JacobianPattern(const Variables *vars,
+                           TreeNode *const *funcs,
+                           size_t           func_count,
+                           bool            *pattern)
+{
+    CHECK(vars);
+    CHECK(funcs);
+    CHECK(pattern);
+
+    size_t var_count = vars->var_count;
+
+    for (size_t func = 0; func < func_count; func++)
+    {
+        bool     *row  = pattern + func * var_count;
+        VarDeps_t deps = (funcs[func] != nullptr) ? funcs[func]->deps : 0;
+
+        for (size_t var = 0; var < var_count; var++)
+        {
+            row[var] = (var < kSharedDepsBit) && (deps & VarDepsBit(var)) != 0;
+        }
+
+        if (var_count > kSharedDepsBit && (deps & VarDepsBit(kSharedDepsBit)) != 0)
+        {
+            TreeErrs_t status = MarkSharedVars(funcs[func], row);
+
+            if (status != kTreeSuccess)
+            {
+                return status;
+            }
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeNode *JacobianEntry(const Jacobian *jac,
+                        size_t          func,
+                        size_t          var)
+{
+    CHECK(jac);
+
+    if (func >= jac->func_count || var >= jac->var_count)
+    {
+        return nullptr;
+    }
+
+    return jac->entries[func * jac->var_count + var];
+}
+
+//==============================================================================
+
+static void JacobianWorker(JacobianJob *job,
+                           size_t       worker)
+{
+    Jacobian *jac = job->jac;
+
+    // worker 0 is the calling thread, none of its tables are shared
+
+    NodeArena *arena      = &jac->arenas[worker];
+    NodeArena *prev_arena = NodeArenaSelect(arena);
+    DagTable  *prev_dag   = DagSelect(nullptr);
+    RuleSet   *prev_rules = RuleSetSelect(nullptr);
+    DiffMemo  *prev_memo  = DiffMemoSelect(nullptr);
+
+    for (size_t next = job->next_pair++; next < job->pair_count; next = job->next_pair++)
+    {
+        size_t pair = job->pairs[next];
+
+        Tree tree  = {};
+        tree.arena = arena;
+        tree.root  = DiffTree(job->funcs[pair / jac->var_count], pair % jac->var_count, nullptr);
+
+        if (tree.root == nullptr)
+        {
+            job->failed = true;
+
+            continue;
+        }
+
+        // not OptimizeTree(), its graph dump is not thread-safe
+
+        if (SimplifyTree(&tree) != kTreeSuccess || CanonTree(&tree) != kTreeSuccess)
+        {
+            job->failed = true;
+        }
+
+        jac->entries[pair] = tree.root;
+    }
+
+    DiffMemoSelect(prev_memo);
+    RuleSetSelect(prev_rules);
+    DagSelect(prev_dag);
+    NodeArenaSelect(prev_arena);
+}
+
+//==============================================================================
+
+static TreeErrs_t MarkSharedVars(const TreeNode *node,
+                                 bool           *row)
+{
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    TreeErrs_t status = WorkPushNode(&stk, node, 0);
+
+    while (stk.size > 0 && status == kTreeSuccess)
+    {
+        const TreeNode *curr = WorkPop(&stk).val.const_node;
+
+        if ((curr->deps & VarDepsBit(kSharedDepsBit)) == 0)
+        {
+            continue;
+        }
+
+        if (curr->type == kVariable)
+        {
+            row[curr->data.variable_pos] = true;
+        }
+
+        if ((curr->left  != nullptr && (status = WorkPushNode(&stk, curr->left,  0)) != kTreeSuccess) ||
+            (curr->right != nullptr && (status = WorkPushNode(&stk, curr->right, 0)) != kTreeSuccess))
+        {
+            break;
+        }
+    }
+
+    WorkStackDtor(&stk);
+
+    return status;
+}
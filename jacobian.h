@@ -0,0 +1,51 @@
+#ifndef JACOBIAN_HEADER
+#define JACOBIAN_HEADER
+
+#include "trees.h"
+#include "parse.h"
+
+//! Symbolic Jacobian of func_count expressions by every variable of vars.
+//! Every (expression, variable) pair is differentiated and simplified on its
+//! own, the pairs are spread over thread_count worker threads (0 means one
+//! per hardware thread). Input trees are only read and may be shared between
+//! workers, they must not live in a DagTable. Each worker allocates from its
+//! own NodeArena, all of them are owned by the Jacobian. The DagTable,
+//! RuleSet and DiffMemo selected by the caller are not used, so every entry
+//! comes out the same whichever thread computes it.
+//!
+//! Entries whose expression does not contain the variable are structural
+//! zeros: they are never differentiated and stay nullptr.
+
+struct Jacobian
+{
+    size_t func_count;
+    size_t var_count;
+
+    TreeNode **entries; // entries[func * var_count + var] = d func / d var
+    size_t     nonzero_count;
+
+    NodeArena *arenas;
+    size_t     arena_count;
+};
+
+TreeErrs_t JacobianCtor(Jacobian        *jac,
+                        Variables       *vars,
+                        TreeNode *const *funcs,
+                        size_t           func_count,
+                        size_t           thread_count);
+
+TreeErrs_t JacobianDtor(Jacobian *jac);
+
+//! pattern[func * var_count + var] is true if func depends on var. Taken
+//! from deps of the roots, the variables sharing the last bit are looked up
+//! in the tree.
+TreeErrs_t JacobianPattern(const Variables *vars,
+                           TreeNode *const *funcs,
+                           size_t           func_count,
+                           bool            *pattern);
+
+TreeNode *JacobianEntry(const Jacobian *jac,
+                        size_t          func,
+                        size_t          var);
+
+#endif
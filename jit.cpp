@@ -0,0 +1,493 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "jit.h"
+#include "debug/debug.h"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(DIFF_NO_JIT)
+#define DIFF_JIT_ENABLED
+#endif
+
+#ifdef DIFF_JIT_ENABLED
+
+#define JIT_EMIT(buf, ...)                                  \
+    do                                                      \
+    {                                                       \
+        const uint8_t jit_bytes_[] = {__VA_ARGS__};         \
+                                                            \
+        JitBytes(buf, jit_bytes_, sizeof(jit_bytes_));      \
+    } while (0)
+
+static const size_t kBaseJitCapacity = 256;
+
+static const size_t kJitMultiplier = 2;
+
+static const uint32_t kJitNoReg = UINT32_MAX;
+
+// rbx holds the register file, r12 the variables; 8 bytes keep rsp aligned
+// for calls and 32 are the Win64 shadow space.
+static const uint8_t kJitFrameSize = 40;
+
+struct JitBuf
+{
+    uint8_t *data;
+
+    size_t size;
+    size_t capacity;
+
+    bool failed;
+};
+
+static void JitBytes(JitBuf        *buf,
+                     const uint8_t *bytes,
+                     size_t         count);
+
+static void JitImm32(JitBuf   *buf,
+                     uint32_t  imm);
+
+static void JitImm64(JitBuf   *buf,
+                     uint64_t  imm);
+
+static void JitRegOp(JitBuf   *buf,
+                     uint8_t   opcode,
+                     uint8_t   xmm,
+                     uint32_t  reg);
+
+static void JitCall(JitBuf     *buf,
+                    const void *func);
+
+static void JitInstr(JitBuf        *buf,
+                     const BcInstr *ins,
+                     uint32_t       prev_dst);
+
+static void *JitMap(const JitBuf *buf);
+
+static void JitUnmap(void   *code,
+                     size_t  size);
+
+//==============================================================================
+
+static void JitBytes(JitBuf        *buf,
+                     const uint8_t *bytes,
+                     size_t         count)
+{
+    if (buf->failed)
+    {
+        return;
+    }
+
+    if (buf->size + count > buf->capacity)
+    {
+        size_t new_capacity = (buf->capacity == 0) ? kBaseJitCapacity : buf->capacity * kJitMultiplier;
+
+        while (new_capacity < buf->size + count)
+        {
+            new_capacity *= kJitMultiplier;
+        }
+
+        uint8_t *new_data = (uint8_t *) realloc(buf->data, new_capacity);
+
+        if (new_data == nullptr)
+        {
+            buf->failed = true;
+
+            return;
+        }
+
+        buf->data     = new_data;
+        buf->capacity = new_capacity;
+    }
+
+    memcpy(buf->data + buf->size, bytes, count);
+
+    buf->size += count;
+}
+
+//==============================================================================
+
+static void JitImm32(JitBuf   *buf,
+                     uint32_t  imm)
+{
+    uint8_t bytes[4] = {};
+
+    for (size_t i = 0; i < sizeof(bytes); i++)
+    {
+        bytes[i] = (uint8_t) (imm >> (8 * i));
+    }
+
+    JitBytes(buf, bytes, sizeof(bytes));
+}
+
+//==============================================================================
+
+static void JitImm64(JitBuf   *buf,
+                     uint64_t  imm)
+{
+    JitImm32(buf, (uint32_t) imm);
+    JitImm32(buf, (uint32_t) (imm >> 32));
+}
+
+//==============================================================================
+
+// F2 0F <opcode> with xmm and [rbx + reg * 8]: movsd (10 load, 11 store),
+// addsd 58, mulsd 59, subsd 5C, divsd 5E, sqrtsd 51.
+
+static void JitRegOp(JitBuf   *buf,
+                     uint8_t   opcode,
+                     uint8_t   xmm,
+                     uint32_t  reg)
+{
+    const uint8_t bytes[] = {0xf2, 0x0f, opcode, (uint8_t) (0x83 | (xmm << 3))};
+
+    JitBytes(buf, bytes, sizeof(bytes));
+    JitImm32(buf, reg * (uint32_t) sizeof(NumType_t));
+}
+
+//==============================================================================
+
+static void JitCall(JitBuf     *buf,
+                    const void *func)
+{
+    JIT_EMIT(buf, 0x48, 0xb8);     // mov rax, imm64
+    JitImm64(buf, (uint64_t) (uintptr_t) func);
+    JIT_EMIT(buf, 0xff, 0xd0);     // call rax
+}
+
+//==============================================================================
+
+static void JitInstr(JitBuf        *buf,
+                     const BcInstr *ins,
+                     uint32_t       prev_dst)
+{
+    static const uint8_t kMovsdLoad  = 0x10;
+    static const uint8_t kMovsdStore = 0x11;
+    static const uint8_t kSqrtsd     = 0x51;
+    static const uint8_t kAddsd      = 0x58;
+    static const uint8_t kMulsd      = 0x59;
+    static const uint8_t kSubsd      = 0x5c;
+    static const uint8_t kDivsd      = 0x5e;
+
+    switch ((BcOp_t) ins->op)
+    {
+        case kBcLoadVar:
+        {
+            // movsd xmm0, [r12 + disp32]
+            JIT_EMIT(buf, 0xf2, 0x41, 0x0f, 0x10, 0x84, 0x24);
+            JitImm32(buf, (uint32_t) (ins->lhs * sizeof(Variable) + offsetof(Variable, value)));
+
+            break;
+        }
+
+        case kBcAdd:
+        case kBcMult:
+        {
+            uint8_t opcode = (ins->op == kBcAdd) ? kAddsd : kMulsd;
+
+            if (ins->rhs == prev_dst)
+            {
+                JitRegOp(buf, opcode, 0, ins->lhs);
+            }
+            else
+            {
+                if (ins->lhs != prev_dst)
+                {
+                    JitRegOp(buf, kMovsdLoad, 0, ins->lhs);
+                }
+
+                JitRegOp(buf, opcode, 0, ins->rhs);
+            }
+
+            break;
+        }
+
+        case kBcSub:
+        {
+            if (ins->lhs != prev_dst)
+            {
+                JitRegOp(buf, kMovsdLoad, 0, ins->lhs);
+            }
+
+            JitRegOp(buf, kSubsd, 0, ins->rhs);
+
+            break;
+        }
+
+        case kBcDiv:
+        {
+            if (ins->lhs != prev_dst)
+            {
+                JitRegOp(buf, kMovsdLoad, 0, ins->lhs);
+            }
+
+            JitRegOp(buf, kMovsdLoad, 1, ins->rhs);
+            JitRegOp(buf, kDivsd,     0, ins->rhs);
+
+            // a zero divisor (not nan) gives NAN, as in Eval()
+            JIT_EMIT(buf, 0x66, 0x0f, 0x57, 0xd2);   // xorpd   xmm2, xmm2
+            JIT_EMIT(buf, 0x66, 0x0f, 0x2e, 0xca);   // ucomisd xmm1, xmm2
+            JIT_EMIT(buf, 0x7a, 17);                 // jp  end
+            JIT_EMIT(buf, 0x75, 15);                 // jne end
+
+            NumType_t nan_val  = NAN;
+            uint64_t  nan_bits = 0;
+
+            memcpy(&nan_bits, &nan_val, sizeof(nan_bits));
+
+            JIT_EMIT(buf, 0x48, 0xb8);               // mov  rax, NAN
+            JitImm64(buf, nan_bits);
+            JIT_EMIT(buf, 0x66, 0x48, 0x0f, 0x6e, 0xc0); // movq xmm0, rax
+
+            break;
+        }
+
+        case kBcSqrt:
+        {
+            JitRegOp(buf, kSqrtsd, 0, ins->rhs);
+
+            break;
+        }
+
+        case kBcSin:
+        case kBcCos:
+        case kBcTg:
+        case kBcLn:
+        {
+            if (ins->rhs != prev_dst)
+            {
+                JitRegOp(buf, kMovsdLoad, 0, ins->rhs);
+            }
+
+            double (*func)(double) = log;
+
+            if      (ins->op == kBcSin) func = sin;
+            else if (ins->op == kBcCos) func = cos;
+            else if (ins->op == kBcTg)  func = tan;
+
+            JitCall(buf, (const void *) func);
+
+            break;
+        }
+
+        case kBcExp:
+        {
+            if (ins->lhs != prev_dst)
+            {
+                JitRegOp(buf, kMovsdLoad, 0, ins->lhs);
+            }
+
+            JitRegOp(buf, kMovsdLoad, 1, ins->rhs);
+
+            double (*pow_func)(double, double) = pow;
+
+            JitCall(buf, (const void *) pow_func);
+
+            break;
+        }
+
+        default:
+        {
+            buf->failed = true;
+
+            return;
+        }
+    }
+
+    JitRegOp(buf, kMovsdStore, 0, ins->dst);
+}
+
+//==============================================================================
+
+static void *JitMap(const JitBuf *buf)
+{
+#if defined(_WIN32)
+    void *code = VirtualAlloc(nullptr, buf->size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (code == nullptr)
+    {
+        return nullptr;
+    }
+
+    memcpy(code, buf->data, buf->size);
+
+    DWORD old_protect = 0;
+
+    if (!VirtualProtect(code, buf->size, PAGE_EXECUTE_READ, &old_protect))
+    {
+        VirtualFree(code, 0, MEM_RELEASE);
+
+        return nullptr;
+    }
+
+    FlushInstructionCache(GetCurrentProcess(), code, buf->size);
+#else
+    void *code = mmap(nullptr, buf->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    memcpy(code, buf->data, buf->size);
+
+    if (mprotect(code, buf->size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, buf->size);
+
+        return nullptr;
+    }
+#endif
+
+    return code;
+}
+
+//==============================================================================
+
+static void JitUnmap(void   *code,
+                     size_t  size)
+{
+#if defined(_WIN32)
+    (void) size;
+
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, size);
+#endif
+}
+
+#endif // DIFF_JIT_ENABLED
+
+//==============================================================================
+
+TreeErrs_t JitCtor(JitFunc *jit)
+{
+    CHECK(jit);
+
+    memset(jit, 0, sizeof(JitFunc));
+
+    return BcCtor(&jit->prog);
+}
+
+//==============================================================================
+
+TreeErrs_t JitDtor(JitFunc *jit)
+{
+    CHECK(jit);
+
+#ifdef DIFF_JIT_ENABLED
+    if (jit->code != nullptr)
+    {
+        JitUnmap(jit->code, jit->code_size);
+    }
+#endif
+
+    BcDtor(&jit->prog);
+
+    memset(jit, 0, sizeof(JitFunc));
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t JitCompile(JitFunc        *jit,
+                      const TreeNode *node)
+{
+    CHECK(jit);
+    CHECK(node);
+
+#ifdef DIFF_JIT_ENABLED
+    if (jit->code != nullptr)
+    {
+        JitUnmap(jit->code, jit->code_size);
+    }
+#endif
+
+    jit->code      = nullptr;
+    jit->code_size = 0;
+    jit->entry     = nullptr;
+
+    TreeErrs_t status = BcCompile(&jit->prog, node);
+
+    if (status != kTreeSuccess)
+    {
+        return status;
+    }
+
+#ifdef DIFF_JIT_ENABLED
+    JitBuf buf = {};
+
+    const BcProgram *prog = &jit->prog;
+
+    // System V passes the arguments in rdi and rsi, Win64 in rcx and rdx
+
+    JIT_EMIT(&buf, 0x53);                         // push rbx
+    JIT_EMIT(&buf, 0x41, 0x54);                   // push r12
+    JIT_EMIT(&buf, 0x48, 0x83, 0xec, kJitFrameSize); // sub  rsp, frame
+#if defined(_WIN32)
+    JIT_EMIT(&buf, 0x48, 0x89, 0xcb);             // mov  rbx, rcx
+    JIT_EMIT(&buf, 0x49, 0x89, 0xd4);             // mov  r12, rdx
+#else
+    JIT_EMIT(&buf, 0x48, 0x89, 0xfb);             // mov  rbx, rdi
+    JIT_EMIT(&buf, 0x49, 0x89, 0xf4);             // mov  r12, rsi
+#endif
+
+    uint32_t prev_dst = kJitNoReg;
+
+    for (size_t i = 0; i < prog->code_size; i++)
+    {
+        JitInstr(&buf, &prog->code[i], prev_dst);
+
+        prev_dst = prog->code[i].dst;
+    }
+
+    if (prev_dst != prog->result)
+    {
+        JitRegOp(&buf, 0x10, 0, prog->result);                           // movsd xmm0, result
+    }
+
+    JIT_EMIT(&buf, 0x48, 0x83, 0xc4, kJitFrameSize); // add  rsp, frame
+    JIT_EMIT(&buf, 0x41, 0x5c);                   // pop  r12
+    JIT_EMIT(&buf, 0x5b);                         // pop  rbx
+    JIT_EMIT(&buf, 0xc3);                         // ret
+
+    if (!buf.failed)
+    {
+        jit->code = JitMap(&buf);
+    }
+
+    if (jit->code != nullptr)
+    {
+        jit->code_size = buf.size;
+        jit->entry     = (JitEntry_t) jit->code;
+    }
+
+    free(buf.data);
+#endif
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+NumType_t JitEval(JitFunc         *jit,
+                  const Variables *vars)
+{
+    CHECK(jit);
+    CHECK(vars);
+
+    if (jit->entry == nullptr)
+    {
+        return BcEval(&jit->prog, vars);
+    }
+
+    return jit->entry(jit->prog.regs, vars->var_array);
+}
@@ -0,0 +1,42 @@
+#ifndef JIT_HEADER
+#define JIT_HEADER
+
+#include "trees.h"
+#include "parse.h"
+#include "bytecode.h"
+
+//! Native x86-64 code generated from the bytecode of an expression.
+//! Every bytecode instruction becomes a few SSE2 instructions working on the
+//! register file of prog, transcendental ops call libm. The value computed
+//! by the previous instruction stays in xmm0 and is not loaded again.
+//! Code pages are written first and made executable after (W^X).
+//!
+//! The JIT is built for x86-64 with the System V and Win64 conventions and
+//! can be turned off with -DDIFF_NO_JIT. When it is off, or the code buffer
+//! cannot be mapped, JitEval() runs the bytecode interpreter instead.
+
+typedef NumType_t (*JitEntry_t)(NumType_t      *regs,
+                                const Variable *var_array);
+
+struct JitFunc
+{
+    BcProgram prog;
+
+    void   *code;
+    size_t  code_size;
+
+    JitEntry_t entry; // nullptr if the bytecode is used
+};
+
+TreeErrs_t JitCtor(JitFunc *jit);
+
+TreeErrs_t JitDtor(JitFunc *jit);
+
+TreeErrs_t JitCompile(JitFunc        *jit,
+                      const TreeNode *node);
+
+//! Bit-identical to Eval().
+NumType_t JitEval(JitFunc         *jit,
+                  const Variables *vars);
+
+#endif
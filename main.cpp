@@ -1,10 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "trees.h"
 #include "diff.h"
 #include "tree_dump.h"
 #include "parse.h"
+#include "codegen.h"
+#include "rules.h"
+
+static void ParseOpts(int            argc,
+                      const char    *argv[],
+                      MaclaurinOpts *opts);
 
 int main(int argc, const char *argv[])
 {
@@ -31,11 +38,31 @@ int main(int argc, const char *argv[])
     expr.pos  = 0;
     Tree func = {0};
 
+    MaclaurinOpts opts;
+    ParseOpts(argc, argv, &opts);
+
+
+    RuleSet rules = {};
+
+    if (RuleSetCtor(&rules) != kTreeSuccess ||
+        RuleSetAddDefaults(&rules) != kTreeSuccess ||
+        (opts.rules_file_name != nullptr && RuleSetLoad(&rules, opts.rules_file_name) != kTreeSuccess))
+    {
+        printf(">>Failed to load rewrite rules\n");
+    }
+
+    RuleSetSelect(&rules);
 
     func.root = GetG(&vars, &expr);
-    OptimizeTree(&vars, &func);
+    OptimizeTree(&func);
+
+    LatexDump(&vars, &func, &expr, &opts, output_file_name);
 
-    LatexDump(&vars, &func, &expr, output_file_name);
+    if (opts.c_file_name != nullptr &&
+        CodegenMaclaurin(&func, opts.order, "f", opts.c_file_name) != kTreeSuccess)
+    {
+        printf(">>Failed to write %s\n", opts.c_file_name);
+    }
 
     EndTreeGraphDump();
 
@@ -43,5 +70,51 @@ int main(int argc, const char *argv[])
     TreeDtor(func.root);
     VarArrayDtor(&vars);
 
+    RuleSetSelect(nullptr);
+    RuleSetDtor(&rules);
+
     return 0;
 }
+
+static void ParseOpts(int            argc,
+                      const char    *argv[],
+                      MaclaurinOpts *opts)
+{
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--dag") == 0)
+        {
+            opts->use_dag = true;
+        }
+        else if (strcmp(argv[i], "--egraph") == 0)
+        {
+            opts->use_egraph = true;
+        }
+        else if (strcmp(argv[i], "--memo") == 0)
+        {
+            opts->use_memo = true;
+        }
+        else if (strcmp(argv[i], "--expand") == 0)
+        {
+            opts->expand = true;
+        }
+        else if (strncmp(argv[i], "--emit-c=", sizeof("--emit-c=") - 1) == 0)
+        {
+            opts->c_file_name = argv[i] + sizeof("--emit-c=") - 1;
+        }
+        else if (strncmp(argv[i], "--rules=", sizeof("--rules=") - 1) == 0)
+        {
+            opts->rules_file_name = argv[i] + sizeof("--rules=") - 1;
+        }
+        else if (sscanf(argv[i], "--derivs=%zu", &opts->derivs) != 1 &&
+                 sscanf(argv[i], "--order=%zu",  &opts->order)  != 1)
+        {
+            printf(">>Unknown option %s\n", argv[i]);
+        }
+    }
+
+    if (opts->order < 1)
+    {
+        opts->order = 1;
+    }
+}
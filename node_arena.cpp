@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "node_arena.h"
+#include "trees.h"
+#include "debug/debug.h"
+
+static NodeArena default_arena = {};
+
+static thread_local NodeArena *curr_arena = &default_arena;
+
+static const size_t kSlotSize = (sizeof(TreeNode) + alignof(TreeNode) - 1) / alignof(TreeNode) * alignof(TreeNode);
+
+static const size_t kFirstSlotOffset = (sizeof(ArenaChunk) + alignof(TreeNode) - 1) / alignof(TreeNode) * alignof(TreeNode);
+
+static ArenaChunk *ChunkAlloc();
+
+static void ChunkFree(ArenaChunk *chunk);
+
+static ArenaErrs_t AddChunk(NodeArena *arena);
+
+//==============================================================================
+
+ArenaErrs_t NodeArenaCtor(NodeArena *arena)
+{
+    CHECK(arena);
+
+    memset(arena, 0, sizeof(NodeArena));
+
+    return kArenaSuccess;
+}
+
+//==============================================================================
+
+ArenaErrs_t NodeArenaDtor(NodeArena *arena)
+{
+    CHECK(arena);
+
+    ArenaChunk *chunk = arena->chunks;
+
+    while (chunk != nullptr)
+    {
+        ArenaChunk *next = chunk->next;
+
+        ChunkFree(chunk);
+
+        chunk = next;
+    }
+
+    if (curr_arena == arena)
+    {
+        curr_arena = &default_arena;
+    }
+
+    memset(arena, 0, sizeof(NodeArena));
+
+    return kArenaSuccess;
+}
+
+//==============================================================================
+
+ArenaErrs_t NodeArenaReset(NodeArena *arena)
+{
+    CHECK(arena);
+
+    ArenaChunk *first = arena->chunks;
+
+    if (first == nullptr)
+    {
+        return kArenaSuccess;
+    }
+
+    ArenaChunk *chunk = first->next;
+
+    while (chunk != nullptr)
+    {
+        ArenaChunk *next = chunk->next;
+
+        ChunkFree(chunk);
+
+        chunk = next;
+    }
+
+    first->next = nullptr;
+
+    arena->curr = (char *) first + kFirstSlotOffset;
+    arena->end  = (char *) first + kArenaChunkSize;
+
+    arena->free_list = nullptr;
+
+    arena->stats.nodes_freed   += arena->stats.nodes_alive;
+    arena->stats.nodes_alive    = 0;
+    arena->stats.bytes_used     = 0;
+    arena->stats.chunk_count    = 1;
+    arena->stats.bytes_reserved = kArenaChunkSize;
+
+    return kArenaSuccess;
+}
+
+//==============================================================================
+
+NodeArena *NodeArenaSelect(NodeArena *arena)
+{
+    NodeArena *prev_arena = curr_arena;
+
+    curr_arena = (arena == nullptr) ? &default_arena : arena;
+
+    return prev_arena;
+}
+
+//==============================================================================
+
+NodeArena *NodeArenaCurrent()
+{
+    return curr_arena;
+}
+
+//==============================================================================
+
+TreeNode *NodeAlloc()
+{
+    NodeArena *arena = curr_arena;
+
+    TreeNode *node = nullptr;
+
+    if (arena->free_list != nullptr)
+    {
+        node = (TreeNode *) arena->free_list;
+
+        arena->free_list = arena->free_list->next;
+    }
+    else
+    {
+        if (arena->curr == nullptr || arena->curr + kSlotSize > arena->end)
+        {
+            if (AddChunk(arena) != kArenaSuccess)
+            {
+                return nullptr;
+            }
+        }
+
+        node = (TreeNode *) arena->curr;
+
+        arena->curr += kSlotSize;
+    }
+
+    memset(node, 0, sizeof(TreeNode));
+
+    arena->stats.nodes_alloced++;
+    arena->stats.nodes_alive++;
+    arena->stats.bytes_used += kSlotSize;
+
+    if (arena->stats.bytes_used > arena->stats.peak_bytes_used)
+    {
+        arena->stats.peak_bytes_used = arena->stats.bytes_used;
+    }
+
+    return node;
+}
+
+//==============================================================================
+
+void NodeFree(TreeNode *node)
+{
+    if (node == nullptr)
+    {
+        return;
+    }
+
+    NodeArena *arena = NodeOwner(node);
+
+    FreeSlot *slot = (FreeSlot *) node;
+
+    slot->next = arena->free_list;
+
+    arena->free_list = slot;
+
+    arena->stats.nodes_freed++;
+    arena->stats.nodes_alive--;
+    arena->stats.bytes_used -= kSlotSize;
+}
+
+//==============================================================================
+
+NodeArena *NodeOwner(const TreeNode *node)
+{
+    CHECK(node);
+
+    ArenaChunk *chunk = (ArenaChunk *) ((uintptr_t) node & ~(uintptr_t) (kArenaChunkSize - 1));
+
+    return chunk->owner;
+}
+
+//==============================================================================
+
+void NodeArenaDump(const NodeArena *arena,
+                   const char      *phase,
+                   FILE            *output_file)
+{
+    CHECK(arena);
+    CHECK(output_file);
+
+    fprintf(output_file, "arena[%p] %s:\n"
+                         "\tnodes alloced  : %zu\n"
+                         "\tnodes freed    : %zu\n"
+                         "\tnodes alive    : %zu\n"
+                         "\tchunks         : %zu\n"
+                         "\tbytes reserved : %zu\n"
+                         "\tbytes used     : %zu\n"
+                         "\tpeak bytes used: %zu\n",
+                         arena,
+                         phase,
+                         arena->stats.nodes_alloced,
+                         arena->stats.nodes_freed,
+                         arena->stats.nodes_alive,
+                         arena->stats.chunk_count,
+                         arena->stats.bytes_reserved,
+                         arena->stats.bytes_used,
+                         arena->stats.peak_bytes_used);
+}
+
+//==============================================================================
+
+static ArenaErrs_t AddChunk(NodeArena *arena)
+{
+    ArenaChunk *chunk = ChunkAlloc();
+
+    if (chunk == nullptr)
+    {
+        return kArenaFailedAlloc;
+    }
+
+    chunk->owner = arena;
+    chunk->next  = arena->chunks;
+
+    arena->chunks = chunk;
+
+    arena->curr = (char *) chunk + kFirstSlotOffset;
+    arena->end  = (char *) chunk + kArenaChunkSize;
+
+    arena->stats.chunk_count++;
+    arena->stats.bytes_reserved += kArenaChunkSize;
+
+    return kArenaSuccess;
+}
+
+//==============================================================================
+
+static ArenaChunk *ChunkAlloc()
+{
+#ifdef _WIN32
+    return (ArenaChunk *) _aligned_malloc(kArenaChunkSize, kArenaChunkSize);
+#else
+    return (ArenaChunk *) aligned_alloc(kArenaChunkSize, kArenaChunkSize);
+#endif
+}
+
+//==============================================================================
+
+static void ChunkFree(ArenaChunk *chunk)
+{
+#ifdef _WIN32
+    _aligned_free(chunk);
+#else
+    free(chunk);
+#endif
+}
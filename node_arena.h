@@ -0,0 +1,78 @@
+#ifndef NODE_ARENA_HEADER
+#define NODE_ARENA_HEADER
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct TreeNode;
+
+//! Nodes are cut out of chunks of kArenaChunkSize bytes. Chunks are aligned
+//! to their size, so the arena owning any node is found from its address.
+static const size_t kArenaChunkSize = 64 * 1024;
+
+struct ArenaChunk
+{
+    struct NodeArena *owner;
+    ArenaChunk       *next;
+};
+
+struct FreeSlot
+{
+    FreeSlot *next;
+};
+
+struct ArenaStats
+{
+    size_t nodes_alloced;
+    size_t nodes_freed;
+    size_t nodes_alive;
+
+    size_t chunk_count;
+    size_t bytes_reserved;
+    size_t bytes_used;
+    size_t peak_bytes_used;
+};
+
+//! Zero-initialized NodeArena is a valid empty arena.
+struct NodeArena
+{
+    ArenaChunk *chunks;
+
+    char *curr;
+    char *end;
+
+    FreeSlot *free_list;
+
+    ArenaStats stats;
+};
+
+typedef enum
+{
+    kArenaSuccess,
+    kArenaFailedAlloc,
+} ArenaErrs_t;
+
+ArenaErrs_t NodeArenaCtor(NodeArena *arena);
+
+ArenaErrs_t NodeArenaDtor(NodeArena *arena);
+
+//! Drops every node of the arena at once. First chunk is kept for reuse.
+ArenaErrs_t NodeArenaReset(NodeArena *arena);
+
+//! Makes arena current for the calling thread, returns the previous one.
+//! nullptr selects the default arena.
+NodeArena *NodeArenaSelect(NodeArena *arena);
+
+NodeArena *NodeArenaCurrent();
+
+TreeNode *NodeAlloc();
+
+void NodeFree(TreeNode *node);
+
+NodeArena *NodeOwner(const TreeNode *node);
+
+void NodeArenaDump(const NodeArena *arena,
+                   const char      *phase,
+                   FILE            *output_file);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "parse.h"
 #include "trees.h"
+#include "diff.h"
 
 
 static const char *output_file_name = "TOP_G_DUMP.txt";
@@ -15,6 +16,8 @@ static void SkipSpaces(Expr *expr);
 
 static const size_t kBaseVarCount = 16;
 
+static const size_t kVarArrayMultiplier = 2;
+
 static const size_t kMaxIdLen = 64;
 
 int VarArrayInit(Variables *vars)
@@ -48,11 +51,26 @@ int SeekVariable(Variables *vars, const char *var_name)
 
 int AddVar(Variables *vars, const char *var_name)
 {
+    if (vars->var_count >= vars->size)
+    {
+        size_t new_size = vars->size * kVarArrayMultiplier;
+
+        Variable *new_array = (Variable *) realloc(vars->var_array, new_size * sizeof(Variable));
+
+        if (new_array == nullptr)
+        {
+            return -1;
+        }
+
+        vars->var_array = new_array;
+        vars->size      = new_size;
+    }
+
     vars->var_array[vars->var_count].id    = strdup(var_name);
     vars->var_array[vars->var_count].value = 0;
 
     ++vars->var_count;
-    return vars->var_count;
+    return vars->var_count - 1;
 }
 
 int VarArrayDtor(Variables *vars)
@@ -88,10 +106,10 @@ TreeNode *GetG(Variables *vars, Expr *expr) // !!!! rename
 
     SetParents(node);
 
-    fclose(output_file);
-
     LOG_PRINT("GetG finished work\n");
 
+    fclose(output_file);
+
     return node;
 }
 
@@ -118,6 +136,8 @@ TreeNode *GetP(Variables *vars, Expr *expr)
 
         ++POS;
 
+        SkipSpaces(expr);
+
         return node;
     }
     else
@@ -144,33 +164,21 @@ TreeNode *GetT(Variables *vars, Expr *expr)
         {
             case '*':
             {
-                node_lhs =  NodeCtor(nullptr,
-                                     node_lhs,
-                                     node_rhs,
-                                     kOperator,
-                                     kMult);
+                node_lhs = OpCtor(kMult, node_lhs, node_rhs);
 
                 break;
             }
 
             case '/':
             {
-                node_lhs = NodeCtor(nullptr,
-                                    node_lhs,
-                                    node_rhs,
-                                    kOperator,
-                                    kDiv);
+                node_lhs = OpCtor(kDiv, node_lhs, node_rhs);
 
                 break;
             }
 
             case '^':
             {
-                node_lhs = NodeCtor(nullptr,
-                                    node_lhs,
-                                    node_rhs,
-                                    kOperator,
-                                    kExp);
+                node_lhs = OpCtor(kExp, node_lhs, node_rhs);
                 break;
             }
 
@@ -217,22 +225,14 @@ TreeNode *GetE(Variables *vars, Expr *expr)
         {
             case '+':
             {
-                node_lhs = NodeCtor(nullptr,
-                                    node_lhs,
-                                    node_rhs,
-                                    kOperator,
-                                    kAdd);
+                node_lhs = OpCtor(kAdd, node_lhs, node_rhs);
 
                 break;
             }
 
             case '-':
             {
-                node_lhs = NodeCtor(nullptr,
-                                    node_lhs,
-                                    node_rhs,
-                                    kOperator,
-                                    kSub);
+                node_lhs = OpCtor(kSub, node_lhs, node_rhs);
 
                 break;
             }
@@ -334,10 +334,9 @@ TreeNode *GetId(Variables *vars, Expr *expr)
     var_name[i] = '\0';
 
     int var_pos = SeekVariable(vars, var_name);
-    if (var_pos < 0)
+    if (var_pos < 0 && (var_pos = AddVar(vars, var_name)) < 0)
     {
-        var_pos = AddVar(vars, var_name);
-
+        return nullptr;
     }
 
     SkipSpaces(expr);
@@ -0,0 +1,2132 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "poly.h"
+#include "diff.h"
+#include "dag.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+static const size_t kBasePolyCapacity = 8;
+static const size_t kPolyMultiplier   = 2;
+
+// Smaller operand of a product multiplied by NTT, below it the schoolbook
+// product is faster (they break even at about 450 terms).
+static const size_t kPolyNttMinSize = 512;
+
+struct NttPrime
+{
+    uint64_t mod;  // c * 2^k + 1
+    uint64_t root; // primitive root
+};
+
+// p1 * p2 > 4 * 10^17 holds every product coefficient below 2^53 with sign
+static const NttPrime kNttPrimes[] =
+{
+    {998244353, 3}, // 2^23 points at most
+    {469762049, 3}, // 2^26
+};
+
+static const size_t kNttMaxSize = (size_t) 1 << 23;
+
+static const int kPolyEnter   = 0;
+static const int kPolyCombine = 1;
+static const int kPolyDivPow  = 2; // p / q^k with q kept as the base
+
+static const size_t kBaseShapesCapacity = 64;
+
+static const size_t kNoShapeVar = SIZE_MAX;
+
+// Operands of the operators on the walk of RatFromTree(). Popped entries keep
+// their buffers for the next push.
+struct PolyCtx
+{
+    RatFunc *stack;
+    size_t   size;
+    size_t   capacity;
+
+    Poly tmp_lhs; // expanded denominators
+    Poly tmp_rhs;
+    Poly tmp;
+};
+
+static TreeErrs_t PolyReserve(Poly   *poly,
+                              size_t  size);
+
+static void PolyTrim(Poly *poly);
+
+static TreeErrs_t PolySetConst(Poly      *poly,
+                               NumType_t  val);
+
+static TreeErrs_t PolyCopy(Poly       *dst,
+                           const Poly *src);
+
+static void PolyScale(Poly      *poly,
+                      NumType_t  mult);
+
+static bool PolyIsExact(const Poly *poly);
+
+static bool RatIsExact(const RatFunc *rat);
+
+static bool PolyEqual(const Poly *lhs,
+                      const Poly *rhs);
+
+static void PolySwap(Poly *lhs,
+                     Poly *rhs);
+
+static bool NttFits(const Poly *lhs,
+                    const Poly *rhs);
+
+static TreeErrs_t NttMul(Poly       *prod,
+                         const Poly *lhs,
+                         const Poly *rhs);
+
+static void NttLoad(uint64_t   *vals,
+                    size_t      size,
+                    const Poly *poly,
+                    uint64_t    mod);
+
+static void Ntt(uint64_t       *vals,
+                size_t          size,
+                const uint64_t *twiddles,
+                uint64_t        mod,
+                bool            invert);
+
+static inline uint64_t MulMod(uint64_t lhs,
+                              uint64_t rhs,
+                              uint64_t mod);
+
+static uint64_t PowMod(uint64_t base,
+                       uint64_t exp,
+                       uint64_t mod);
+
+static size_t PolyTreeSize(const Poly *poly);
+
+static TreeNode *PolyToTree(const Poly *poly,
+                            size_t      var_pos);
+
+static TreeErrs_t RatPush(PolyCtx  *ctx,
+                          RatFunc **rat);
+
+static TreeErrs_t RatLeaf(PolyCtx        *ctx,
+                          const TreeNode *node,
+                          size_t          var_pos);
+
+static TreeErrs_t RatCombine(PolyCtx  *ctx,
+                             OpCode_t  op_code,
+                             bool      is_unary);
+
+static TreeErrs_t RatAdd(PolyCtx   *ctx,
+                         RatFunc   *lhs,
+                         RatFunc   *rhs,
+                         NumType_t  sign);
+
+static TreeErrs_t RatMul(PolyCtx *ctx,
+                         RatFunc *lhs,
+                         RatFunc *rhs);
+
+static TreeErrs_t RatDiv(PolyCtx *ctx,
+                         RatFunc *lhs,
+                         RatFunc *rhs);
+
+static TreeErrs_t RatPow(PolyCtx *ctx,
+                         RatFunc *lhs,
+                         RatFunc *rhs);
+
+static TreeErrs_t RatDivPow(PolyCtx *ctx,
+                            size_t   exp);
+
+static size_t DivPowExp(const TreeNode *node);
+
+static TreeErrs_t RatExpandDen(const RatFunc *rat,
+                               Poly          *res);
+
+static TreeErrs_t RatNormalize(RatFunc *rat);
+
+static bool RatIsConst(const RatFunc *rat);
+
+static NumType_t RatConst(const RatFunc *rat);
+
+static bool IsRatShape(const RatShapes *shapes,
+                       const TreeNode  *node,
+                       size_t           var_pos,
+                       bool            *is_plain);
+
+static RatShape ShapeOf(const RatShapes *shapes,
+                        const TreeNode  *node);
+
+static RatShape CombineShapes(const RatShapes *shapes,
+                              const TreeNode  *node);
+
+static RatShape *SeekShape(RatShape       *table,
+                           size_t          capacity,
+                           const TreeNode *node);
+
+static TreeErrs_t ShapesReserve(RatShapes *shapes,
+                                size_t     size);
+
+static size_t HashPtr(const void *ptr);
+
+static bool SingleVar(VarDeps_t  deps,
+                      size_t    *var_pos);
+
+static TreeNode *DenseNode(const TreeNode  *node,
+                           const RatShapes *shapes,
+                           bool            *is_rat);
+
+static TreeNode *RatOp(OpCode_t  op_code,
+                       TreeNode *left,
+                       TreeNode *right);
+
+static void DropBase(TreeNode *node);
+
+//==============================================================================
+
+TreeErrs_t PolyCtor(Poly   *poly,
+                    size_t  capacity)
+{
+    CHECK(poly);
+
+    *poly = {};
+
+    return PolyReserve(poly, capacity);
+}
+
+//==============================================================================
+
+TreeErrs_t PolyDtor(Poly *poly)
+{
+    CHECK(poly);
+
+    free(poly->coeffs);
+
+    *poly = {};
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t PolyAdd(Poly       *res,
+                   const Poly *lhs,
+                   const Poly *rhs,
+                   NumType_t   rhs_mult)
+{
+    CHECK(res);
+    CHECK(lhs);
+    CHECK(rhs);
+
+    size_t lhs_size = lhs->size;
+    size_t rhs_size = rhs->size;
+    size_t size     = (lhs_size > rhs_size) ? lhs_size : rhs_size;
+
+    if (PolyReserve(res, size) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    // res may be one of the operands, every coefficient is read before written,
+    // adding a short rhs to res == lhs only touches the low coefficients
+
+    size_t common = (lhs_size < rhs_size) ? lhs_size : rhs_size;
+
+    for (size_t i = 0; i < common; i++)
+    {
+        res->coeffs[i] = lhs->coeffs[i] + rhs_mult * rhs->coeffs[i];
+    }
+
+    for (size_t i = common; i < lhs_size && res != lhs; i++)
+    {
+        res->coeffs[i] = lhs->coeffs[i];
+    }
+
+    for (size_t i = common; i < rhs_size; i++)
+    {
+        res->coeffs[i] = rhs_mult * rhs->coeffs[i];
+    }
+
+    res->size = size;
+
+    PolyTrim(res);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t PolyMul(Poly       *res,
+                   const Poly *lhs,
+                   const Poly *rhs)
+{
+    CHECK(res);
+    CHECK(lhs);
+    CHECK(rhs);
+
+    if (lhs->size == 0 || rhs->size == 0)
+    {
+        res->size = 0;
+
+        return kTreeSuccess;
+    }
+
+    size_t size = lhs->size + rhs->size - 1;
+
+    if (size - 1 > kMaxPolyDegree)
+    {
+        return kFailedToFind;
+    }
+
+    if (lhs->size == 1 || rhs->size == 1)
+    {
+        NumType_t   mult  = (lhs->size == 1) ? lhs->coeffs[0] : rhs->coeffs[0];
+        const Poly *other = (lhs->size == 1) ? rhs : lhs;
+
+        if (PolyCopy(res, other) != kTreeSuccess)
+        {
+            return kFailedAllocation;
+        }
+
+        PolyScale(res, mult);
+
+        return PolyIsExact(res) ? kTreeSuccess : kFailedToFind;
+    }
+
+    bool use_ntt = lhs->size >= kPolyNttMinSize && rhs->size >= kPolyNttMinSize && NttFits(lhs, rhs);
+
+    if (!use_ntt && (NumType_t) lhs->size * (NumType_t) rhs->size > (NumType_t) kMaxPolyMulWork)
+    {
+        return kFailedToFind;
+    }
+
+    Poly prod = {};
+
+    if (PolyReserve(&prod, size) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    prod.size = size;
+
+    if (use_ntt)
+    {
+        if (NttMul(&prod, lhs, rhs) != kTreeSuccess)
+        {
+            PolyDtor(&prod);
+
+            return kFailedAllocation;
+        }
+    }
+    else
+    {
+        memset(prod.coeffs, 0, size * sizeof(NumType_t));
+
+        for (size_t i = 0; i < lhs->size; i++)
+        {
+            NumType_t coeff = lhs->coeffs[i];
+
+            if (IsNumEqual(coeff, 0))
+            {
+                continue;
+            }
+
+            for (size_t j = 0; j < rhs->size; j++)
+            {
+                prod.coeffs[i + j] += coeff * rhs->coeffs[j];
+            }
+        }
+    }
+
+    PolyTrim(&prod);
+
+    if (!PolyIsExact(&prod))
+    {
+        PolyDtor(&prod);
+
+        return kFailedToFind;
+    }
+
+    PolySwap(res, &prod);
+    PolyDtor(&prod);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t PolyPow(Poly       *res,
+                   const Poly *base,
+                   size_t      exp)
+{
+    CHECK(res);
+    CHECK(base);
+
+    if (exp == 0)
+    {
+        return PolySetConst(res, 1);
+    }
+
+    if (base->size == 0)
+    {
+        res->size = 0;
+
+        return kTreeSuccess;
+    }
+
+    size_t degree = base->size - 1;
+
+    if (degree != 0 && exp > kMaxPolyDegree / degree)
+    {
+        return kFailedToFind;
+    }
+
+    // c * x^k, the usual base, needs no multiplications
+
+    size_t nonzero = 0;
+
+    for (size_t i = 0; i < base->size; i++)
+    {
+        nonzero += !IsNumEqual(base->coeffs[i], 0);
+    }
+
+    if (nonzero == 1)
+    {
+        NumType_t coeff = pow(base->coeffs[degree], (NumType_t) exp);
+        size_t    size  = degree * exp + 1;
+
+        if (!(fabs(coeff) <= kMaxPolyCoeff))
+        {
+            return kFailedToFind;
+        }
+
+        if (PolyReserve(res, size) != kTreeSuccess)
+        {
+            return kFailedAllocation;
+        }
+
+        memset(res->coeffs, 0, size * sizeof(NumType_t));
+
+        res->coeffs[size - 1] = coeff;
+        res->size             = size;
+
+        return kTreeSuccess;
+    }
+
+    Poly square = {};
+    Poly acc    = {};
+
+    TreeErrs_t status = kTreeSuccess;
+
+    if ((status = PolyCopy(&square, base)) != kTreeSuccess ||
+        (status = PolySetConst(&acc, 1))   != kTreeSuccess)
+    {
+        PolyDtor(&square);
+        PolyDtor(&acc);
+
+        return status;
+    }
+
+    for ( ; exp > 0 && status == kTreeSuccess; exp >>= 1)
+    {
+        if ((exp & 1) != 0)
+        {
+            status = PolyMul(&acc, &acc, &square);
+        }
+
+        if (exp > 1 && status == kTreeSuccess)
+        {
+            status = PolyMul(&square, &square, &square);
+        }
+    }
+
+    if (status == kTreeSuccess)
+    {
+        PolySwap(res, &acc);
+    }
+
+    PolyDtor(&square);
+    PolyDtor(&acc);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeErrs_t PolyDiff(Poly   *poly,
+                    size_t  order)
+{
+    CHECK(poly);
+
+    if (order == 0)
+    {
+        return kTreeSuccess;
+    }
+
+    if (order >= poly->size)
+    {
+        poly->size = 0;
+
+        return kTreeSuccess;
+    }
+
+    // x^i -> i! / (i - order)! * x^(i - order), the falling factorial is
+    // carried from one coefficient to the next
+
+    NumType_t falling = 1;
+
+    for (size_t i = 2; i <= order; i++)
+    {
+        falling *= (NumType_t) i;
+    }
+
+    for (size_t i = order; i < poly->size; i++)
+    {
+        poly->coeffs[i - order] = poly->coeffs[i] * falling;
+
+        falling = falling * (NumType_t) (i + 1) / (NumType_t) (i + 1 - order);
+    }
+
+    poly->size -= order;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+NumType_t PolyEval(const Poly *poly,
+                   NumType_t   x)
+{
+    CHECK(poly);
+
+    NumType_t val = 0;
+
+    for (size_t i = poly->size; i-- > 0; )
+    {
+        val = val * x + poly->coeffs[i];
+    }
+
+    return val;
+}
+
+//==============================================================================
+
+TreeErrs_t RatFuncCtor(RatFunc *rat)
+{
+    CHECK(rat);
+
+    *rat = {};
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t RatFuncDtor(RatFunc *rat)
+{
+    CHECK(rat);
+
+    PolyDtor(&rat->num);
+    PolyDtor(&rat->den);
+
+    rat->den_pow = 0;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t RatFromTree(RatFunc        *rat,
+                       const TreeNode *node,
+                       size_t          var_pos,
+                       size_t         *tree_size)
+{
+    CHECK(rat);
+    CHECK(node);
+
+    PolyCtx ctx = {};
+
+    WorkStack frames = {};
+    WorkStackCtor(&frames);
+
+    size_t size = 0;
+
+    TreeErrs_t status = WorkPushNode(&frames, node, kPolyEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        if (frame.state == kPolyCombine)
+        {
+            status = RatCombine(&ctx, curr->data.op_code, curr->left == nullptr);
+
+            continue;
+        }
+
+        if (frame.state == kPolyDivPow)
+        {
+            status = RatDivPow(&ctx, DivPowExp(curr));
+
+            continue;
+        }
+
+        size++;
+
+        if (curr->type != kOperator)
+        {
+            status = RatLeaf(&ctx, curr, var_pos);
+        }
+        else if (DivPowExp(curr) != 0)
+        {
+            size += 2; // the power and its exponent
+
+            if ((status = WorkPushNode(&frames, curr,              kPolyDivPow)) == kTreeSuccess &&
+                (status = WorkPushNode(&frames, curr->right->left, kPolyEnter))  == kTreeSuccess)
+            {
+                status = WorkPushNode(&frames, curr->left, kPolyEnter);
+            }
+        }
+        else if ((status = WorkPushNode(&frames, curr, kPolyCombine)) == kTreeSuccess &&
+                 (curr->right == nullptr || (status = WorkPushNode(&frames, curr->right, kPolyEnter)) == kTreeSuccess) &&
+                  curr->left  != nullptr)
+        {
+            status = WorkPushNode(&frames, curr->left, kPolyEnter);
+        }
+    }
+
+    if (status == kTreeSuccess && (ctx.size != 1 || !RatIsExact(&ctx.stack[0])))
+    {
+        status = kFailedToFind;
+    }
+
+    if (status == kTreeSuccess)
+    {
+        RatFuncDtor(rat);
+
+        *rat         = ctx.stack[0];
+        ctx.stack[0] = {};
+    }
+
+    if (tree_size != nullptr)
+    {
+        *tree_size = size;
+    }
+
+    WorkStackDtor(&frames);
+
+    for (size_t i = 0; i < ctx.capacity; i++)
+    {
+        RatFuncDtor(&ctx.stack[i]);
+    }
+
+    free(ctx.stack);
+
+    PolyDtor(&ctx.tmp_lhs);
+    PolyDtor(&ctx.tmp_rhs);
+    PolyDtor(&ctx.tmp);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeErrs_t RatDiff(RatFunc *rat,
+                   size_t   order)
+{
+    CHECK(rat);
+
+    TreeErrs_t status = kTreeSuccess;
+
+    if (rat->den_pow == 0)
+    {
+        status = PolyDiff(&rat->num, order);
+
+        return (status == kTreeSuccess && !RatIsExact(rat)) ? kFailedToFind : status;
+    }
+
+    Poly d_den = {};
+    Poly d_num = {};
+    Poly tmp   = {};
+
+    if ((status = PolyCopy(&d_den, &rat->den)) == kTreeSuccess)
+    {
+        status = PolyDiff(&d_den, 1);
+    }
+
+    for (size_t i = 0; i < order && status == kTreeSuccess; i++)
+    {
+        // p' q - k p q' over q^(k + 1)
+
+        if ((status = PolyCopy(&d_num, &rat->num))            != kTreeSuccess ||
+            (status = PolyDiff(&d_num, 1))                    != kTreeSuccess ||
+            (status = PolyMul(&d_num, &d_num, &rat->den))     != kTreeSuccess ||
+            (status = PolyMul(&tmp, &rat->num, &d_den))       != kTreeSuccess ||
+            (status = PolyAdd(&rat->num, &d_num, &tmp,
+                              -(NumType_t) rat->den_pow))     != kTreeSuccess)
+        {
+            break;
+        }
+
+        rat->den_pow++;
+    }
+
+    if (status == kTreeSuccess && !RatIsExact(rat))
+    {
+        status = kFailedToFind;
+    }
+
+    PolyDtor(&d_den);
+    PolyDtor(&d_num);
+    PolyDtor(&tmp);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeNode *RatToTree(const RatFunc *rat,
+                    size_t         var_pos)
+{
+    CHECK(rat);
+
+    TreeNode *num = PolyToTree(&rat->num, var_pos);
+
+    if (rat->den_pow == 0 || num == nullptr)
+    {
+        return num;
+    }
+
+    TreeNode *den = PolyToTree(&rat->den, var_pos);
+
+    if (rat->den_pow > 1)
+    {
+        den = RatOp(kExp, den, NodeCtor(nullptr, nullptr, nullptr, kConstNumber, (double) rat->den_pow));
+    }
+
+    return RatOp(kDiv, num, den);
+}
+
+//==============================================================================
+
+size_t RatTreeSize(const RatFunc *rat)
+{
+    CHECK(rat);
+
+    size_t size = PolyTreeSize(&rat->num);
+
+    if (rat->den_pow > 0)
+    {
+        size += 1 + PolyTreeSize(&rat->den) + ((rat->den_pow > 1) ? 2 : 0);
+    }
+
+    return size;
+}
+
+//==============================================================================
+
+TreeErrs_t RatShapesCtor(RatShapes      *shapes,
+                         const TreeNode *root)
+{
+    CHECK(shapes);
+    CHECK(root);
+
+    memset(shapes, 0, sizeof(RatShapes));
+
+    // post-order, a node shared in a DAG is classified once
+
+    WorkStack frames = {};
+    WorkStackCtor(&frames);
+
+    TreeErrs_t status = WorkPushNode(&frames, root, kPolyEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        if (curr->type != kOperator || curr->deps == 0)
+        {
+            continue; // numbers and variables need no entry
+        }
+
+        if (frame.state == kPolyCombine)
+        {
+            if ((status = ShapesReserve(shapes, shapes->size + 1)) != kTreeSuccess)
+            {
+                break;
+            }
+
+            *SeekShape(shapes->table, shapes->capacity, curr) = CombineShapes(shapes, curr);
+
+            shapes->size++;
+
+            continue;
+        }
+
+        if (shapes->capacity != 0 && SeekShape(shapes->table, shapes->capacity, curr)->node != nullptr)
+        {
+            continue;
+        }
+
+        if ((status = WorkPushNode(&frames, curr, kPolyCombine)) != kTreeSuccess ||
+            (curr->right != nullptr && (status = WorkPushNode(&frames, curr->right, kPolyEnter)) != kTreeSuccess) ||
+            (curr->left  != nullptr && (status = WorkPushNode(&frames, curr->left,  kPolyEnter)) != kTreeSuccess))
+        {
+            break;
+        }
+    }
+
+    WorkStackDtor(&frames);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeErrs_t RatShapesDtor(RatShapes *shapes)
+{
+    CHECK(shapes);
+
+    free(shapes->table);
+
+    memset(shapes, 0, sizeof(RatShapes));
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeNode *PolyDiffNode(const TreeNode  *node,
+                       size_t           var_pos,
+                       const RatShapes *shapes,
+                       bool            *is_rat)
+{
+    CHECK(node);
+    CHECK(shapes);
+    CHECK(is_rat);
+
+    bool is_plain = false;
+
+    *is_rat = node->type == kOperator && node->deps == VarDepsBit(var_pos) &&
+              IsRatShape(shapes, node, var_pos, &is_plain);
+
+    if (!*is_rat || is_plain)
+    {
+        return nullptr;
+    }
+
+    RatFunc rat = {};
+
+    size_t    tree_size = 0;
+    TreeNode *diff      = nullptr;
+
+    if (RatFromTree(&rat, node, var_pos, &tree_size) == kTreeSuccess &&
+        RatTreeSize(&rat) <= tree_size &&
+        RatDiff(&rat, 1) == kTreeSuccess)
+    {
+        diff = RatToTree(&rat, var_pos);
+    }
+
+    RatFuncDtor(&rat);
+
+    return diff;
+}
+
+//==============================================================================
+
+TreeErrs_t PolyTree(Tree *tree)
+{
+    CHECK(tree);
+
+    if (tree->root == nullptr || DagCurrent() != nullptr)
+    {
+        return kTreeSuccess;
+    }
+
+    RatShapes shapes = {};
+
+    TreeErrs_t status = RatShapesCtor(&shapes, tree->root);
+
+    bool is_rat = false;
+
+    TreeNode *dense = (status == kTreeSuccess) ? DenseNode(tree->root, &shapes, &is_rat) : nullptr;
+
+    if (status != kTreeSuccess || is_rat)
+    {
+        if (dense != nullptr)
+        {
+            dense->parent = tree->root->parent;
+
+            DropBase(tree->root);
+
+            tree->root = dense;
+        }
+
+        RatShapesDtor(&shapes);
+
+        return status;
+    }
+
+    WorkStack frames = {};
+    WorkStackCtor(&frames);
+
+    status = WorkPushNode(&frames, tree->root, 0);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        TreeNode *curr = WorkPop(&frames).val.node;
+
+        TreeNode **slots[] = {&curr->left, &curr->right};
+
+        for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]) && status == kTreeSuccess; i++)
+        {
+            TreeNode *child = *slots[i];
+
+            if (child == nullptr || child->type != kOperator)
+            {
+                continue;
+            }
+
+            // a rational subtree not made smaller is left whole, its
+            // operands are not tried one by one
+
+            if ((dense = DenseNode(child, &shapes, &is_rat)) == nullptr)
+            {
+                status = is_rat ? kTreeSuccess : WorkPushNode(&frames, child, 0);
+
+                continue;
+            }
+
+            dense->parent = curr;
+            *slots[i]     = dense;
+
+            DropBase(child);
+        }
+    }
+
+    WorkStackDtor(&frames);
+
+    RatShapesDtor(&shapes);
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t PolyReserve(Poly   *poly,
+                              size_t  size)
+{
+    if (size <= poly->capacity)
+    {
+        return kTreeSuccess;
+    }
+
+    size_t capacity = (poly->capacity != 0) ? poly->capacity * kPolyMultiplier : kBasePolyCapacity;
+
+    if (capacity < size)
+    {
+        capacity = size;
+    }
+
+    NumType_t *coeffs = (NumType_t *) realloc(poly->coeffs, capacity * sizeof(NumType_t));
+
+    if (coeffs == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    poly->coeffs   = coeffs;
+    poly->capacity = capacity;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static void PolyTrim(Poly *poly)
+{
+    while (poly->size > 0 && IsNumEqual(poly->coeffs[poly->size - 1], 0))
+    {
+        poly->size--;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t PolySetConst(Poly      *poly,
+                               NumType_t  val)
+{
+    if (PolyReserve(poly, 1) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    poly->coeffs[0] = val;
+    poly->size      = !IsNumEqual(val, 0);
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t PolyCopy(Poly       *dst,
+                           const Poly *src)
+{
+    if (dst == src)
+    {
+        return kTreeSuccess;
+    }
+
+    if (PolyReserve(dst, src->size) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    if (src->size != 0)
+    {
+        memcpy(dst->coeffs, src->coeffs, src->size * sizeof(NumType_t));
+    }
+
+    dst->size = src->size;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static void PolyScale(Poly      *poly,
+                      NumType_t  mult)
+{
+    for (size_t i = 0; i < poly->size; i++)
+    {
+        poly->coeffs[i] *= mult;
+    }
+
+    PolyTrim(poly);
+}
+
+//------------------------------------------------------------------------------
+// No coefficient is above kMaxPolyCoeff, nan or infinite.
+
+static bool PolyIsExact(const Poly *poly)
+{
+    for (size_t i = 0; i < poly->size; i++)
+    {
+        if (!(fabs(poly->coeffs[i]) <= kMaxPolyCoeff))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool RatIsExact(const RatFunc *rat)
+{
+    return PolyIsExact(&rat->num) && (rat->den_pow == 0 || PolyIsExact(&rat->den));
+}
+
+//------------------------------------------------------------------------------
+
+static bool PolyEqual(const Poly *lhs,
+                      const Poly *rhs)
+{
+    if (lhs->size != rhs->size)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < lhs->size; i++)
+    {
+        if (!IsNumEqual(lhs->coeffs[i], rhs->coeffs[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static void PolySwap(Poly *lhs,
+                     Poly *rhs)
+{
+    Poly tmp = *lhs;
+
+    *lhs = *rhs;
+    *rhs = tmp;
+}
+
+//------------------------------------------------------------------------------
+// Floating point FFT errors are relative to the largest coefficient, while
+// coefficients of expanded powers span hundreds of orders ((1 + x)^1000 goes
+// from 1 to 10^299), so only integer products that NTT gets exactly are
+// taken off the schoolbook loop.
+
+static bool NttFits(const Poly *lhs,
+                    const Poly *rhs)
+{
+    if (lhs->size + rhs->size - 1 > kNttMaxSize)
+    {
+        return false;
+    }
+
+    const Poly *polys[] = {lhs, rhs};
+    NumType_t   maxes[] = {0, 0};
+
+    for (size_t i = 0; i < sizeof(polys) / sizeof(polys[0]); i++)
+    {
+        for (size_t j = 0; j < polys[i]->size; j++)
+        {
+            NumType_t coeff = fabs(polys[i]->coeffs[j]);
+
+            if (!IsNumEqual(coeff, floor(coeff)) || coeff >= kMaxPolyCoeff)
+            {
+                return false;
+            }
+
+            maxes[i] = (coeff > maxes[i]) ? coeff : maxes[i];
+        }
+    }
+
+    size_t terms = (lhs->size < rhs->size) ? lhs->size : rhs->size;
+
+    return maxes[0] * maxes[1] * (NumType_t) terms < kMaxPolyCoeff;
+}
+
+//------------------------------------------------------------------------------
+// Convolution modulo both primes, the coefficients are put back together by
+// Garner's formula x = r1 + p1 * ((r2 - r1) / p1 mod p2).
+
+static TreeErrs_t NttMul(Poly       *prod,
+                         const Poly *lhs,
+                         const Poly *rhs)
+{
+    size_t size = 1;
+
+    while (size < prod->size)
+    {
+        size <<= 1;
+    }
+
+    uint64_t *buf = (uint64_t *) calloc(3 * size + size / 2, sizeof(uint64_t));
+
+    if (buf == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    uint64_t *first    = buf;            // product modulo the first prime
+    uint64_t *vals_lhs = buf + size;
+    uint64_t *vals_rhs = buf + 2 * size;
+    uint64_t *twiddles = buf + 3 * size;
+
+    bool is_square = (lhs == rhs);
+
+    for (size_t p = 0; p < sizeof(kNttPrimes) / sizeof(kNttPrimes[0]); p++)
+    {
+        uint64_t mod  = kNttPrimes[p].mod;
+        uint64_t step = PowMod(kNttPrimes[p].root, (mod - 1) / size, mod);
+
+        twiddles[0] = 1;
+
+        for (size_t i = 1; i < size / 2; i++)
+        {
+            twiddles[i] = MulMod(twiddles[i - 1], step, mod);
+        }
+
+        NttLoad(vals_lhs, size, lhs, mod);
+        Ntt(vals_lhs, size, twiddles, mod, false);
+
+        if (!is_square)
+        {
+            NttLoad(vals_rhs, size, rhs, mod);
+            Ntt(vals_rhs, size, twiddles, mod, false);
+        }
+
+        const uint64_t *other = is_square ? vals_lhs : vals_rhs;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            vals_lhs[i] = MulMod(vals_lhs[i], other[i], mod);
+        }
+
+        Ntt(vals_lhs, size, twiddles, mod, true);
+
+        if (p == 0)
+        {
+            memcpy(first, vals_lhs, size * sizeof(uint64_t));
+        }
+    }
+
+    uint64_t mod1 = kNttPrimes[0].mod;
+    uint64_t mod2 = kNttPrimes[1].mod;
+    uint64_t inv1 = PowMod(mod1 % mod2, mod2 - 2, mod2);
+
+    int64_t full = (int64_t) (mod1 * mod2);
+
+    for (size_t i = 0; i < prod->size; i++)
+    {
+        uint64_t diff = (vals_lhs[i] + mod2 - first[i] % mod2) % mod2;
+        int64_t  val  = (int64_t) (first[i] + mod1 * (diff * inv1 % mod2));
+
+        prod->coeffs[i] = (NumType_t) ((val > full / 2) ? val - full : val);
+    }
+
+    free(buf);
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static void NttLoad(uint64_t   *vals,
+                    size_t      size,
+                    const Poly *poly,
+                    uint64_t    mod)
+{
+    for (size_t i = 0; i < poly->size; i++)
+    {
+        int64_t rem = (int64_t) poly->coeffs[i] % (int64_t) mod;
+
+        vals[i] = (uint64_t) ((rem < 0) ? rem + (int64_t) mod : rem);
+    }
+
+    memset(vals + poly->size, 0, (size - poly->size) * sizeof(uint64_t));
+}
+
+//------------------------------------------------------------------------------
+// In place radix-2 transform of a power of two values. twiddles[j] is the
+// j-th power of the size-th root of unity; the inverse transform is the
+// forward one with the outputs reversed and scaled by 1 / size.
+
+static void Ntt(uint64_t       *vals,
+                size_t          size,
+                const uint64_t *twiddles,
+                uint64_t        mod,
+                bool            invert)
+{
+    for (size_t i = 1, j = 0; i < size; i++)
+    {
+        size_t bit = size >> 1;
+
+        for ( ; (j & bit) != 0; bit >>= 1)
+        {
+            j ^= bit;
+        }
+
+        j ^= bit;
+
+        if (i < j)
+        {
+            uint64_t tmp = vals[i];
+
+            vals[i] = vals[j];
+            vals[j] = tmp;
+        }
+    }
+
+    for (size_t len = 2; len <= size; len <<= 1)
+    {
+        size_t half   = len / 2;
+        size_t stride = size / len;
+
+        for (size_t i = 0; i < size; i += len)
+        {
+            for (size_t j = 0; j < half; j++)
+            {
+                uint64_t lo = vals[i + j];
+                uint64_t hi = MulMod(vals[i + j + half], twiddles[j * stride], mod);
+
+                vals[i + j]        = (lo + hi < mod) ? lo + hi : lo + hi - mod;
+                vals[i + j + half] = (lo >= hi)      ? lo - hi : lo + mod - hi;
+            }
+        }
+    }
+
+    if (!invert)
+    {
+        return;
+    }
+
+    for (size_t i = 1, j = size - 1; i < j; i++, j--)
+    {
+        uint64_t tmp = vals[i];
+
+        vals[i] = vals[j];
+        vals[j] = tmp;
+    }
+
+    uint64_t inv_size = PowMod(size % mod, mod - 2, mod);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        vals[i] = MulMod(vals[i], inv_size, mod);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Barrett reduction, lhs * rhs < mod^2 < 2^60: the quotient estimate by the
+// precomputed 2^64 / mod is off by at most 2, no 64-bit division per product.
+
+static inline uint64_t MulMod(uint64_t lhs,
+                              uint64_t rhs,
+                              uint64_t mod)
+{
+    static const uint64_t kBarrett[] =
+    {
+        UINT64_MAX / kNttPrimes[0].mod,
+        UINT64_MAX / kNttPrimes[1].mod,
+    };
+
+    uint64_t factor = (mod == kNttPrimes[0].mod) ? kBarrett[0] : kBarrett[1];
+
+    uint64_t prod = lhs * rhs;
+    uint64_t quot = (uint64_t) (((unsigned __int128) prod * factor) >> 64);
+    uint64_t rem  = prod - quot * mod;
+
+    while (rem >= mod)
+    {
+        rem -= mod;
+    }
+
+    return rem;
+}
+
+//------------------------------------------------------------------------------
+
+static uint64_t PowMod(uint64_t base,
+                       uint64_t exp,
+                       uint64_t mod)
+{
+    uint64_t res = 1;
+
+    for (base %= mod; exp > 0; exp >>= 1)
+    {
+        if ((exp & 1) != 0)
+        {
+            res = res * base % mod;
+        }
+
+        base = base * base % mod;
+    }
+
+    return res;
+}
+
+//------------------------------------------------------------------------------
+// Must agree with PolyToTree(): a term is a number, x or x^k, times the
+// absolute value of its coefficient unless that is 1, the first term keeps
+// the sign of its coefficient, the next ones are joined by + or -.
+
+static size_t PolyTreeSize(const Poly *poly)
+{
+    size_t size  = 0;
+    size_t terms = 0;
+
+    for (size_t k = poly->size; k-- > 0; )
+    {
+        NumType_t coeff = poly->coeffs[k];
+
+        if (IsNumEqual(coeff, 0))
+        {
+            continue;
+        }
+
+        NumType_t mult = (terms == 0) ? coeff : fabs(coeff);
+
+        size += (k > 1) ? 3 : 1;
+        size += (k > 0 && !IsNumEqual(mult, 1)) ? 2 : 0;
+
+        terms++;
+    }
+
+    return (terms == 0) ? 1 : size + terms - 1;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeNode *PolyToTree(const Poly *poly,
+                            size_t      var_pos)
+{
+    TreeNode *sum = nullptr;
+
+    for (size_t k = poly->size; k-- > 0; )
+    {
+        NumType_t coeff = poly->coeffs[k];
+
+        if (IsNumEqual(coeff, 0))
+        {
+            continue;
+        }
+
+        NumType_t mult = (sum == nullptr) ? coeff : fabs(coeff);
+
+        TreeNode *term = (k == 0) ? NodeCtor(nullptr, nullptr, nullptr, kConstNumber, mult) :
+                                    NodeCtor(nullptr, nullptr, nullptr, kVariable,    (double) var_pos);
+
+        if (k > 1)
+        {
+            term = RatOp(kExp, term, NodeCtor(nullptr, nullptr, nullptr, kConstNumber, (double) k));
+        }
+
+        if (k > 0 && !IsNumEqual(mult, 1))
+        {
+            term = RatOp(kMult, NodeCtor(nullptr, nullptr, nullptr, kConstNumber, mult), term);
+        }
+
+        if (sum == nullptr)
+        {
+            sum = term;
+        }
+        else
+        {
+            sum = RatOp((coeff < 0) ? kSub : kAdd, sum, term);
+        }
+
+        if (sum == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    return (sum != nullptr) ? sum : NodeCtor(nullptr, nullptr, nullptr, kConstNumber, 0);
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t RatPush(PolyCtx  *ctx,
+                          RatFunc **rat)
+{
+    if (ctx->size == ctx->capacity)
+    {
+        size_t capacity = (ctx->capacity != 0) ? ctx->capacity * kPolyMultiplier : kBasePolyCapacity;
+
+        RatFunc *stack = (RatFunc *) realloc(ctx->stack, capacity * sizeof(RatFunc));
+
+        if (stack == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        memset(stack + ctx->capacity, 0, (capacity - ctx->capacity) * sizeof(RatFunc));
+
+        ctx->stack    = stack;
+        ctx->capacity = capacity;
+    }
+
+    *rat = &ctx->stack[ctx->size++];
+
+    (*rat)->num.size = 0;
+    (*rat)->den.size = 0;
+    (*rat)->den_pow  = 0;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t RatLeaf(PolyCtx        *ctx,
+                          const TreeNode *node,
+                          size_t          var_pos)
+{
+    if (node->type == kVariable && node->data.variable_pos != var_pos)
+    {
+        return kFailedToFind;
+    }
+
+    if (node->type != kVariable && node->type != kConstNumber)
+    {
+        return kFailedToFind;
+    }
+
+    RatFunc *rat = nullptr;
+
+    if (RatPush(ctx, &rat) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    if (node->type == kConstNumber)
+    {
+        return PolySetConst(&rat->num, node->data.const_val);
+    }
+
+    if (PolyReserve(&rat->num, 2) != kTreeSuccess)
+    {
+        return kFailedAllocation;
+    }
+
+    rat->num.coeffs[0] = 0;
+    rat->num.coeffs[1] = 1;
+    rat->num.size      = 2;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// The result replaces the left operand on the stack, unary operators only
+// fold numbers.
+
+static TreeErrs_t RatCombine(PolyCtx  *ctx,
+                             OpCode_t  op_code,
+                             bool      is_unary)
+{
+    RatFunc *rhs = &ctx->stack[--ctx->size];
+    RatFunc *lhs = rhs;
+
+    if (!is_unary)
+    {
+        lhs = &ctx->stack[ctx->size - 1];
+    }
+    else
+    {
+        ctx->size++;
+    }
+
+    if (RatIsConst(rhs) && (is_unary || RatIsConst(lhs)))
+    {
+        NumType_t val = ApplyOp(op_code, is_unary ? 0 : RatConst(lhs), RatConst(rhs));
+
+        if (!isfinite(val))
+        {
+            return kFailedToFind;
+        }
+
+        return PolySetConst(&lhs->num, val);
+    }
+
+    if (is_unary)
+    {
+        return kFailedToFind;
+    }
+
+    TreeErrs_t status = kFailedToFind;
+
+    switch (op_code)
+    {
+        case kAdd:  status = RatAdd(ctx, lhs, rhs,  1); break;
+        case kSub:  status = RatAdd(ctx, lhs, rhs, -1); break;
+        case kMult: status = RatMul(ctx, lhs, rhs);     break;
+        case kDiv:  status = RatDiv(ctx, lhs, rhs);     break;
+        case kExp:  status = RatPow(ctx, lhs, rhs);     break;
+
+        case kSqrt:
+        case kSin:
+        case kCos:
+        case kTg:
+        case kLn:
+        case kNotAnOperation:
+        default:
+            break;
+    }
+
+    return (status == kTreeSuccess) ? RatNormalize(lhs) : status;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t RatAdd(PolyCtx   *ctx,
+                         RatFunc   *lhs,
+                         RatFunc   *rhs,
+                         NumType_t  sign)
+{
+    TreeErrs_t status = kTreeSuccess;
+
+    if (rhs->den_pow == 0 && lhs->den_pow == 0)
+    {
+        return PolyAdd(&lhs->num, &lhs->num, &rhs->num, sign);
+    }
+
+    if (rhs->den_pow == lhs->den_pow && PolyEqual(&rhs->den, &lhs->den))
+    {
+        return PolyAdd(&lhs->num, &lhs->num, &rhs->num, sign);
+    }
+
+    // a / q^m +- c / q^n over the higher power of q, expanding both
+    // denominators loses the digits of every term to cancellation
+
+    if (rhs->den_pow != 0 && lhs->den_pow != 0 && PolyEqual(&rhs->den, &lhs->den))
+    {
+        if (lhs->den_pow > rhs->den_pow)
+        {
+            if ((status = PolyPow(&ctx->tmp_rhs, &rhs->den, lhs->den_pow - rhs->den_pow)) != kTreeSuccess ||
+                (status = PolyMul(&ctx->tmp, &rhs->num, &ctx->tmp_rhs))                  != kTreeSuccess)
+            {
+                return status;
+            }
+
+            return PolyAdd(&lhs->num, &lhs->num, &ctx->tmp, sign);
+        }
+
+        if ((status = PolyPow(&ctx->tmp_lhs, &lhs->den, rhs->den_pow - lhs->den_pow)) != kTreeSuccess ||
+            (status = PolyMul(&lhs->num, &lhs->num, &ctx->tmp_lhs))                  != kTreeSuccess)
+        {
+            return status;
+        }
+
+        lhs->den_pow = rhs->den_pow;
+
+        return PolyAdd(&lhs->num, &lhs->num, &rhs->num, sign);
+    }
+
+    if (rhs->den_pow == 0)
+    {
+        if ((status = RatExpandDen(lhs, &ctx->tmp_lhs))                != kTreeSuccess ||
+            (status = PolyMul(&ctx->tmp, &rhs->num, &ctx->tmp_lhs))    != kTreeSuccess)
+        {
+            return status;
+        }
+
+        return PolyAdd(&lhs->num, &lhs->num, &ctx->tmp, sign);
+    }
+
+    if (lhs->den_pow == 0)
+    {
+        if ((status = RatExpandDen(rhs, &ctx->tmp_rhs))                != kTreeSuccess ||
+            (status = PolyMul(&lhs->num, &lhs->num, &ctx->tmp_rhs))    != kTreeSuccess ||
+            (status = PolyAdd(&lhs->num, &lhs->num, &rhs->num, sign))  != kTreeSuccess ||
+            (status = PolyCopy(&lhs->den, &rhs->den))                  != kTreeSuccess)
+        {
+            return status;
+        }
+
+        lhs->den_pow = rhs->den_pow;
+
+        return kTreeSuccess;
+    }
+
+    // a / b +- c / d = (a d +- c b) / (b d)
+
+    if ((status = RatExpandDen(lhs, &ctx->tmp_lhs))                    != kTreeSuccess ||
+        (status = RatExpandDen(rhs, &ctx->tmp_rhs))                    != kTreeSuccess ||
+        (status = PolyMul(&lhs->num, &lhs->num, &ctx->tmp_rhs))        != kTreeSuccess ||
+        (status = PolyMul(&ctx->tmp, &rhs->num, &ctx->tmp_lhs))        != kTreeSuccess ||
+        (status = PolyAdd(&lhs->num, &lhs->num, &ctx->tmp, sign))      != kTreeSuccess ||
+        (status = PolyMul(&lhs->den, &ctx->tmp_lhs, &ctx->tmp_rhs))    != kTreeSuccess)
+    {
+        return status;
+    }
+
+    lhs->den_pow = 1;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t RatMul(PolyCtx *ctx,
+                         RatFunc *lhs,
+                         RatFunc *rhs)
+{
+    TreeErrs_t status = PolyMul(&lhs->num, &lhs->num, &rhs->num);
+
+    if (status != kTreeSuccess || rhs->den_pow == 0)
+    {
+        return status;
+    }
+
+    if (lhs->den_pow == 0)
+    {
+        lhs->den_pow = rhs->den_pow;
+
+        return PolyCopy(&lhs->den, &rhs->den);
+    }
+
+    if (PolyEqual(&lhs->den, &rhs->den))
+    {
+        lhs->den_pow += rhs->den_pow;
+
+        return kTreeSuccess;
+    }
+
+    if ((status = RatExpandDen(lhs, &ctx->tmp_lhs))                    != kTreeSuccess ||
+        (status = RatExpandDen(rhs, &ctx->tmp_rhs))                    != kTreeSuccess ||
+        (status = PolyMul(&lhs->den, &ctx->tmp_lhs, &ctx->tmp_rhs))    != kTreeSuccess)
+    {
+        return status;
+    }
+
+    lhs->den_pow = 1;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t RatDiv(PolyCtx *ctx,
+                         RatFunc *lhs,
+                         RatFunc *rhs)
+{
+    if (rhs->num.size == 0)
+    {
+        return kFailedToFind;
+    }
+
+    TreeErrs_t status = kTreeSuccess;
+
+    // the denominator of rhs goes up
+
+    if (rhs->den_pow != 0 &&
+        ((status = RatExpandDen(rhs, &ctx->tmp_rhs))               != kTreeSuccess ||
+         (status = PolyMul(&lhs->num, &lhs->num, &ctx->tmp_rhs))   != kTreeSuccess))
+    {
+        return status;
+    }
+
+    if (rhs->num.size == 1)
+    {
+        PolyScale(&lhs->num, 1 / rhs->num.coeffs[0]);
+
+        return kTreeSuccess;
+    }
+
+    if (lhs->den_pow == 0)
+    {
+        lhs->den_pow = 1;
+
+        return PolyCopy(&lhs->den, &rhs->num);
+    }
+
+    if (PolyEqual(&lhs->den, &rhs->num))
+    {
+        lhs->den_pow++;
+
+        return kTreeSuccess;
+    }
+
+    if ((status = RatExpandDen(lhs, &ctx->tmp_lhs))                != kTreeSuccess ||
+        (status = PolyMul(&lhs->den, &ctx->tmp_lhs, &rhs->num))    != kTreeSuccess)
+    {
+        return status;
+    }
+
+    lhs->den_pow = 1;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Only integer exponents, (a / b^m)^-k = b^(m k) / a^k.
+
+static TreeErrs_t RatPow(PolyCtx *ctx,
+                         RatFunc *lhs,
+                         RatFunc *rhs)
+{
+    if (!RatIsConst(rhs))
+    {
+        return kFailedToFind;
+    }
+
+    NumType_t exp_val = RatConst(rhs);
+
+    if (!IsNumEqual(exp_val, floor(exp_val)) || fabs(exp_val) > (NumType_t) kMaxPolyDegree)
+    {
+        return kFailedToFind;
+    }
+
+    size_t exp = (size_t) fabs(exp_val);
+
+    TreeErrs_t status = kTreeSuccess;
+
+    if (exp_val >= 0)
+    {
+        lhs->den_pow *= exp;
+
+        return PolyPow(&lhs->num, &lhs->num, exp);
+    }
+
+    if (lhs->num.size == 0)
+    {
+        return kFailedToFind;
+    }
+
+    if ((status = RatExpandDen(lhs, &ctx->tmp_lhs))            != kTreeSuccess ||
+        (status = PolyPow(&ctx->tmp, &ctx->tmp_lhs, exp))      != kTreeSuccess)
+    {
+        return status;
+    }
+
+    PolySwap(&lhs->den, &lhs->num);
+    PolySwap(&lhs->num, &ctx->tmp);
+
+    lhs->den_pow = exp;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Pops q and p, pushes p / q^exp. A polynomial q becomes the denominator base
+// instead of being expanded, so terms over other powers of q share it.
+
+static TreeErrs_t RatDivPow(PolyCtx *ctx,
+                            size_t   exp)
+{
+    RatFunc *rhs = &ctx->stack[--ctx->size];
+    RatFunc *lhs = &ctx->stack[ctx->size - 1];
+
+    TreeErrs_t status = kTreeSuccess;
+
+    if (rhs->den_pow != 0 || rhs->num.size <= 1)
+    {
+        rhs->den_pow *= exp;
+
+        if ((status = PolyPow(&rhs->num, &rhs->num, exp)) != kTreeSuccess ||
+            (status = RatDiv(ctx, lhs, rhs))              != kTreeSuccess)
+        {
+            return status;
+        }
+    }
+    else if (lhs->den_pow == 0)
+    {
+        lhs->den_pow = exp;
+
+        status = PolyCopy(&lhs->den, &rhs->num);
+    }
+    else if (PolyEqual(&lhs->den, &rhs->num))
+    {
+        lhs->den_pow += exp;
+    }
+    else if ((status = RatExpandDen(lhs, &ctx->tmp_lhs))                 != kTreeSuccess ||
+             (status = PolyPow(&ctx->tmp_rhs, &rhs->num, exp))           != kTreeSuccess ||
+             (status = PolyMul(&lhs->den, &ctx->tmp_lhs, &ctx->tmp_rhs)) != kTreeSuccess)
+    {
+        return status;
+    }
+    else
+    {
+        lhs->den_pow = 1;
+    }
+
+    return (status == kTreeSuccess) ? RatNormalize(lhs) : status;
+}
+
+//------------------------------------------------------------------------------
+// Exponent k of node = p / q^k for a whole number k > 1, 0 for other nodes.
+
+static size_t DivPowExp(const TreeNode *node)
+{
+    if (node->type != kOperator || node->data.op_code != kDiv)
+    {
+        return 0;
+    }
+
+    const TreeNode *power = node->right;
+
+    if (power->type != kOperator || power->data.op_code != kExp || power->right->type != kConstNumber)
+    {
+        return 0;
+    }
+
+    NumType_t exp = power->right->data.const_val;
+
+    if (exp < 2 || exp > (NumType_t) kMaxPolyDegree || !IsNumEqual(exp, floor(exp)))
+    {
+        return 0;
+    }
+
+    return (size_t) exp;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeErrs_t RatExpandDen(const RatFunc *rat,
+                               Poly          *res)
+{
+    if (rat->den_pow == 0)
+    {
+        return PolySetConst(res, 1);
+    }
+
+    return PolyPow(res, &rat->den, rat->den_pow);
+}
+
+//------------------------------------------------------------------------------
+// A number in the denominator goes to the numerator, 0 / q is 0 like x/x is 1
+// for the rules.
+
+static TreeErrs_t RatNormalize(RatFunc *rat)
+{
+    if (rat->den_pow == 0)
+    {
+        return kTreeSuccess;
+    }
+
+    if (rat->den.size == 0)
+    {
+        return kFailedToFind;
+    }
+
+    if (rat->num.size == 0)
+    {
+        rat->den_pow = 0;
+    }
+    else if (rat->den.size == 1)
+    {
+        PolyScale(&rat->num, pow(rat->den.coeffs[0], -(NumType_t) rat->den_pow));
+
+        rat->den_pow = 0;
+    }
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static bool RatIsConst(const RatFunc *rat)
+{
+    return rat->den_pow == 0 && rat->num.size <= 1;
+}
+
+//------------------------------------------------------------------------------
+
+static NumType_t RatConst(const RatFunc *rat)
+{
+    return (rat->num.size != 0) ? rat->num.coeffs[0] : 0;
+}
+
+//------------------------------------------------------------------------------
+// A plain subtree is a sum of numbers times powers of the variable, trees
+// handle those in linear time already and the dense form would only be
+// rebuilt. Operators missing from shapes count as not rational.
+
+static bool IsRatShape(const RatShapes *shapes,
+                       const TreeNode  *node,
+                       size_t           var_pos,
+                       bool            *is_plain)
+{
+    RatShape shape = ShapeOf(shapes, node);
+
+    *is_plain = shape.is_plain;
+
+    return shape.is_rat && shape.var_pos == var_pos;
+}
+
+//------------------------------------------------------------------------------
+// Subtrees without variables are folded to numbers, they count as such.
+
+static RatShape ShapeOf(const RatShapes *shapes,
+                        const TreeNode  *node)
+{
+    if (node->deps == 0)
+    {
+        return {node, kNoShapeVar, true, true};
+    }
+
+    if (node->type == kVariable)
+    {
+        return {node, node->data.variable_pos, true, true};
+    }
+
+    RatShape *shape = (shapes->capacity != 0) ? SeekShape(shapes->table, shapes->capacity, node) : nullptr;
+
+    if (node->type != kOperator || shape == nullptr || shape->node == nullptr)
+    {
+        return {node, kNoShapeVar, false, false};
+    }
+
+    return *shape;
+}
+
+//------------------------------------------------------------------------------
+// Shape of an operator node with a variable from the shapes of its operands,
+// which are in shapes already.
+
+static RatShape CombineShapes(const RatShapes *shapes,
+                              const TreeNode  *node)
+{
+    RatShape shape = {node, kNoShapeVar, false, false};
+
+    OpCode_t op_code = node->data.op_code;
+
+    bool is_arith = (op_code == kAdd || op_code == kSub || op_code == kMult || op_code == kDiv);
+
+    if (!is_arith && !(op_code == kExp && node->right->deps == 0))
+    {
+        return shape;
+    }
+
+    RatShape left  = ShapeOf(shapes, node->left);
+    RatShape right = ShapeOf(shapes, node->right);
+
+    bool one_var = (left.var_pos == kNoShapeVar || right.var_pos == kNoShapeVar || left.var_pos == right.var_pos);
+
+    shape.var_pos  = (left.var_pos != kNoShapeVar) ? left.var_pos : right.var_pos;
+    shape.is_rat   = left.is_rat && right.is_rat && one_var;
+    shape.is_plain = left.is_plain && right.is_plain;
+
+    if (op_code == kExp)
+    {
+        shape.is_plain = shape.is_plain && node->left->type == kVariable;
+    }
+    else if ((op_code == kMult && node->left->deps != 0 && node->right->deps != 0) ||
+             (op_code == kDiv  && node->right->deps != 0))
+    {
+        shape.is_plain = false;
+    }
+
+    return shape;
+}
+
+//------------------------------------------------------------------------------
+// Slot of node or the empty one it goes to, capacity is a power of two.
+
+static RatShape *SeekShape(RatShape       *table,
+                           size_t          capacity,
+                           const TreeNode *node)
+{
+    size_t mask = capacity - 1;
+    size_t pos  = HashPtr(node) & mask;
+
+    while (table[pos].node != nullptr && table[pos].node != node)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return &table[pos];
+}
+
+//------------------------------------------------------------------------------
+// At most half full, the entries are placed again when the table grows.
+
+static TreeErrs_t ShapesReserve(RatShapes *shapes,
+                                size_t     size)
+{
+    if (size * kPolyMultiplier <= shapes->capacity)
+    {
+        return kTreeSuccess;
+    }
+
+    size_t new_capacity = (shapes->capacity == 0) ? kBaseShapesCapacity : shapes->capacity;
+
+    while (size * kPolyMultiplier > new_capacity)
+    {
+        new_capacity *= kPolyMultiplier;
+    }
+
+    RatShape *table = (RatShape *) calloc(new_capacity, sizeof(RatShape));
+
+    if (table == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    for (size_t i = 0; i < shapes->capacity; i++)
+    {
+        if (shapes->table[i].node != nullptr)
+        {
+            *SeekShape(table, new_capacity, shapes->table[i].node) = shapes->table[i];
+        }
+    }
+
+    free(shapes->table);
+
+    shapes->table    = table;
+    shapes->capacity = new_capacity;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+
+static size_t HashPtr(const void *ptr)
+{
+    uint64_t val = (uint64_t) (uintptr_t) ptr;
+
+    val ^= val >> 33;
+    val *= 0xff51afd7ed558ccdULL;
+    val ^= val >> 33;
+
+    return (size_t) val;
+}
+
+//------------------------------------------------------------------------------
+
+static bool SingleVar(VarDeps_t  deps,
+                      size_t    *var_pos)
+{
+    if (deps == 0 || (deps & (deps - 1)) != 0)
+    {
+        return false;
+    }
+
+    size_t bit = 0;
+
+    while ((deps >> bit) != 1)
+    {
+        bit++;
+    }
+
+    // the shared bit may stand for several variables
+
+    *var_pos = bit;
+
+    return bit != kSharedDepsBit;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeNode *DenseNode(const TreeNode  *node,
+                           const RatShapes *shapes,
+                           bool            *is_rat)
+{
+    size_t var_pos  = 0;
+    bool   is_plain = false;
+
+    *is_rat = node->type == kOperator && SingleVar(node->deps, &var_pos) &&
+              IsRatShape(shapes, node, var_pos, &is_plain);
+
+    if (!*is_rat || is_plain)
+    {
+        return nullptr;
+    }
+
+    RatFunc rat = {};
+
+    size_t    tree_size = 0;
+    TreeNode *dense     = nullptr;
+
+    if (RatFromTree(&rat, node, var_pos, &tree_size) == kTreeSuccess &&
+        RatTreeSize(&rat) < tree_size)
+    {
+        dense = RatToTree(&rat, var_pos);
+    }
+
+    RatFuncDtor(&rat);
+
+    return dense;
+}
+
+//------------------------------------------------------------------------------
+
+static TreeNode *RatOp(OpCode_t  op_code,
+                       TreeNode *left,
+                       TreeNode *right)
+{
+    if (left == nullptr || right == nullptr)
+    {
+        DropBase(left);
+        DropBase(right);
+
+        return nullptr;
+    }
+
+    return OpCtor(op_code, left, right);
+}
+
+//------------------------------------------------------------------------------
+
+static void DropBase(TreeNode *node)
+{
+    if (node != nullptr && DagCurrent() == nullptr)
+    {
+        TreeDtor(node);
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef POLY_HEADER
+#define POLY_HEADER
+
+#include "trees.h"
+
+//! Dense polynomials and rational functions of one variable. A subtree made
+//! of numbers, one variable, + - * / and integer powers is turned into
+//! coefficient vectors once, then differentiated and combined on the vectors
+//! and built back into a tree only when a tree is needed. Trees with other
+//! variables or functions of the variable are left to the tree algorithms.
+//!
+//! Dense forms are expanded: (x + 1)^100 has 101 terms. They are only used
+//! where their tree is not bigger than the original one, see RatTreeSize(),
+//! and where every coefficient stays within kMaxPolyCoeff. Exact coefficients
+//! still cancel when the sum is evaluated near a multiple root: (1 + x)^40
+//! at -0.99 is 10^-80, while its expanded terms are up to 10^11 and leave an
+//! error of about 10^-5.
+
+//! Highest degree kept in a Poly, bigger results leave the subtree as a tree.
+static const size_t kMaxPolyDegree = (size_t) 1 << 16;
+
+//! Most coefficient products of one schoolbook product, bigger ones leave the
+//! subtree as a tree as well. Integer products that fit are multiplied by
+//! NTT instead, exactly and in O(n log n), see PolyMul().
+static const size_t kMaxPolyMulWork = (size_t) 1 << 24;
+
+//! Largest magnitude of a coefficient, 2^53: every integer up to it is a
+//! double. Results with a bigger or non-finite coefficient ((1 + x)^100 has
+//! C(100, 50) ~ 10^29) are not exact any more and leave the subtree as a
+//! tree, so do the operations that produce them.
+static const NumType_t kMaxPolyCoeff = 9007199254740992.0;
+
+struct Poly
+{
+    NumType_t *coeffs; // coeffs[i] at x^i
+    size_t     size;   // degree + 1, 0 for the zero polynomial
+    size_t     capacity;
+};
+
+//! num / den^den_pow, a polynomial if den_pow is 0 (den is not used then).
+struct RatFunc
+{
+    Poly   num;
+    Poly   den;
+    size_t den_pow;
+};
+
+TreeErrs_t PolyCtor(Poly   *poly,
+                    size_t  capacity);
+
+TreeErrs_t PolyDtor(Poly *poly);
+
+//! res = lhs + rhs_mult * rhs, res may be lhs or rhs.
+TreeErrs_t PolyAdd(Poly       *res,
+                   const Poly *lhs,
+                   const Poly *rhs,
+                   NumType_t   rhs_mult);
+
+//! res = lhs * rhs, res may be lhs or rhs. Integer coefficients whose
+//! product stays below 2^53 are multiplied by number theoretic transforms
+//! modulo two primes once both operands are long enough, the result is the
+//! same as the schoolbook one. kFailedToFind if a coefficient of the product
+//! is beyond kMaxPolyCoeff, then res may be changed.
+TreeErrs_t PolyMul(Poly       *res,
+                   const Poly *lhs,
+                   const Poly *rhs);
+
+//! res = base^exp by squaring, res may be base.
+TreeErrs_t PolyPow(Poly       *res,
+                   const Poly *base,
+                   size_t      exp);
+
+//! Derivative of the given order in place, one pass over the coefficients.
+TreeErrs_t PolyDiff(Poly   *poly,
+                    size_t  order);
+
+NumType_t PolyEval(const Poly *poly,
+                   NumType_t   x);
+
+TreeErrs_t RatFuncCtor(RatFunc *rat);
+
+TreeErrs_t RatFuncDtor(RatFunc *rat);
+
+//! Dense form of node as a function of the variable at var_pos. Returns
+//! kFailedToFind if node is not a rational function of that variable alone
+//! or a coefficient is beyond kMaxPolyCoeff, tree_size (may be nullptr) gets
+//! the number of nodes of node.
+TreeErrs_t RatFromTree(RatFunc        *rat,
+                       const TreeNode *node,
+                       size_t          var_pos,
+                       size_t         *tree_size);
+
+//! Derivative of the given order in place. The denominator stays a power of
+//! the same polynomial: (p / q^k)' = (p' q - k p q') / q^(k + 1).
+TreeErrs_t RatDiff(RatFunc *rat,
+                   size_t   order);
+
+//! Sum of monomials by descending degree over den^den_pow.
+TreeNode *RatToTree(const RatFunc *rat,
+                    size_t         var_pos);
+
+//! Number of nodes RatToTree() builds.
+size_t RatTreeSize(const RatFunc *rat);
+
+struct RatShape
+{
+    const TreeNode *node;
+    size_t          var_pos;  // the one variable below, SIZE_MAX if none
+    bool            is_rat;
+    bool            is_plain; // sum of numbers times powers of the variable
+};
+
+//! Which operator nodes of a tree are rational functions of one variable,
+//! found in one post-order pass over the tree. Callers that ask it for every
+//! node of a path from the root do not walk the subtrees again and again,
+//! sin(x) + x*x + ... + x*x would take O(n^2) then.
+struct RatShapes
+{
+    RatShape *table; // open addressing by node address
+    size_t    capacity;
+    size_t    size;
+};
+
+//! Shapes of every operator node of root. RatShapesDtor() is needed even if
+//! this fails, the nodes left out count as not rational.
+TreeErrs_t RatShapesCtor(RatShapes      *shapes,
+                         const TreeNode *root);
+
+TreeErrs_t RatShapesDtor(RatShapes *shapes);
+
+//! Fast path of DiffTree(): the derivative of a rational function of the
+//! variable at var_pos built from its dense form. nullptr if node is not one,
+//! is a plain sum of monomials or its dense form is bigger than node. is_rat
+//! is set in the last two cases, the subtrees of those are not worth trying
+//! either. shapes are the RatShapes of a tree node belongs to.
+TreeNode *PolyDiffNode(const TreeNode  *node,
+                       size_t           var_pos,
+                       const RatShapes *shapes,
+                       bool            *is_rat);
+
+//! Replaces every largest subtree that is a rational function of one
+//! variable with its dense form if that is smaller. Plain sums of monomials
+//! and trees of a DagTable are left as they are.
+TreeErrs_t PolyTree(Tree *tree);
+
+#endif
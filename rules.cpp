@@ -0,0 +1,951 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "rules.h"
+#include "diff.h"
+#include "parse.h"
+#include "dag.h"
+#include "debug/debug.h"
+
+static const size_t kBaseRuleCapacity = 16;
+static const size_t kRuleMultiplier   = 2;
+static const size_t kMaxRuleLen       = 256;
+
+static const char * const kDefaultRules[] =
+{
+    "a - a -> 0",
+    "0 - a -> -1 * a",
+    "a + -1 * b -> a - b",
+    "a - -1 * b -> a + b",
+    "-1 * a + b -> b - a",
+
+    "a + a -> 2 * a",
+    "c * a + a -> (c + 1) * a : num(c)",
+    "a + c * a -> (c + 1) * a : num(c)",
+    "c * a + d * a -> (c + d) * a : num(c), num(d)",
+
+    "c * (d * a) -> (c * d) * a : num(c), num(d)",
+    "(c * a) * d -> (c * d) * a : num(c), num(d)",
+    "a * c -> c * a : num(c), notnum(a)",
+
+    "a * a -> a^2",
+    "a^b * a -> a^(b + 1) : num(b)",
+    "a * a^b -> a^(b + 1) : num(b)",
+    "a^b * a^c -> a^(b + c)",
+    "a^b / a -> a^(b - 1) : num(b), nonzero(a)",
+    "a / a^b -> a^(1 - b) : num(b), nonzero(a)",
+    "(a^b)^c -> a^(b * c) : odd(b), num(c)", // a^b keeps the sign of a
+    "(a^b)^c -> a^(b * c) : num(b), int(c)",
+    "(a^b)^c -> a^(b * c) : num(b), num(c), positive(a)",
+    "a / a -> 1 : nonzero(a)",
+
+    "sin(a)^2 + cos(a)^2 -> 1",
+    "cos(a)^2 + sin(a)^2 -> 1",
+    "sin(a) / cos(a) -> tg(a)",
+    "tg(a) * cos(a) -> sin(a)",
+    "cos(a) * tg(a) -> sin(a)",
+
+    "sin(0) -> 0",
+    "cos(0) -> 1",
+    "tg(0) -> 0",
+    "ln(1) -> 0",
+};
+
+static const size_t kDefaultRuleCount = sizeof(kDefaultRules) / sizeof(kDefaultRules[0]);
+
+static thread_local RuleSet *curr_rules = nullptr;
+
+struct RuleSymbol
+{
+    ExpressionType_t type; // kVariable for a pattern variable
+    NodeData         data;
+};
+
+static TreeErrs_t ParseRule(const char *rule_str,
+                            Rule       *rule);
+
+static TreeErrs_t ParseGuards(Variables *vars,
+                              char      *guards_str,
+                              Rule      *rule);
+
+static TreeErrs_t InsertRule(RuleSet *set,
+                             size_t   rule_idx);
+
+static size_t PatternSymbols(const TreeNode *pattern,
+                             RuleSymbol     *symbols);
+
+static size_t TrieNodeCtor(RuleSet *set);
+
+static size_t TrieStep(RuleSet          *set,
+                       size_t            trie,
+                       const RuleSymbol *symbol);
+
+static RuleTrieEdge *SeekEdge(RuleTrieEdge     *edges,
+                              size_t            capacity,
+                              size_t            from,
+                              ExpressionType_t  type,
+                              NodeData          data);
+
+static TreeErrs_t GrowEdges(RuleSet *set);
+
+static void TrieMatch(RuleSet         *set,
+                      size_t           trie,
+                      const TreeNode **pending,
+                      size_t           pending_count,
+                      const TreeNode  *node,
+                      size_t          *best,
+                      const TreeNode **best_binds);
+
+static bool BindPattern(const TreeNode  *pattern,
+                        const TreeNode  *node,
+                        const TreeNode **binds);
+
+static bool CheckGuards(const Rule      *rule,
+                        const TreeNode **binds);
+
+static TreeNode *Instantiate(const TreeNode  *replacement,
+                             const TreeNode **binds);
+
+static bool SymbolEqual(ExpressionType_t  type,
+                        NodeData          data,
+                        const TreeNode   *node);
+
+//==============================================================================
+
+TreeErrs_t RuleSetCtor(RuleSet *set)
+{
+    CHECK(set);
+
+    memset(set, 0, sizeof(RuleSet));
+
+    NodeArenaCtor(&set->arena);
+
+    // trie node 0 is the root
+
+    if (TrieNodeCtor(set) == kRuleNone)
+    {
+        RuleSetDtor(set);
+
+        return kFailedAllocation;
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t RuleSetDtor(RuleSet *set)
+{
+    CHECK(set);
+
+    if (curr_rules == set)
+    {
+        curr_rules = nullptr;
+    }
+
+    // patterns and replacements all live in the arena
+
+    NodeArenaDtor(&set->arena);
+
+    free(set->rules);
+    free(set->trie);
+    free(set->edges);
+
+    memset(set, 0, sizeof(RuleSet));
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+RuleSet *RuleSetSelect(RuleSet *set)
+{
+    RuleSet *prev_set = curr_rules;
+
+    curr_rules = set;
+
+    return prev_set;
+}
+
+//==============================================================================
+
+RuleSet *RuleSetCurrent()
+{
+    return curr_rules;
+}
+
+//==============================================================================
+
+TreeErrs_t RuleSetAdd(RuleSet    *set,
+                      const char *rule_str)
+{
+    CHECK(set);
+    CHECK(rule_str);
+
+    if (set->rule_count >= set->rule_capacity)
+    {
+        size_t new_capacity = (set->rule_capacity == 0) ? kBaseRuleCapacity :
+                                                          set->rule_capacity * kRuleMultiplier;
+
+        Rule *new_rules = (Rule *) realloc(set->rules, new_capacity * sizeof(Rule));
+
+        if (new_rules == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        set->rules         = new_rules;
+        set->rule_capacity = new_capacity;
+    }
+
+    Rule *rule = &set->rules[set->rule_count];
+
+    memset(rule, 0, sizeof(Rule));
+
+    rule->next_rule = kRuleNone;
+
+    NodeArena *prev_arena = NodeArenaSelect(&set->arena);
+    DagTable  *prev_dag   = DagSelect(nullptr);
+
+    TreeErrs_t status = ParseRule(rule_str, rule);
+
+    DagSelect(prev_dag);
+    NodeArenaSelect(prev_arena);
+
+    if (status != kTreeSuccess)
+    {
+        printf(">>Bad rule \"%s\"\n", rule_str);
+
+        return status;
+    }
+
+    set->rule_count++;
+
+    return InsertRule(set, set->rule_count - 1);
+}
+
+//==============================================================================
+
+TreeErrs_t RuleSetLoad(RuleSet    *set,
+                       const char *file_name)
+{
+    CHECK(set);
+    CHECK(file_name);
+
+    FILE *rules_file = fopen(file_name, "r");
+
+    if (rules_file == nullptr)
+    {
+        perror("\nRuleSetLoad() failed to open rules file\n");
+
+        return kFailedToOpenFile;
+    }
+
+    char line[kMaxRuleLen] = {};
+
+    TreeErrs_t status = kTreeSuccess;
+
+    while (status == kTreeSuccess && fgets(line, sizeof(line), rules_file) != nullptr)
+    {
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        if (line[strspn(line, " \t")] == '\0')
+        {
+            continue;
+        }
+
+        status = RuleSetAdd(set, line);
+    }
+
+    fclose(rules_file);
+
+    return status;
+}
+
+//==============================================================================
+
+TreeErrs_t RuleSetAddDefaults(RuleSet *set)
+{
+    CHECK(set);
+
+    for (size_t i = 0; i < kDefaultRuleCount; i++)
+    {
+        TreeErrs_t status = RuleSetAdd(set, kDefaultRules[i]);
+
+        if (status != kTreeSuccess)
+        {
+            return status;
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeNode *RuleRewrite(RuleSet        *set,
+                      const TreeNode *node)
+{
+    if (set == nullptr || node == nullptr || node->type != kOperator)
+    {
+        return nullptr;
+    }
+
+    set->lookups++;
+
+    const TreeNode *binds[kMaxRuleVars] = {};
+
+    size_t best = kRuleNone;
+
+    TrieMatch(set, 0, &node, 1, node, &best, binds);
+
+    if (best == kRuleNone)
+    {
+        return nullptr;
+    }
+
+    TreeNode *replacement = Instantiate(set->rules[best].replacement, binds);
+
+    if (replacement != nullptr)
+    {
+        set->rules[best].uses++;
+        set->rewrites++;
+    }
+
+    return replacement;
+}
+
+//==============================================================================
+
+void RuleSetDump(const RuleSet *set,
+                 FILE          *output_file)
+{
+    CHECK(set);
+    CHECK(output_file);
+
+    fprintf(output_file, "rules[%p]:\n"
+                         "\trules      : %zu\n"
+                         "\ttrie nodes : %zu\n"
+                         "\tlookups    : %zu\n"
+                         "\tcandidates : %zu\n"
+                         "\trewrites   : %zu\n",
+                         set,
+                         set->rule_count,
+                         set->trie_size,
+                         set->lookups,
+                         set->candidates,
+                         set->rewrites);
+
+    for (size_t i = 0; i < set->rule_count; i++)
+    {
+        if (set->rules[i].uses != 0)
+        {
+            fprintf(output_file, "\t\trule %zu used %zu times\n", i, set->rules[i].uses);
+        }
+    }
+}
+
+//==============================================================================
+
+static TreeErrs_t ParseRule(const char *rule_str,
+                            Rule       *rule)
+{
+    char buf[kMaxRuleLen] = {};
+
+    if (strlen(rule_str) >= sizeof(buf))
+    {
+        return kFailedToReadText;
+    }
+
+    strcpy(buf, rule_str);
+
+    char *arrow = strstr(buf, "->");
+    char *colon = strchr(buf, ':');
+
+    if (arrow == nullptr || (colon != nullptr && colon < arrow))
+    {
+        return kFailedToReadText;
+    }
+
+    *arrow = '\0';
+
+    if (colon != nullptr)
+    {
+        *colon = '\0';
+    }
+
+    Variables vars = {};
+
+    if (VarArrayInit(&vars) != 0)
+    {
+        return kFailedAllocation;
+    }
+
+    Expr pattern_expr     = {buf,       0};
+    Expr replacement_expr = {arrow + 2, 0};
+
+    rule->pattern   = GetG(&vars, &pattern_expr);
+    rule->var_count = vars.var_count;
+
+    TreeErrs_t status = kFailedToReadText;
+
+    // the replacement may only use variables bound by the pattern
+
+    if (rule->pattern != nullptr && rule->pattern->type == kOperator &&
+        rule->var_count <= kMaxRuleVars &&
+        (rule->replacement = GetG(&vars, &replacement_expr)) != nullptr &&
+        vars.var_count == rule->var_count)
+    {
+        status = (colon != nullptr) ? ParseGuards(&vars, colon + 1, rule) : kTreeSuccess;
+    }
+
+    RuleSymbol symbols[kMaxRuleSize] = {};
+
+    if (status == kTreeSuccess && PatternSymbols(rule->pattern, symbols) == 0)
+    {
+        status = kFailedToReadText;
+    }
+
+    for (size_t i = 0; i < vars.var_count; i++)
+    {
+        free(vars.var_array[i].id);
+    }
+
+    VarArrayDtor(&vars);
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+// "num(a), nonzero(b)"
+
+static TreeErrs_t ParseGuards(Variables *vars,
+                              char      *guards_str,
+                              Rule      *rule)
+{
+    for (char *guard = strtok(guards_str, ","); guard != nullptr; guard = strtok(nullptr, ","))
+    {
+        char kind[16] = {};
+        char name[16] = {};
+
+        if (rule->guard_count >= kMaxRuleGuards ||
+            sscanf(guard, " %15[a-z] ( %15[a-zA-Z] )", kind, name) != 2)
+        {
+            return kFailedToReadText;
+        }
+
+        int var = SeekVariable(vars, name);
+
+        if (var < 0)
+        {
+            return kFailedToReadText;
+        }
+
+        RuleGuard *dest = &rule->guards[rule->guard_count++];
+
+        dest->var = (size_t) var;
+
+        if (strcmp(kind, "num") == 0)
+        {
+            dest->kind = kGuardNum;
+        }
+        else if (strcmp(kind, "notnum") == 0)
+        {
+            dest->kind = kGuardNotNum;
+        }
+        else if (strcmp(kind, "int") == 0)
+        {
+            dest->kind = kGuardInt;
+        }
+        else if (strcmp(kind, "odd") == 0)
+        {
+            dest->kind = kGuardOdd;
+        }
+        else if (strcmp(kind, "nonzero") == 0)
+        {
+            dest->kind = kGuardNonZero;
+        }
+        else if (strcmp(kind, "positive") == 0)
+        {
+            dest->kind = kGuardPositive;
+        }
+        else
+        {
+            return kFailedToReadText;
+        }
+    }
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static TreeErrs_t InsertRule(RuleSet *set,
+                             size_t   rule_idx)
+{
+    RuleSymbol symbols[kMaxRuleSize] = {};
+
+    size_t symbol_count = PatternSymbols(set->rules[rule_idx].pattern, symbols);
+
+    size_t trie = 0;
+
+    for (size_t i = 0; i < symbol_count && trie != kRuleNone; i++)
+    {
+        trie = TrieStep(set, trie, &symbols[i]);
+    }
+
+    if (trie == kRuleNone)
+    {
+        set->rule_count--;
+
+        return kFailedAllocation;
+    }
+
+    // rules of one trie node stay in the order they were added
+
+    size_t *link = &set->trie[trie].first_rule;
+
+    while (*link != kRuleNone)
+    {
+        link = &set->rules[*link].next_rule;
+    }
+
+    *link = rule_idx;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// Preorder symbols of pattern, 0 if it has more than kMaxRuleSize nodes.
+
+static size_t PatternSymbols(const TreeNode *pattern,
+                             RuleSymbol     *symbols)
+{
+    const TreeNode *stk[kMaxRuleSize + 1] = {pattern};
+
+    size_t stk_size     = 1;
+    size_t symbol_count = 0;
+
+    while (stk_size > 0)
+    {
+        const TreeNode *node = stk[--stk_size];
+
+        if (symbol_count >= kMaxRuleSize || stk_size + 2 > kMaxRuleSize)
+        {
+            return 0;
+        }
+
+        symbols[symbol_count].type = node->type;
+        symbols[symbol_count].data = node->data;
+
+        symbol_count++;
+
+        if (node->right != nullptr)
+        {
+            stk[stk_size++] = node->right;
+        }
+
+        if (node->left != nullptr)
+        {
+            stk[stk_size++] = node->left;
+        }
+    }
+
+    return symbol_count;
+}
+
+//==============================================================================
+
+static size_t TrieNodeCtor(RuleSet *set)
+{
+    if (set->trie_size >= set->trie_capacity)
+    {
+        size_t new_capacity = (set->trie_capacity == 0) ? kBaseRuleCapacity :
+                                                          set->trie_capacity * kRuleMultiplier;
+
+        RuleTrieNode *new_trie = (RuleTrieNode *) realloc(set->trie, new_capacity * sizeof(RuleTrieNode));
+
+        if (new_trie == nullptr)
+        {
+            return kRuleNone;
+        }
+
+        set->trie          = new_trie;
+        set->trie_capacity = new_capacity;
+    }
+
+    set->trie[set->trie_size] = {kRuleNone, kRuleNone};
+
+    return set->trie_size++;
+}
+
+//------------------------------------------------------------------------------
+// Trie node after symbol from trie, created if there is none yet.
+
+static size_t TrieStep(RuleSet          *set,
+                       size_t            trie,
+                       const RuleSymbol *symbol)
+{
+    if (symbol->type == kVariable)
+    {
+        if (set->trie[trie].wildcard == kRuleNone)
+        {
+            size_t wildcard = TrieNodeCtor(set);
+
+            if (wildcard == kRuleNone)
+            {
+                return kRuleNone;
+            }
+
+            set->trie[trie].wildcard = wildcard;
+        }
+
+        return set->trie[trie].wildcard;
+    }
+
+    if ((set->edge_count + 1) * kRuleMultiplier > set->edge_capacity && GrowEdges(set) != kTreeSuccess)
+    {
+        return kRuleNone;
+    }
+
+    RuleTrieEdge *edge = SeekEdge(set->edges, set->edge_capacity, trie, symbol->type, symbol->data);
+
+    if (edge->from != kRuleNone)
+    {
+        return edge->target;
+    }
+
+    size_t target = TrieNodeCtor(set);
+
+    if (target == kRuleNone)
+    {
+        return kRuleNone;
+    }
+
+    *edge = {trie, symbol->type, symbol->data, target};
+
+    set->edge_count++;
+
+    return target;
+}
+
+//------------------------------------------------------------------------------
+// Slot of the edge from trie node from by the symbol or the empty slot where
+// it would go.
+
+static RuleTrieEdge *SeekEdge(RuleTrieEdge     *edges,
+                              size_t            capacity,
+                              size_t            from,
+                              ExpressionType_t  type,
+                              NodeData          data)
+{
+    uint64_t key = 0;
+
+    if (type == kOperator)
+    {
+        key = (uint64_t) data.op_code;
+    }
+    else
+    {
+        // -0.0 == 0.0, so both get the same bits
+        NumType_t val = IsNumEqual(data.const_val, 0) ? 0 : data.const_val;
+
+        memcpy(&key, &val, sizeof(key));
+    }
+
+    uint64_t hash = (key ^ ((uint64_t) from << 32) ^ (uint64_t) type) * 0x9e3779b97f4a7c15ULL;
+
+    size_t mask = capacity - 1;
+    size_t pos  = (size_t) (hash >> 17) & mask;
+
+    while (edges[pos].from != kRuleNone &&
+           !(edges[pos].from == from && edges[pos].type == type &&
+             ((type == kOperator    && edges[pos].data.op_code   == data.op_code) ||
+              (type == kConstNumber && IsNumEqual(edges[pos].data.const_val, data.const_val)))))
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return &edges[pos];
+}
+
+//==============================================================================
+
+static TreeErrs_t GrowEdges(RuleSet *set)
+{
+    size_t new_capacity = (set->edge_capacity == 0) ? kBaseRuleCapacity :
+                                                      set->edge_capacity * kRuleMultiplier;
+
+    RuleTrieEdge *new_edges = (RuleTrieEdge *) calloc(new_capacity, sizeof(RuleTrieEdge));
+
+    if (new_edges == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    for (size_t i = 0; i < new_capacity; i++)
+    {
+        new_edges[i].from = kRuleNone;
+    }
+
+    for (size_t i = 0; i < set->edge_capacity; i++)
+    {
+        const RuleTrieEdge *edge = &set->edges[i];
+
+        if (edge->from != kRuleNone)
+        {
+            *SeekEdge(new_edges, new_capacity, edge->from, edge->type, edge->data) = *edge;
+        }
+    }
+
+    free(set->edges);
+
+    set->edges         = new_edges;
+    set->edge_capacity = new_capacity;
+
+    return kTreeSuccess;
+}
+
+//------------------------------------------------------------------------------
+// pending holds the subtrees of node still to be matched, the next one last.
+// A pattern variable takes a whole subtree, any other symbol must agree with
+// the root of the subtree and its operands are matched next. The recursion is
+// as deep as the longest pattern.
+
+static void TrieMatch(RuleSet         *set,
+                      size_t           trie,
+                      const TreeNode **pending,
+                      size_t           pending_count,
+                      const TreeNode  *node,
+                      size_t          *best,
+                      const TreeNode **best_binds)
+{
+    if (pending_count == 0)
+    {
+        for (size_t rule = set->trie[trie].first_rule; rule != kRuleNone && rule < *best;
+             rule = set->rules[rule].next_rule)
+        {
+            const TreeNode *binds[kMaxRuleVars] = {};
+
+            set->candidates++;
+
+            if (BindPattern(set->rules[rule].pattern, node, binds) &&
+                CheckGuards(&set->rules[rule], binds))
+            {
+                *best = rule;
+
+                memcpy(best_binds, binds, sizeof(binds));
+
+                break;
+            }
+        }
+
+        return;
+    }
+
+    const TreeNode *next = pending[pending_count - 1];
+
+    if (set->trie[trie].wildcard != kRuleNone)
+    {
+        TrieMatch(set, set->trie[trie].wildcard, pending, pending_count - 1, node, best, best_binds);
+    }
+
+    if ((next->type != kOperator && next->type != kConstNumber) ||
+        set->edge_capacity == 0 || pending_count + 1 > kMaxRuleSize)
+    {
+        return;
+    }
+
+    const RuleTrieEdge *edge = SeekEdge(set->edges, set->edge_capacity, trie, next->type, next->data);
+
+    if (edge->from == kRuleNone)
+    {
+        return;
+    }
+
+    const TreeNode *operands[kMaxRuleSize + 1] = {};
+
+    memcpy(operands, pending, (pending_count - 1) * sizeof(TreeNode *));
+
+    size_t operand_count = pending_count - 1;
+
+    if (next->right != nullptr)
+    {
+        operands[operand_count++] = next->right;
+    }
+
+    if (next->left != nullptr)
+    {
+        operands[operand_count++] = next->left;
+    }
+
+    TrieMatch(set, edge->target, operands, operand_count, node, best, best_binds);
+}
+
+//------------------------------------------------------------------------------
+// The trie only checks symbols, here the variables get bound and repeated
+// variables are compared.
+
+static bool BindPattern(const TreeNode  *pattern,
+                        const TreeNode  *node,
+                        const TreeNode **binds)
+{
+    if (pattern == nullptr || node == nullptr)
+    {
+        return pattern == node;
+    }
+
+    if (pattern->type == kVariable)
+    {
+        const TreeNode **bind = &binds[pattern->data.variable_pos];
+
+        if (*bind == nullptr)
+        {
+            *bind = node;
+
+            return true;
+        }
+
+        return TreeEqual(*bind, node);
+    }
+
+    return SymbolEqual(pattern->type, pattern->data, node) &&
+           BindPattern(pattern->left,  node->left,  binds) &&
+           BindPattern(pattern->right, node->right, binds);
+}
+
+//==============================================================================
+
+static bool CheckGuards(const Rule      *rule,
+                        const TreeNode **binds)
+{
+    for (size_t i = 0; i < rule->guard_count; i++)
+    {
+        const TreeNode *bind = binds[rule->guards[i].var];
+
+        bool is_num = (bind->type == kConstNumber);
+        bool is_int = is_num && IsNumEqual(bind->data.const_val, floor(bind->data.const_val));
+
+        switch (rule->guards[i].kind)
+        {
+            case kGuardNum:
+            {
+                if (!is_num) return false;
+
+                break;
+            }
+
+            case kGuardNotNum:
+            {
+                if (is_num) return false;
+
+                break;
+            }
+
+            case kGuardInt:
+            {
+                if (!is_int) return false;
+
+                break;
+            }
+
+            case kGuardOdd:
+            {
+                if (!is_int || IsNumEqual(fmod(bind->data.const_val, 2), 0)) return false;
+
+                break;
+            }
+
+            case kGuardNonZero:
+            {
+                if (!IsAwayFromZero(bind)) return false;
+
+                break;
+            }
+
+            case kGuardPositive:
+            {
+                if (!IsAboveZero(bind)) return false;
+
+                break;
+            }
+
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Built through the constructors, so (c + 1) with a number c is folded.
+
+static TreeNode *Instantiate(const TreeNode  *replacement,
+                             const TreeNode **binds)
+{
+    if (replacement == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (replacement->type == kVariable)
+    {
+        return CopyNode(binds[replacement->data.variable_pos], nullptr);
+    }
+
+    if (replacement->type == kConstNumber)
+    {
+        return NodeCtor(nullptr, nullptr, nullptr, kConstNumber, replacement->data.const_val);
+    }
+
+    TreeNode *left  = Instantiate(replacement->left,  binds);
+    TreeNode *right = Instantiate(replacement->right, binds);
+
+    if ((replacement->left  != nullptr && left  == nullptr) ||
+        (replacement->right != nullptr && right == nullptr))
+    {
+        TreeDtor(left);
+        TreeDtor(right);
+
+        return nullptr;
+    }
+
+    return OpCtor(replacement->data.op_code, left, right);
+}
+
+//==============================================================================
+
+static bool SymbolEqual(ExpressionType_t  type,
+                        NodeData          data,
+                        const TreeNode   *node)
+{
+    if (node->type != type)
+    {
+        return false;
+    }
+
+    switch (type)
+    {
+        case kOperator:
+        {
+            return node->data.op_code == data.op_code;
+        }
+
+        case kConstNumber:
+        {
+            return IsNumEqual(node->data.const_val, data.const_val);
+        }
+
+        case kVariable:
+        case kRepVar:
+        default:
+        {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef RULES_HEADER
+#define RULES_HEADER
+
+#include <stdio.h>
+
+#include "trees.h"
+
+//! Rewrite rules applied by SimplifyTree() after the rules of the
+//! constructors. One rule per line:
+//!
+//!     pattern -> replacement [: guard, guard ...]
+//!
+//! Both sides are parsed by GetG(), every identifier is a pattern variable
+//! that matches any subtree, the same variable twice matches equal subtrees.
+//! Numbers are integers as in the rest of the parser. Guards are num(a),
+//! notnum(a), int(a) and odd(a) for numbers with an integer or an odd
+//! integer value, nonzero(a) and positive(a), the last two hold where
+//! IsAwayFromZero() and IsAboveZero() prove them. Lines starting with '#' are
+//! comments. When several rules match, the one added first wins.
+//!
+//! Patterns are compiled into a discrimination tree keyed by their symbols in
+//! preorder, so a node is matched against all rules in one walk that only
+//! follows the symbols of the node itself.
+
+static const size_t kMaxRuleVars   = 8;
+static const size_t kMaxRuleGuards = 4;
+static const size_t kMaxRuleSize   = 32; // nodes in a pattern
+
+static const size_t kRuleNone = SIZE_MAX;
+
+typedef enum
+{
+    kGuardNum,
+    kGuardNotNum,
+    kGuardInt,
+    kGuardOdd,
+    kGuardNonZero,
+    kGuardPositive,
+} RuleGuard_t;
+
+struct RuleGuard
+{
+    RuleGuard_t kind;
+    size_t      var;
+};
+
+struct Rule
+{
+    TreeNode *pattern;
+    TreeNode *replacement;
+
+    size_t    var_count;
+    RuleGuard guards[kMaxRuleGuards];
+    size_t    guard_count;
+
+    size_t next_rule; // next rule ending in the same trie node
+    size_t uses;
+};
+
+struct RuleTrieNode
+{
+    size_t wildcard;   // trie node after a pattern variable
+    size_t first_rule;
+};
+
+//! Edges of all trie nodes live in one hash table keyed by the trie node and
+//! the symbol, so a step costs one probe whatever the fan-out.
+struct RuleTrieEdge
+{
+    size_t           from; // kRuleNone for an empty slot
+    ExpressionType_t type; // kOperator or kConstNumber
+    NodeData         data;
+
+    size_t target;
+};
+
+struct RuleSet
+{
+    Rule  *rules;
+    size_t rule_count;
+    size_t rule_capacity;
+
+    RuleTrieNode *trie;
+    size_t        trie_size;
+    size_t        trie_capacity;
+
+    RuleTrieEdge *edges;
+    size_t        edge_count;
+    size_t        edge_capacity;
+
+    NodeArena arena; // patterns and replacements
+
+    size_t lookups;
+    size_t candidates; // rules reached in the trie
+    size_t rewrites;
+};
+
+TreeErrs_t RuleSetCtor(RuleSet *set);
+
+TreeErrs_t RuleSetDtor(RuleSet *set);
+
+//! Makes set current for the calling thread, returns the previous one.
+//! Matching updates the counters of the set, so a set is used by one thread.
+RuleSet *RuleSetSelect(RuleSet *set);
+
+RuleSet *RuleSetCurrent();
+
+TreeErrs_t RuleSetAdd(RuleSet    *set,
+                      const char *rule_str);
+
+TreeErrs_t RuleSetLoad(RuleSet    *set,
+                       const char *file_name);
+
+//! Trig, log and power identities the constructors don't know.
+TreeErrs_t RuleSetAddDefaults(RuleSet *set);
+
+//! Replacement built for node by the first matching rule or nullptr, node
+//! itself is not changed.
+TreeNode *RuleRewrite(RuleSet        *set,
+                      const TreeNode *node);
+
+void RuleSetDump(const RuleSet *set,
+                 FILE          *output_file);
+
+#endif
@@ -0,0 +1,657 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "taylor.h"
+#include "diff.h"
+#include "work_stack.h"
+#include "debug/debug.h"
+
+//! Series of the operands live in consecutive slots of order coefficients, in
+//! the same order Eval() keeps values on its stack. Slots above the live ones
+//! are scratch for the result of the current operator.
+struct TaylorPool
+{
+    NumType_t *data;
+    size_t     order;
+    size_t     live;
+    size_t     capacity; // in slots
+};
+
+static const size_t kTaylorScratch    = 3;
+static const size_t kTaylorMultiplier = 2;
+
+static TreeErrs_t TaylorReserve(TaylorPool *pool,
+                                size_t      slots);
+
+static NumType_t *TaylorSlot(TaylorPool *pool,
+                             size_t      slot);
+
+static void TaylorApply(OpCode_t   op_code,
+                        NumType_t *res,
+                        NumType_t *left,
+                        NumType_t *right,
+                        NumType_t *scratch_1,
+                        NumType_t *scratch_2,
+                        size_t     order);
+
+static void SeriesMult(NumType_t       *res,
+                       const NumType_t *left,
+                       const NumType_t *right,
+                       size_t           order);
+
+static void SeriesDiv(NumType_t       *res,
+                      const NumType_t *left,
+                      const NumType_t *right,
+                      size_t           order);
+
+static void SeriesSqrt(NumType_t       *res,
+                       const NumType_t *arg,
+                       size_t           order);
+
+static void SeriesLn(NumType_t       *res,
+                     const NumType_t *arg,
+                     size_t           order);
+
+static void SeriesExp(NumType_t       *res,
+                      const NumType_t *arg,
+                      size_t           order);
+
+static void SeriesSinCos(NumType_t       *sin_res,
+                         NumType_t       *cos_res,
+                         const NumType_t *arg,
+                         size_t           order);
+
+static void SeriesTg(NumType_t       *res,
+                     NumType_t       *sec_sqr,
+                     const NumType_t *arg,
+                     size_t           order);
+
+static void SeriesPow(NumType_t       *res,
+                      const NumType_t *base,
+                      const NumType_t *power,
+                      NumType_t       *scratch_1,
+                      NumType_t       *scratch_2,
+                      size_t           order);
+
+static void SeriesConstPow(NumType_t       *res,
+                           const NumType_t *base,
+                           NumType_t        power,
+                           size_t           order);
+
+static void SeriesFill(NumType_t *res,
+                       size_t     from,
+                       size_t     order,
+                       NumType_t  val);
+
+static bool IsConstSeries(const NumType_t *series,
+                          size_t           order);
+
+//==============================================================================
+
+TreeErrs_t TaylorSeries(Variables      *vars,
+                        const TreeNode *node,
+                        size_t          var_pos,
+                        size_t          order,
+                        NumType_t      *coeffs)
+{
+    static const int kTaylorEnter = 0;
+    static const int kTaylorApply = 1;
+
+    CHECK(vars);
+    CHECK(node);
+    CHECK(coeffs);
+
+    if (order == 0)
+    {
+        return kTreeSuccess;
+    }
+
+    TaylorPool pool = {nullptr, order, 0, 0};
+
+    WorkStack frames = {};
+
+    WorkStackCtor(&frames);
+
+    TreeErrs_t status = WorkPushNode(&frames, node, kTaylorEnter);
+
+    while (frames.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        if ((status = TaylorReserve(&pool, pool.live + kTaylorScratch)) != kTreeSuccess)
+        {
+            break;
+        }
+
+        if (frame.state == kTaylorApply)
+        {
+            NumType_t *left = TaylorSlot(&pool, pool.live - 2);
+            NumType_t *res  = TaylorSlot(&pool, pool.live);
+
+            TaylorApply(curr->data.op_code, res, left, TaylorSlot(&pool, pool.live - 1),
+                        TaylorSlot(&pool, pool.live + 1), TaylorSlot(&pool, pool.live + 2), order);
+
+            memcpy(left, res, order * sizeof(NumType_t));
+
+            pool.live--;
+
+            continue;
+        }
+
+        if (curr != nullptr && curr->type == kOperator)
+        {
+            if ((status = WorkPushNode(&frames, curr,        kTaylorApply)) != kTreeSuccess ||
+                (status = WorkPushNode(&frames, curr->right, kTaylorEnter)) != kTreeSuccess ||
+                (status = WorkPushNode(&frames, curr->left,  kTaylorEnter)) != kTreeSuccess)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        NumType_t *leaf = TaylorSlot(&pool, pool.live++);
+
+        SeriesFill(leaf, 0, order, 0);
+
+        if (curr == nullptr)
+        {
+            continue;
+        }
+
+        if (curr->type == kConstNumber)
+        {
+            leaf[0] = curr->data.const_val;
+        }
+        else if (curr->type == kVariable)
+        {
+            leaf[0] = vars->var_array[curr->data.variable_pos].value;
+
+            if (order > 1 && curr->data.variable_pos == var_pos)
+            {
+                leaf[1] = 1;
+            }
+        }
+    }
+
+    if (status == kTreeSuccess && pool.live == 1)
+    {
+        memcpy(coeffs, TaylorSlot(&pool, 0), order * sizeof(NumType_t));
+    }
+    else
+    {
+        SeriesFill(coeffs, 0, order, NAN);
+    }
+
+    WorkStackDtor(&frames);
+    free(pool.data);
+
+    return status;
+}
+
+//==============================================================================
+
+static TreeErrs_t TaylorReserve(TaylorPool *pool,
+                                size_t      slots)
+{
+    if (slots <= pool->capacity)
+    {
+        return kTreeSuccess;
+    }
+
+    size_t new_capacity = (pool->capacity == 0) ? kTaylorScratch + 1 : pool->capacity;
+
+    while (new_capacity < slots)
+    {
+        new_capacity *= kTaylorMultiplier;
+    }
+
+    NumType_t *new_data = (NumType_t *) realloc(pool->data, new_capacity * pool->order * sizeof(NumType_t));
+
+    if (new_data == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    pool->data     = new_data;
+    pool->capacity = new_capacity;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static NumType_t *TaylorSlot(TaylorPool *pool,
+                             size_t      slot)
+{
+    return pool->data + slot * pool->order;
+}
+
+//==============================================================================
+
+static void TaylorApply(OpCode_t   op_code,
+                        NumType_t *res,
+                        NumType_t *left,
+                        NumType_t *right,
+                        NumType_t *scratch_1,
+                        NumType_t *scratch_2,
+                        size_t     order)
+{
+    if (IsConstSeries(left, order) && IsConstSeries(right, order))
+    {
+        // nothing below depends on the variable, the result is a constant
+        // even where the recurrence divides by a zero value (sqrt, ln, pow
+        // of 0), like DiffTree() folds the zero derivative of such a node
+
+        SeriesFill(res, 1, order, 0);
+
+        res[0] = ApplyOp(op_code, left[0], right[0]);
+
+        return;
+    }
+
+    switch (op_code)
+    {
+        case kAdd:
+        {
+            for (size_t k = 0; k < order; k++)
+            {
+                res[k] = left[k] + right[k];
+            }
+
+            break;
+        }
+
+        case kSub:
+        {
+            for (size_t k = 0; k < order; k++)
+            {
+                res[k] = left[k] - right[k];
+            }
+
+            break;
+        }
+
+        case kMult:
+        {
+            SeriesMult(res, left, right, order);
+
+            break;
+        }
+
+        case kDiv:
+        {
+            SeriesDiv(res, left, right, order);
+
+            break;
+        }
+
+        case kSqrt:
+        {
+            SeriesSqrt(res, right, order);
+
+            break;
+        }
+
+        case kSin:
+        {
+            SeriesSinCos(res, scratch_1, right, order);
+
+            break;
+        }
+
+        case kCos:
+        {
+            SeriesSinCos(scratch_1, res, right, order);
+
+            break;
+        }
+
+        case kTg:
+        {
+            SeriesTg(res, scratch_1, right, order);
+
+            break;
+        }
+
+        case kLn:
+        {
+            SeriesLn(res, right, order);
+
+            break;
+        }
+
+        case kExp:
+        {
+            SeriesPow(res, left, right, scratch_1, scratch_2, order);
+
+            break;
+        }
+
+        case kNotAnOperation:
+        default:
+        {
+            SeriesFill(res, 0, order, NAN);
+
+            break;
+        }
+    }
+
+    // the value itself is always the one Eval() gives
+    res[0] = ApplyOp(op_code, left[0], right[0]);
+}
+
+//==============================================================================
+
+static void SeriesMult(NumType_t       *res,
+                       const NumType_t *left,
+                       const NumType_t *right,
+                       size_t           order)
+{
+    for (size_t k = 0; k < order; k++)
+    {
+        NumType_t sum = 0;
+
+        for (size_t j = 0; j <= k; j++)
+        {
+            sum += left[j] * right[k - j];
+        }
+
+        res[k] = sum;
+    }
+}
+
+//==============================================================================
+
+static void SeriesDiv(NumType_t       *res,
+                      const NumType_t *left,
+                      const NumType_t *right,
+                      size_t           order)
+{
+    if (IsNumEqual(right[0], 0))
+    {
+        SeriesFill(res, 0, order, NAN);
+
+        return;
+    }
+
+    for (size_t k = 0; k < order; k++)
+    {
+        NumType_t sum = left[k];
+
+        for (size_t j = 1; j <= k; j++)
+        {
+            sum -= right[j] * res[k - j];
+        }
+
+        res[k] = sum / right[0];
+    }
+}
+
+//==============================================================================
+
+static void SeriesSqrt(NumType_t       *res,
+                       const NumType_t *arg,
+                       size_t           order)
+{
+    res[0] = sqrt(arg[0]);
+
+    if (IsNumEqual(res[0], 0))
+    {
+        SeriesFill(res, 1, order, NAN);
+
+        return;
+    }
+
+    for (size_t k = 1; k < order; k++)
+    {
+        NumType_t sum = arg[k];
+
+        for (size_t j = 1; j < k; j++)
+        {
+            sum -= res[j] * res[k - j];
+        }
+
+        res[k] = sum / (2 * res[0]);
+    }
+}
+
+//==============================================================================
+
+static void SeriesLn(NumType_t       *res,
+                     const NumType_t *arg,
+                     size_t           order)
+{
+    res[0] = log(arg[0]);
+
+    if (IsNumEqual(arg[0], 0))
+    {
+        SeriesFill(res, 1, order, NAN);
+
+        return;
+    }
+
+    for (size_t k = 1; k < order; k++)
+    {
+        NumType_t sum = 0;
+
+        for (size_t j = 1; j < k; j++)
+        {
+            sum += (NumType_t) j * res[j] * arg[k - j];
+        }
+
+        res[k] = (arg[k] - sum / (NumType_t) k) / arg[0];
+    }
+}
+
+//==============================================================================
+
+static void SeriesExp(NumType_t       *res,
+                      const NumType_t *arg,
+                      size_t           order)
+{
+    res[0] = exp(arg[0]);
+
+    for (size_t k = 1; k < order; k++)
+    {
+        NumType_t sum = 0;
+
+        for (size_t j = 1; j <= k; j++)
+        {
+            sum += (NumType_t) j * arg[j] * res[k - j];
+        }
+
+        res[k] = sum / (NumType_t) k;
+    }
+}
+
+//==============================================================================
+
+static void SeriesSinCos(NumType_t       *sin_res,
+                         NumType_t       *cos_res,
+                         const NumType_t *arg,
+                         size_t           order)
+{
+    sin_res[0] = sin(arg[0]);
+    cos_res[0] = cos(arg[0]);
+
+    for (size_t k = 1; k < order; k++)
+    {
+        NumType_t sin_sum = 0;
+        NumType_t cos_sum = 0;
+
+        for (size_t j = 1; j <= k; j++)
+        {
+            sin_sum += (NumType_t) j * arg[j] * cos_res[k - j];
+            cos_sum += (NumType_t) j * arg[j] * sin_res[k - j];
+        }
+
+        sin_res[k] =  sin_sum / (NumType_t) k;
+        cos_res[k] = -cos_sum / (NumType_t) k;
+    }
+}
+
+//==============================================================================
+
+// tg' = (1 + tg^2) * arg', sec_sqr keeps the series of 1 + tg^2
+
+static void SeriesTg(NumType_t       *res,
+                     NumType_t       *sec_sqr,
+                     const NumType_t *arg,
+                     size_t           order)
+{
+    res[0] = tan(arg[0]);
+
+    for (size_t k = 1; k < order; k++)
+    {
+        NumType_t sqr = (k == 1) ? 1 : 0;
+
+        for (size_t i = 0; i < k; i++)
+        {
+            sqr += res[i] * res[k - 1 - i];
+        }
+
+        sec_sqr[k - 1] = sqr;
+
+        NumType_t sum = 0;
+
+        for (size_t j = 1; j <= k; j++)
+        {
+            sum += (NumType_t) j * arg[j] * sec_sqr[k - j];
+        }
+
+        res[k] = sum / (NumType_t) k;
+    }
+}
+
+//==============================================================================
+
+static void SeriesPow(NumType_t       *res,
+                      const NumType_t *base,
+                      const NumType_t *power,
+                      NumType_t       *scratch_1,
+                      NumType_t       *scratch_2,
+                      size_t           order)
+{
+    bool const_power = true;
+
+    for (size_t k = 1; k < order && const_power; k++)
+    {
+        const_power = IsNumEqual(power[k], 0);
+    }
+
+    if (!const_power)
+    {
+        // base^power = exp(power * ln(base))
+
+        SeriesLn(scratch_1, base, order);
+        SeriesMult(scratch_2, power, scratch_1, order);
+        SeriesExp(res, scratch_2, order);
+
+        return;
+    }
+
+    size_t    shift     = 0;
+    NumType_t power_val = power[0];
+
+    while (shift < order && IsNumEqual(base[shift], 0))
+    {
+        shift++;
+    }
+
+    if (shift == 0)
+    {
+        SeriesConstPow(res, base, power_val, order);
+
+        return;
+    }
+
+    // base = x^shift * rest with rest[0] != 0, so base^power_val has the
+    // factor x^(shift * power_val), analytic only for integer power_val >= 0
+
+    SeriesFill(res, 0, order, 0);
+    res[0] = pow(base[0], power_val);
+
+    if (power_val < 0 || !IsNumEqual(power_val, floor(power_val)))
+    {
+        for (size_t k = 1; k < order; k++)
+        {
+            res[k] = ((NumType_t) k < power_val * (NumType_t) shift) ? 0 : NAN;
+        }
+
+        return;
+    }
+
+    if (power_val * (NumType_t) shift >= (NumType_t) order)
+    {
+        return;
+    }
+
+    size_t res_shift  = (size_t) power_val * shift;
+    size_t rest_order = order - res_shift;
+
+    for (size_t k = 0; k < rest_order; k++)
+    {
+        scratch_1[k] = (shift + k < order) ? base[shift + k] : 0;
+    }
+
+    SeriesConstPow(scratch_2, scratch_1, power_val, rest_order);
+
+    memcpy(res + res_shift, scratch_2, rest_order * sizeof(NumType_t));
+}
+
+//==============================================================================
+
+// c_k = sum_{j=1}^{k} (power * j - (k - j)) * a_j * c_{k-j} / (k * a_0), a_0 != 0
+
+static void SeriesConstPow(NumType_t       *res,
+                           const NumType_t *base,
+                           NumType_t        power,
+                           size_t           order)
+{
+    res[0] = pow(base[0], power);
+
+    for (size_t k = 1; k < order; k++)
+    {
+        NumType_t sum = 0;
+
+        for (size_t j = 1; j <= k; j++)
+        {
+            sum += (power * (NumType_t) j - (NumType_t) (k - j)) * base[j] * res[k - j];
+        }
+
+        res[k] = sum / ((NumType_t) k * base[0]);
+    }
+}
+
+//==============================================================================
+
+static void SeriesFill(NumType_t *res,
+                       size_t     from,
+                       size_t     order,
+                       NumType_t  val)
+{
+    for (size_t k = from; k < order; k++)
+    {
+        res[k] = val;
+    }
+}
+
+//==============================================================================
+
+static bool IsConstSeries(const NumType_t *series,
+                          size_t           order)
+{
+    for (size_t k = 1; k < order; k++)
+    {
+        if (!IsNumEqual(series[k], 0))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
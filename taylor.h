@@ -0,0 +1,23 @@
+#ifndef TAYLOR_HEADER
+#define TAYLOR_HEADER
+
+#include "trees.h"
+#include "parse.h"
+
+//! Truncated power series arithmetic. Every node of the tree gets its first
+//! order Taylor coefficients around the current value of the variable at
+//! var_pos, computed from the series of its operands with the usual
+//! recurrences: O(order^2) per node and no derivative trees at all.
+//!
+//! coeffs[k] = f^(k)(x0) / k!, k = 0 ... order - 1. Coefficients that do not
+//! exist (division by zero, ln or non-integer power at 0) are NAN, like the
+//! values Eval() gives for the symbolic derivatives. A node whose operands do
+//! not depend on the variable is a constant series even at such a point.
+
+TreeErrs_t TaylorSeries(Variables      *vars,
+                        const TreeNode *node,
+                        size_t          var_pos,
+                        size_t          order,
+                        NumType_t      *coeffs);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test_utils.h"
+#include "../trees.h"
+#include "../diff.h"
+#include "../parse.h"
+#include "../bytecode.h"
+#include "../jit.h"
+
+//! Points per second of Eval(), BcEval(), JitEval() and EvalBatch() on
+//! derivatives sampled over a grid of x, and a check that all of them give
+//! the same bits.
+//! Usage: bench_eval [point_count]
+
+static const size_t kBasePointCount = 1000000;
+
+struct BenchExpr
+{
+    const char *expr_str;
+    size_t      diff_order;
+};
+
+static const BenchExpr kBenchExprs[] =
+{
+    {"x*x*x+2*x*x-x/3+7",           1},
+    {"sin(x)/cos(x)",               1},
+    {"sin(x)/cos(x)",               2},
+    {"x^3*ln(x*x+1)-tg(x)/(x-1)",   1},
+};
+
+static const size_t kBenchExprCount = sizeof(kBenchExprs) / sizeof(kBenchExprs[0]);
+
+static bool BenchExprRun(const BenchExpr *bench,
+                         const NumType_t *xs,
+                         size_t           point_count,
+                         NumType_t       *expected,
+                         NumType_t       *out);
+
+static size_t CountMismatches(const NumType_t *expected,
+                              const NumType_t *out,
+                              size_t           point_count);
+
+int main(int argc, const char *argv[])
+{
+    size_t point_count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : kBasePointCount;
+
+    NumType_t *xs       = (NumType_t *) calloc(point_count, sizeof(NumType_t));
+    NumType_t *expected = (NumType_t *) calloc(point_count, sizeof(NumType_t));
+    NumType_t *out      = (NumType_t *) calloc(point_count, sizeof(NumType_t));
+
+    if (point_count == 0 || xs == nullptr || expected == nullptr || out == nullptr)
+    {
+        printf(">>bench_eval: bad point count or out of memory\n");
+
+        return 1;
+    }
+
+    for (size_t i = 0; i < point_count; i++)
+    {
+        xs[i] = 0.1 + 1.8 * (NumType_t) i / (NumType_t) point_count;
+    }
+
+    printf("%zu points of x in [0.1, 1.9), millions of points per second\n\n", point_count);
+    printf("%-28s %5s %8s %8s %8s %8s\n", "expression", "diff", "Eval", "BcEval", "Jit", "Batch");
+
+    bool is_ok = true;
+
+    for (size_t i = 0; i < kBenchExprCount; i++)
+    {
+        is_ok = BenchExprRun(&kBenchExprs[i], xs, point_count, expected, out) && is_ok;
+    }
+
+    free(xs);
+    free(expected);
+    free(out);
+
+    return is_ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+// One row of the table. Eval() gives the expected bits for the others.
+
+static bool BenchExprRun(const BenchExpr *bench,
+                         const NumType_t *xs,
+                         size_t           point_count,
+                         NumType_t       *expected,
+                         NumType_t       *out)
+{
+    Variables vars = {};
+
+    VarArrayInit(&vars);
+
+    Tree func = {};
+
+    func.root = ParseExpr(&vars, bench->expr_str);
+
+    for (size_t order = 0; func.root != nullptr && order < bench->diff_order; order++)
+    {
+        TreeNode *diff = DiffTree(func.root, 0, nullptr);
+
+        TreeDtor(func.root);
+
+        func.root = diff;
+    }
+
+    BcProgram prog = {};
+    JitFunc   jit  = {};
+
+    BcCtor(&prog);
+    JitCtor(&jit);
+
+    if (func.root == nullptr || vars.var_count != 1 ||
+        BcCompile(&prog, func.root) != kTreeSuccess || JitCompile(&jit, func.root) != kTreeSuccess)
+    {
+        printf(">>bench_eval: failed to prepare %s\n", bench->expr_str);
+
+        JitDtor(&jit);
+        BcDtor(&prog);
+        TreeDtor(func.root);
+        VarArrayDtor(&vars);
+
+        return false;
+    }
+
+    double start = TimeNow();
+
+    for (size_t i = 0; i < point_count; i++)
+    {
+        vars.var_array[0].value = xs[i];
+
+        expected[i] = Eval(&vars, func.root);
+    }
+
+    double eval_time = TimeNow() - start;
+
+    start = TimeNow();
+
+    for (size_t i = 0; i < point_count; i++)
+    {
+        vars.var_array[0].value = xs[i];
+
+        out[i] = BcEval(&prog, &vars);
+    }
+
+    double bc_time = TimeNow() - start;
+
+    size_t mismatches = CountMismatches(expected, out, point_count);
+
+    start = TimeNow();
+
+    for (size_t i = 0; i < point_count; i++)
+    {
+        vars.var_array[0].value = xs[i];
+
+        out[i] = JitEval(&jit, &vars);
+    }
+
+    double jit_time = TimeNow() - start;
+
+    mismatches += CountMismatches(expected, out, point_count);
+
+    start = TimeNow();
+
+    EvalBatch(&vars, func.root, &xs, point_count, out);
+
+    double batch_time = TimeNow() - start;
+
+    mismatches += CountMismatches(expected, out, point_count);
+
+    double mpts = (double) point_count * 1e-6;
+
+    printf("%-28s %5zu %8.2f %8.2f %8.2f %8.2f", bench->expr_str, bench->diff_order,
+           mpts / eval_time, mpts / bc_time, mpts / jit_time, mpts / batch_time);
+
+    if (mismatches != 0)
+    {
+        printf("  %zu results differ from Eval()", mismatches);
+    }
+
+    printf("\n");
+
+    JitDtor(&jit);
+    BcDtor(&prog);
+    TreeDtor(func.root);
+    VarArrayDtor(&vars);
+
+    return mismatches == 0;
+}
+
+//------------------------------------------------------------------------------
+
+static size_t CountMismatches(const NumType_t *expected,
+                              const NumType_t *out,
+                              size_t           point_count)
+{
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < point_count; i++)
+    {
+        mismatches += !IsSameNum(expected[i], out[i]);
+    }
+
+    return mismatches;
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test_utils.h"
+#include "../trees.h"
+#include "../diff.h"
+#include "../poly.h"
+
+//! Time per node of SimplifyTree() on random trees full of 0*e, e*1, e+0,
+//! e^1 and constant subexpressions. The walk visits every dirty node once,
+//! so the time per node should stay about the same as the trees grow. The
+//! same holds for DiffTree() and PolyTree() on sin(x) + x*x + ... + x*x,
+//! whose every sum has a function of x below it.
+//! Usage: bench_simplify [repeat_count]
+
+static const size_t kBaseRepeatCount = 20;
+
+static const size_t kTreeSizes[] = {2500, 5000, 10000, 20000, 40000, 80000};
+
+static const size_t kTreeSizeCount = sizeof(kTreeSizes) / sizeof(kTreeSizes[0]);
+
+static const size_t kChainTerms[] = {2500, 5000, 10000, 20000};
+
+static const size_t kChainTermCount = sizeof(kChainTerms) / sizeof(kChainTerms[0]);
+
+static bool BenchChains(size_t repeat_count);
+
+static TreeNode *ChainTree(size_t term_count);
+
+static TreeNode *RandTree(uint64_t *seed,
+                          size_t    size);
+
+static TreeNode *RandOp(OpCode_t  op_code,
+                        TreeNode *left,
+                        TreeNode *right);
+
+static TreeNode *RandNum(NumType_t num);
+
+static size_t CountNodes(const TreeNode *node);
+
+static uint64_t NextRand(uint64_t *seed);
+
+int main(int argc, const char *argv[])
+{
+    size_t repeat_count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : kBaseRepeatCount;
+
+    if (repeat_count == 0)
+    {
+        printf(">>bench_simplify: bad repeat count\n");
+
+        return 1;
+    }
+
+    printf("SimplifyTree() on random trees, %zu runs each\n\n", repeat_count);
+    printf("%10s %10s %10s\n", "nodes", "left", "ns/node");
+
+    bool is_ok = true;
+
+    for (size_t i = 0; i < kTreeSizeCount && is_ok; i++)
+    {
+        double total_time = 0;
+        size_t node_count = 0;
+        size_t left_count = 0;
+
+        for (size_t run = 0; run < repeat_count; run++)
+        {
+            uint64_t seed = i + 1;
+
+            Tree tree = {};
+
+            tree.root  = RandTree(&seed, kTreeSizes[i]);
+            node_count = CountNodes(tree.root);
+
+            double start = TimeNow();
+
+            is_ok = (tree.root != nullptr && SimplifyTree(&tree) == kTreeSuccess);
+
+            total_time += TimeNow() - start;
+
+            left_count = CountNodes(tree.root);
+
+            TreeDtor(tree.root);
+
+            if (!is_ok)
+            {
+                printf(">>bench_simplify: failed on %zu nodes\n", kTreeSizes[i]);
+
+                break;
+            }
+        }
+
+        if (is_ok)
+        {
+            printf("%10zu %10zu %10.1f\n", node_count, left_count,
+                   total_time * 1e9 / (double) (node_count * repeat_count));
+        }
+    }
+
+    is_ok = is_ok && BenchChains(repeat_count);
+
+    return is_ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+// Every sum of the chain asks whether it is a rational function of x, the
+// answer must not cost a walk over the sums below it.
+
+static bool BenchChains(size_t repeat_count)
+{
+    printf("\nDiffTree() and PolyTree() on sin(x) + x*x + ... + x*x, %zu runs each\n\n", repeat_count);
+    printf("%10s %14s %14s\n", "nodes", "diff ns/node", "poly ns/node");
+
+    for (size_t i = 0; i < kChainTermCount; i++)
+    {
+        double diff_time  = 0;
+        double poly_time  = 0;
+        size_t node_count = 0;
+
+        for (size_t run = 0; run < repeat_count; run++)
+        {
+            Tree tree = {};
+
+            tree.root  = ChainTree(kChainTerms[i]);
+            node_count = CountNodes(tree.root);
+
+            double start = TimeNow();
+
+            TreeNode *diff = (tree.root != nullptr) ? DiffTree(tree.root, 0, nullptr) : nullptr;
+
+            diff_time += TimeNow() - start;
+            start      = TimeNow();
+
+            bool is_ok = (diff != nullptr && PolyTree(&tree) == kTreeSuccess);
+
+            poly_time += TimeNow() - start;
+
+            TreeDtor(diff);
+            TreeDtor(tree.root);
+
+            if (!is_ok)
+            {
+                printf(">>bench_simplify: failed on a chain of %zu terms\n", kChainTerms[i]);
+
+                return false;
+            }
+        }
+
+        printf("%10zu %14.1f %14.1f\n", node_count,
+               diff_time * 1e9 / (double) (node_count * repeat_count),
+               poly_time * 1e9 / (double) (node_count * repeat_count));
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// About size nodes. Half of the inner nodes are neutral or constant and go
+// away, the rest is x, sin() and the four arithmetic ops.
+
+static TreeNode *RandTree(uint64_t *seed,
+                          size_t    size)
+{
+    uint64_t pick = NextRand(seed);
+
+    if (size < 5)
+    {
+        return (pick & 1) ? NodeCtor(nullptr, nullptr, nullptr, kVariable, 0) :
+                            RandNum((NumType_t) (pick % 7 + 1));
+    }
+
+    size_t half = (size - 1) / 2;
+
+    switch (pick % 10)
+    {
+        case 0:
+            return RandOp(kMult, RandNum(0), RandTree(seed, size - 2));
+
+        case 1:
+            return RandOp(kMult, RandTree(seed, size - 2), RandNum(1));
+
+        case 2:
+            return RandOp(kAdd, RandTree(seed, size - 2), RandNum(0));
+
+        case 3:
+            return RandOp(kExp, RandTree(seed, size - 2), RandNum(1));
+
+        case 4:
+            return RandOp(kAdd, RandTree(seed, size - 4), RandOp(kMult, RandNum(2), RandNum(3)));
+
+        case 5:
+            return RandOp(kSin, nullptr, RandTree(seed, size - 1));
+
+        case 6:
+            return RandOp(kAdd, RandTree(seed, half), RandTree(seed, size - 1 - half));
+
+        case 7:
+            return RandOp(kMult, RandTree(seed, half), RandTree(seed, size - 1 - half));
+
+        case 8:
+            return RandOp(kSub, RandTree(seed, half), RandTree(seed, size - 1 - half));
+
+        default:
+            return RandOp(kDiv, RandTree(seed, half), RandTree(seed, size - 1 - half));
+    }
+}
+
+//------------------------------------------------------------------------------
+// Left-deep, so sin(x) is at the bottom of every sum.
+
+static TreeNode *ChainTree(size_t term_count)
+{
+    TreeNode *root = RandOp(kSin, nullptr, NodeCtor(nullptr, nullptr, nullptr, kVariable, 0));
+
+    for (size_t i = 0; i < term_count && root != nullptr; i++)
+    {
+        TreeNode *term = RandOp(kMult, NodeCtor(nullptr, nullptr, nullptr, kVariable, 0),
+                                       NodeCtor(nullptr, nullptr, nullptr, kVariable, 0));
+
+        root = RandOp(kAdd, root, term);
+    }
+
+    return root;
+}
+
+//------------------------------------------------------------------------------
+// NodeCtor() and not the constructors of diff.cpp, they would fold the
+// rewrites away before SimplifyTree() runs.
+
+static TreeNode *RandOp(OpCode_t  op_code,
+                        TreeNode *left,
+                        TreeNode *right)
+{
+    return NodeCtor(nullptr, left, right, kOperator, op_code);
+}
+
+//------------------------------------------------------------------------------
+
+static TreeNode *RandNum(NumType_t num)
+{
+    return NodeCtor(nullptr, nullptr, nullptr, kConstNumber, num);
+}
+
+//------------------------------------------------------------------------------
+
+static size_t CountNodes(const TreeNode *node)
+{
+    if (node == nullptr)
+    {
+        return 0;
+    }
+
+    return 1 + CountNodes(node->left) + CountNodes(node->right);
+}
+
+//------------------------------------------------------------------------------
+// xorshift64*, the same trees on every run.
+
+static uint64_t NextRand(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+
+    return *seed * 0x2545F4914F6CDD1DULL;
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "test_utils.h"
+#include "../trees.h"
+#include "../diff.h"
+#include "../parse.h"
+#include "../compact_tree.h"
+
+//! CompactEval() against Eval() on the same expressions, and CompactDiff()
+//! followed by CompactOptimize() against DiffTree() by every variable, on a
+//! grid of x and y.
+//! Usage: test_compact [grid_size]
+
+static const size_t kBaseGridSize = 40;
+
+static const size_t kVarCount = 2;
+
+// the derivatives are built by different rules, they round differently
+static const NumType_t kRelTol = 1e-10;
+
+static const char * const kExprs[] =
+{
+    "x*x*x+2*x*y-x/3+7",
+    "cos(y)",
+    "sin(x)/cos(x)",
+    "x^3*ln(x*x+1)-tg(y)/(x+2)",
+    "cos(x-y)/(x*y+1)",
+    "x^y+y^(5/2)",
+    "ln(x)/(y*y+1)",
+};
+
+static const size_t kExprCount = sizeof(kExprs) / sizeof(kExprs[0]);
+
+static bool CheckExpr(Variables  *vars,
+                      const char *expr_str,
+                      size_t      grid_size);
+
+static bool IsClose(NumType_t lhs,
+                    NumType_t rhs);
+
+int main(int argc, const char *argv[])
+{
+    size_t grid_size = (argc > 1) ? strtoul(argv[1], nullptr, 10) : kBaseGridSize;
+
+    Variables vars = {};
+
+    VarArrayInit(&vars);
+    TreeDtor(ParseExpr(&vars, "x+y")); // x is variable 0, y is 1
+
+    if (grid_size == 0 || vars.var_count != kVarCount)
+    {
+        printf(">>test_compact: bad grid size or variables\n");
+
+        return 1;
+    }
+
+    printf("CompactTree against the pointer tree, %zu x %zu points\n", grid_size, grid_size);
+
+    bool is_ok = true;
+
+    for (size_t i = 0; i < kExprCount; i++)
+    {
+        is_ok = CheckExpr(&vars, kExprs[i], grid_size) && is_ok;
+    }
+
+    printf("%s\n", is_ok ? "OK" : "FAILED");
+
+    VarArrayDtor(&vars);
+
+    return is_ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+// x and y in (0.1, 2.1), the logarithms and x^y stay defined. Values must be
+// the same bits, derivatives are compared where DiffTree() gives a number.
+
+static bool CheckExpr(Variables  *vars,
+                      const char *expr_str,
+                      size_t      grid_size)
+{
+    TreeNode *func = ParseExpr(vars, expr_str);
+
+    TreeNode *diffs[kVarCount] = {};
+
+    CompactTree ct            = {};
+    CompactTree raw[kVarCount] = {};
+    CompactTree opt[kVarCount] = {};
+
+    bool is_ok = func != nullptr && CompactCtor(&ct) == kTreeSuccess && CompactFromTree(&ct, func) == kTreeSuccess;
+
+    for (size_t var = 0; var < kVarCount; var++)
+    {
+        is_ok = is_ok && CompactCtor(&raw[var]) == kTreeSuccess && CompactCtor(&opt[var]) == kTreeSuccess &&
+                CompactDiff(&raw[var], &ct, var) == kTreeSuccess &&
+                CompactOptimize(&opt[var], &raw[var]) == kTreeSuccess &&
+                (diffs[var] = DiffTree(func, var, nullptr)) != nullptr;
+    }
+
+    size_t eval_fails = 0;
+    size_t diff_fails = 0;
+
+    for (size_t i = 0; is_ok && i < grid_size; i++)
+    {
+        for (size_t j = 0; j < grid_size; j++)
+        {
+            vars->var_array[0].value = 0.1 + 2 * ((NumType_t) i + 0.5) / (NumType_t) grid_size;
+            vars->var_array[1].value = 0.1 + 2 * ((NumType_t) j + 0.5) / (NumType_t) grid_size;
+
+            eval_fails += !IsSameNum(CompactEval(&ct, vars), Eval(vars, func));
+
+            for (size_t var = 0; var < kVarCount; var++)
+            {
+                NumType_t expected = Eval(vars, diffs[var]);
+
+                if (isfinite(expected))
+                {
+                    diff_fails += !IsClose(CompactEval(&raw[var], vars), expected) ||
+                                  !IsClose(CompactEval(&opt[var], vars), expected);
+                }
+            }
+        }
+    }
+
+    is_ok = is_ok && eval_fails == 0 && diff_fails == 0;
+
+    printf("%-28s %5zu values %5zu derivatives differ%s\n", expr_str, eval_fails, diff_fails,
+           is_ok ? "" : "  FAILED");
+
+    for (size_t var = 0; var < kVarCount; var++)
+    {
+        CompactDtor(&raw[var]);
+        CompactDtor(&opt[var]);
+        TreeDtor(diffs[var]);
+    }
+
+    CompactDtor(&ct);
+    TreeDtor(func);
+
+    return is_ok;
+}
+
+//------------------------------------------------------------------------------
+// Relative to the larger of the two, absolute below 1.
+
+static bool IsClose(NumType_t lhs,
+                    NumType_t rhs)
+{
+    NumType_t scale = fmax(1, fmax(fabs(lhs), fabs(rhs)));
+
+    return fabs(lhs - rhs) <= kRelTol * scale;
+}
@@ -0,0 +1,845 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "test_utils.h"
+#include "../trees.h"
+#include "../diff.h"
+#include "../parse.h"
+#include "../dag.h"
+#include "../bytecode.h"
+#include "../jit.h"
+#include "../taylor.h"
+#include "../canon.h"
+#include "../rules.h"
+#include "../egraph.h"
+#include "../poly.h"
+#include "../jacobian.h"
+
+//! Cross-checks on random expressions of x and y. Every check computes the
+//! same values two ways: the evaluators against Eval(), derivatives of
+//! DiffTree() against EvalDual(), TaylorSeries() and each other, the
+//! rewriters against the tree they rewrote, the Jacobian on one thread
+//! against more of them and NTT products against the schoolbook loop.
+//! Usage: test_regress [expr_count]
+
+static const size_t kBaseExprCount = 300;
+
+static const size_t kPointCount = 8;
+static const size_t kVarCount   = 2;
+static const size_t kMaxDepth   = 5;
+
+static const size_t kJacobianFuncCount = 4;
+static const size_t kNttProductCount   = 8;
+
+static const size_t kMaxPrintedFails = 3; // per check
+
+// Values are about 1, this covers the rounding of a few dozen operations
+// done in another order.
+static const NumType_t kRelTol = 1e-8;
+
+static const NumType_t kConsts[] = {1, 2, 3, 0.5};
+static const NumType_t kExps[]   = {1, 2, 3, -1, -2, 0.5, 1.5};
+
+// Sign of x and y at each point, 0 is the exact zero.
+static const int kPointSigns[][2] =
+{
+    { 0,  0},
+    { 0,  1},
+    { 1,  0},
+    {-1,  1},
+    { 1, -1},
+    {-1, -1},
+    { 1,  1},
+    { 1,  1},
+};
+
+// Checked before the random ones, each of them broke a rewrite once.
+static const char * const kFixedExprs[] =
+{
+    "((x-3)^2)^(1/2)",      // (a^b)^c -> a^(b * c) for a negative a
+    "(cos(y+2)^2)^(1/2)*x",
+
+    // e-graph reassociation inside the exponent A/A = 1 of a negative base
+    "(0-2-x*x)^(((1/2+(0-2))/(y^(0-1)))/((1/2+(0-2))/(y^(0-1))))",
+};
+
+static const size_t kConstCount = sizeof(kConsts) / sizeof(kConsts[0]);
+static const size_t kExpCount   = sizeof(kExps)   / sizeof(kExps[0]);
+
+static const size_t kFixedExprCount = sizeof(kFixedExprs) / sizeof(kFixedExprs[0]);
+
+typedef enum
+{
+    kCheckEval,
+    kCheckDual,
+    kCheckDag,
+    kCheckTaylor,
+    kCheckSimplify,
+    kCheckRules,
+    kCheckCanon,
+    kCheckEGraph,
+    kCheckJacobian,
+    kCheckNtt,
+    kCheckCount,
+} Check_t;
+
+static const char * const kCheckNames[kCheckCount] =
+{
+    "BcEval, JitEval, EvalBatch = Eval",
+    "DiffTree = EvalDual",
+    "DiffTree with a DagTable",
+    "TaylorSeries = derivatives",
+    "SimplifyTree keeps the value",
+    "rules keep the value",
+    "CanonTree keeps the value",
+    "EGraphSimplify keeps the value",
+    "Jacobian on 1 and 4 threads",
+    "NTT PolyMul = schoolbook",
+};
+
+struct Regress
+{
+    Variables vars;
+
+    NumType_t points[kVarCount][kPointCount];
+
+    RuleSet rules;
+    EGraph  egraph;
+
+    size_t checked[kCheckCount];
+    size_t failed[kCheckCount];
+
+    uint64_t seed;
+};
+
+static void CheckExpr(Regress  *reg,
+                      TreeNode *func);
+
+static void CheckEvaluators(Regress        *reg,
+                            const TreeNode *func,
+                            const NumType_t *values);
+
+static void CheckDerivatives(Regress        *reg,
+                             const TreeNode *func,
+                             const NumType_t *values);
+
+static void CheckRewrite(Regress         *reg,
+                         Check_t          check,
+                         const TreeNode  *func,
+                         const NumType_t *values);
+
+static void CheckJacobian(Regress *reg);
+
+static void CheckNtt(Regress *reg);
+
+static void EvalPoints(Regress        *reg,
+                       const TreeNode *node,
+                       NumType_t      *values);
+
+static void SetPoint(Regress *reg,
+                     size_t   point);
+
+static bool HasInfinity(Regress        *reg,
+                        const TreeNode *node);
+
+static bool IsClose(NumType_t lhs,
+                    NumType_t rhs);
+
+static void Report(Regress        *reg,
+                   Check_t         check,
+                   bool            is_ok,
+                   const TreeNode *func,
+                   size_t          point);
+
+static TreeNode *RandExpr(Regress *reg,
+                          size_t   depth);
+
+static TreeNode *RandOp(OpCode_t  op_code,
+                        TreeNode *left,
+                        TreeNode *right);
+
+static TreeNode *RandNum(NumType_t num);
+
+static void PrintExpr(const TreeNode *node);
+
+static uint64_t NextRand(uint64_t *seed);
+
+static NumType_t RandUnit(uint64_t *seed);
+
+int main(int argc, const char *argv[])
+{
+    size_t expr_count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : kBaseExprCount;
+
+    Regress reg = {};
+
+    reg.seed = 1;
+
+    VarArrayInit(&reg.vars);
+    TreeDtor(ParseExpr(&reg.vars, "x+y")); // x is variable 0, y is 1
+
+    if (reg.vars.var_count != kVarCount ||
+        RuleSetCtor(&reg.rules) != kTreeSuccess || RuleSetAddDefaults(&reg.rules) != kTreeSuccess ||
+        EGraphCtor(&reg.egraph) != kTreeSuccess)
+    {
+        printf(">>test_regress: failed to set up\n");
+
+        return 1;
+    }
+
+    for (size_t var = 0; var < kVarCount; var++)
+    {
+        for (size_t point = 0; point < kPointCount; point++)
+        {
+            reg.points[var][point] = kPointSigns[point][var] * (0.3 + 1.9 * RandUnit(&reg.seed));
+        }
+    }
+
+    printf("%zu fixed and %zu random expressions of x and y at %zu points\n",
+           kFixedExprCount, expr_count, kPointCount);
+
+    for (size_t i = 0; i < kFixedExprCount; i++)
+    {
+        TreeNode *func = ParseExpr(&reg.vars, kFixedExprs[i]);
+
+        if (func == nullptr)
+        {
+            printf(">>test_regress: failed to parse %s\n", kFixedExprs[i]);
+
+            return 1;
+        }
+
+        CheckExpr(&reg, func);
+
+        TreeDtor(func);
+    }
+
+    for (size_t i = 0; i < expr_count; i++)
+    {
+        TreeNode *func = RandExpr(&reg, kMaxDepth);
+
+        CheckExpr(&reg, func);
+
+        TreeDtor(func);
+    }
+
+    CheckJacobian(&reg);
+    CheckNtt(&reg);
+
+    bool is_ok = true;
+
+    for (size_t check = 0; check < kCheckCount; check++)
+    {
+        printf("%-36s %7zu checked %5zu failed\n", kCheckNames[check], reg.checked[check], reg.failed[check]);
+
+        is_ok = is_ok && reg.failed[check] == 0 && reg.checked[check] != 0;
+    }
+
+    printf("%s\n", is_ok ? "OK" : "FAILED");
+
+    EGraphDtor(&reg.egraph);
+    RuleSetDtor(&reg.rules);
+    VarArrayDtor(&reg.vars);
+
+    return is_ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+
+static void CheckExpr(Regress  *reg,
+                      TreeNode *func)
+{
+    NumType_t values[kPointCount] = {};
+
+    EvalPoints(reg, func, values);
+
+    CheckEvaluators(reg, func, values);
+    CheckDerivatives(reg, func, values);
+
+    CheckRewrite(reg, kCheckSimplify, func, values);
+    CheckRewrite(reg, kCheckRules,    func, values);
+    CheckRewrite(reg, kCheckCanon,    func, values);
+    CheckRewrite(reg, kCheckEGraph,   func, values);
+}
+
+//------------------------------------------------------------------------------
+// All of them promise the bits of Eval().
+
+static void CheckEvaluators(Regress         *reg,
+                            const TreeNode  *func,
+                            const NumType_t *values)
+{
+    BcProgram prog = {};
+    JitFunc   jit  = {};
+
+    BcCtor(&prog);
+    JitCtor(&jit);
+
+    NumType_t batch[kPointCount] = {};
+
+    const NumType_t *var_values[kVarCount] = {reg->points[0], reg->points[1]};
+
+    bool is_ready = BcCompile(&prog, func) == kTreeSuccess && JitCompile(&jit, func) == kTreeSuccess &&
+                    EvalBatch(&reg->vars, func, var_values, kPointCount, batch) == kTreeSuccess;
+
+    for (size_t point = 0; point < kPointCount; point++)
+    {
+        SetPoint(reg, point);
+
+        bool is_ok = is_ready &&
+                     IsSameNum(values[point], BcEval(&prog, &reg->vars)) &&
+                     IsSameNum(values[point], JitEval(&jit, &reg->vars)) &&
+                     IsSameNum(values[point], batch[point]);
+
+        Report(reg, kCheckEval, is_ok, func, point);
+    }
+
+    JitDtor(&jit);
+    BcDtor(&prog);
+}
+
+//------------------------------------------------------------------------------
+// Derivative by x three ways, the second one by DiffTree() and by the
+// series, the same derivative once more inside a DagTable.
+
+static void CheckDerivatives(Regress         *reg,
+                             const TreeNode  *func,
+                             const NumType_t *values)
+{
+    TreeNode *d_func  = DiffTree(func, 0, nullptr);
+    TreeNode *d2_func = (d_func != nullptr) ? DiffTree(d_func, 0, nullptr) : nullptr;
+
+    DagTable dag = {};
+
+    DagCtor(&dag);
+    DagTable *prev_dag = DagSelect(&dag);
+
+    TreeNode *dag_func = DagImport(&dag, func);
+    TreeNode *d_dag    = (dag_func != nullptr) ? DiffTree(dag_func, 0, nullptr) : nullptr;
+
+    NumType_t d_values[kPointCount]   = {};
+    NumType_t d2_values[kPointCount]  = {};
+    NumType_t dag_values[kPointCount] = {};
+
+    if (d_dag != nullptr)
+    {
+        EvalPoints(reg, d_dag, dag_values);
+    }
+
+    DagSelect(prev_dag);
+    DagDtor(&dag);
+
+    if (d_func != nullptr && d2_func != nullptr)
+    {
+        EvalPoints(reg, d_func,  d_values);
+        EvalPoints(reg, d2_func, d2_values);
+    }
+
+    for (size_t point = 0; point < kPointCount; point++)
+    {
+        SetPoint(reg, point);
+
+        Dual dual = EvalDual(&reg->vars, func, 0);
+
+        NumType_t coeffs[3] = {};
+
+        bool has_series = TaylorSeries(&reg->vars, func, 0, 3, coeffs) == kTreeSuccess;
+
+        // a NaN of a tree is not compared, a simplified derivative may be
+        // defined where the other is not. Where the tree has a value or an
+        // infinity, the others must have the same one. A series has no
+        // coefficient for an infinite derivative (x^0.5 at 0), it is NaN.
+        // Under an infinite operand the chain rule meets 0 * inf, so NaN is
+        // allowed there as well: (x^-1)^-2 at 0 has the derivative of x^2
+
+        if (isnan(values[point]))
+        {
+            continue;
+        }
+
+        bool has_der = !isnan(d_values[point]);
+        bool has_inf = HasInfinity(reg, func);
+
+        Report(reg, kCheckDual, d_func != nullptr && IsSameNum(dual.val, values[point]) &&
+                                (!has_der || IsClose(dual.der, d_values[point]) ||
+                                 (has_inf && isnan(dual.der))), func, point);
+
+        if (has_der)
+        {
+            Report(reg, kCheckDag, d_dag != nullptr && IsClose(dag_values[point], d_values[point]), func, point);
+        }
+
+        Report(reg, kCheckTaylor, has_series && IsClose(coeffs[0], values[point]) &&
+                                  (!isfinite(d_values[point])  || IsClose(coeffs[1], d_values[point]) ||
+                                   (has_inf && isnan(coeffs[1]))) &&
+                                  (!isfinite(d2_values[point]) || IsClose(2 * coeffs[2], d2_values[point]) ||
+                                   (has_inf && isnan(coeffs[2]))), func, point);
+    }
+
+    TreeDtor(d_func);
+    TreeDtor(d2_func);
+}
+
+//------------------------------------------------------------------------------
+// A rewrite may define the tree at more points (0*e -> 0), but where the
+// original has a value or an infinity the rewritten tree must have the same.
+
+static void CheckRewrite(Regress         *reg,
+                         Check_t          check,
+                         const TreeNode  *func,
+                         const NumType_t *values)
+{
+    Tree tree = {};
+
+    tree.root = CopyNode(func, nullptr);
+
+    RuleSet *prev_rules = RuleSetSelect((check == kCheckRules) ? &reg->rules : nullptr);
+
+    TreeErrs_t status = kFailedToFind;
+
+    if (tree.root != nullptr)
+    {
+        switch (check)
+        {
+            case kCheckSimplify:
+            case kCheckRules:
+            {
+                status = SimplifyTree(&tree);
+
+                break;
+            }
+
+            case kCheckCanon:
+            {
+                status = CanonTree(&tree);
+
+                break;
+            }
+
+            case kCheckEGraph:
+            {
+                status = EGraphSimplify(&reg->egraph, &tree);
+
+                break;
+            }
+
+            case kCheckEval:
+            case kCheckDual:
+            case kCheckDag:
+            case kCheckTaylor:
+            case kCheckJacobian:
+            case kCheckNtt:
+            case kCheckCount:
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    RuleSetSelect(prev_rules);
+
+    NumType_t new_values[kPointCount] = {};
+
+    if (status == kTreeSuccess)
+    {
+        EvalPoints(reg, tree.root, new_values);
+    }
+
+    for (size_t point = 0; point < kPointCount; point++)
+    {
+        if (!isnan(values[point]))
+        {
+            Report(reg, check, status == kTreeSuccess && IsClose(values[point], new_values[point]), func, point);
+        }
+    }
+
+    TreeDtor(tree.root);
+}
+
+//------------------------------------------------------------------------------
+// The calling thread has a RuleSet selected, the workers must not use it, so
+// every entry comes out the same on any number of threads. The entries are
+// also checked against DiffTree() by both variables.
+
+static void CheckJacobian(Regress *reg)
+{
+    TreeNode *funcs[kJacobianFuncCount] = {};
+
+    for (size_t i = 0; i < kJacobianFuncCount; i++)
+    {
+        funcs[i] = RandExpr(reg, kMaxDepth);
+    }
+
+    RuleSet *prev_rules = RuleSetSelect(&reg->rules);
+
+    Jacobian single = {};
+    Jacobian multi  = {};
+
+    bool is_ready = JacobianCtor(&single, &reg->vars, funcs, kJacobianFuncCount, 1) == kTreeSuccess &&
+                    JacobianCtor(&multi,  &reg->vars, funcs, kJacobianFuncCount, 4) == kTreeSuccess;
+
+    RuleSetSelect(prev_rules);
+
+    for (size_t func = 0; func < kJacobianFuncCount; func++)
+    {
+        for (size_t var = 0; var < kVarCount; var++)
+        {
+            TreeNode *diff = DiffTree(funcs[func], var, nullptr);
+
+            NumType_t expected[kPointCount]    = {};
+            NumType_t single_vals[kPointCount] = {};
+            NumType_t multi_vals[kPointCount]  = {};
+
+            const TreeNode *single_entry = is_ready ? JacobianEntry(&single, func, var) : nullptr;
+            const TreeNode *multi_entry  = is_ready ? JacobianEntry(&multi,  func, var) : nullptr;
+
+            if (diff != nullptr)
+            {
+                EvalPoints(reg, diff, expected);
+            }
+
+            // structural zeros are nullptr
+
+            if (single_entry != nullptr)
+            {
+                EvalPoints(reg, single_entry, single_vals);
+            }
+
+            if (multi_entry != nullptr)
+            {
+                EvalPoints(reg, multi_entry, multi_vals);
+            }
+
+            for (size_t point = 0; point < kPointCount; point++)
+            {
+                if (!isfinite(expected[point]))
+                {
+                    continue;
+                }
+
+                Report(reg, kCheckJacobian, is_ready && diff != nullptr &&
+                                            IsSameNum(single_vals[point], multi_vals[point]) &&
+                                            IsClose(single_vals[point], expected[point]), funcs[func], point);
+            }
+
+            TreeDtor(diff);
+        }
+    }
+
+    JacobianDtor(&single);
+    JacobianDtor(&multi);
+
+    for (size_t i = 0; i < kJacobianFuncCount; i++)
+    {
+        TreeDtor(funcs[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Integer coefficients in [-1000, 1000] and at least 512 terms go through
+// NTT. The schoolbook sums stay below 2^53 as well, so both are exact.
+
+static void CheckNtt(Regress *reg)
+{
+    for (size_t i = 0; i < kNttProductCount; i++)
+    {
+        Poly lhs  = {};
+        Poly rhs  = {};
+        Poly prod = {};
+
+        size_t lhs_size = 512 + NextRand(&reg->seed) % 1500;
+        size_t rhs_size = 512 + NextRand(&reg->seed) % 1500;
+
+        bool is_ok = PolyCtor(&lhs, lhs_size) == kTreeSuccess && PolyCtor(&rhs, rhs_size) == kTreeSuccess &&
+                     PolyCtor(&prod, 1) == kTreeSuccess;
+
+        NumType_t *expected = (NumType_t *) calloc(lhs_size + rhs_size - 1, sizeof(NumType_t));
+
+        if (is_ok && expected != nullptr)
+        {
+            Poly *polys[] = {&lhs, &rhs};
+
+            for (size_t k = 0; k < sizeof(polys) / sizeof(polys[0]); k++)
+            {
+                polys[k]->size = (k == 0) ? lhs_size : rhs_size;
+
+                for (size_t j = 0; j < polys[k]->size; j++)
+                {
+                    polys[k]->coeffs[j] = (NumType_t) ((int) (NextRand(&reg->seed) % 2001) - 1000);
+                }
+
+                polys[k]->coeffs[polys[k]->size - 1] = 1; // no zero leading term
+            }
+
+            for (size_t j = 0; j < lhs_size; j++)
+            {
+                for (size_t k = 0; k < rhs_size; k++)
+                {
+                    expected[j + k] += lhs.coeffs[j] * rhs.coeffs[k];
+                }
+            }
+
+            is_ok = PolyMul(&prod, &lhs, &rhs) == kTreeSuccess && prod.size == lhs_size + rhs_size - 1;
+
+            for (size_t j = 0; is_ok && j < prod.size; j++)
+            {
+                is_ok = IsSameNum(prod.coeffs[j], expected[j]);
+            }
+        }
+
+        Report(reg, kCheckNtt, is_ok && expected != nullptr, nullptr, 0);
+
+        free(expected);
+
+        PolyDtor(&lhs);
+        PolyDtor(&rhs);
+        PolyDtor(&prod);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void EvalPoints(Regress        *reg,
+                       const TreeNode *node,
+                       NumType_t      *values)
+{
+    for (size_t point = 0; point < kPointCount; point++)
+    {
+        SetPoint(reg, point);
+
+        values[point] = Eval(&reg->vars, node);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void SetPoint(Regress *reg,
+                     size_t   point)
+{
+    for (size_t var = 0; var < kVarCount; var++)
+    {
+        reg->vars.var_array[var].value = reg->points[var][point];
+    }
+}
+
+//------------------------------------------------------------------------------
+// Some subtree of node is infinite at the current point.
+
+static bool HasInfinity(Regress        *reg,
+                        const TreeNode *node)
+{
+    if (node == nullptr)
+    {
+        return false;
+    }
+
+    return isinf(Eval(&reg->vars, node)) || HasInfinity(reg, node->left) || HasInfinity(reg, node->right);
+}
+
+//------------------------------------------------------------------------------
+// Relative to the larger of the two, absolute below 1. A NaN is only close
+// to a NaN and an infinity to an infinity of any sign: that is the sign of
+// a zero below it, which rewrites do not keep (x * 0 -> 0 for a negative x).
+
+static bool IsClose(NumType_t lhs,
+                    NumType_t rhs)
+{
+    if (!isfinite(lhs) || !isfinite(rhs))
+    {
+        return (isnan(lhs) && isnan(rhs)) || (isinf(lhs) && isinf(rhs));
+    }
+
+    NumType_t scale = fmax(1, fmax(fabs(lhs), fabs(rhs)));
+
+    return fabs(lhs - rhs) <= kRelTol * scale;
+}
+
+//------------------------------------------------------------------------------
+
+static void Report(Regress        *reg,
+                   Check_t         check,
+                   bool            is_ok,
+                   const TreeNode *func,
+                   size_t          point)
+{
+    reg->checked[check]++;
+
+    if (is_ok)
+    {
+        return;
+    }
+
+    if (reg->failed[check]++ < kMaxPrintedFails)
+    {
+        printf("%s failed at x = %.17g, y = %.17g: ", kCheckNames[check],
+               reg->points[0][point], reg->points[1][point]);
+
+        PrintExpr(func);
+
+        printf("\n");
+    }
+}
+
+//------------------------------------------------------------------------------
+// Half of the arguments of ln and sqrt and of the denominators are kept away
+// from zero, so most points have a value, the rest meet the exact zeros of
+// the points. Exponents are small, negative or halves. Some operands are
+// repeated for the rewrites that cancel them.
+
+static TreeNode *RandExpr(Regress *reg,
+                          size_t   depth)
+{
+    uint64_t pick = NextRand(&reg->seed);
+
+    if (depth == 0 || pick % 8 == 0)
+    {
+        pick >>= 3;
+
+        if (pick % 3 != 0)
+        {
+            return NodeCtor(nullptr, nullptr, nullptr, kVariable, (double) (pick % kVarCount));
+        }
+
+        return RandNum(kConsts[(pick >> 2) % kConstCount]);
+    }
+
+    switch ((pick >> 3) % 11)
+    {
+        case 0:
+            return RandOp(kAdd, RandExpr(reg, depth - 1), RandExpr(reg, depth - 1));
+
+        case 1:
+            return RandOp(kSub, RandExpr(reg, depth - 1), RandExpr(reg, depth - 1));
+
+        case 2:
+        case 3:
+            return RandOp(kMult, RandExpr(reg, depth - 1), RandExpr(reg, depth - 1));
+
+        case 4:
+        {
+            TreeNode *num = RandExpr(reg, depth - 1);
+
+            if ((pick >> 7) % 2 == 0)
+            {
+                return RandOp(kDiv, num, RandExpr(reg, depth - 1));
+            }
+
+            return RandOp(kDiv, num, RandOp(kAdd, RandOp(kMult, RandExpr(reg, depth - 1), RandExpr(reg, depth - 1)),
+                                            RandNum(3)));
+        }
+
+        case 5:
+            return RandOp(kSin, nullptr, RandExpr(reg, depth - 1));
+
+        case 6:
+            return RandOp(kCos, nullptr, RandExpr(reg, depth - 1));
+
+        case 7:
+        case 8:
+        {
+            OpCode_t  op_code = ((pick >> 3) % 11 == 7) ? kLn : kSqrt;
+            TreeNode *arg     = RandExpr(reg, depth - 1);
+
+            if ((pick >> 7) % 2 == 0)
+            {
+                return RandOp(op_code, nullptr, arg);
+            }
+
+            return RandOp(op_code, nullptr, RandOp(kAdd, RandOp(kMult, arg, CopyNode(arg, nullptr)), RandNum(1)));
+        }
+
+        case 9:
+            return RandOp(kExp, RandExpr(reg, depth - 1), RandNum(kExps[(pick >> 7) % kExpCount]));
+
+        default:
+        {
+            // a / a, (a * b) / a and a - a for the rules that cancel
+            TreeNode *arg = RandExpr(reg, depth - 1);
+
+            switch ((pick >> 7) % 3)
+            {
+                case 0:
+                    return RandOp(kDiv, arg, CopyNode(arg, nullptr));
+
+                case 1:
+                    return RandOp(kDiv, RandOp(kMult, arg, RandExpr(reg, depth - 1)), CopyNode(arg, nullptr));
+
+                default:
+                    return RandOp(kSub, arg, CopyNode(arg, nullptr));
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// NodeCtor() and not the constructors of diff.cpp, the rewriters get the
+// tree as it was generated.
+
+static TreeNode *RandOp(OpCode_t  op_code,
+                        TreeNode *left,
+                        TreeNode *right)
+{
+    return NodeCtor(nullptr, left, right, kOperator, op_code);
+}
+
+//------------------------------------------------------------------------------
+
+static TreeNode *RandNum(NumType_t num)
+{
+    return NodeCtor(nullptr, nullptr, nullptr, kConstNumber, num);
+}
+
+//------------------------------------------------------------------------------
+
+static void PrintExpr(const TreeNode *node)
+{
+    if (node == nullptr)
+    {
+        return;
+    }
+
+    if (node->type == kConstNumber)
+    {
+        printf("%g", node->data.const_val);
+    }
+    else if (node->type != kOperator)
+    {
+        printf("%s", (node->data.variable_pos == 0) ? "x" : "y");
+    }
+    else if (IsUnaryOp(node->data.op_code))
+    {
+        printf("%s(", OperationArray[node->data.op_code].op_str);
+        PrintExpr(node->right);
+        printf(")");
+    }
+    else
+    {
+        printf("(");
+        PrintExpr(node->left);
+        printf(" %s ", OperationArray[node->data.op_code].op_str);
+        PrintExpr(node->right);
+        printf(")");
+    }
+}
+
+//------------------------------------------------------------------------------
+// xorshift64*, the same expressions on every run.
+
+static uint64_t NextRand(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+
+    return *seed * 0x2545F4914F6CDD1DULL;
+}
+
+//------------------------------------------------------------------------------
+// [0, 1) with 53 random bits.
+
+static NumType_t RandUnit(uint64_t *seed)
+{
+    return (NumType_t) (NextRand(seed) >> 11) * 0x1p-53;
+}
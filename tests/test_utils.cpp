@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "test_utils.h"
+
+//==============================================================================
+
+TreeNode *ParseExpr(Variables  *vars,
+                    const char *expr_str)
+{
+    Expr expr = {};
+
+    expr.string = expr_str;
+    expr.pos    = 0;
+
+    return GetG(vars, &expr);
+}
+
+//==============================================================================
+
+double TimeNow()
+{
+    return (double) clock() / CLOCKS_PER_SEC;
+}
+
+//==============================================================================
+
+size_t UlpDiff(double lhs,
+               double rhs)
+{
+    if (isnan(lhs) || isnan(rhs))
+    {
+        return (isnan(lhs) && isnan(rhs)) ? 0 : SIZE_MAX;
+    }
+
+    if (isinf(lhs) || isinf(rhs))
+    {
+        return IsSameNum(lhs, rhs) ? 0 : SIZE_MAX;
+    }
+
+    int64_t lhs_bits = 0;
+    int64_t rhs_bits = 0;
+
+    memcpy(&lhs_bits, &lhs, sizeof(lhs_bits));
+    memcpy(&rhs_bits, &rhs, sizeof(rhs_bits));
+
+    // doubles ordered as integers: negatives are mirrored below zero
+
+    lhs_bits = (lhs_bits < 0) ? INT64_MIN - lhs_bits : lhs_bits;
+    rhs_bits = (rhs_bits < 0) ? INT64_MIN - rhs_bits : rhs_bits;
+
+    return (lhs_bits > rhs_bits) ? (size_t) ((uint64_t) lhs_bits - (uint64_t) rhs_bits) :
+                                   (size_t) ((uint64_t) rhs_bits - (uint64_t) lhs_bits);
+}
+
+//==============================================================================
+
+bool IsSameNum(double lhs,
+               double rhs)
+{
+    if (isnan(lhs) || isnan(rhs))
+    {
+        return isnan(lhs) && isnan(rhs);
+    }
+
+    return memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+}
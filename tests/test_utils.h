@@ -0,0 +1,28 @@
+#ifndef TEST_UTILS_HEADER
+#define TEST_UTILS_HEADER
+
+#include "../trees.h"
+#include "../parse.h"
+
+//! Helpers shared by the programs in tests/. Tests print what they check and
+//! return non-zero from main() on the first failure, benchmarks print their
+//! numbers and only fail if two evaluators disagree.
+
+//! Tree of expr_str with its variables added to vars, nullptr on a syntax
+//! error.
+TreeNode *ParseExpr(Variables  *vars,
+                    const char *expr_str);
+
+//! Processor time in seconds, for differences only.
+double TimeNow();
+
+//! Distance between two doubles in units in the last place, 0 if both are
+//! the same nan or infinity, SIZE_MAX if only one of them is.
+size_t UlpDiff(double lhs,
+               double rhs);
+
+//! Same bits or both nan.
+bool IsSameNum(double lhs,
+               double rhs);
+
+#endif
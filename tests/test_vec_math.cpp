@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+
+#include "test_utils.h"
+#include "../vec_math.h"
+
+//! Sweeps every kernel of vec_math.h over the ranges of its header table
+//! against libm and fails if the worst error is above the documented bound.
+//! Arguments outside the table must give exactly the libm value.
+//! Usage: test_vec_math [point_count]
+
+static const size_t kBasePointCount = 1000000;
+
+static const size_t kSweepBlock = 256; // points per kernel call
+
+typedef void (*UnaryKernel_t)(NumType_t       *dst,
+                              const NumType_t *src,
+                              size_t           count);
+
+typedef double (*UnaryLibm_t)(double x);
+
+typedef NumType_t (*PointGen_t)(uint64_t *seed);
+
+typedef bool (*InTable_t)(NumType_t x);
+
+struct UnarySweep
+{
+    const char   *name;
+    UnaryKernel_t kernel;
+    UnaryLibm_t   libm;
+    PointGen_t    gen;
+    InTable_t     in_table;
+    size_t        max_ulp; // bound of the vec_math.h table
+};
+
+static NumType_t GenTrig(uint64_t *seed);
+static NumType_t GenLn(  uint64_t *seed);
+
+static bool IsTrigArg(NumType_t x);
+static bool IsLnArg(  NumType_t x);
+
+static const UnarySweep kUnarySweeps[] =
+{
+    {"VecSin", VecSin, sin, GenTrig, IsTrigArg, 2},
+    {"VecCos", VecCos, cos, GenTrig, IsTrigArg, 2},
+    {"VecTg",  VecTg,  tan, GenTrig, IsTrigArg, 4},
+    {"VecLn",  VecLn,  log, GenLn,   IsLnArg,   1},
+};
+
+static const size_t kUnarySweepCount = sizeof(kUnarySweeps) / sizeof(kUnarySweeps[0]);
+
+static const size_t kPowMaxUlp = 7;
+
+// the ones outside the table of a kernel go to libm unchanged
+static const NumType_t kSpecialVals[] =
+{
+    0.0, -0.0, INFINITY, -INFINITY, NAN, DBL_MIN / 4, -DBL_MIN / 4, DBL_TRUE_MIN,
+    1e300, -1e300, 2e5, -3.5e7, -1.0, DBL_MAX,
+};
+
+static const size_t kSpecialValCount = sizeof(kSpecialVals) / sizeof(kSpecialVals[0]);
+
+static bool SweepUnary(const UnarySweep *sweep,
+                       size_t            point_count);
+
+static bool SweepPow(size_t point_count);
+
+static bool CheckSpecials();
+
+static uint64_t NextRand(uint64_t *seed);
+
+static NumType_t RandUnit(uint64_t *seed);
+
+int main(int argc, const char *argv[])
+{
+    size_t point_count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : kBasePointCount;
+
+    printf("vec_math against libm, %zu points per kernel\n", point_count);
+
+    bool is_ok = true;
+
+    for (size_t i = 0; i < kUnarySweepCount; i++)
+    {
+        is_ok = SweepUnary(&kUnarySweeps[i], point_count) && is_ok;
+    }
+
+    is_ok = SweepPow(point_count) && is_ok;
+    is_ok = CheckSpecials()       && is_ok;
+
+    printf("%s\n", is_ok ? "OK" : "FAILED");
+
+    return is_ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+
+static bool SweepUnary(const UnarySweep *sweep,
+                       size_t            point_count)
+{
+    NumType_t src[kSweepBlock] = {};
+    NumType_t dst[kSweepBlock] = {};
+
+    uint64_t seed = 1;
+
+    size_t    max_ulp   = 0;
+    NumType_t worst_arg = 0;
+
+    for (size_t done = 0; done < point_count; done += kSweepBlock)
+    {
+        size_t count = (point_count - done < kSweepBlock) ? point_count - done : kSweepBlock;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            src[i] = sweep->gen(&seed);
+        }
+
+        sweep->kernel(dst, src, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t ulp = UlpDiff(dst[i], sweep->libm(src[i]));
+
+            if (ulp > max_ulp)
+            {
+                max_ulp   = ulp;
+                worst_arg = src[i];
+            }
+        }
+    }
+
+    bool is_ok = (max_ulp <= sweep->max_ulp);
+
+    printf("%-8s max %zu ULP (bound %zu) at %.17g%s\n", sweep->name, max_ulp, sweep->max_ulp,
+           worst_arg, is_ok ? "" : "  FAILED");
+
+    return is_ok;
+}
+
+//------------------------------------------------------------------------------
+// Integer powers up to 8 of bases that neither overflow nor underflow.
+
+static bool SweepPow(size_t point_count)
+{
+    NumType_t base[kSweepBlock]  = {};
+    NumType_t power[kSweepBlock] = {};
+    NumType_t dst[kSweepBlock]   = {};
+
+    uint64_t seed = 2;
+
+    size_t    max_ulp     = 0;
+    NumType_t worst_base  = 0;
+    NumType_t worst_power = 0;
+
+    for (size_t done = 0; done < point_count; done += kSweepBlock)
+    {
+        size_t count = (point_count - done < kSweepBlock) ? point_count - done : kSweepBlock;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            NumType_t mag = ldexp(1 + RandUnit(&seed), (int) (NextRand(&seed) % 161) - 80);
+
+            base[i]  = (NextRand(&seed) & 1) ? -mag : mag;
+            power[i] = (NumType_t) ((int) (NextRand(&seed) % 17) - 8);
+        }
+
+        VecPow(dst, base, power, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t ulp = UlpDiff(dst[i], pow(base[i], power[i]));
+
+            if (ulp > max_ulp)
+            {
+                max_ulp     = ulp;
+                worst_base  = base[i];
+                worst_power = power[i];
+            }
+        }
+    }
+
+    bool is_ok = (max_ulp <= kPowMaxUlp);
+
+    printf("%-8s max %zu ULP (bound %zu) at %.17g^%g%s\n", "VecPow", max_ulp, kPowMaxUlp,
+           worst_base, worst_power, is_ok ? "" : "  FAILED");
+
+    return is_ok;
+}
+
+//------------------------------------------------------------------------------
+
+static bool CheckSpecials()
+{
+    NumType_t dst[kSpecialValCount] = {};
+
+    bool is_ok = true;
+
+    for (size_t k = 0; k < kUnarySweepCount; k++)
+    {
+        const UnarySweep *sweep = &kUnarySweeps[k];
+
+        sweep->kernel(dst, kSpecialVals, kSpecialValCount);
+
+        for (size_t i = 0; i < kSpecialValCount; i++)
+        {
+            size_t max_ulp = sweep->in_table(kSpecialVals[i]) ? sweep->max_ulp : 0;
+
+            if (UlpDiff(dst[i], sweep->libm(kSpecialVals[i])) > max_ulp)
+            {
+                printf("%-8s(%g) = %.17g, libm gives %.17g  FAILED\n", sweep->name,
+                       kSpecialVals[i], dst[i], sweep->libm(kSpecialVals[i]));
+
+                is_ok = false;
+            }
+        }
+    }
+
+    NumType_t powers[kSpecialValCount] = {};
+
+    for (size_t i = 0; i < kSpecialValCount; i++)
+    {
+        powers[i] = 0.5; // not an integer, libm only
+    }
+
+    VecPow(dst, kSpecialVals, powers, kSpecialValCount);
+
+    for (size_t i = 0; i < kSpecialValCount; i++)
+    {
+        if (!IsSameNum(dst[i], pow(kSpecialVals[i], powers[i])))
+        {
+            printf("%-8s(%g, %g) = %.17g, libm gives %.17g  FAILED\n", "VecPow",
+                   kSpecialVals[i], powers[i], dst[i], pow(kSpecialVals[i], powers[i]));
+
+            is_ok = false;
+        }
+    }
+
+    printf("special values %s\n", is_ok ? "match libm" : "differ from libm");
+
+    return is_ok;
+}
+
+//------------------------------------------------------------------------------
+// |x| <= 1e5 with a log-uniform magnitude, so small arguments are swept too.
+
+static NumType_t GenTrig(uint64_t *seed)
+{
+    NumType_t mag = 1e5 * pow(2, -40 * RandUnit(seed));
+
+    return (NextRand(seed) & 1) ? -mag : mag;
+}
+
+//------------------------------------------------------------------------------
+// Positive normal numbers, every binary exponent equally often.
+
+static NumType_t GenLn(uint64_t *seed)
+{
+    return ldexp(1 + RandUnit(seed), (int) (NextRand(seed) % 2046) - 1022);
+}
+
+//------------------------------------------------------------------------------
+
+static bool IsTrigArg(NumType_t x)
+{
+    return fabs(x) <= 1e5;
+}
+
+//------------------------------------------------------------------------------
+
+static bool IsLnArg(NumType_t x)
+{
+    return isnormal(x) && x > 0;
+}
+
+//------------------------------------------------------------------------------
+// xorshift64*, the same points on every run.
+
+static uint64_t NextRand(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+
+    return *seed * 0x2545F4914F6CDD1DULL;
+}
+
+//------------------------------------------------------------------------------
+// [0, 1) with 53 random bits.
+
+static NumType_t RandUnit(uint64_t *seed)
+{
+    return (NumType_t) (NextRand(seed) >> 11) * 0x1p-53;
+}
@@ -7,6 +7,13 @@
 #include "trees.h"
 #include "tree_dump.h"
 #include "diff.h"
+#include "dag.h"
+#include "work_stack.h"
+#include "taylor.h"
+#include "diff_memo.h"
+#include "rules.h"
+#include "egraph.h"
+#include "poly.h"
 #include "time.h"
 
 
@@ -21,13 +28,16 @@ static const char * const log_file_name = "tree.dmp.html";
 static void LogPrintTree(TreeNode *node,
                          FILE     *dot_file);
 
-static void PrintWithBrackets(Replaces *reps,
-                              Variables *vars,
-                              TreeNode *node,
-                              FILE *latex_file);
+static const int kTexNode      = 0;
+static const int kTexBracketed = 1;
+static const int kTexStr       = 2;
 
+static WorkItem TexItem(const TreeNode *node,
+                        const char     *str,
+                        int             state);
 
-static int Factorial(int num);
+
+static double Factorial(size_t num);
 
 static const char *FoolStrings[] =
 {
@@ -177,51 +187,62 @@ TreeErrs_t GraphDumpTree(Tree *tree,
 static void LogPrintTree(TreeNode *node,
                          FILE     *dot_file)
 {
-    if (node->type == kOperator)
-    {
-        LOG_PRINT("node%p [style = filled, fillcolor = \"lightgreen\", shape = Mrecord, label = "
-                  "\"data: %s | {type : operator | op_code : %d} | {parent: %p | pointer: %p | left: %p | right: %p} \"]\n",
-                  node,
-                  OperationArray[node->data.op_code].op_str,
-                  node->data.op_code,
-                  node->parent,
-                  node,
-                  node->left,
-                  node->right);
-    }
-    else if (node->type == kConstNumber)
-    {
-        LOG_PRINT("node%p [style = filled, fillcolor = \"lightblue\", shape = Mrecord, label = "
-                  "\"data: %lg | type : const number | {parent: %p | pointer: %p | left: %p | right: %p} \"]\n",
-                  node,
-                  node->data.const_val,
-                  node->parent,
-                  node,
-                  node->left,
-                  node->right);
-    }
-    else if (node->type == kVariable)
-    {
-        LOG_PRINT("node%p [style = filled, fillcolor = \"pink\", shape = Mrecord, label = "
-                  "\"data: %d | type : variable | {parent: %p | pointer: %p | left: %p | right: %p} \"]\n",
-                  node,
-                  node->data.variable_pos,
-                  node->parent,
-                  node,
-                  node->left,
-                  node->right);
-    }
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
 
-    if (node->left != nullptr)
-    {
-        LogPrintTree(node->left, dot_file);
-    }
+    WorkPushNode(&stk, node, 0);
 
-    if (node->right != nullptr)
+    while (stk.size > 0)
     {
-        LogPrintTree(node->right, dot_file);
+        node = WorkPop(&stk).val.node;
+
+        if (node->type == kOperator)
+        {
+            LOG_PRINT("node%p [style = filled, fillcolor = \"lightgreen\", shape = Mrecord, label = "
+                      "\"data: %s | {type : operator | op_code : %d} | {parent: %p | pointer: %p | left: %p | right: %p} \"]\n",
+                      node,
+                      OperationArray[node->data.op_code].op_str,
+                      node->data.op_code,
+                      node->parent,
+                      node,
+                      node->left,
+                      node->right);
+        }
+        else if (node->type == kConstNumber)
+        {
+            LOG_PRINT("node%p [style = filled, fillcolor = \"lightblue\", shape = Mrecord, label = "
+                      "\"data: %lg | type : const number | {parent: %p | pointer: %p | left: %p | right: %p} \"]\n",
+                      node,
+                      node->data.const_val,
+                      node->parent,
+                      node,
+                      node->left,
+                      node->right);
+        }
+        else if (node->type == kVariable)
+        {
+            LOG_PRINT("node%p [style = filled, fillcolor = \"pink\", shape = Mrecord, label = "
+                      "\"data: %d | type : variable | {parent: %p | pointer: %p | left: %p | right: %p} \"]\n",
+                      node,
+                      node->data.variable_pos,
+                      node->parent,
+                      node,
+                      node->left,
+                      node->right);
+        }
+
+        if (node->right != nullptr)
+        {
+            WorkPushNode(&stk, node->right, 0);
+        }
+
+        if (node->left != nullptr)
+        {
+            WorkPushNode(&stk, node->left, 0);
+        }
     }
 
+    WorkStackDtor(&stk);
 }
 
 //================================================================================================
@@ -229,46 +250,59 @@ static void LogPrintTree(TreeNode *node,
 void LogPrintEdges(TreeNode *node,
                    FILE     *dot_file)
 {
-    if (node->left != nullptr)
-    {
-        LOG_PRINT("node%p->node%p\n",
-                  node,
-                  node->left);
-    }
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
 
-    if (node->parent != nullptr)
-    {
-        LOG_PRINT("node%p->node%p[color = \"yellow\"]\n",
-                  node,
-                  node->parent);
-    }
+    WorkPushNode(&stk, node, 0);
 
-    if (node->right != nullptr)
+    while (stk.size > 0)
     {
-        LOG_PRINT("node%p->node%p\n",
-                  node,
-                  node->right);
-    }
+        node = WorkPop(&stk).val.node;
 
-    if (node->left != nullptr)
-    {
-        LogPrintEdges(node->left, dot_file);
-    }
+        if (node->left != nullptr)
+        {
+            LOG_PRINT("node%p->node%p\n",
+                      node,
+                      node->left);
+        }
 
-    if (node->right != nullptr)
-    {
-        LogPrintEdges(node->right, dot_file);
+        if (node->parent != nullptr)
+        {
+            LOG_PRINT("node%p->node%p[color = \"yellow\"]\n",
+                      node,
+                      node->parent);
+        }
+
+        if (node->right != nullptr)
+        {
+            LOG_PRINT("node%p->node%p\n",
+                      node,
+                      node->right);
+        }
+
+        if (node->right != nullptr)
+        {
+            WorkPushNode(&stk, node->right, 0);
+        }
+
+        if (node->left != nullptr)
+        {
+            WorkPushNode(&stk, node->left, 0);
+        }
     }
+
+    WorkStackDtor(&stk);
 }
 
 #undef LOG_PRINT
 
 //================================================================================================
 
-void LatexDump(Variables      *vars,
-               const Tree     *func,
-               Expr           *expr,
-               const char     *latex_file_name)
+void LatexDump(Variables           *vars,
+               const Tree          *func,
+               Expr                *expr,
+               const MaclaurinOpts *opts,
+               const char          *latex_file_name)
 {
     system("rm -rf *.pdf");
     system("rm -rf *.log");
@@ -307,7 +341,7 @@ void LatexDump(Variables      *vars,
               "\\begin{document}\n"
               "\\maketitle\n", transpos_latex_string);
 
-    PrintMaclaurinSeries(vars, func, latex_file, expr);
+    PrintMaclaurinSeries(vars, func, latex_file, expr, opts);
     printf("HUY");
 
     TEX_PRINT("\n\\end{document}");
@@ -327,250 +361,449 @@ TreeErrs_t LatexPrintNode(Replaces       *reps,
                           const TreeNode *node,
                           FILE           *latex_file)
 {
-    #define PRINT_BR(node) PrintWithBrackets(reps, vars, node, latex_file)
+    #define SEQ_NODE(node) seq[seq_size++] = TexItem(node, nullptr, kTexNode)
+    #define SEQ_BR(node)   seq[seq_size++] = TexItem(node, nullptr, kTexBracketed)
+    #define SEQ_STR(str)   seq[seq_size++] = TexItem(nullptr, str,  kTexStr)
 
-    /*if (reps != nullptr)
-    {
-        ++(reps->curr_depth);
+    static const size_t kMaxTexSeq = 8;
 
-        if (reps->curr_depth >= 32 && reps->rep_count < 14)
-        {
-            size_t pos = AddReplace(reps, (TreeNode *) node);
-            TEX_PRINT("%C", reps->rep_array[pos].id);
-            reps->curr_depth = 0;
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
 
-            return kTreeSuccess;
-        }
-    }*/
+    WorkPush(&stk, TexItem(node, nullptr, kTexNode));
 
-    if (node == nullptr)
+    while (stk.size > 0)
     {
-        return kTreeSuccess;
-    }
+        WorkItem item = WorkPop(&stk);
 
-    if (node->type == kConstNumber)
-    {
-        TEX_PRINT("%lg", node->data.const_val);
-
-        return kTreeSuccess;
-    }
+        if (item.state == kTexStr)
+        {
+            TEX_PRINT("%s", item.val.str);
 
-    if (node->type == kVariable)
-    {
-        TEX_PRINT("%s", vars->var_array[node->data.variable_pos].id);
+            continue;
+        }
 
-        return kTreeSuccess;
-    }
+        const TreeNode *curr = item.val.const_node;
 
-    if (node->type == kRepVar)
-    {
-        if (reps != nullptr)
+        if (curr == nullptr)
         {
-            TEX_PRINT("%c", reps->rep_array[node->data.variable_pos].id);
+            continue;
         }
-    }
 
-    switch (node->data.op_code)
-    {
-        case kAdd:
-        {
-            LatexPrintNode(reps, vars, node->left, latex_file);
+        WorkItem seq[kMaxTexSeq] = {};
+        size_t   seq_size = 0;
 
-            TEX_PRINT("+");
+        if (item.state == kTexBracketed)
+        {
+            if (curr->type == kOperator && !IsUnaryOp(curr->data.op_code) && curr->data.op_code != kMult)
+            {
+                SEQ_STR("\\left( ");
+                SEQ_NODE(curr);
+                SEQ_STR(" \\right)");
+            }
+            else
+            {
+                SEQ_NODE(curr);
+            }
+        }
+        else if (curr->type == kConstNumber)
+        {
+            TEX_PRINT("%lg", curr->data.const_val);
+        }
+        else if (curr->type == kVariable)
+        {
+            TEX_PRINT("%s", vars->var_array[curr->data.variable_pos].id);
+        }
+        else if (curr->type == kRepVar)
+        {
+            if (reps != nullptr)
+            {
+                TEX_PRINT("%c", reps->rep_array[curr->data.variable_pos].id);
+            }
+        }
+        else switch (curr->data.op_code)
+        {
+            case kAdd:
+            {
+                SEQ_NODE(curr->left);
+                SEQ_STR("+");
+                SEQ_NODE(curr->right);
 
-            LatexPrintNode(reps, vars, node->right, latex_file);
+                break;
+            }
 
-            break;
-        }
+            case kSub:
+            {
+                SEQ_NODE(curr->left);
+                SEQ_STR("-");
+                SEQ_NODE(curr->right);
 
-        case kSub:
-        {
-            LatexPrintNode(reps, vars, node->left, latex_file);
+                break;
+            }
 
-            TEX_PRINT("-");
+            case kDiv:
+            {
+                SEQ_STR(OperationArray[kDiv].tex_str);
+                SEQ_STR("{");
+                SEQ_NODE(curr->left);
+                SEQ_STR("}");
 
-            LatexPrintNode(reps, vars, node->right, latex_file);
+                SEQ_STR("{");
+                SEQ_NODE(curr->right);
+                SEQ_STR("}");
 
-            break;
-        }
+                break;
+            }
 
-        case kDiv:
-        {
-            TEX_PRINT("%s{", OperationArray[kDiv].tex_str);
-            LatexPrintNode(reps, vars, node->left, latex_file);
-            TEX_PRINT("}");
+            case kMult:
+            {
+                SEQ_BR(curr->left);
 
-            TEX_PRINT("{");
-            LatexPrintNode(reps, vars, node->right, latex_file);
-            TEX_PRINT("}");
+                SEQ_STR(" ");
+                SEQ_STR(OperationArray[kMult].tex_str);
+                SEQ_STR(" ");
 
-            break;
-        }
+                SEQ_BR(curr->right);
 
-        case kMult:
-        {
-            PRINT_BR(node->left);
+                break;
+            }
 
-            TEX_PRINT(" %s ", OperationArray[kMult].tex_str);
+            case kExp:
+            {
+                SEQ_BR(curr->left);
 
-            PRINT_BR(node->right);
+                SEQ_STR("^");
 
-            break;
-        }
+                SEQ_STR("{");
+                SEQ_NODE(curr->right);
+                SEQ_STR("}");
 
-        case kExp:
-        {
-            PRINT_BR(node->left);
+                break;
+            }
 
-            TEX_PRINT("^");
+            case kSin:
+            case kCos:
+            case kSqrt:
+            case kTg:
+            case kLn:
+            {
+                SEQ_STR(OperationArray[curr->data.op_code].tex_str);
+                SEQ_STR(" ");
+                SEQ_STR("{");
+                SEQ_BR(curr->right);
+                SEQ_STR("}");
 
-            TEX_PRINT("{");
-            LatexPrintNode(reps, vars, node->right, latex_file);
-            TEX_PRINT("}");
+                break;
+            }
 
-            break;
-        }
+            case kNotAnOperation:
+            default:
+            {
+                printf("kavo> OPCODE : %d?\n", curr->data.op_code);
 
-        case kSin:
-        case kCos:
-        case kSqrt:
-        case kTg:
-        case kLn:
-        {
-            TEX_PRINT("%s ", OperationArray[node->data.op_code].tex_str);
-            TEX_PRINT("{");
-            PRINT_BR(node->right);
-            TEX_PRINT("}");
-            break;
+                break;
+            }
         }
 
-        case kNotAnOperation:
-        default:
+        while (seq_size > 0)
         {
-            printf("kavo> OPCODE : %d?\n", node->data.op_code);
+            if (WorkPush(&stk, seq[--seq_size]) != kTreeSuccess)
+            {
+                WorkStackDtor(&stk);
 
-            return kTreeSuccess;//===
+                return kFailedAllocation;
+            }
         }
-
     }
 
+    WorkStackDtor(&stk);
+
+    #undef SEQ_NODE
+    #undef SEQ_BR
+    #undef SEQ_STR
+
     return kTreeSuccess;
 }
 
 //================================================================================================
 
-static void PrintWithBrackets(Replaces *reps,
-                              Variables *vars,
-                              TreeNode *node,
-                              FILE *latex_file)
+static WorkItem TexItem(const TreeNode *node,
+                        const char     *str,
+                        int             state)
 {
-    if(node->type != kVariable && node->type != kConstNumber)
+    WorkItem item = {};
+
+    if (state == kTexStr)
     {
-        if (!IsUnaryOp(node->data.op_code) && node->data.op_code != kMult)
-        {
-            TEX_PRINT("\\left( ");
-        }
+        item.val.str = str;
     }
-
-    LatexPrintNode(reps, vars, node, latex_file);
-
-    if(node->type != kVariable && node->type != kConstNumber)
+    else
     {
-        if (!IsUnaryOp(node->data.op_code) && node->data.op_code != kMult)
-        {
-            TEX_PRINT(" \\right)");
-        }
+        item.val.const_node = node;
     }
+
+    item.state = state;
+
+    return item;
 }
 
 //================================================================================================
 
-TreeErrs_t PrintMaclaurinSeries(Variables  *vars,
-                                const Tree *func,
-                                FILE       *latex_file,
-                                Expr       *expr)
+TreeErrs_t PrintMaclaurinSeries(Variables           *vars,
+                                const Tree          *func,
+                                FILE                *latex_file,
+                                Expr                *expr,
+                                const MaclaurinOpts *opts)
 {
     srand(time(NULL));
 
-    static const size_t kPrecise = 5;
+    static const size_t kMaxPrintedSize = 4096;
+
+    size_t order  = opts->order;
+    size_t derivs = (opts->derivs < order) ? opts->derivs : order;
+
+    NumType_t *coeffs = (NumType_t *) calloc(order, sizeof(NumType_t));
+
+    if (coeffs == nullptr)
+    {
+        return kFailedAllocation;
+    }
+
+    // coefficients come from truncated series, derivative trees are built
+    // only for the derivs - 1 derivatives printed below
+
+    TaylorSeries(vars, func->root, 0, order, coeffs);
+
+    DagTable   dag      = {};
+    DagTable  *prev_dag = DagCurrent();
+
+    NodeArena  diff_arenas[2] = {};
+    NodeArena *prev_arena = NodeArenaSelect(&diff_arenas[0]);
+
+    DiffMemo  memo      = {};
+    DiffMemo *prev_memo = DiffMemoCurrent();
+
+    // not selected: the derivative of an extracted tree is often bigger than
+    // the one of the canonical tree, so only the printed copy goes through it
+
+    EGraph egraph     = {};
+    bool   use_egraph = opts->use_egraph && !opts->use_dag && EGraphCtor(&egraph) == kTreeSuccess;
+
+    // a rational function of x stays in dense form for the whole chain,
+    // with opts->expand even if it is bigger, while its coefficients are
+    // exact: (1 + x)^100 or a derivative that leaves kMaxPolyCoeff goes on
+    // as a tree
+
+    RatFunc rat     = {};
+    bool    use_rat = false;
 
     Tree diff_tree = {0};
-    diff_tree.root = DiffTree(func->root, nullptr);
 
-    double coeffs[kPrecise] = {0};
+    if (opts->use_dag)
+    {
+        DagCtor(&dag);
+        DagSelect(&dag);
+
+        if (derivs > 1)
+        {
+            diff_tree.root = DiffTree(DagImport(&dag, func->root), 0, nullptr);
+        }
+    }
+    else if (derivs > 1)
+    {
+        size_t func_size = 0;
+
+        diff_tree.arena = &diff_arenas[0];
 
-    coeffs[0] = Eval(vars, func->root);
+        use_rat = func->root->deps == VarDepsBit(0) &&
+                  RatFromTree(&rat, func->root, 0, &func_size) == kTreeSuccess &&
+                  (opts->expand || RatTreeSize(&rat) <= func_size) &&
+                  RatDiff(&rat, 1) == kTreeSuccess;
+
+        if (use_rat)
+        {
+            diff_tree.root = RatToTree(&rat, 0);
+        }
+        else
+        {
+            if (opts->use_memo && DiffMemoCtor(&memo) == kTreeSuccess)
+            {
+                DiffMemoSelect(&memo);
+            }
+
+            diff_tree.root = DiffTree(func->root, 0, nullptr);
+        }
+    }
 //
     TEX_PRINT("\\begin{equation*}\n\\begin{wrapeqn}\n f(x) = ");
     LatexPrintNode(nullptr, vars, func->root, latex_file);
     TEX_PRINT("\\end{wrapeqn}\n\\end{equation*}\n");
 //func
-    for (size_t i = 1; i < kPrecise; i++)
+    bool has_series = true;
+
+    for (size_t i = 1; i < order; i++)
     {
-        coeffs[i] = Eval(vars, diff_tree.root);
+        NumType_t diff_val = coeffs[i] * Factorial(i);
 
-        Replaces reps;
-        RepCtor(&reps);
-        TreeNode *tmp = diff_tree.root;
+        if (i < derivs)
+        {
+            Replaces reps;
+            RepCtor(&reps);
 
-        TEX_PRINT("%s\\newline\n", FoolStrings[rand() % kFoolStringsSize]);
+            TEX_PRINT("%s\\newline\n", FoolStrings[rand() % kFoolStringsSize]);
 //printf formula
-        TEX_PRINT("\\begin{equation*}\n\\begin{wrapeqn}\nf^{%d}(x) = ", i);
+            size_t diff_size = opts->use_dag ? DagTreeSize(&dag, diff_tree.root) : 0;
+
+            if (diff_size <= kMaxPrintedSize)
+            {
+                TEX_PRINT("\\begin{equation*}\n\\begin{wrapeqn}\nf^{%zu}(x) = ", i);
 //
-        LatexPrintNode(&reps, vars, diff_tree.root, latex_file);
+                Tree cheapest = {};
+
+                if (use_egraph && (cheapest.root = CopyNode(diff_tree.root, nullptr)) != nullptr)
+                {
+                    EGraphSimplify(&egraph, &cheapest);
+                }
+
+                LatexPrintNode(&reps, vars, (cheapest.root != nullptr) ? cheapest.root : diff_tree.root, latex_file);
 //
-        TEX_PRINT("\\end{wrapeqn}\n\\end{equation*}\n");
+                TEX_PRINT("\\end{wrapeqn}\n\\end{equation*}\n");
 //
-        PrintReps(&reps, vars, latex_file);
+                PrintReps(&reps, vars, latex_file);
+
+                TreeDtor(cheapest.root);
+            }
+            else
+            {
+                TEX_PRINT("$f^{%zu}(x)$    : %zu .\\newline\n", i, diff_size);
+            }
 
-        double diff_val = Eval(vars, diff_tree.root);
+            RepDtor(&reps);
+        }
 
         if (!isnan(diff_val))
         {
-            TEX_PRINT("$$f^{%d}(0) = %.3lg$$", i, diff_val);
+            if (i < derivs)
+            {
+                TEX_PRINT("$$f^{%zu}(0) = %.3lg$$", i, diff_val);
+            }
         }
         else
         {
             PasteImage(latex_file, "fun_img/img1.jpg");
 
-            TEX_PRINT("  0 $f^{%d}(0)$  .     !\\newline\n", i);
+            TEX_PRINT("  0 $f^{%zu}(0)$  .     !\\newline\n", i);
 
-            RepDtor(&reps);
-            TreeDtor(diff_tree.root);
+            has_series = false;
+
+            break;
+        }
 
-            return kTreeSuccess;
+        if (i + 1 >= derivs)
+        {
+            continue;
         }
-        diff_tree.root = DiffTree(diff_tree.root, nullptr);
 
-        TreeDtor(tmp);
+        if (opts->use_dag)
+        {
+            diff_tree.root = DiffTree(diff_tree.root, 0, nullptr);
+
+            continue;
+        }
+
+        NodeArena *old_arena = diff_tree.arena;
+
+        diff_tree.arena = &diff_arenas[i % 2];
+        NodeArenaSelect(diff_tree.arena);
 
-        OptimizeTree(vars, &diff_tree);
+        use_rat = use_rat && RatDiff(&rat, 1) == kTreeSuccess;
 
+        diff_tree.root = use_rat ? RatToTree(&rat, 0) : DiffTree(diff_tree.root, 0, nullptr);
+
+        NodeArenaReset(old_arena);
+
+        if (use_rat)
+        {
+            continue; // built from the dense form, nothing to simplify
+        }
+
+        OptimizeTree(&diff_tree);
+
+#ifdef DEBUG
+        if (log_file != nullptr)
+        {
+            NodeArenaDump(diff_tree.arena, "optimized derivative", log_file);
+        }
+#endif
 
         GRAPH_DUMP_TREE(&diff_tree);
-        RepDtor(&reps);
     }
 
-    TEX_PRINT(" :\\newline\n$$f(x) = ");
-
-    for (size_t i = 0; i < kPrecise; i++)
+    if (has_series)
     {
-        if (coeffs[i] != 0 && !isnan(coeffs[i]))
+        TEX_PRINT(" :\\newline\n$$f(x) = ");
+
+        for (size_t i = 0; i < order; i++)
         {
-            if (i == 0)
+            if (coeffs[i] != 0 && !isnan(coeffs[i]))
             {
-                TEX_PRINT("%.3lg +", coeffs[i]);
-            }
-            else
-            {
-                TEX_PRINT("\\frac{%.3lg}{%d} \\cdot x^{%d} +", coeffs[i], Factorial(i), i);
+                if (i == 0)
+                {
+                    TEX_PRINT("%.3lg +", coeffs[i]);
+                }
+                else
+                {
+                    TEX_PRINT("%.3lg \\cdot x^{%zu} +", coeffs[i], i);
+                }
             }
         }
+
+        TEX_PRINT("O(x^{%zu})$$", order);
+    }
+
+#ifdef DEBUG
+    if (opts->use_dag && log_file != nullptr)
+    {
+        DagDump(&dag, log_file);
+    }
+
+    if (memo.capacity != 0 && log_file != nullptr)
+    {
+        DiffMemoDump(&memo, log_file);
+    }
+
+    if (RuleSetCurrent() != nullptr && log_file != nullptr)
+    {
+        RuleSetDump(RuleSetCurrent(), log_file);
+    }
+
+    if (egraph.runs != 0 && log_file != nullptr)
+    {
+        EGraphDump(&egraph, log_file);
+    }
+#endif
+
+    if (opts->use_dag)
+    {
+        DagDtor(&dag);
+    }
+
+    RatFuncDtor(&rat);
+
+    DiffMemoSelect(prev_memo);
+    DiffMemoDtor(&memo);
+
+    if (use_egraph)
+    {
+        EGraphDtor(&egraph);
     }
 
-    TEX_PRINT("O(x^%d)$$", kPrecise);
+    DagSelect(prev_dag);
+    NodeArenaSelect(prev_arena);
+    NodeArenaDtor(&diff_arenas[0]);
+    NodeArenaDtor(&diff_arenas[1]);
 
-    TreeDtor(diff_tree.root);
+    free(coeffs);
 
     return kTreeSuccess;
 }
@@ -589,7 +822,7 @@ static void PasteImage(FILE       *latex_file,
 
 //================================================================================================
 
-static int Factorial(int num)
+static double Factorial(size_t num)
 {
     if (num == 1 || num == 0)
     {
@@ -750,7 +983,6 @@ void MakeGraph(Expr       *expr,
 
 
 
-#undef PRINT_BR
 #undef TEX_PRINT
 
 
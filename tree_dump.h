@@ -23,6 +23,20 @@ struct Replaces
     size_t rep_count = 0;
 };
 
+static const size_t kBaseMaclaurinOrder = 5;
+
+struct MaclaurinOpts
+{
+    size_t      order           = kBaseMaclaurinOrder; // terms of the series
+    size_t      derivs          = kBaseMaclaurinOrder; // f' ... f^(derivs - 1) are printed as formulas
+    bool        use_dag         = false;               // share subtrees of derivatives through a DagTable
+    bool        use_egraph      = false;               // cheapest equal form of every derivative, see egraph.h
+    bool        use_memo        = false;               // differentiate equal subtrees once, see diff_memo.h
+    bool        expand          = false;               // dense form of a rational f even if it is bigger, inaccurate near its roots, see poly.h
+    const char *c_file_name     = nullptr;             // also write the derivatives as C source
+    const char *rules_file_name = nullptr;             // rewrite rules added to the default ones
+};
+
 
 TreeErrs_t GraphDumpTree(Tree *tree,
                          const char *file,
@@ -36,20 +50,22 @@ void InitTreeGraphDump();
 void LogPrintEdges(TreeNode *node,
                    FILE     *dot_file);
 
-void LatexDump(Variables      *vars,
-               const Tree     *func,
-               Expr           *expr,
-               const char     *latex_file_name);
+void LatexDump(Variables           *vars,
+               const Tree          *func,
+               Expr                *expr,
+               const MaclaurinOpts *opts,
+               const char          *latex_file_name);
 
 TreeErrs_t LatexPrintNode(Replaces       *reps,
                           Variables      *vars,
                           const TreeNode *node,
                           FILE           *latex_file);
 
-TreeErrs_t PrintMaclaurinSeries(Variables  *vars,
-                                const Tree *func,
-                                FILE       *latex_file,
-                                Expr       *expr);
+TreeErrs_t PrintMaclaurinSeries(Variables           *vars,
+                                const Tree          *func,
+                                FILE                *latex_file,
+                                Expr                *expr,
+                                const MaclaurinOpts *opts);
 
 void InFixPrintTree(Variables *vars,
                     TreeNode  *node,
@@ -8,6 +8,8 @@
 #include "tree_dump.h"
 #include "Stack/stack.h"
 #include "diff.h"
+#include "dag.h"
+#include "work_stack.h"
 
 static const char *kTreeSaveFileName = "tree_save.txt";
 
@@ -15,6 +17,8 @@ static const int kPoisonVal = 0xBADBABA;
 
 static const char *kPreCtored = "*";
 
+static uint64_t NodeKey(const TreeNode *node);
+
 static TreeErrs_t CreateNodeFromText(Tree     *tree,
                                      TreeNode *parent_node,
                                      TreeNode **curr_node,
@@ -47,6 +51,9 @@ static TreeErrs_t CreateNodeFromInfixBrackets(Tree      *tree,
                                               Text      *text,
                                               size_t    *iterator);
 
+static TreeNode *ShallowCopy(const TreeNode *src_node,
+                             TreeNode       *parent_node);
+
 //==============================================================================
 
 TreeErrs_t TreeCtor(Tree *tree)
@@ -67,20 +74,58 @@ TreeErrs_t TreeCtor(Tree *tree)
 
 TreeErrs_t TreeDtor(TreeNode *root)
 {
-    if (root != nullptr)
+    if (root == nullptr)
     {
-        if (root->left != nullptr)
+        return kTreeSuccess;
+    }
+
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    WorkPushNode(&stk, root, 0);
+
+    while (stk.size > 0)
+    {
+        TreeNode *node = WorkPop(&stk).val.node;
+
+        if (node->left != nullptr && WorkPushNode(&stk, node->left, 0) != kTreeSuccess)
         {
-            TreeDtor(root->left);
+            WorkStackDtor(&stk);
+
+            return kFailedAllocation;
         }
 
-        if (root->right != nullptr)
+        if (node->right != nullptr && WorkPushNode(&stk, node->right, 0) != kTreeSuccess)
         {
-            TreeDtor(root->right);
+            WorkStackDtor(&stk);
+
+            return kFailedAllocation;
         }
+
+        NodeFree(node);
     }
 
-    free(root);
+    WorkStackDtor(&stk);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t TreeRelease(Tree *tree)
+{
+    CHECK(tree);
+
+    if (tree->arena != nullptr)
+    {
+        NodeArenaReset(tree->arena);
+    }
+    else
+    {
+        TreeDtor(tree->root);
+    }
+
+    tree->root = nullptr;
 
     return kTreeSuccess;
 }
@@ -94,9 +139,9 @@ TreeErrs_t s_NodeCtor(Tree                  *tree,
 {
     CHECK(node);
 
-    *node = (TreeNode *) calloc(1, sizeof(TreeNode));
+    *node = NodeAlloc();
 
-    if (node == nullptr)
+    if (*node == nullptr)
     {
         return kFailedAllocation;
     }
@@ -105,6 +150,8 @@ TreeErrs_t s_NodeCtor(Tree                  *tree,
 
     (*node)->left   = (*node)->right = nullptr;
     (*node)->parent = parent_node;
+    (*node)->deps   = 0;
+    (*node)->dirty  = true;
 
     GRAPH_DUMP_TREE(tree);
 
@@ -119,28 +166,58 @@ TreeNode *NodeCtor(TreeNode         *parent_node,
                    ExpressionType_t  type,
                    double            data)
 {
-    TreeNode *node = (TreeNode *) calloc(1, sizeof(TreeNode));
+    NodeData node_data = {};
 
-    if (node == nullptr)
+    if (type == kOperator)
     {
-        return nullptr;
+        node_data.op_code = (OpCode_t) data;
+    }
+    else if (type == kVariable || type == kRepVar)
+    {
+        node_data.variable_pos = (size_t) data;
+    }
+    else
+    {
+        node_data.const_val = data;
     }
 
-    node->type = type;
+    DagTable *dag = DagCurrent();
 
-    if (type == kOperator)
+    if (dag != nullptr)
     {
-        node->data.op_code = (OpCode_t) data;
+        return DagNodeCtor(dag, type, node_data, left, right);
     }
-    else
+
+    TreeNode *node = NodeAlloc();
+
+    if (node == nullptr)
     {
-        node->data.const_val = data;
+        return nullptr;
     }
 
+    node->type = type;
+    node->data = node_data;
+
     node->left  = left;
     node->right = right;
     node->parent = parent_node;
 
+    node->deps = ((left  != nullptr) ? left->deps  : 0) |
+                 ((right != nullptr) ? right->deps : 0) |
+                 ((type == kVariable) ? VarDepsBit(node_data.variable_pos) : 0);
+
+    node->dirty = true;
+
+    if (left != nullptr)
+    {
+        left->parent = node;
+    }
+
+    if (right != nullptr)
+    {
+        right->parent = node;
+    }
+
     return node;
 }
 
@@ -238,6 +315,8 @@ TreeErrs_t ReadTreeOutOfFile(Tree       *tree,
         return kFailedToReadTree;
     }
 
+    UpdateDeps(tree->root);
+
     GRAPH_DUMP_TREE(tree);
 
     return kTreeSuccess;
@@ -431,6 +510,27 @@ static TreeErrs_t CreateNodeFromInfixBrackets(Tree      *tree,
 
 //==============================================================================
 
+static TreeNode *ShallowCopy(const TreeNode *src_node,
+                             TreeNode       *parent_node)
+{
+    TreeNode *node = NodeAlloc();
+
+    if (node == nullptr)
+    {
+        return nullptr;
+    }
+
+    *node = *src_node;
+
+    node->parent = parent_node;
+
+    return node;
+}
+
+//------------------------------------------------------------------------------
+// Fresh copies keep the children pointers of their source until they are
+// popped, then those are replaced with copies in turn.
+
 TreeNode *CopyNode(const TreeNode *src_node,
                    TreeNode       *parent_node)
 {
@@ -439,17 +539,52 @@ TreeNode *CopyNode(const TreeNode *src_node,
         return nullptr;
     }
 
-    TreeNode *node = (TreeNode *) calloc(1, sizeof(TreeNode));
+    DagTable *dag = DagCurrent();
 
-    node->data = src_node->data;
+    if (dag != nullptr)
+    {
+        return DagImport(dag, src_node);
+    }
 
-    node->type = src_node->type;
+    TreeNode *root = ShallowCopy(src_node, parent_node);
 
-    node->left   = CopyNode(src_node->left, node);
-    node->right  = CopyNode(src_node->right, node);
-    node->parent = parent_node;
+    if (root == nullptr)
+    {
+        return nullptr;
+    }
 
-    return node;
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    WorkPushNode(&stk, root, 0);
+
+    while (stk.size > 0)
+    {
+        TreeNode *node = WorkPop(&stk).val.node;
+
+        TreeNode **children[] = {&node->left, &node->right};
+
+        for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); i++)
+        {
+            if (*children[i] == nullptr)
+            {
+                continue;
+            }
+
+            *children[i] = ShallowCopy(*children[i], node);
+
+            if (*children[i] == nullptr || WorkPushNode(&stk, *children[i], 0) != kTreeSuccess)
+            {
+                WorkStackDtor(&stk);
+
+                return nullptr;
+            }
+        }
+    }
+
+    WorkStackDtor(&stk);
+
+    return root;
 }
 
 //==============================================================================
@@ -461,20 +596,267 @@ TreeErrs_t SetParents(TreeNode *parent_node)
         return kTreeSuccess;
     }
 
-    if (parent_node->left != nullptr)
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    WorkPushNode(&stk, parent_node, 0);
+
+    while (stk.size > 0)
     {
-        parent_node->left->parent = parent_node;
+        TreeNode *node = WorkPop(&stk).val.node;
+
+        TreeNode *children[] = {node->left, node->right};
+
+        for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); i++)
+        {
+            if (children[i] == nullptr)
+            {
+                continue;
+            }
 
-        SetParents(parent_node->left);
+            children[i]->parent = node;
+
+            if (WorkPushNode(&stk, children[i], 0) != kTreeSuccess)
+            {
+                WorkStackDtor(&stk);
+
+                return kFailedAllocation;
+            }
+        }
     }
-    if (parent_node->right != nullptr)
+
+    WorkStackDtor(&stk);
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+static uint64_t NodeKey(const TreeNode *node)
+{
+    uint64_t key = 0;
+
+    switch (node->type)
     {
-        parent_node->right->parent = parent_node;
+        case kConstNumber:
+        {
+            memcpy(&key, &node->data.const_val, sizeof(key));
+
+            break;
+        }
+
+        case kOperator:
+        {
+            key = (uint64_t) node->data.op_code;
+
+            break;
+        }
 
-        SetParents(parent_node->right);
+        case kVariable:
+        case kRepVar:
+        default:
+        {
+            key = (uint64_t) node->data.variable_pos;
+
+            break;
+        }
     }
 
-    return kTreeSuccess;
+    return key;
+}
+
+//==============================================================================
+
+size_t NodeHash(const TreeNode *node,
+                size_t          left_hash,
+                size_t          right_hash)
+{
+    uint64_t hash = NodeKey(node) * 0x9e3779b97f4a7c15ULL + (uint64_t) node->type;
+
+    hash ^= hash >> 29;
+    hash  = hash * 31 + left_hash;
+    hash  = hash * 31 + right_hash;
+    hash ^= hash >> 32;
+
+    return (size_t) hash;
+}
+
+//==============================================================================
+
+size_t TreeHash(const TreeNode *node)
+{
+    static const int kHashEnter   = 0;
+    static const int kHashCombine = 1;
+
+    if (node == nullptr)
+    {
+        return 0;
+    }
+
+    WorkStack frames = {};
+    WorkStack hashes = {};
+
+    WorkStackCtor(&frames);
+    WorkStackCtor(&hashes);
+
+    WorkPushNode(&frames, node, kHashEnter);
+
+    while (frames.size > 0)
+    {
+        WorkItem frame = WorkPop(&frames);
+
+        const TreeNode *curr = frame.val.const_node;
+
+        WorkItem hash = {};
+
+        if (frame.state == kHashCombine)
+        {
+            size_t right_hash = (curr->right != nullptr) ? WorkPop(&hashes).val.idx : 0;
+            size_t left_hash  = (curr->left  != nullptr) ? WorkPop(&hashes).val.idx : 0;
+
+            hash.val.idx = NodeHash(curr, left_hash, right_hash);
+        }
+        else if (curr->left != nullptr || curr->right != nullptr)
+        {
+            if (WorkPushNode(&frames, curr, kHashCombine) != kTreeSuccess ||
+                (curr->right != nullptr && WorkPushNode(&frames, curr->right, kHashEnter) != kTreeSuccess) ||
+                (curr->left  != nullptr && WorkPushNode(&frames, curr->left,  kHashEnter) != kTreeSuccess))
+            {
+                break;
+            }
+
+            continue;
+        }
+        else
+        {
+            hash.val.idx = NodeHash(curr, 0, 0);
+        }
+
+        if (WorkPush(&hashes, hash) != kTreeSuccess)
+        {
+            break;
+        }
+    }
+
+    size_t hash = (frames.size == 0 && hashes.size == 1) ? WorkPop(&hashes).val.idx : 0;
+
+    WorkStackDtor(&frames);
+    WorkStackDtor(&hashes);
+
+    return hash;
+}
+
+//==============================================================================
+
+bool TreeEqual(const TreeNode *lhs,
+               const TreeNode *rhs)
+{
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    // nodes are pushed in pairs, rhs on top
+
+    bool equal = (WorkPushNode(&stk, lhs, 0) == kTreeSuccess &&
+                  WorkPushNode(&stk, rhs, 0) == kTreeSuccess);
+
+    while (equal && stk.size > 0)
+    {
+        const TreeNode *right_node = WorkPop(&stk).val.const_node;
+        const TreeNode *left_node  = WorkPop(&stk).val.const_node;
+
+        if (left_node == right_node)
+        {
+            continue;
+        }
+
+        if (left_node == nullptr || right_node == nullptr ||
+            left_node->type != right_node->type ||
+            NodeKey(left_node) != NodeKey(right_node))
+        {
+            equal = false;
+
+            break;
+        }
+
+        equal = (WorkPushNode(&stk, left_node->left,   0) == kTreeSuccess &&
+                 WorkPushNode(&stk, right_node->left,  0) == kTreeSuccess &&
+                 WorkPushNode(&stk, left_node->right,  0) == kTreeSuccess &&
+                 WorkPushNode(&stk, right_node->right, 0) == kTreeSuccess);
+    }
+
+    WorkStackDtor(&stk);
+
+    return equal;
+}
+
+//==============================================================================
+
+VarDeps_t VarDepsBit(size_t var_pos)
+{
+    return (VarDeps_t) 1 << ((var_pos < kSharedDepsBit) ? var_pos : kSharedDepsBit);
+}
+
+//==============================================================================
+
+void MarkDirty(TreeNode *node)
+{
+    // ancestors of a dirty node are dirty as well
+
+    for ( ; node != nullptr && !node->dirty; node = node->parent)
+    {
+        node->dirty = true;
+    }
+}
+
+//==============================================================================
+
+TreeErrs_t UpdateDeps(TreeNode *root)
+{
+    static const int kDepsEnter   = 0;
+    static const int kDepsCombine = 1;
+
+    if (root == nullptr)
+    {
+        return kTreeSuccess;
+    }
+
+    WorkStack stk = {};
+    WorkStackCtor(&stk);
+
+    TreeErrs_t status = WorkPushNode(&stk, root, kDepsEnter);
+
+    while (stk.size > 0 && status == kTreeSuccess)
+    {
+        WorkItem item = WorkPop(&stk);
+
+        TreeNode *node = item.val.node;
+
+        if (item.state == kDepsCombine)
+        {
+            node->deps = ((node->left  != nullptr) ? node->left->deps  : 0) |
+                         ((node->right != nullptr) ? node->right->deps : 0);
+
+            continue;
+        }
+
+        if (node->type != kOperator)
+        {
+            node->deps = (node->type == kVariable) ? VarDepsBit(node->data.variable_pos) : 0;
+
+            continue;
+        }
+
+        if ((status = WorkPushNode(&stk, node, kDepsCombine)) != kTreeSuccess ||
+            (node->right != nullptr && (status = WorkPushNode(&stk, node->right, kDepsEnter)) != kTreeSuccess) ||
+            (node->left  != nullptr && (status = WorkPushNode(&stk, node->left,  kDepsEnter)) != kTreeSuccess))
+        {
+            break;
+        }
+    }
+
+    WorkStackDtor(&stk);
+
+    return status;
 }
 
 //==============================================================================
@@ -1,13 +1,23 @@
 #ifndef TREES_HEADER
 #define TREES_HEADER
 
+#include <stdint.h>
+#include <math.h>
+
 #include "TextParse/text_parse.h"
 #include "Stack/stack.h"
+#include "node_arena.h"
 
 typedef char* TreeDataType_t;
 
 typedef double NumType_t;
 
+//! Set of variables a subtree depends on, one bit per variable position.
+//! Variables from kSharedDepsBit on all share the last bit.
+typedef uint64_t VarDeps_t;
+
+static const size_t kSharedDepsBit = 63;
+
 typedef enum
 {
     kAdd  = 0,
@@ -65,6 +75,10 @@ struct TreeNode
     TreeNode *parent;
     TreeNode *left;
     TreeNode *right;
+
+    VarDeps_t deps; // kept by NodeCtor(), recomputed by UpdateDeps()
+
+    bool dirty; // not simplified yet, then so are all of the ancestors
 };
 
 struct Tree
@@ -72,6 +86,8 @@ struct Tree
     TreeNode *root;
 
     Changes_t status; // ????
+
+    NodeArena *arena; // owns every node of the tree if not nullptr
 };
 
 
@@ -96,6 +112,8 @@ TreeNode *NodeCtor(TreeNode         *parent_node,
 
 TreeErrs_t TreeDtor(TreeNode *root);
 
+TreeErrs_t TreeRelease(Tree *tree);
+
 TreeErrs_t PrintTreeInFile(Tree       *tree,
                            const char *file_name);
 
@@ -114,6 +132,37 @@ TreeNode *CopyNode(const TreeNode *src_node,
 
 TreeErrs_t SetParents(TreeNode *parent_node);
 
+VarDeps_t VarDepsBit(size_t var_pos);
+
+//! Marks node and its ancestors for the next SimplifyTree(). Call it after a
+//! child of node is replaced in place, new nodes are dirty already.
+void MarkDirty(TreeNode *node);
+
+//! Structural hash of one node given the hashes of its children (0 for none).
+size_t NodeHash(const TreeNode *node,
+                size_t          left_hash,
+                size_t          right_hash);
+
+//! Structural hash of the whole subtree, equal trees get equal hashes.
+size_t TreeHash(const TreeNode *node);
+
+//! Same shape, types and data everywhere. Numbers are compared bitwise.
+bool TreeEqual(const TreeNode *lhs,
+               const TreeNode *rhs);
+
+//! Exact comparison of two numbers, for values that are matched or folded by
+//! value on purpose (0 and 1 of rewrites, integer exponents). NaN equals
+//! nothing, 0 equals -0.
+inline bool IsNumEqual(NumType_t lhs,
+                       NumType_t rhs)
+{
+    return !islessgreater(lhs, rhs) && !isunordered(lhs, rhs);
+}
+
+//! Recomputes deps of every node for trees that were built top-down or
+//! edited in place. Removing subtrees never makes deps wrong, only wider.
+TreeErrs_t UpdateDeps(TreeNode *root);
+
 TreeErrs_t GetDepth(const TreeNode *node, int *depth);
 
 
@@ -0,0 +1,449 @@
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+
+#include "vec_math.h"
+
+#if defined(__GNUC__)
+
+// Coefficients are the fdlibm ones (__kernel_sin, __kernel_cos, __ieee754_log).
+
+typedef NumType_t VmVec_t __attribute__((vector_size(16), aligned(8)));
+typedef int64_t   VmInt_t __attribute__((vector_size(16), aligned(8)));
+
+typedef VmVec_t (*VmKernel_t)(VmVec_t  x,
+                              VmInt_t *bad);
+
+static const size_t kVmLanes = sizeof(VmVec_t) / sizeof(NumType_t);
+
+static const NumType_t kVmShifter     = 6755399441055744.0; // 1.5 * 2^52, adding it rounds to integer
+static const int64_t   kVmShifterBits = 0x4338000000000000;
+
+static const int64_t kVmSignMask     = INT64_MIN;
+static const int64_t kVmExpBias      = 1023;
+static const int64_t kVmMantissaMask = 0x000fffffffffffff;
+static const int64_t kVmOneBits      = 0x3ff0000000000000;
+
+static const NumType_t kVmTrigMax  = 1e5;
+static const NumType_t kVmTrigTiny = 7.450580596923828125e-09; // 2^-27, sin(x) and tan(x) round to x below it
+
+static const NumType_t kVmTwoOverPi = 6.36619772367581382433e-01;
+static const NumType_t kVmPio2_1    = 1.57079632673412561417e+00; // first 33 bits of pi/2
+static const NumType_t kVmPio2_2    = 6.07710050630396597660e-11; // next 33 bits
+static const NumType_t kVmPio2_3    = 2.02226624871116645580e-21; // the rest
+
+static const NumType_t kVmS1 = -1.66666666666666324348e-01;
+static const NumType_t kVmS2 =  8.33333333332248946124e-03;
+static const NumType_t kVmS3 = -1.98412698298579493134e-04;
+static const NumType_t kVmS4 =  2.75573137070700676789e-06;
+static const NumType_t kVmS5 = -2.50507602534068634195e-08;
+static const NumType_t kVmS6 =  1.58969099521155010221e-10;
+
+static const NumType_t kVmC1 =  4.16666666666666019037e-02;
+static const NumType_t kVmC2 = -1.38888888888741095749e-03;
+static const NumType_t kVmC3 =  2.48015872894767294178e-05;
+static const NumType_t kVmC4 = -2.75573143513906633035e-07;
+static const NumType_t kVmC5 =  2.08757232129817482790e-09;
+static const NumType_t kVmC6 = -1.13596475577881948265e-11;
+
+static const NumType_t kVmSqrt2  = 1.41421356237309504880e+00;
+static const NumType_t kVmLn2Hi  = 6.93147180369123816490e-01;
+static const NumType_t kVmLn2Lo  = 1.90821492927058770002e-10;
+
+static const NumType_t kVmLg1 = 6.666666666666735130e-01;
+static const NumType_t kVmLg2 = 3.999999999940941908e-01;
+static const NumType_t kVmLg3 = 2.857142874366239149e-01;
+static const NumType_t kVmLg4 = 2.222219843214978396e-01;
+static const NumType_t kVmLg5 = 1.818357216161805012e-01;
+static const NumType_t kVmLg6 = 1.531383769920937332e-01;
+static const NumType_t kVmLg7 = 1.479819860511658591e-01;
+
+static const NumType_t kVmPowMax = 8;
+
+static const int kVmPowBits = 4; // enough bits for exponents up to kVmPowMax
+
+static void VmApply(NumType_t       *dst,
+                    const NumType_t *src,
+                    size_t           count,
+                    VmKernel_t       kernel,
+                    double         (*fallback)(double));
+
+static VmVec_t SinKernel(VmVec_t  x,
+                         VmInt_t *bad);
+
+static VmVec_t CosKernel(VmVec_t  x,
+                         VmInt_t *bad);
+
+static VmVec_t TgKernel(VmVec_t  x,
+                        VmInt_t *bad);
+
+static VmVec_t LnKernel(VmVec_t  x,
+                        VmInt_t *bad);
+
+static VmVec_t PowKernel(VmVec_t  x,
+                         VmVec_t  y,
+                         VmInt_t *bad);
+
+//==============================================================================
+
+static inline VmVec_t VmLoad(const NumType_t *src)
+{
+    VmVec_t vec = {};
+
+    memcpy(&vec, src, sizeof(VmVec_t));
+
+    return vec;
+}
+
+//==============================================================================
+
+static inline void VmStore(NumType_t *dst,
+                           VmVec_t    vec)
+{
+    memcpy(dst, &vec, sizeof(VmVec_t));
+}
+
+//==============================================================================
+
+static inline VmVec_t VmAbs(VmVec_t x)
+{
+    return (VmVec_t) ((VmInt_t) x & ~kVmSignMask);
+}
+
+//==============================================================================
+
+// Splits x into k * pi/2 + r, |r| <= pi/4. The three parts of pi/2 keep
+// k * kVmPio2_1 and k * kVmPio2_2 exact while |x| <= kVmTrigMax.
+
+static inline VmVec_t TrigReduce(VmVec_t  x,
+                                 VmInt_t *quadrant)
+{
+    VmVec_t k = x * kVmTwoOverPi + kVmShifter;
+
+    *quadrant = (VmInt_t) k - kVmShifterBits;
+
+    k -= kVmShifter;
+
+    return ((x - k * kVmPio2_1) - k * kVmPio2_2) - k * kVmPio2_3;
+}
+
+//==============================================================================
+
+static inline VmVec_t SinPoly(VmVec_t r)
+{
+    VmVec_t z = r * r;
+    VmVec_t v = z * r;
+
+    VmVec_t p = kVmS2 + z * (kVmS3 + z * (kVmS4 + z * (kVmS5 + z * kVmS6)));
+
+    return r + v * (kVmS1 + z * p);
+}
+
+//==============================================================================
+
+static inline VmVec_t CosPoly(VmVec_t r)
+{
+    VmVec_t z  = r * r;
+    VmVec_t p  = z * (kVmC1 + z * (kVmC2 + z * (kVmC3 + z * (kVmC4 + z * (kVmC5 + z * kVmC6)))));
+    VmVec_t hz = 0.5 * z;
+    VmVec_t w  = 1.0 - hz;
+
+    return w + (((1.0 - w) - hz) + z * p);
+}
+
+//==============================================================================
+
+static inline VmVec_t SinQuadrant(VmVec_t r,
+                                  VmInt_t quadrant)
+{
+    VmVec_t s = SinPoly(r);
+    VmVec_t c = CosPoly(r);
+
+    VmVec_t res = ((quadrant & 1) != 0) ? c : s;
+
+    return ((quadrant & 2) != 0) ? -res : res;
+}
+
+//==============================================================================
+
+static VmVec_t SinKernel(VmVec_t  x,
+                         VmInt_t *bad)
+{
+    *bad = ~(VmAbs(x) <= kVmTrigMax);
+
+    VmInt_t quadrant = {};
+    VmVec_t r        = TrigReduce(x, &quadrant);
+
+    VmVec_t res = SinQuadrant(r, quadrant);
+
+    return (VmAbs(x) < kVmTrigTiny) ? x : res;
+}
+
+//==============================================================================
+
+static VmVec_t CosKernel(VmVec_t  x,
+                         VmInt_t *bad)
+{
+    *bad = ~(VmAbs(x) <= kVmTrigMax);
+
+    VmInt_t quadrant = {};
+    VmVec_t r        = TrigReduce(x, &quadrant);
+
+    return SinQuadrant(r, quadrant + 1);
+}
+
+//==============================================================================
+
+static VmVec_t TgKernel(VmVec_t  x,
+                        VmInt_t *bad)
+{
+    *bad = ~(VmAbs(x) <= kVmTrigMax);
+
+    VmInt_t quadrant = {};
+    VmVec_t r        = TrigReduce(x, &quadrant);
+
+    VmVec_t s = SinPoly(r);
+    VmVec_t c = CosPoly(r);
+
+    VmVec_t res = ((quadrant & 1) != 0) ? -c / s : s / c;
+
+    return (VmAbs(x) < kVmTrigTiny) ? x : res;
+}
+
+//==============================================================================
+
+// x = m * 2^e with sqrt(1/2) <= m < sqrt(2), ln(m) = ln(1 + f) is computed
+// from s = f / (2 + f) as in fdlibm.
+
+static VmVec_t LnKernel(VmVec_t  x,
+                        VmInt_t *bad)
+{
+    *bad = ~(x >= DBL_MIN) | ~(x <= DBL_MAX);
+
+    VmInt_t bits = (VmInt_t) x;
+
+    VmInt_t e = (bits >> 52) - kVmExpBias;
+    VmVec_t m = (VmVec_t) ((bits & kVmMantissaMask) | kVmOneBits);
+
+    VmInt_t big = (m > kVmSqrt2);
+
+    m = big ? 0.5 * m : m;
+    e = e - big;
+
+    VmVec_t dk = (VmVec_t) (e + kVmShifterBits) - kVmShifter;
+
+    VmVec_t f    = m - 1.0;
+    VmVec_t hfsq = 0.5 * f * f;
+    VmVec_t s    = f / (2.0 + f);
+    VmVec_t z    = s * s;
+    VmVec_t w    = z * z;
+
+    VmVec_t t1 = w * (kVmLg2 + w * (kVmLg4 + w * kVmLg6));
+    VmVec_t t2 = z * (kVmLg1 + w * (kVmLg3 + w * (kVmLg5 + w * kVmLg7)));
+
+    VmVec_t r = t1 + t2;
+
+    return dk * kVmLn2Hi - ((hfsq - (s * (hfsq + r) + dk * kVmLn2Lo)) - f);
+}
+
+//==============================================================================
+
+// Small integer powers by binary exponentiation, the rest goes to libm.
+
+static VmVec_t PowKernel(VmVec_t  x,
+                         VmVec_t  y,
+                         VmInt_t *bad)
+{
+    VmVec_t k = y + kVmShifter;
+
+    VmInt_t n = (VmInt_t) k - kVmShifterBits;
+
+    k -= kVmShifter;
+
+    *bad = ~(VmAbs(y) <= kVmPowMax) | (k != y);
+
+    VmInt_t negative = (n < 0);
+
+    n = negative ? -n : n;
+
+    VmVec_t res = {1.0, 1.0};
+
+    for (int bit = 0; bit < kVmPowBits; bit++)
+    {
+        res = ((n & 1) != 0) ? res * x : res;
+        x   = x * x;
+        n   = n >> 1;
+    }
+
+    return negative ? 1.0 / res : res;
+}
+
+//==============================================================================
+
+static void VmApply(NumType_t       *dst,
+                    const NumType_t *src,
+                    size_t           count,
+                    VmKernel_t       kernel,
+                    double         (*fallback)(double))
+{
+    size_t i = 0;
+
+    for (; i + kVmLanes <= count; i += kVmLanes)
+    {
+        VmVec_t x   = VmLoad(src + i);
+        VmInt_t bad = {};
+
+        VmVec_t y = kernel(x, &bad);
+
+        for (size_t lane = 0; lane < kVmLanes; lane++)
+        {
+            if (bad[lane])
+            {
+                y[lane] = fallback(x[lane]);
+            }
+        }
+
+        VmStore(dst + i, y);
+    }
+
+    for (; i < count; i++)
+    {
+        dst[i] = fallback(src[i]);
+    }
+}
+
+//==============================================================================
+
+void VecSin(NumType_t       *dst,
+            const NumType_t *src,
+            size_t           count)
+{
+    VmApply(dst, src, count, SinKernel, sin);
+}
+
+//==============================================================================
+
+void VecCos(NumType_t       *dst,
+            const NumType_t *src,
+            size_t           count)
+{
+    VmApply(dst, src, count, CosKernel, cos);
+}
+
+//==============================================================================
+
+void VecTg(NumType_t       *dst,
+           const NumType_t *src,
+           size_t           count)
+{
+    VmApply(dst, src, count, TgKernel, tan);
+}
+
+//==============================================================================
+
+void VecLn(NumType_t       *dst,
+           const NumType_t *src,
+           size_t           count)
+{
+    VmApply(dst, src, count, LnKernel, log);
+}
+
+//==============================================================================
+
+void VecPow(NumType_t       *dst,
+            const NumType_t *base,
+            const NumType_t *power,
+            size_t           count)
+{
+    size_t i = 0;
+
+    for (; i + kVmLanes <= count; i += kVmLanes)
+    {
+        VmVec_t x   = VmLoad(base  + i);
+        VmVec_t y   = VmLoad(power + i);
+        VmInt_t bad = {};
+
+        VmVec_t res = PowKernel(x, y, &bad);
+
+        for (size_t lane = 0; lane < kVmLanes; lane++)
+        {
+            if (bad[lane])
+            {
+                res[lane] = pow(x[lane], y[lane]);
+            }
+        }
+
+        VmStore(dst + i, res);
+    }
+
+    for (; i < count; i++)
+    {
+        dst[i] = pow(base[i], power[i]);
+    }
+}
+
+#else // no vector extensions: plain libm loops
+
+//==============================================================================
+
+void VecSin(NumType_t       *dst,
+            const NumType_t *src,
+            size_t           count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = sin(src[i]);
+    }
+}
+
+//==============================================================================
+
+void VecCos(NumType_t       *dst,
+            const NumType_t *src,
+            size_t           count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = cos(src[i]);
+    }
+}
+
+//==============================================================================
+
+void VecTg(NumType_t       *dst,
+           const NumType_t *src,
+           size_t           count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = tan(src[i]);
+    }
+}
+
+//==============================================================================
+
+void VecLn(NumType_t       *dst,
+           const NumType_t *src,
+           size_t           count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = log(src[i]);
+    }
+}
+
+//==============================================================================
+
+void VecPow(NumType_t       *dst,
+            const NumType_t *base,
+            const NumType_t *power,
+            size_t           count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = pow(base[i], power[i]);
+    }
+}
+
+#endif
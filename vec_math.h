@@ -0,0 +1,43 @@
+#ifndef VEC_MATH_HEADER
+#define VEC_MATH_HEADER
+
+#include <stddef.h>
+
+#include "trees.h"
+
+//! Array versions of the libm calls used by Eval(), two lanes per step.
+//! dst may be the same array as an input. Error against libm over 10^7
+//! points of each range, tests/test_vec_math.cpp checks these bounds:
+//!
+//!   VecSin, VecCos  |x| <= 1e5            2 ULP
+//!   VecTg           |x| <= 1e5            4 ULP
+//!   VecLn           positive normal x     1 ULP
+//!   VecPow          integer |y| <= 8      7 ULP (no overflow or underflow)
+//!
+//! Other lanes (larger |x|, zero, negative or subnormal ln argument,
+//! non-integer powers, inf and nan) are passed to libm, so results outside
+//! the table are exact libm values. Without GCC vector extensions every
+//! lane goes to libm.
+
+void VecSin(NumType_t       *dst,
+            const NumType_t *src,
+            size_t           count);
+
+void VecCos(NumType_t       *dst,
+            const NumType_t *src,
+            size_t           count);
+
+void VecTg(NumType_t       *dst,
+           const NumType_t *src,
+           size_t           count);
+
+void VecLn(NumType_t       *dst,
+           const NumType_t *src,
+           size_t           count);
+
+void VecPow(NumType_t       *dst,
+            const NumType_t *base,
+            const NumType_t *power,
+            size_t           count);
+
+#endif
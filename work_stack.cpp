@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "work_stack.h"
+#include "debug/debug.h"
+
+static const size_t kWorkStackMultiplier = 2;
+
+//==============================================================================
+
+TreeErrs_t WorkStackCtor(WorkStack *stk)
+{
+    CHECK(stk);
+
+    stk->data     = stk->local;
+    stk->size     = 0;
+    stk->capacity = kWorkStackLocal;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t WorkStackDtor(WorkStack *stk)
+{
+    CHECK(stk);
+
+    if (stk->data != stk->local)
+    {
+        free(stk->data);
+    }
+
+    stk->data     = nullptr;
+    stk->size     = 0;
+    stk->capacity = 0;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t WorkPush(WorkStack *stk,
+                    WorkItem   item)
+{
+    CHECK(stk);
+
+    if (stk->size >= stk->capacity)
+    {
+        size_t new_capacity = stk->capacity * kWorkStackMultiplier;
+
+        WorkItem *new_data = nullptr;
+
+        if (stk->data == stk->local)
+        {
+            new_data = (WorkItem *) malloc(new_capacity * sizeof(WorkItem));
+
+            if (new_data != nullptr)
+            {
+                memcpy(new_data, stk->local, stk->size * sizeof(WorkItem));
+            }
+        }
+        else
+        {
+            new_data = (WorkItem *) realloc(stk->data, new_capacity * sizeof(WorkItem));
+        }
+
+        if (new_data == nullptr)
+        {
+            return kFailedAllocation;
+        }
+
+        stk->data     = new_data;
+        stk->capacity = new_capacity;
+    }
+
+    stk->data[stk->size++] = item;
+
+    return kTreeSuccess;
+}
+
+//==============================================================================
+
+TreeErrs_t WorkPushNode(WorkStack      *stk,
+                        const TreeNode *node,
+                        int             state)
+{
+    WorkItem item = {};
+
+    item.val.const_node = node;
+    item.state          = state;
+
+    return WorkPush(stk, item);
+}
+
+//==============================================================================
+
+TreeErrs_t WorkPushNum(WorkStack *stk,
+                       NumType_t  num)
+{
+    WorkItem item = {};
+
+    item.val.num = num;
+
+    return WorkPush(stk, item);
+}
+
+//==============================================================================
+
+WorkItem WorkPop(WorkStack *stk)
+{
+    CHECK(stk);
+    CHECK(stk->size > 0);
+
+    return stk->data[--stk->size];
+}
@@ -0,0 +1,52 @@
+#ifndef WORK_STACK_HEADER
+#define WORK_STACK_HEADER
+
+#include "trees.h"
+
+//! Growable stack for recursion-free traversals. The first kWorkStackLocal
+//! items live inside the struct, so shallow walks don't touch the heap.
+//! WorkStack must not be copied while in use.
+
+static const size_t kWorkStackLocal = 32;
+
+union WorkVal
+{
+    TreeNode       *node;
+    const TreeNode *const_node;
+    NumType_t       num;
+    size_t          idx;
+    const char     *str;
+};
+
+struct WorkItem
+{
+    WorkVal val;
+    int     state;
+};
+
+struct WorkStack
+{
+    WorkItem *data;
+    size_t    size;
+    size_t    capacity;
+
+    WorkItem  local[kWorkStackLocal];
+};
+
+TreeErrs_t WorkStackCtor(WorkStack *stk);
+
+TreeErrs_t WorkStackDtor(WorkStack *stk);
+
+TreeErrs_t WorkPush(WorkStack *stk,
+                    WorkItem   item);
+
+TreeErrs_t WorkPushNode(WorkStack      *stk,
+                        const TreeNode *node,
+                        int             state);
+
+TreeErrs_t WorkPushNum(WorkStack *stk,
+                       NumType_t  num);
+
+WorkItem WorkPop(WorkStack *stk);
+
+#endif